@@ -406,6 +406,8 @@ int main_impl(int argc, char* argv[])
 					node.m_Cfg.m_Listen.port(port);
 					node.m_Cfg.m_Listen.ip(INADDR_ANY);
 					node.m_Cfg.m_sPathLocal = vm[cli::STORAGE].as<string>();
+					if (vm.count(cli::TREES_IMAGE))
+						node.m_Cfg.m_sPathTrees = vm[cli::TREES_IMAGE].as<string>();
 					node.m_Cfg.m_MiningThreads = vm[cli::MINING_THREADS].as<uint32_t>();
 					node.m_Cfg.m_MinerID = vm[cli::MINER_ID].as<uint32_t>();
 					node.m_Cfg.m_VerificationThreads = vm[cli::VERIFICATION_THREADS].as<int>();
@@ -108,7 +108,7 @@ int main_impl(int argc, char* argv[])
 #endif
 
 		const auto path = boost::filesystem::system_complete("./logs");
-		auto logger = beam::Logger::create(logLevel, logLevel, fileLogLevel, "node_", path.string());
+		auto logger = beam::Logger::create(logLevel, logLevel, fileLogLevel, "node_", path.string(), true);
 
 		try
 		{
@@ -151,6 +151,8 @@ int main_impl(int argc, char* argv[])
 					node.m_Cfg.m_Listen.port(port);
 					node.m_Cfg.m_Listen.ip(INADDR_ANY);
 					node.m_Cfg.m_sPathLocal = vm[cli::STORAGE].as<string>();
+					if (vm.count(cli::TREES_IMAGE))
+						node.m_Cfg.m_sPathTrees = vm[cli::TREES_IMAGE].as<string>();
 					node.m_Cfg.m_MiningThreads = vm[cli::MINING_THREADS].as<uint32_t>();
 					node.m_Cfg.m_MinerID = vm[cli::MINER_ID].as<uint32_t>();
 					node.m_Cfg.m_VerificationThreads = vm[cli::VERIFICATION_THREADS].as<int>();
@@ -187,6 +189,8 @@ int main_impl(int argc, char* argv[])
 
 					node.m_Cfg.m_HistoryCompression.m_sPathOutput = vm[cli::HISTORY].as<string>();
 					node.m_Cfg.m_HistoryCompression.m_sPathTmp = vm[cli::TEMP].as<string>();
+					node.m_Cfg.m_SnapshotSync = vm[cli::SNAPSHOT_SYNC].as<bool>();
+					node.m_Cfg.m_MaxPoolBytes = uint64_t(vm[cli::POOL_MAX_MB].as<uint32_t>()) << 20;
 
 					LOG_INFO() << "starting a node on " << node.m_Cfg.m_Listen.port() << " port...";
 
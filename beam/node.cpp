@@ -36,7 +36,9 @@ void Node::RefreshCongestions()
 	for (TaskList::iterator it = m_lstTasksUnassigned.begin(); m_lstTasksUnassigned.end() != it; )
 	{
 		Task& t = *(it++);
-		if (!t.m_bRelevant)
+		if (t.m_bRelevant)
+			TryAssignTask(t, NULL); // peers may have free download slots by now
+		else
 			DeleteUnassignedTask(t);
 	}
 }
@@ -54,16 +56,105 @@ uint32_t Node::WantedTx::get_Timeout_ms()
 	return get_ParentObj().m_Cfg.m_Timeout.m_GetTx_ms;
 }
 
+uint64_t Node::BodyCache::get_SizeMax(size_t nBody)
+{
+	// the body, its serialized images in both modes, the output slab (if small), and the bookkeeping
+	return uint64_t(nBody) * 3 + proto::NodeConnection::Broadcast::s_SlabSize + sizeof(Entry);
+}
+
+uint64_t Node::BodyCache::get_Size(const Entry& e)
+{
+	return uint64_t(e.m_Msg.m_Buffer.size()) + e.m_Bc.get_Size() + sizeof(Entry);
+}
+
+Node::BodyCache::Entry* Node::BodyCache::Find(const Block::SystemState::ID& id)
+{
+	Entry key;
+	key.m_ID = id;
+
+	Set::iterator it = m_set.find(key);
+	if (m_set.end() == it)
+		return NULL;
+
+	Entry& e = *it;
+	m_lst.erase(List::s_iterator_to(e));
+	m_lst.push_back(e);
+
+	return &e;
+}
+
+Node::BodyCache::Entry* Node::BodyCache::Add(const Block::SystemState::ID& id, ByteBuffer& body, uint64_t nMaxBytes)
+{
+	if (get_SizeMax(body.size()) > nMaxBytes)
+		return NULL;
+
+	Entry* pEntry = new Entry;
+	pEntry->m_ID = id;
+	pEntry->m_Msg.m_Buffer.swap(body);
+	pEntry->m_nSize = get_Size(*pEntry);
+
+	m_lst.push_back(*pEntry);
+	m_set.insert(*pEntry);
+	m_nBytes += pEntry->m_nSize;
+
+	Trim(*pEntry, nMaxBytes);
+	return pEntry;
+}
+
+void Node::BodyCache::OnSent(Entry& e, uint64_t nMaxBytes)
+{
+	uint64_t nSize = get_Size(e);
+	if (nSize == e.m_nSize)
+		return;
+
+	m_nBytes += nSize - e.m_nSize;
+	e.m_nSize = nSize;
+
+	Trim(e, nMaxBytes);
+}
+
+void Node::BodyCache::Trim(const Entry& e, uint64_t nMaxBytes)
+{
+	while ((m_nBytes > nMaxBytes) && (&m_lst.front() != &e))
+		Delete(m_lst.front());
+}
+
+void Node::BodyCache::Delete(Entry& e)
+{
+	// buffers that are still being sent are kept alive by the connections
+	m_nBytes -= e.m_nSize;
+	m_lst.erase(List::s_iterator_to(e));
+	m_set.erase(Set::s_iterator_to(e));
+	delete &e;
+}
+
+void Node::BodyCache::Delete(const Block::SystemState::ID& id)
+{
+	Entry key;
+	key.m_ID = id;
+
+	Set::iterator it = m_set.find(key);
+	if (m_set.end() != it)
+		Delete(*it);
+}
+
+void Node::BodyCache::Clear()
+{
+	while (!m_lst.empty())
+		Delete(m_lst.front());
+}
+
 void Node::WantedTx::OnExpired(const KeyType& key)
 {
 	proto::GetTransaction msg;
 	msg.m_ID = key;
+	proto::NodeConnection::Broadcast bc(msg);
 
 	for (PeerList::iterator it = get_ParentObj().m_lstPeers.begin(); get_ParentObj().m_lstPeers.end() != it; it++)
 	{
 		Peer& peer = *it;
 		if (peer.m_Config.m_SpreadingTransactions)
-			peer.Send(msg);
+			peer.Send(bc);
 	}
 }
 
@@ -83,12 +174,13 @@ void Node::Bbs::WantedMsg::OnExpired(const KeyType& key)
 {
 	proto::BbsGetMsg msg;
 	msg.m_Key = key;
+	proto::NodeConnection::Broadcast bc(msg);
 
 	for (PeerList::iterator it = get_ParentObj().get_ParentObj().m_lstPeers.begin(); get_ParentObj().get_ParentObj().m_lstPeers.end() != it; it++)
 	{
 		Peer& peer = *it;
 		if (peer.m_Config.m_Bbs)
-			peer.Send(msg);
+			peer.Send(bc);
 	}
 
 	get_ParentObj().MaybeCleanup();
@@ -192,16 +284,39 @@ void Node::TryAssignTask(Task& t, const PeerID* pPeerID)
 	while (true)
 	{
 		Peer* pSel = NULL;
+		uint64_t nSelScore = 0;
 
 		if (pPeerID)
 		{
 			bool bCreate = false;
 			PeerMan::PeerInfoPlus* pInfo = (PeerMan::PeerInfoPlus*) m_PeerMan.Find(*pPeerID, bCreate);
 
-			if (pInfo && pInfo->m_pLive && pInfo->m_pLive->m_bPiRcvd)
+			if (pInfo && pInfo->m_pLive && ShouldAssignTask(t, *pInfo->m_pLive))
 				pSel = pInfo->m_pLive;
 		}
 
+		if (t.m_Key.second)
+		{
+			// Spread blocks wrt measured throughput: pick the peer that is expected to deliver it first.
+			// The preferred peer wins only if it's not worse than others.
+			if (pSel)
+				nSelScore = pSel->get_BlockScore();
+
+			for (PeerList::iterator it = m_lstPeers.begin(); m_lstPeers.end() != it; it++)
+			{
+				Peer& p = *it;
+				if ((&p == pSel) || !ShouldAssignTask(t, p))
+					continue;
+
+				uint64_t nScore = p.get_BlockScore();
+				if (!pSel || (nScore < nSelScore))
+				{
+					pSel = &p;
+					nSelScore = nScore;
+				}
+			}
+		}
+
 		for (PeerList::iterator it = m_lstPeers.begin(); !pSel && (m_lstPeers.end() != it); it++)
 		{
 			Peer& p = *it;
@@ -236,11 +351,24 @@ void Node::AssignTask(Task& t, Peer& p)
 		p.Send(msg);
 	}
 	else
-	{
-		proto::GetHdr msg;
-		msg.m_ID = t.m_Key.first;
-		p.Send(msg);
-	}
+		if (p.m_Config.m_HdrPack)
+		{
+			// request the whole range down to our tip at once. Headers that we already have are just ignored.
+			proto::GetHdrPack msg;
+			msg.m_Top = t.m_Key.first;
+
+			Height h0 = m_Processor.m_Cursor.m_ID.m_Height;
+			Height dh = (msg.m_Top.m_Height > h0) ? (msg.m_Top.m_Height - h0) : proto::g_HdrPackMaxSize;
+			msg.m_Count = static_cast<uint32_t>(std::min<Height>(dh, proto::g_HdrPackMaxSize));
+
+			p.Send(msg);
+		}
+		else
+		{
+			proto::GetHdr msg;
+			msg.m_ID = t.m_Key.first;
+			p.Send(msg);
+		}
 
 	bool bEmpty = p.m_lstTasks.empty();
 
@@ -259,7 +387,38 @@ void Node::Peer::SetTimerWrtFirstTask()
 	if (m_lstTasks.empty())
 		KillTimer();
 	else
-		SetTimer(m_lstTasks.front().m_Key.second ? m_This.m_Cfg.m_Timeout.m_GetBlock_ms : m_This.m_Cfg.m_Timeout.m_GetState_ms);
+	{
+		m_FirstTask_ms = GetTime_ms();
+
+		const Task& t = m_lstTasks.front();
+		if (t.m_Key.second)
+			SetTimer(t.m_bHedged ? m_This.m_Cfg.m_Timeout.m_GetBlock_ms : get_BlockStall_ms());
+		else
+			SetTimer(m_This.m_Cfg.m_Timeout.m_GetState_ms);
+	}
+}
+
+uint32_t Node::Peer::get_BlocksPending()
+{
+	uint32_t n = 0;
+	for (TaskList::iterator it = m_lstTasks.begin(); m_lstTasks.end() != it; it++)
+		if (it->m_Key.second)
+			n++;
+	return n;
+}
+
+uint64_t Node::Peer::get_BlockScore()
+{
+	// expected time to deliver one more block. Peers not measured yet are probed first
+	uint64_t n = get_BlocksPending() + 1;
+	return m_BlockAvg_ms ? (n * m_BlockAvg_ms) : n;
+}
+
+uint32_t Node::Peer::get_BlockStall_ms()
+{
+	// Considered stalled if much slower than usual
+	const Node::Config::Timeout& cfg = m_This.m_Cfg.m_Timeout;
+	return std::min(std::max(cfg.m_GetBlockStall_ms, m_BlockAvg_ms * 4), cfg.m_GetBlock_ms);
 }
 
 bool Node::ShouldAssignTask(Task& t, Peer& p)
@@ -271,14 +430,53 @@ bool Node::ShouldAssignTask(Task& t, Peer& p)
 	if (!(p.m_bPiRcvd && p.m_pInfo))
 		return false;
 
-	// check if the peer currently transfers a block
-	for (TaskList::iterator it = p.m_lstTasks.begin(); p.m_lstTasks.end() != it; it++)
-		if (it->m_Key.second)
-			return false;
+	if (t.m_Key.second)
+	{
+		if (m_Snapshot.m_pOwner)
+			return false; // blocks below the snapshot aren't needed
+
+		// check the download window, and that this block isn't already requested from this peer
+		uint32_t nBlocks = 0;
+		for (TaskList::iterator it = p.m_lstTasks.begin(); p.m_lstTasks.end() != it; it++)
+		{
+			if (!it->m_Key.second)
+				continue;
+
+			if ((++nBlocks >= m_Cfg.m_BlockDownloadWindow) || (it->m_Key == t.m_Key))
+				return false;
+		}
+	}
 
 	return p.m_setRejected.end() == p.m_setRejected.find(t.m_Key);
 }
 
+void Node::HedgeTasks(Peer& p)
+{
+	// Request the pending blocks of the stalled peer from others as well. Whichever arrives first is used, the other is ignored
+	for (TaskList::iterator it = p.m_lstTasks.begin(); p.m_lstTasks.end() != it; it++)
+	{
+		Task& t = *it;
+		if (!t.m_Key.second || t.m_bHedged)
+			continue;
+
+		t.m_bHedged = true;
+
+		Task* pTask = new Task;
+		pTask->m_Key = t.m_Key;
+		pTask->m_bRelevant = true;
+		pTask->m_bHedged = true;
+		pTask->m_pOwner = NULL;
+
+		m_setTasks.insert(*pTask);
+		m_lstTasksUnassigned.push_back(*pTask);
+
+		TryAssignTask(*pTask, NULL);
+
+		if (!pTask->m_pOwner)
+			DeleteUnassignedTask(*pTask); // no one else can take it now
+	}
+}
+
 void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock, const PeerID* pPreferredPeer)
 {
 	Task tKey;
@@ -293,6 +491,7 @@ void Node::Processor::RequestData(const Block::SystemState::ID& id, bool bBlock,
 		Task* pTask = new Task;
 		pTask->m_Key = tKey.m_Key;
 		pTask->m_bRelevant = true;
+		pTask->m_bHedged = false;
 		pTask->m_pOwner = NULL;
 
 		get_ParentObj().m_setTasks.insert(*pTask);
@@ -335,21 +534,24 @@ void Node::Processor::OnNewState()
 	LOG_INFO() << "My Tip: " << msg.m_ID;
 
 	get_ParentObj().m_TxPool.DeleteOutOfBound(msg.m_ID.m_Height + 1);
+	DeleteSpentTxs(get_ParentObj().m_TxPool);
 
 	get_ParentObj().m_Miner.HardAbortSafe();
 
 	get_ParentObj().m_Miner.SetTimer(0, true); // don't start mined block construction, because we're called in the context of NodeProcessor, which holds the DB transaction.
 
+	proto::NodeConnection::Broadcast bcTip(msg), bcHdr(msgHdr);
+
 	for (PeerList::iterator it = get_ParentObj().m_lstPeers.begin(); get_ParentObj().m_lstPeers.end() != it; it++)
 	{
 		Peer& peer = *it;
 
 		if (peer.m_bConnected && (peer.m_TipWork <= msg.m_ChainWork))
 		{
-			peer.Send(msg);
+			peer.Send(bcTip);
 
 			if (peer.m_Config.m_AutoSendHdr)
-				peer.Send(msgHdr);
+				peer.Send(bcHdr);
 		}
 	}
 
@@ -367,9 +569,26 @@ void Node::Processor::OnRolledBack()
 		get_ParentObj().m_Compressor.OnRolledBack();
 }
 
+void Node::Processor::OnBodyDeleted(const Block::SystemState::ID& id)
+{
+	get_ParentObj().m_BodyCache.Delete(id);
+}
+
 bool Node::Processor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&& r, const HeightRange& hr)
 {
-	uint32_t nThreads = get_ParentObj().m_Cfg.m_VerificationThreads;
+	VerifyItem vi;
+	vi.m_pBlock = &block;
+	vi.m_pR = &r;
+	vi.m_Height = hr;
+	vi.m_SubsidyOpen = m_Cursor.m_SubsidyOpen;
+
+	return VerifyBlocks(&vi, 1);
+}
+
+bool Node::Processor::VerifyBlocks(const VerifyItem* pItems, size_t nCount)
+{
+	// All the blocks share the same batch, it's flushed once for all of them
+	uint32_t nThreads = get_ParentObj().get_BlockVerificationThreads();
 	if (!nThreads)
 	{
 		std::unique_ptr<Verifier::MyBatch> p(new Verifier::MyBatch);
@@ -377,38 +596,79 @@ bool Node::Processor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&
 		Verifier::MyBatch::Scope scope(*p);
 
 		return
-			NodeProcessor::VerifyBlock(block, std::move(r), hr) &&
+			NodeProcessor::VerifyBlocks(pItems, nCount) &&
 			p->Flush();
 	}
 
 	Verifier& v = m_Verifier; // alias
 	std::unique_lock<std::mutex> scope(v.m_Mutex);
 
-	if (v.m_vThreads.empty())
-	{
-		v.m_iTask = 1;
+	v.StartLocked(nThreads);
+
+	v.m_iTask ^= 2;
+	v.m_pItems = pItems;
+	v.m_pHasher = NULL;
+	v.m_bFail = false;
+	v.m_Remaining = nThreads;
+	v.m_Sched.Reset();
 
-		v.m_vThreads.resize(nThreads);
-		for (uint32_t i = 0; i < nThreads; i++)
-			v.m_vThreads[i] = std::thread(&Verifier::Thread, &v, i);
+	v.m_vContexts.resize(nCount);
+	for (size_t i = 0; i < nCount; i++)
+	{
+		TxBase::Context& ctx = v.m_vContexts[i];
+		ctx.Reset();
+		ctx.m_bBlockMode = true;
+		ctx.m_Height = pItems[i].m_Height;
 	}
 
+	v.m_TaskNew.notify_all();
+
+	while (v.m_Remaining)
+		v.m_TaskFinished.wait(scope);
+
+	if (v.m_bFail)
+		return false;
+
+	for (size_t i = 0; i < nCount; i++)
+		if (!v.m_vContexts[i].IsValidBlock(*pItems[i].m_pBlock, pItems[i].m_SubsidyOpen))
+			return false;
+
+	return true;
+}
+
+void Node::Processor::HashLiveParallel(RadixHashTree::ParallelHasher& ph)
+{
+	uint32_t nThreads = get_ParentObj().get_BlockVerificationThreads();
+	if (!nThreads)
+		return;
+
+	Verifier& v = m_Verifier; // alias
+	std::unique_lock<std::mutex> scope(v.m_Mutex);
+
+	v.StartLocked(nThreads);
 
 	v.m_iTask ^= 2;
-	v.m_pTx = &block;
-	v.m_pR = &r;
-	v.m_bFail = false;
+	v.m_pHasher = &ph;
 	v.m_Remaining = nThreads;
-	v.m_Context.m_bBlockMode = true;
-	v.m_Context.m_Height = hr;
-	v.m_Context.m_nVerifiers = nThreads;
 
 	v.m_TaskNew.notify_all();
 
 	while (v.m_Remaining)
 		v.m_TaskFinished.wait(scope);
+}
+
+void Node::Processor::Verifier::StartLocked(uint32_t nThreads)
+{
+	if (!m_vThreads.empty())
+		return;
+
+	m_iTask = 1;
 
-	return !v.m_bFail && v.m_Context.IsValidBlock(block, m_Cursor.m_SubsidyOpen);
+	m_vThreads.resize(nThreads);
+	m_vStats.resize(nThreads); // zero-initialized
+
+	for (uint32_t i = 0; i < nThreads; i++)
+		m_vThreads[i] = std::thread(&Verifier::Thread, this, i);
 }
 
 void Node::Processor::Verifier::Thread(uint32_t iVerifier)
@@ -431,28 +691,59 @@ void Node::Processor::Verifier::Thread(uint32_t iVerifier)
 			iTask = m_iTask;
 		}
 
+		if (m_pHasher)
+		{
+			m_pHasher->Execute();
+
+			std::unique_lock<std::mutex> scope(m_Mutex);
+			verify(m_Remaining--);
+			if (!m_Remaining)
+				m_TaskFinished.notify_one();
+
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
 		p->Reset();
 
 		assert(m_Remaining);
 
-		TxBase::Context ctx;
-		ctx.m_bBlockMode = true;
-		ctx.m_Height = m_Context.m_Height;
-		ctx.m_nVerifiers = m_Context.m_nVerifiers;
-		ctx.m_iVerifier = iVerifier;
-		ctx.m_pAbort = &m_bFail; // obsolete actually
+		// the walk continues across all the blocks, chunks are grabbed dynamically
+		TxBase::Context::Scheduler sched(m_Sched);
 
-		TxBase::IReader::Ptr pR;
-		m_pR->Clone(pR);
+		std::vector<TxBase::Context> vCtx(m_vContexts.size());
+		bool bValid = true;
 
-		bool bValid = ctx.ValidateAndSummarize(*m_pTx, std::move(*pR)) && p->Flush();
+		for (size_t i = 0; bValid && (i < vCtx.size()); i++)
+		{
+			TxBase::Context& ctx = vCtx[i];
+			ctx.m_bBlockMode = true;
+			ctx.m_Height = m_vContexts[i].m_Height;
+			ctx.m_pScheduler = &sched;
+			ctx.m_pAbort = &m_bFail;
+
+			TxBase::IReader::Ptr pR;
+			m_pItems[i].m_pR->Clone(pR);
+
+			bValid = ctx.ValidateAndSummarize(*m_pItems[i].m_pBlock, std::move(*pR));
+		}
+
+		if (bValid)
+			bValid = p->Flush(); // single flush for all the blocks
 
 		std::unique_lock<std::mutex> scope(m_Mutex);
 
+		ThreadStats& ts = m_vStats[iVerifier];
+		ts.m_Tasks++;
+		ts.m_Chunks += sched.m_nChunks;
+		ts.m_Cost += sched.m_CostVerified;
+		ts.m_Busy_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+
 		verify(m_Remaining--);
 
-		if (bValid && !m_bFail)
-			bValid = m_Context.Merge(ctx);
+		for (size_t i = 0; bValid && !m_bFail && (i < vCtx.size()); i++)
+			bValid = m_vContexts[i].Merge(vCtx[i]);
 
 		if (!bValid)
 			m_bFail = true;
@@ -482,6 +773,8 @@ Node::Peer* Node::AllocPeer(const beam::io::Address& addr)
 	pPeer->m_Port = 0;
 	pPeer->m_TipHeight = 0;
 	pPeer->m_TipWork = Zero;
+	pPeer->m_FirstTask_ms = 0;
+	pPeer->m_BlockAvg_ms = 0;
 	pPeer->m_RemoteAddr = addr;
 	ZeroObject(pPeer->m_Config);
 
@@ -492,7 +785,17 @@ Node::Peer* Node::AllocPeer(const beam::io::Address& addr)
 
 void Node::Initialize()
 {
+	// must be normalized before the processor is initialized, it may already use the verifier threads (live tree hashing)
+	if (m_Cfg.m_VerificationThreads < 0)
+	{
+		uint32_t numCores = std::thread::hardware_concurrency();
+		m_Cfg.m_VerificationThreads = (numCores > m_Cfg.m_MiningThreads + 1) ? (numCores - m_Cfg.m_MiningThreads) : 0;
+	}
+
 	m_Processor.m_Horizon = m_Cfg.m_Horizon;
+	m_Processor.m_VerifyBatchBlocks = m_Cfg.m_VerificationBatchBlocks;
+	m_Processor.m_RequestBlocksMax = m_Cfg.m_BlockDownloadSpan;
+	m_Processor.m_sPathTrees = m_Cfg.m_sPathTrees;
 	m_Processor.Initialize(m_Cfg.m_sPathLocal.c_str());
     m_Processor.m_Kdf.m_Secret = m_Cfg.m_WalletKey;
 
@@ -523,11 +826,7 @@ void Node::Initialize()
 	LOG_INFO() << "Node ID=" << m_MyPublicID << ", Owner=" << m_MyOwnerID;
 	LOG_INFO() << "Initial Tip: " << m_Processor.m_Cursor.m_ID;
 
-	if (m_Cfg.m_VerificationThreads < 0)
-	{
-		uint32_t numCores = std::thread::hardware_concurrency();
-		m_Cfg.m_VerificationThreads = (numCores > m_Cfg.m_MiningThreads + 1) ? (numCores - m_Cfg.m_MiningThreads) : 0;
-	}
+	m_TxVerifier.Start(get_TxVerificationThreads());
 
 	RefreshCongestions();
 
@@ -581,6 +880,7 @@ void Node::Initialize()
 		m_Miner.m_pEvtMined = io::AsyncEvent::create(io::Reactor::get_Current().shared_from_this(), [this]() { m_Miner.OnMined(); });
 
 		m_Miner.m_vThreads.resize(m_Cfg.m_MiningThreads);
+		m_Miner.m_vSolvers.resize(m_Cfg.m_MiningThreads); // allocated on-demand, by the appropriate thread
 		for (uint32_t i = 0; i < m_Cfg.m_MiningThreads; i++)
 		{
 			PerThread& pt = m_Miner.m_vThreads[i];
@@ -598,6 +898,8 @@ void Node::Initialize()
 	if (m_Compressor.m_bEnabled)
 		m_Compressor.Init();
 
+	m_Snapshot.Init();
+
 	m_Bbs.Cleanup();
 }
 
@@ -690,8 +992,10 @@ Node::~Node()
 			pt.m_Thread.join();
 	}
 	m_Miner.m_vThreads.clear();
+	m_Miner.m_vSolvers.clear();
 
 	m_Compressor.StopCurrent();
+	m_Snapshot.m_bDone = true; // don't switch to other peers
 
 	for (PeerList::iterator it = m_lstPeers.begin(); m_lstPeers.end() != it; it++)
 		ZeroObject(it->m_Config); // prevent re-assigning of tasks in the next loop
@@ -704,6 +1008,8 @@ Node::~Node()
 
 	assert(m_setTasks.empty());
 
+	m_TxVerifier.Stop();
+
 	Processor::Verifier& v = m_Processor.m_Verifier; // alias
 	if (!v.m_vThreads.empty())
 	{
@@ -714,8 +1020,13 @@ Node::~Node()
 		}
 
 		for (size_t i = 0; i < v.m_vThreads.size(); i++)
+		{
 			if (v.m_vThreads[i].joinable())
 				v.m_vThreads[i].join();
+
+			const Processor::Verifier::ThreadStats& ts = v.m_vStats[i];
+			LOG_INFO() << "Verifier " << i << ": Tasks=" << ts.m_Tasks << ", Chunks=" << ts.m_Chunks << ", Cost=" << ts.m_Cost << ", Busy=" << ts.m_Busy_us / 1000 << " ms";
+		}
 	}
 
 	LOG_INFO() << "Node stopped";
@@ -741,6 +1052,20 @@ void Node::Peer::OnTimer()
 	{
 		assert(!m_lstTasks.empty());
 
+		Task& t = m_lstTasks.front();
+		if (t.m_Key.second && !t.m_bHedged)
+		{
+			LOG_INFO() << "Peer " << m_RemoteAddr << " stalled, requesting pending blocks from others";
+
+			m_This.HedgeTasks(*this);
+
+			// give it the remaining time for the current block
+			uint32_t dt_ms = GetTime_ms() - m_FirstTask_ms;
+			const uint32_t& timeout_ms = m_This.m_Cfg.m_Timeout.m_GetBlock_ms;
+			SetTimer((dt_ms < timeout_ms) ? (timeout_ms - dt_ms) : 0);
+			return;
+		}
+
 		LOG_WARNING() << "Peer " << m_RemoteAddr << " request timeout";
 
 		if (m_pInfo)
@@ -803,6 +1128,8 @@ void Node::Peer::OnConnectedSecure()
 	msgCfg.m_SpreadingTransactions = true;
 	msgCfg.m_Bbs = true;
 	msgCfg.m_SendPeers = true;
+	msgCfg.m_HdrPack = true;
+	msgCfg.m_ProofUtxoMulti = true;
 	Send(msgCfg);
 
 	if (m_This.m_Processor.m_Cursor.m_Sid.m_Row)
@@ -979,8 +1306,11 @@ void Node::Peer::DeleteSelf(bool bIsError, uint8_t nByeReason)
 	m_TipWork = Zero;
 
 	ReleaseTasks();
+	ReleaseTxTasks();
 	Unsubscribe();
 
+	m_This.m_Snapshot.OnPeerLost(*this);
+
 	if (m_pInfo)
 	{
 		// detach
@@ -1038,6 +1368,7 @@ void Node::Peer::OnMsg(proto::NewTip&& msg)
 
 	LOG_INFO() << "Peer " << m_RemoteAddr << " Tip: " << msg.m_ID;
 
+	m_This.m_Snapshot.TryStart(); // before the blocks are requested
 	TakeTasks();
 
 	if (m_This.m_Processor.IsStateNeeded(msg.m_ID))
@@ -1099,21 +1430,62 @@ void Node::Peer::OnMsg(proto::Hdr&& msg)
 	OnFirstTaskDone(eStatus);
 }
 
-void Node::Peer::OnMsg(proto::GetBody&& msg)
+void Node::Peer::OnMsg(proto::GetHdrPack&& msg)
 {
-	uint64_t rowid = m_This.m_Processor.get_DB().StateFindSafe(msg.m_ID);
-	if (rowid)
+	proto::HdrPack msgOut;
+
+	if (m_This.m_Processor.ExportHdrPack(msg.m_Top, std::min(msg.m_Count, proto::g_HdrPackMaxSize), msgOut.m_Prefix, msgOut.m_vElements))
+		Send(msgOut);
+	else
 	{
-		proto::Body msgBody;
-		ByteBuffer bbRollback;
-		m_This.m_Processor.get_DB().GetStateBlock(rowid, msgBody.m_Buffer, bbRollback);
+		proto::DataMissing msgMiss(Zero);
+		Send(msgMiss);
+	}
+}
+
+void Node::Peer::OnMsg(proto::HdrPack&& msg)
+{
+	Task& t = get_FirstTask();
+
+	if (t.m_Key.second || (msg.m_vElements.size() > proto::g_HdrPackMaxSize))
+		ThrowUnexpected();
+
+	assert(m_bPiRcvd && m_pInfo);
+	m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardHeader, true);
+
+	NodeProcessor::DataStatus::Enum eStatus = m_This.m_Processor.OnStatePack(msg.m_Prefix, msg.m_vElements, t.m_Key.first, m_pInfo->m_ID.m_Key);
+	OnFirstTaskDone(eStatus);
+}
 
-		if (!msgBody.m_Buffer.empty())
+void Node::Peer::OnMsg(proto::GetBody&& msg)
+{
+	BodyCache::Entry* pEntry = m_This.m_BodyCache.Find(msg.m_ID);
+	if (!pEntry)
+	{
+		NodeDB& db = m_This.m_Processor.get_DB();
+		uint64_t rowid = db.StateFindSafe(msg.m_ID);
+		if (rowid)
 		{
-			Send(msgBody);
-			return;
+			proto::Body msgBody;
+			db.GetStateBody(rowid, msgBody.m_Buffer);
+
+			if (!msgBody.m_Buffer.empty())
+			{
+				pEntry = m_This.m_BodyCache.Add(msg.m_ID, msgBody.m_Buffer, m_This.m_Cfg.m_BodyCacheBytes);
+				if (!pEntry)
+				{
+					Send(msgBody); // too large to cache
+					return;
+				}
+			}
 		}
+	}
 
+	if (pEntry)
+	{
+		Send(pEntry->m_Bc);
+		m_This.m_BodyCache.OnSent(*pEntry, m_This.m_Cfg.m_BodyCacheBytes);
+		return;
 	}
 
 	proto::DataMissing msgMiss(Zero);
@@ -1130,8 +1502,13 @@ void Node::Peer::OnMsg(proto::Body&& msg)
 	assert(m_bPiRcvd && m_pInfo);
 	m_This.m_PeerMan.ModifyRating(*m_pInfo, PeerMan::Rating::RewardBlock, true);
 
+	// update the throughput estimation. Subsequent requests are pipelined, hence the time since it became the first
+	uint32_t dt_ms = std::max(GetTime_ms() - m_FirstTask_ms, 1U);
+	m_BlockAvg_ms = m_BlockAvg_ms ? ((m_BlockAvg_ms * 3 + dt_ms) >> 2) : dt_ms;
+
 	const Block::SystemState::ID& id = t.m_Key.first;
 
+	// Blocks may arrive out of order. They're stored as functional, and interpreted once the preceding ones arrive
 	NodeProcessor::DataStatus::Enum eStatus = m_This.m_Processor.OnBlock(id, msg.m_Buffer, m_pInfo->m_ID.m_Key);
 	OnFirstTaskDone(eStatus);
 }
@@ -1154,35 +1531,96 @@ void Node::Peer::OnMsg(proto::NewTransaction&& msg)
 		ThrowUnexpected(); // our deserialization permits NULL Ptrs.
 	// However the transaction body must have already been checked for NULLs
 
-	proto::Boolean msgOut;
-	msgOut.m_Value = OnNewTransaction(std::move(msg.m_Transaction));
-	Send(msgOut);
+	TxVerifier::Task* pTask = new TxVerifier::Task;
+	pTask->m_pTx = std::move(msg.m_Transaction);
+	pTask->m_pTx->get_Key(pTask->m_Key);
+	pTask->m_pPeer = this;
+	pTask->m_bValid = false;
+	pTask->m_bDone = false;
+
+	m_lstTxPending.push_back(pTask->m_Peer);
+
+	OnNewTransaction(*pTask);
 }
 
-bool Node::Peer::OnNewTransaction(Transaction::Ptr&& ptx)
+void Node::Peer::OnNewTransaction(TxVerifier::Task& t)
 {
 	NodeProcessor::TxPool::Element::Tx key;
-	ptx->get_Key(key.m_Key);
+	key.m_Key = t.m_Key;
 
 	NodeProcessor::TxPool::TxSet::iterator it = m_This.m_TxPool.m_setTxs.find(key);
 	if (m_This.m_TxPool.m_setTxs.end() != it)
-		return true;
+	{
+		t.m_bValid = t.m_bDone = true;
+		SendTxReplies();
+		return;
+	}
 
 	m_This.m_Wtx.Delete(key.m_Key);
 
 	// new transaction
-	const Transaction& tx = *ptx;
-	Transaction::Context ctx;
+	const Transaction& tx = *t.m_pTx;
+	if (tx.m_vInputs.empty() || tx.m_vKernelsOutput.empty())
+	{
+		m_This.OnTransactionVerified(t);
+		SendTxReplies();
+		return;
+	}
 
-	bool bValid = !tx.m_vInputs.empty() && !tx.m_vKernelsOutput.empty();
-	if (bValid)
-		bValid = m_This.m_Processor.ValidateTx(tx, ctx);
+	m_This.m_TxVerifier.Push(t);
+}
+
+void Node::Peer::SendTxReplies()
+{
+	while (!m_lstTxPending.empty())
+	{
+		TxVerifier::Task& t = m_lstTxPending.front().get_ParentObj();
+		if (!t.m_bDone)
+			break;
+
+		proto::Boolean msgOut;
+		msgOut.m_Value = t.m_bValid;
+
+		m_lstTxPending.pop_front();
+		delete &t;
+
+		Send(msgOut);
+	}
+}
+
+void Node::Peer::ReleaseTxTasks()
+{
+	while (!m_lstTxPending.empty())
+	{
+		TxVerifier::Task& t = m_lstTxPending.front().get_ParentObj();
+		m_lstTxPending.pop_front();
+
+		if (t.m_bDone)
+			delete &t;
+		else
+			t.m_pPeer = NULL; // still owned by the verifier
+	}
+}
+
+void Node::OnTransactionVerified(TxVerifier::Task& t)
+{
+	t.m_bDone = true;
+
+	if (t.m_bValid)
+		t.m_bValid = m_Processor.ValidateTxWrtHeight(t.m_Ctx);
 
+	const Transaction& tx = *t.m_pTx;
+
+	// Log it. The summary only, the full listing is too heavy for each tx
+	LOG_INFO() << "Tx " << t.m_Key << " from " << (t.m_pPeer ? t.m_pPeer->m_RemoteAddr.str() : std::string("self"))
+		<< ", I/O/K=" << tx.m_vInputs.size() << "/" << tx.m_vOutputs.size() << "/" << tx.m_vKernelsOutput.size()
+		<< ", Valid: " << t.m_bValid;
+
+#if LOG_DEBUG_ENABLED
 	{
-		// Log it
 		std::ostringstream os;
 
-		os << "Tx " << key.m_Key << " from " << m_RemoteAddr;
+		os << "Tx " << t.m_Key;
 
 		for (size_t i = 0; i < tx.m_vInputs.size(); i++)
 			os << "\n\tI: " << tx.m_vInputs[i]->m_Commitment;
@@ -1205,32 +1643,220 @@ bool Node::Peer::OnNewTransaction(Transaction::Ptr&& ptx)
 		for (size_t i = 0; i < tx.m_vKernelsOutput.size(); i++)
 			os << "\n\tK: Fee=" << tx.m_vKernelsOutput[i]->m_Fee;
 
-		os << "\n\tValid: " << bValid;
-		LOG_INFO() << os.str();
+		LOG_DEBUG() << os.str();
 	}
+#endif // LOG_DEBUG_ENABLED
 
-	if (!bValid)
-		return false;
+	if (!t.m_bValid)
+		return;
+
+	NodeProcessor::TxPool::Element::Tx key;
+	key.m_Key = t.m_Key;
+
+	if (m_TxPool.m_setTxs.end() != m_TxPool.m_setTxs.find(key))
+		return; // could have been received from several peers simultaneously
 
 	proto::HaveTransaction msgOut;
-	msgOut.m_ID = key.m_Key;
+	msgOut.m_ID = t.m_Key;
+	proto::NodeConnection::Broadcast bc(msgOut);
 
-	for (PeerList::iterator it = m_This.m_lstPeers.begin(); m_This.m_lstPeers.end() != it; it++)
+	for (PeerList::iterator it = m_lstPeers.begin(); m_lstPeers.end() != it; it++)
 	{
 		Peer& peer = *it;
-		if (this == &peer)
+		if (t.m_pPeer == &peer)
 			continue;
 		if (!peer.m_Config.m_SpreadingTransactions)
 			continue;
 
-		peer.Send(msgOut);
+		peer.Send(bc);
 	}
 
-	m_This.m_TxPool.AddValidTx(std::move(ptx), ctx, key.m_Key);
-	m_This.m_TxPool.ShrinkUpTo(m_This.m_Cfg.m_MaxPoolTransactions);
-	m_This.m_Miner.SetTimer(m_This.m_Cfg.m_Timeout.m_MiningSoftRestart_ms, false);
-
-	return true;
+	m_TxPool.AddValidTx(std::move(t.m_pTx), t.m_Ctx, t.m_Key);
+	m_TxPool.ShrinkUpTo(m_Cfg.m_MaxPoolTransactions, m_Cfg.m_MaxPoolBytes);
+	m_Miner.SetTimer(m_Cfg.m_Timeout.m_MiningSoftRestart_ms, false);
+}
+
+uint32_t Node::get_TxVerificationThreads() const
+{
+	// a quarter, at least 1 thread if any
+	return (static_cast<uint32_t>(m_Cfg.m_VerificationThreads) + 3) / 4;
+}
+
+uint32_t Node::get_BlockVerificationThreads() const
+{
+	return static_cast<uint32_t>(m_Cfg.m_VerificationThreads) - get_TxVerificationThreads();
+}
+
+void Node::TxVerifier::Start(uint32_t nThreads)
+{
+	assert(m_vThreads.empty());
+	m_bStop = false;
+
+	m_pEvtDone = io::AsyncEvent::create(io::Reactor::get_Current().shared_from_this(), [this]() { OnDone(); });
+
+	m_vThreads.resize(nThreads);
+	for (size_t i = 0; i < m_vThreads.size(); i++)
+		m_vThreads[i] = std::thread(&TxVerifier::Thread, this);
+}
+
+void Node::TxVerifier::Stop()
+{
+	if (!m_vThreads.empty())
+	{
+		{
+			std::unique_lock<std::mutex> scope(m_Mutex);
+			m_bStop = true;
+			m_NewTask.notify_all();
+		}
+
+		for (size_t i = 0; i < m_vThreads.size(); i++)
+			if (m_vThreads[i].joinable())
+				m_vThreads[i].join();
+
+		m_vThreads.clear();
+	}
+
+	// Must be called after all the peers are deleted, so that no task is referenced.
+	DeleteAll(m_lstPending);
+	DeleteAll(m_lstDone);
+
+	m_pEvtDone = NULL;
+	m_pBatch.reset();
+}
+
+void Node::TxVerifier::DeleteAll(TaskList& lst)
+{
+	while (!lst.empty())
+	{
+		Task& t = lst.front();
+		lst.pop_front();
+
+		assert(!t.m_pPeer);
+		delete &t;
+	}
+}
+
+void Node::TxVerifier::Push(Task& t)
+{
+	if (m_vThreads.empty())
+	{
+		if (!m_pBatch)
+		{
+			m_pBatch.reset(new Processor::Verifier::MyBatch);
+			m_pBatch->m_bEnableBatch = true;
+		}
+
+		TaskList lst;
+		lst.push_back(t);
+
+		{
+			Processor::Verifier::MyBatch::Scope scope(*m_pBatch);
+			Verify(lst, *m_pBatch);
+		}
+
+		// the reply is sent from the posted event, as for the verifier threads
+		m_lstDone.splice(m_lstDone.end(), lst);
+		m_pEvtDone->post();
+		return;
+	}
+
+	std::unique_lock<std::mutex> scope(m_Mutex);
+
+	m_lstPending.push_back(t);
+	m_NewTask.notify_one();
+}
+
+void Node::TxVerifier::Thread()
+{
+	std::unique_ptr<Processor::Verifier::MyBatch> p(new Processor::Verifier::MyBatch);
+	p->m_bEnableBatch = true;
+	Processor::Verifier::MyBatch::Scope scope(*p);
+
+	while (true)
+	{
+		TaskList lst;
+
+		{
+			std::unique_lock<std::mutex> scope(m_Mutex);
+
+			while (m_lstPending.empty() && !m_bStop)
+				m_NewTask.wait(scope);
+
+			if (m_bStop)
+				return;
+
+			for (uint32_t i = 0; (i < s_BatchMax) && !m_lstPending.empty(); i++)
+			{
+				Task& t = m_lstPending.front();
+				m_lstPending.pop_front();
+				lst.push_back(t);
+			}
+		}
+
+		Verify(lst, *p);
+
+		{
+			std::unique_lock<std::mutex> scope(m_Mutex);
+			m_lstDone.splice(m_lstDone.end(), lst);
+		}
+
+		m_pEvtDone->post();
+	}
+}
+
+void Node::TxVerifier::Verify(TaskList& lst, Processor::Verifier::MyBatch& bc)
+{
+	// Optimistic pass: all the range proofs are aggregated in a single batch
+	bc.Reset();
+	bool bAllValid = true;
+
+	for (TaskList::iterator it = lst.begin(); lst.end() != it; it++)
+	{
+		Task& t = *it;
+		t.m_bValid = t.m_pTx->IsValid(t.m_Ctx);
+
+		if (!t.m_bValid)
+			bAllValid = false;
+	}
+
+	if (bAllValid && bc.Flush())
+		return;
+
+	// Some transaction is invalid. Find out which one(s)
+	for (TaskList::iterator it = lst.begin(); lst.end() != it; it++)
+	{
+		Task& t = *it;
+
+		bc.Reset();
+		t.m_Ctx.Reset();
+
+		t.m_bValid =
+			t.m_pTx->IsValid(t.m_Ctx) &&
+			bc.Flush();
+	}
+}
+
+void Node::TxVerifier::OnDone()
+{
+	TaskList lst;
+
+	{
+		std::unique_lock<std::mutex> scope(m_Mutex);
+		lst.swap(m_lstDone);
+	}
+
+	while (!lst.empty())
+	{
+		Task& t = lst.front();
+		lst.pop_front();
+
+		get_ParentObj().OnTransactionVerified(t);
+
+		if (t.m_pPeer)
+			t.m_pPeer->SendTxReplies();
+		else
+			delete &t;
+	}
 }
 
 void Node::Peer::OnMsg(proto::Config&& msg)
@@ -1315,22 +1941,11 @@ void Node::Peer::OnMsg(proto::GetTransaction&& msg)
 	if (m_This.m_TxPool.m_setTxs.end() == it)
 		return; // don't have it
 
-	// temporarily move the transaction to the Msg object, but make sure it'll be restored back, even in case of the exception.
-	struct Guard
-	{
-		proto::NewTransaction m_Msg;
-		Transaction::Ptr* m_ppVal;
-
-		void Swap() { m_ppVal->swap(m_Msg.m_Transaction); }
-
-		~Guard() { Swap(); }
-	};
-
-	Guard g;
-	g.m_ppVal = &it->get_ParentObj().m_pValue;
-	g.Swap();
+	proto::NewTransaction msgOut;
+	msgOut.m_Transaction = std::make_shared<Transaction>();
+	it->get_ParentObj().get_Value(*msgOut.m_Transaction);
 
-	Send(g.m_Msg);
+	Send(msgOut);
 }
 
 void Node::Peer::OnMsg(proto::GetMined&& msg)
@@ -1412,65 +2027,105 @@ void Node::Peer::OnMsg(proto::GetProofKernel&& msg)
 	Send(msgOut);
 }
 
-void Node::Peer::OnMsg(proto::GetProofUtxo&& msg)
+struct Node::Peer::ProofUtxoBuilder
+	:public UtxoTree::ITraveler
 {
-	struct Traveler :public UtxoTree::ITraveler
+	// the kernels and history hashes are evaluated once, for all the UTXOs queried wrt the current tip
+	UtxoTree& m_Tree;
+	Merkle::Hash m_hvHistory;
+	Merkle::Hash m_hvKernels;
+	std::vector<Input::Proof>* m_pRes;
+
+	ProofUtxoBuilder(NodeProcessor& p)
+		:m_Tree(p.get_Utxos())
 	{
-		proto::ProofUtxo m_Msg;
-		UtxoTree* m_pTree;
-		Merkle::Hash m_hvHistory;
-		Merkle::Hash m_hvKernels;
+		p.get_Kernels().get_Hash(m_hvKernels);
+		m_hvHistory = p.m_Cursor.m_History;
+	}
 
-		virtual bool OnLeaf(const RadixTree::Leaf& x) override {
+	void Build(std::vector<Input::Proof>& res, const ECC::Point& comm, Height hMaturityMin)
+	{
+		m_pRes = &res;
 
-			const UtxoTree::MyLeaf& v = (UtxoTree::MyLeaf&) x;
-			UtxoTree::Key::Data d;
-			d = v.m_Key;
+		UtxoTree::Cursor cu;
+		m_pCu = &cu;
 
-			m_Msg.m_Proofs.resize(m_Msg.m_Proofs.size() + 1);
-			Input::Proof& ret = m_Msg.m_Proofs.back();
+		// bounds
+		UtxoTree::Key kMin, kMax;
 
-			ret.m_State.m_Count = v.m_Value.m_Count;
-			ret.m_State.m_Maturity = d.m_Maturity;
-			m_pTree->get_Proof(ret.m_Proof, *m_pCu);
+		UtxoTree::Key::Data d;
+		d.m_Commitment = comm;
+		d.m_Maturity = hMaturityMin;
+		kMin = d;
+		d.m_Maturity = Height(-1);
+		kMax = d;
 
-			ret.m_Proof.reserve(ret.m_Proof.size() + 2);
+		m_pBound[0] = kMin.m_pArr;
+		m_pBound[1] = kMax.m_pArr;
 
-			ret.m_Proof.resize(ret.m_Proof.size() + 1);
-			ret.m_Proof.back().first = true;
-			ret.m_Proof.back().second = m_hvKernels;
+		m_Tree.Traverse(*this);
+	}
 
-			ret.m_Proof.resize(ret.m_Proof.size() + 1);
-			ret.m_Proof.back().first = false;
-			ret.m_Proof.back().second = m_hvHistory;
+	virtual bool OnLeaf(const RadixTree::Leaf& x) override {
 
-			return m_Msg.m_Proofs.size() < Input::Proof::s_EntriesMax;
-		}
-	} t;
+		const UtxoTree::MyLeaf& v = (UtxoTree::MyLeaf&) x;
+		UtxoTree::Key::Data d;
+		d = v.m_Key;
+
+		m_pRes->resize(m_pRes->size() + 1);
+		Input::Proof& ret = m_pRes->back();
+
+		ret.m_State.m_Count = v.m_Value.m_Count;
+		ret.m_State.m_Maturity = d.m_Maturity;
+		m_Tree.get_Proof(ret.m_Proof, *m_pCu);
+
+		ret.m_Proof.reserve(ret.m_Proof.size() + 2);
+
+		ret.m_Proof.resize(ret.m_Proof.size() + 1);
+		ret.m_Proof.back().first = true;
+		ret.m_Proof.back().second = m_hvKernels;
+
+		ret.m_Proof.resize(ret.m_Proof.size() + 1);
+		ret.m_Proof.back().first = false;
+		ret.m_Proof.back().second = m_hvHistory;
+
+		return m_pRes->size() < Input::Proof::s_EntriesMax;
+	}
+};
+
+void Node::Peer::OnMsg(proto::GetProofUtxo&& msg)
+{
+	ProofUtxoBuilder t(m_This.m_Processor);
+
+	proto::ProofUtxo msgOut;
+	t.Build(msgOut.m_Proofs, msg.m_Utxo.m_Commitment, msg.m_MaturityMin);
+
+	Send(msgOut);
+}
 
-	t.m_pTree = &m_This.m_Processor.get_Utxos();
-	m_This.m_Processor.get_Kernels().get_Hash(t.m_hvKernels);
-	t.m_hvHistory = m_This.m_Processor.m_Cursor.m_History;
+void Node::Peer::OnMsg(proto::GetProofUtxoMulti&& msg)
+{
+	if (msg.m_Utxos.size() > proto::g_ProofUtxoMultiMaxSize)
+		ThrowUnexpected();
 
-	UtxoTree::Cursor cu;
-	t.m_pCu = &cu;
+	ProofUtxoBuilder t(m_This.m_Processor);
 
-	// bounds
-	UtxoTree::Key kMin, kMax;
+	proto::ProofUtxoMulti msgOut;
+	Input::MultiProof::Builder mpb(msgOut.m_Proofs);
 
-	UtxoTree::Key::Data d;
-	d.m_Commitment = msg.m_Utxo.m_Commitment;
-	d.m_Maturity = msg.m_MaturityMin;
-	kMin = d;
-	d.m_Maturity = Height(-1);
-	kMax = d;
+	std::vector<Input::Proof> vProofs;
 
-	t.m_pBound[0] = kMin.m_pArr;
-	t.m_pBound[1] = kMax.m_pArr;
+	for (size_t i = 0; i < msg.m_Utxos.size(); i++)
+	{
+		vProofs.clear();
+		t.Build(vProofs, msg.m_Utxos[i], 0);
 
-	t.m_pTree->Traverse(t);
+		mpb.NextUtxo();
+		for (size_t j = 0; j < vProofs.size(); j++)
+			mpb.Add(vProofs[j]);
+	}
 
-	Send(t.m_Msg);
+	Send(msgOut);
 }
 
 bool Node::Processor::BuildCwp()
@@ -1528,6 +2183,84 @@ void Node::Peer::OnMsg(proto::GetProofChainWork&& msg)
 	Send(msgOut);
 }
 
+void Node::Peer::OnMsg(proto::GetSnapshotChunk&& msg)
+{
+	proto::SnapshotChunk msgOut;
+
+	Processor& p = m_This.m_Processor;
+	if (m_This.m_Compressor.m_bEnabled && (msg.m_Data < Block::BodyBase::RW::s_Datas))
+	{
+		// macroblocks always start at genesis, i.e. each one is a snapshot of the history
+		NodeDB::WalkerState ws(p.get_DB());
+		for (p.get_DB().EnumMacroblocks(ws); ws.MoveNext(); )
+		{
+			if (msg.m_Top.m_Height && (msg.m_Top.m_Height != ws.m_Sid.m_Height))
+				continue;
+
+			Block::SystemState::Full s;
+			p.get_DB().get_State(ws.m_Sid.m_Row, s);
+
+			Block::SystemState::ID id;
+			s.get_ID(id);
+
+			if (msg.m_Top.m_Height && !(msg.m_Top == id))
+				break;
+
+			Block::BodyBase::RW rw;
+			m_This.m_Compressor.FmtPath(rw, id.m_Height, NULL);
+
+			std::string pArr[Block::BodyBase::RW::s_Datas];
+			rw.GetPathes(pArr);
+
+			std::FStream fs;
+			if (fs.Open(pArr[msg.m_Data].c_str(), true))
+			{
+				msgOut.m_Top = id;
+				msgOut.m_Size = fs.get_Remaining();
+
+				if (msg.m_Offset < msgOut.m_Size)
+				{
+					fs.Seek(msg.m_Offset);
+
+					msgOut.m_Data.resize(static_cast<size_t>(std::min<uint64_t>(msgOut.m_Size - msg.m_Offset, proto::g_SnapshotChunkMaxSize)));
+					fs.read(&msgOut.m_Data.front(), msgOut.m_Data.size());
+				}
+			}
+
+			break;
+		}
+	}
+
+	Send(msgOut);
+}
+
+void Node::Peer::OnMsg(proto::SnapshotChunk&& msg)
+{
+	if (!m_This.m_Snapshot.IsDownloading(*this) || (m_This.m_Snapshot.m_iData >= Block::BodyBase::RW::s_Datas))
+		ThrowUnexpected();
+
+	m_This.m_Snapshot.OnChunk(msg);
+}
+
+void Node::Peer::OnMsg(proto::ProofChainWork&& msg)
+{
+	Snapshot& ss = m_This.m_Snapshot;
+	if (!ss.IsDownloading(*this) || (ss.m_iData < Block::BodyBase::RW::s_Datas) || ss.m_bCwp)
+		ThrowUnexpected();
+
+	ss.m_Cwp = std::move(msg.m_Proof);
+	ss.m_bCwp = true;
+}
+
+void Node::Peer::OnMsg(proto::ProofState&& msg)
+{
+	Snapshot& ss = m_This.m_Snapshot;
+	if (!ss.IsDownloading(*this) || !ss.m_bCwp)
+		ThrowUnexpected();
+
+	ss.OnProofs(msg.m_Proof);
+}
+
 void Node::Peer::OnMsg(proto::PeerInfoSelf&& msg)
 {
 	m_Port = msg.m_Port;
@@ -1583,6 +2316,7 @@ void Node::Peer::OnMsg(proto::BbsMsg&& msg)
 
 	proto::BbsHaveMsg msgOut;
 	msgOut.m_Key = wlk.m_Data.m_Key;
+	proto::NodeConnection::Broadcast bcHave(msgOut);
 
 	for (PeerList::iterator it = m_This.m_lstPeers.begin(); m_This.m_lstPeers.end() != it; it++)
 	{
@@ -1592,7 +2326,7 @@ void Node::Peer::OnMsg(proto::BbsMsg&& msg)
 		if (!peer.m_Config.m_Bbs)
 			continue;
 
-		peer.Send(msgOut);
+		peer.Send(bcHave);
 	}
 
 	// 2. Send to subscribed
@@ -1601,6 +2335,8 @@ void Node::Peer::OnMsg(proto::BbsMsg&& msg)
 	Bbs::Subscription::InBbs key;
 	key.m_Channel = msg.m_Channel;
 
+	proto::NodeConnection::Broadcast bcMsg(msg); // same as SendBbsMsg would build from wlk.m_Data
+
 	for (std::pair<It, It> range = m_This.m_Bbs.m_Subscribed.equal_range(key); range.first != range.second; range.first++)
 	{
 		Bbs::Subscription& s = range.first->get_ParentObj();
@@ -1608,7 +2344,7 @@ void Node::Peer::OnMsg(proto::BbsMsg&& msg)
 		if (this == s.m_pPeer)
 			continue;
 
-		s.m_pPeer->SendBbsMsg(wlk.m_Data);
+		s.m_pPeer->Send(bcMsg);
 	}
 }
 
@@ -1773,7 +2509,11 @@ void Node::Miner::OnRefresh(uint32_t iIdx)
 		}
 		else
 		{
-			if (!s.GeneratePoW(fnCancel))
+			Block::PoW::ISolver::Ptr& pSolver = m_vSolvers[iIdx];
+			if (!pSolver)
+				pSolver = Block::PoW::ISolver::CreateDefault();
+
+			if (!s.GeneratePoW(fnCancel, pSolver.get()))
 				continue;
 		}
 
@@ -1994,6 +2734,14 @@ void Node::Compressor::OnNewState()
 	HeightRange hr;
 	hr.m_Max = p.m_Cursor.m_ID.m_Height - cfg.m_Threshold;
 
+	// The range is exported off the reactor thread. Keep it behind the branching horizon, so that it's not rolled back meanwhile
+	if (MaxHeight != p.m_Horizon.m_Branching)
+	{
+		if (p.m_Cursor.m_ID.m_Height <= p.m_Horizon.m_Branching)
+			return;
+		hr.m_Max = std::min(hr.m_Max, p.m_Cursor.m_ID.m_Height - p.m_Horizon.m_Branching);
+	}
+
 	// last macroblock
 	NodeDB::WalkerState ws(p.get_DB());
 	p.get_DB().EnumMacroblocks(ws);
@@ -2002,13 +2750,23 @@ void Node::Compressor::OnNewState()
 	if (hr.m_Min + cfg.m_MinAggregate > hr.m_Max)
 		return;
 
+	// and ahead of the fossil horizon, the older blocks are already erased
+	if (hr.m_Min < p.get_DB().ParamIntGetDef(NodeDB::ParamID::FossilHeight))
+	{
+		LOG_WARNING() << "History generation impossible, blocks after " << hr.m_Min << " are erased";
+		return;
+	}
+
 	LOG_INFO() << "History generation started up to height " << hr.m_Max;
 
 	// Start aggregation
 	m_hrNew = hr;
 	m_bStop = false;
 	m_bSuccess = false;
-	ZeroObject(m_hrInplaceRequest);
+
+	ZeroObject(m_Stats);
+	m_Stats.m_Range = hr;
+	m_Start_ms = GetTime_ms();
 
 	m_Link.m_pReactor = io::Reactor::get_Current().shared_from_this();
 	m_Link.m_pEvt = io::AsyncEvent::create(m_Link.m_pReactor, [this]() { OnNotify(); });;
@@ -2031,82 +2789,55 @@ void Node::Compressor::OnNotify()
 {
 	assert(m_hrNew.m_Max);
 
-	if (m_hrInplaceRequest.m_Max)
-	{
-		// extract & resume
-		try
-		{
-			Block::Body::RW rw;
-			FmtPath(rw, m_hrInplaceRequest.m_Max, &m_hrInplaceRequest.m_Min);
-			if (!rw.Open(false))
-				std::ThrowIoError();
-
-			get_ParentObj().m_Processor.ExportMacroBlock(rw, m_hrInplaceRequest);
-		}
-		catch (const std::exception& e) {
-			m_bStop = true; // error indication
-			LOG_WARNING() << "History add " << e.what();
-		}
-
-		{
-			// lock is aqcuired by the other thread before it trigger the events. The following line guarantees it won't miss our notification
-			std::unique_lock<std::mutex> scope(m_Mutex);
-		}
+	Height h = m_hrNew.m_Max;
+	StopCurrent();
 
-		m_Cond.notify_one();
-	}
-	else
+	if (m_bSuccess)
 	{
-		Height h = m_hrNew.m_Max;
-		StopCurrent();
-
-		if (m_bSuccess)
-		{
-			std::string pSrc[Block::Body::RW::s_Datas];
-			std::string pTrg[Block::Body::RW::s_Datas];
+		std::string pSrc[Block::Body::RW::s_Datas];
+		std::string pTrg[Block::Body::RW::s_Datas];
 
-			Block::Body::RW rwSrc, rwTrg;
-			FmtPath(rwSrc, h, &Rules::HeightGenesis);
-			FmtPath(rwTrg, h, NULL);
-			rwSrc.GetPathes(pSrc);
-			rwTrg.GetPathes(pTrg);
+		Block::Body::RW rwSrc, rwTrg;
+		FmtPath(rwSrc, h, &Rules::HeightGenesis);
+		FmtPath(rwTrg, h, NULL);
+		rwSrc.GetPathes(pSrc);
+		rwTrg.GetPathes(pTrg);
 
-			for (int i = 0; i < Block::Body::RW::s_Datas; i++)
-			{
+		for (int i = 0; i < Block::Body::RW::s_Datas; i++)
+		{
 #ifdef WIN32
-				bool bOk = (FALSE != MoveFileExA(pSrc[i].c_str(), pTrg[i].c_str(), MOVEFILE_REPLACE_EXISTING));
+			bool bOk = (FALSE != MoveFileExA(pSrc[i].c_str(), pTrg[i].c_str(), MOVEFILE_REPLACE_EXISTING));
 #else // WIN32
-				bool bOk = !rename(pSrc[i].c_str(), pTrg[i].c_str());
+			bool bOk = !rename(pSrc[i].c_str(), pTrg[i].c_str());
 #endif // WIN32
 
-				if (!bOk)
-				{
-					LOG_WARNING() << "History file move/rename failed";
-					m_bSuccess = false;
-					break;
-				}
-			}
-
-			if (!m_bSuccess)
+			if (!bOk)
 			{
-				rwSrc.Delete();
-				rwTrg.Delete();
+				LOG_WARNING() << "History file move/rename failed";
+				m_bSuccess = false;
+				break;
 			}
 		}
 
-		if (m_bSuccess)
+		if (!m_bSuccess)
 		{
-			uint64_t rowid = get_ParentObj().m_Processor.FindActiveAtStrict(h);
-			get_ParentObj().m_Processor.get_DB().MacroblockIns(rowid);
+			rwSrc.Delete();
+			rwTrg.Delete();
+		}
+	}
 
-			LOG_INFO() << "History generated up to height " << h;
+	if (m_bSuccess)
+	{
+		uint64_t rowid = get_ParentObj().m_Processor.FindActiveAtStrict(h);
+		get_ParentObj().m_Processor.get_DB().MacroblockIns(rowid);
 
-			Cleanup();
-		}
-		else
-			LOG_WARNING() << "History generation failed";
+		uint32_t dt_ms = std::max(GetTime_ms() - m_Start_ms, 1U);
+		LOG_INFO() << "History generated up to height " << h << ", " << m_Stats.m_Exported << " blocks in " << dt_ms << " ms, " << (m_Stats.m_Exported * 1000 / dt_ms) << " blocks/sec, " << m_Stats.m_Merges << " merges";
 
+		Cleanup();
 	}
+	else
+		LOG_WARNING() << "History generation failed";
 }
 
 void Node::Compressor::StopCurrent()
@@ -2120,14 +2851,31 @@ void Node::Compressor::StopCurrent()
 	}
 
 	m_Cond.notify_one();
+	m_CondWorker.notify_all();
 
 	if (m_Link.m_Thread.joinable())
 		m_Link.m_Thread.join();
 
 	ZeroObject(m_hrNew);
+	ZeroObject(m_Stats.m_Range);
 	m_Link.m_pEvt = NULL; // should prevent "spurious" calls
 }
 
+void Node::get_TxPoolStats(TxPoolStats& s)
+{
+	s.m_Txs = (uint32_t) m_TxPool.m_setTxs.size();
+	s.m_Bytes = m_TxPool.m_nBytes;
+	s.m_Evicted = m_TxPool.m_Stats.m_Evicted;
+	s.m_EvictedBytes = m_TxPool.m_Stats.m_EvictedBytes;
+}
+
+void Node::get_CompressorStats(CompressorStats& s)
+{
+	std::unique_lock<std::mutex> scope(m_Compressor.m_Mutex);
+	s = m_Compressor.m_Stats;
+	s.m_Elapsed_ms = s.m_Range.m_Max ? (GetTime_ms() - m_Compressor.m_Start_ms) : 0;
+}
+
 void Node::Compressor::Proceed()
 {
 	try {
@@ -2139,46 +2887,69 @@ void Node::Compressor::Proceed()
 	if (!(m_bSuccess || m_bStop))
 		LOG_WARNING() << "History generation failed";
 
-	ZeroObject(m_hrInplaceRequest);
 	m_Link.m_pEvt->post();
 }
 
 bool Node::Compressor::ProceedInternal()
 {
 	assert(m_hrNew.m_Max);
-	const Config::HistoryCompression& cfg = get_ParentObj().m_Cfg.m_HistoryCompression;
 
-	std::vector<HeightRange> v;
+	uint32_t nThreads = get_ParentObj().m_Cfg.m_HistoryCompression.m_Threads;
+	if (!nThreads)
+		nThreads = std::max(std::thread::hardware_concurrency(), 1U);
 
-	uint32_t i = 0;
-	for (Height hPos = m_hrNew.m_Min; hPos < m_hrNew.m_Max; i++)
-	{
-		HeightRange hr;
-		hr.m_Min = hPos + 1; // convention is boundary-inclusive, whereas m_hrNew excludes min bound
-		hr.m_Max = std::min(hPos + cfg.m_Naggling, m_hrNew.m_Max);
+	m_vParts.clear();
+	m_qMerges.clear();
+	m_bFail = false;
+	m_bWorkersStop = false;
 
-		{
-			std::unique_lock<std::mutex> scope(m_Mutex);
-			m_hrInplaceRequest = hr;
+	for (uint32_t i = 0; i < nThreads; i++)
+		m_vWorkers.push_back(std::thread(&Compressor::WorkerThread, this));
 
-			m_Link.m_pEvt->post();
+	try {
+		ProceedExport();
+	} catch (const std::exception& e) {
+		LOG_WARNING() << "History add " << e.what();
 
+		std::unique_lock<std::mutex> scope(m_Mutex);
+		m_bFail = true;
+	}
+
+	{
+		std::unique_lock<std::mutex> scope(m_Mutex);
+
+		// wait for the remaining merges
+		while (!(m_bStop || m_bFail) && !((m_vParts.size() == 1) && m_vParts.front().m_bReady))
 			m_Cond.wait(scope);
 
-			if (m_bStop)
-				return false;
+		m_bWorkersStop = true;
+	}
+
+	m_CondWorker.notify_all();
+
+	for (size_t i = 0; i < m_vWorkers.size(); i++)
+		m_vWorkers[i].join();
+	m_vWorkers.clear();
+
+	if (m_bStop || m_bFail)
+	{
+		// delete what's left. Merges that were in progress delete their files by themselves
+		for (size_t i = 0; i < m_vParts.size(); i++)
+		{
+			const Part& x = m_vParts[i];
+			if (x.m_bReady)
+				DeleteTmp(x.m_hr);
 		}
 
-		v.push_back(hr);
-		hPos = hr.m_Max;
+		for (size_t i = 0; i < m_qMerges.size(); i++)
+		{
+			DeleteTmp(m_qMerges[i].first);
+			DeleteTmp(m_qMerges[i].second);
+		}
 
-		for (uint32_t j = i; 1 & j; j >>= 1)
-			SquashOnce(v);
+		return false;
 	}
 
-	while (v.size() > 1)
-		SquashOnce(v);
-
 	if (m_hrNew.m_Min >= Rules::HeightGenesis)
 	{
 		Block::Body::RW rw, rwSrc0, rwSrc1;
@@ -2200,21 +2971,157 @@ bool Node::Compressor::ProceedInternal()
 	return true;
 }
 
-bool Node::Compressor::SquashOnce(std::vector<HeightRange>& v)
+void Node::Compressor::ProceedExport()
 {
-	assert(v.size() >= 2);
+	const Config::HistoryCompression& cfg = get_ParentObj().m_Cfg.m_HistoryCompression;
+
+	// Own read-only connection. The reactor thread is not involved.
+	NodeDB db;
+	db.Open(get_ParentObj().m_Cfg.m_sPathLocal.c_str(), true);
+
+	uint32_t nLog_ms = GetTime_ms();
+
+	for (Height hPos = m_hrNew.m_Min; hPos < m_hrNew.m_Max; )
+	{
+		HeightRange hr;
+		hr.m_Min = hPos + 1; // convention is boundary-inclusive, whereas m_hrNew excludes min bound
+		hr.m_Max = std::min(hPos + cfg.m_Naggling, m_hrNew.m_Max);
+
+		{
+			// Single snapshot for the whole range, the reactor may commit meanwhile (new blocks, pruning)
+			NodeDB::Transaction t(db);
+
+			if (hr.m_Min < db.ParamIntGetDef(NodeDB::ParamID::FossilHeight) + Rules::HeightGenesis)
+				throw std::runtime_error("blocks erased");
+
+			Block::Body::RW rw;
+			FmtPath(rw, hr.m_Max, &hr.m_Min);
+			if (!rw.Open(false))
+				std::ThrowIoError();
+
+			NodeProcessor::ExportMacroBlock(db, rw, hr);
+			t.Commit();
+		}
+
+		hPos = hr.m_Max;
+
+		std::unique_lock<std::mutex> scope(m_Mutex);
+		if (m_bStop || m_bFail)
+			break;
+
+		m_vParts.emplace_back();
+		Part& x = m_vParts.back();
+		x.m_hr = hr;
+		x.m_Level = 0;
+		x.m_bReady = true;
+
+		m_Stats.m_Exported += hr.m_Max - hr.m_Min + 1;
+
+		ScheduleMerges(false);
+
+		uint32_t t_ms = GetTime_ms();
+		if (t_ms - nLog_ms >= 10000)
+		{
+			nLog_ms = t_ms;
+			LOG_INFO() << "History generation: " << hPos << "/" << m_hrNew.m_Max << ", merges done: " << m_Stats.m_Merges << ", pending: " << m_Stats.m_MergesPending;
+		}
+	}
+
+	std::unique_lock<std::mutex> scope(m_Mutex);
+	ScheduleMerges(true); // the rest can be merged in any order
+}
+
+void Node::Compressor::DeleteTmp(const HeightRange& hr)
+{
+	Block::Body::RW rw;
+	FmtPath(rw, hr.m_Max, &hr.m_Min);
+	rw.Delete();
+}
+
+void Node::Compressor::ScheduleMerges(bool bAny)
+{
+	// must be called with the mutex locked
+	for (size_t i = 0; i + 1 < m_vParts.size(); )
+	{
+		Part& x0 = m_vParts[i];
+		const Part& x1 = m_vParts[i + 1];
+
+		if (x0.m_bReady && x1.m_bReady && (bAny || (x0.m_Level == x1.m_Level)))
+		{
+			m_qMerges.push_back(std::make_pair(x0.m_hr, x1.m_hr));
+			m_Stats.m_MergesPending++;
+
+			x0.m_hr.m_Max = x1.m_hr.m_Max;
+			x0.m_Level = std::max(x0.m_Level, x1.m_Level) + 1;
+			x0.m_bReady = false;
+
+			m_vParts.erase(m_vParts.begin() + i + 1);
+			m_CondWorker.notify_one();
+		}
+		else
+			i++;
+	}
+}
+
+void Node::Compressor::WorkerThread()
+{
+	std::unique_lock<std::mutex> scope(m_Mutex);
+
+	while (true)
+	{
+		while (!(m_bStop || m_bWorkersStop) && m_qMerges.empty())
+			m_CondWorker.wait(scope);
+
+		if (m_bStop || m_bWorkersStop)
+			break;
+
+		std::pair<HeightRange, HeightRange> job = m_qMerges.front();
+		m_qMerges.pop_front();
+
+		scope.unlock();
+
+		bool bOk = false;
+		try {
+			bOk = SquashOnce(job.first, job.second);
+		} catch (const std::exception& e) {
+			LOG_WARNING() << "History squash " << e.what();
+		}
+
+		scope.lock();
 
-	HeightRange& hr0 = v[v.size() - 2];
-	HeightRange& hr1 = v[v.size() - 1];
+		m_Stats.m_MergesPending--;
 
+		if (bOk)
+		{
+			m_Stats.m_Merges++;
+
+			for (size_t i = 0; i < m_vParts.size(); i++)
+			{
+				Part& x = m_vParts[i];
+				if ((x.m_hr.m_Min == job.first.m_Min) && (x.m_hr.m_Max == job.second.m_Max))
+				{
+					assert(!x.m_bReady);
+					x.m_bReady = true;
+					break;
+				}
+			}
+
+			ScheduleMerges(m_Stats.m_Exported == m_hrNew.m_Max - m_hrNew.m_Min);
+		}
+		else
+			m_bFail = true;
+
+		m_Cond.notify_one();
+	}
+}
+
+bool Node::Compressor::SquashOnce(const HeightRange& hr0, const HeightRange& hr1)
+{
 	Block::Body::RW rw, rwSrc0, rwSrc1;
 	FmtPath(rw, hr1.m_Max, &hr0.m_Min);
 	FmtPath(rwSrc0, hr0.m_Max, &hr0.m_Min);
 	FmtPath(rwSrc1, hr1.m_Max, &hr1.m_Min);
 
-	hr0.m_Max = hr1.m_Max;
-	v.pop_back();
-
 	rw.m_bAutoDelete = rwSrc0.m_bAutoDelete = rwSrc1.m_bAutoDelete = true;
 
 	if (!SquashOnce(rw, rwSrc0, rwSrc1))
@@ -2240,6 +3147,353 @@ bool Node::Compressor::SquashOnce(Block::BodyBase::RW& rw, Block::BodyBase::RW&
 	return true;
 }
 
+void Node::Snapshot::Init()
+{
+	m_pOwner = NULL;
+	m_bDone = !get_ParentObj().m_Cfg.m_SnapshotSync || get_ParentObj().m_Processor.m_Cursor.m_Sid.m_Row;
+	m_bCwp = false;
+	m_nProofRetries = 0;
+
+	ZeroObject(m_Top);
+	m_iData = 0;
+	m_Offset = 0;
+}
+
+void Node::Snapshot::FmtPath(Block::BodyBase::RW& rw)
+{
+	rw.m_sPath = get_ParentObj().m_Cfg.m_HistoryCompression.m_sPathTmp + "snapshot_";
+}
+
+void Node::Snapshot::TryStart()
+{
+	if (m_bDone || m_pOwner)
+		return;
+
+	if (get_ParentObj().m_Processor.m_Cursor.m_Sid.m_Row)
+	{
+		OnDone(false); // too late, the blocks are already being applied
+		return;
+	}
+
+	// A peer on a lighter fork could make us import a snapshot we can't reorg below
+	Peer* pPeer = FindHeaviest();
+	if (!pPeer)
+		return;
+
+	try {
+		Start(*pPeer);
+	}
+	catch (const std::exception& e) {
+		pPeer->OnExc(e); // would retry with other peers
+	}
+}
+
+Node::Peer* Node::Snapshot::FindHeaviest()
+{
+	Peer* pRet = NULL;
+
+	PeerList& lst = get_ParentObj().m_lstPeers;
+	for (PeerList::iterator it = lst.begin(); lst.end() != it; it++)
+	{
+		Peer& p = *it;
+		if (!(p.m_bPiRcvd && p.m_pInfo && p.m_TipHeight) || p.m_pInfo->m_bSnapshotRejected)
+			continue;
+
+		if (!pRet || (pRet->m_TipWork < p.m_TipWork))
+			pRet = &p;
+	}
+
+	return pRet;
+}
+
+void Node::Snapshot::Start(Peer& p)
+{
+	m_pOwner = &p;
+	m_nProofRetries = 0;
+	LOG_INFO() << "Snapshot requested from " << p.m_RemoteAddr;
+
+	if (m_iData < Block::BodyBase::RW::s_Datas)
+		RequestChunk();
+	else
+		RequestProofs();
+}
+
+void Node::Snapshot::Restart()
+{
+	m_File.Close();
+
+	Block::BodyBase::RW rw;
+	FmtPath(rw);
+	rw.Delete();
+
+	ZeroObject(m_Top);
+	m_iData = 0;
+	m_Offset = 0;
+	m_bCwp = false;
+}
+
+void Node::Snapshot::OnPeerLost(Peer& p)
+{
+	if (!IsDownloading(p))
+		return;
+
+	// The request is in flight. Peers that don't support snapshots disconnect on it (unknown message), don't retry them
+	LOG_INFO() << "Peer " << p.m_RemoteAddr << " lost during the snapshot download";
+	DropOwner();
+
+	if (!(m_pOwner || m_bDone))
+		get_ParentObj().RefreshCongestions(); // proceed with the regular sync meanwhile
+}
+
+void Node::Snapshot::DropOwner()
+{
+	assert(m_pOwner && m_pOwner->m_pInfo);
+	m_pOwner->m_pInfo->m_bSnapshotRejected = true;
+
+	m_pOwner = NULL;
+	m_bCwp = false;
+
+	if (m_pTimer)
+		m_pTimer->cancel();
+
+	TryStart(); // resume from another peer, if it has the same snapshot
+}
+
+void Node::Snapshot::SetTimer()
+{
+	if (!m_pTimer)
+		m_pTimer = io::Timer::create(io::Reactor::get_Current().shared_from_this());
+
+	m_pTimer->start(get_ParentObj().m_Cfg.m_Timeout.m_GetSnapshot_ms, false, [this]() { OnTimer(); });
+}
+
+void Node::Snapshot::OnTimer()
+{
+	if (!m_pOwner)
+		return;
+
+	LOG_WARNING() << "Peer " << m_pOwner->m_RemoteAddr << " snapshot request timed out";
+	DropOwner();
+
+	if (!m_pOwner)
+		get_ParentObj().RefreshCongestions();
+}
+
+void Node::Snapshot::RequestChunk()
+{
+	proto::GetSnapshotChunk msg;
+	msg.m_Top = m_Top;
+	msg.m_Data = m_iData;
+	msg.m_Offset = m_Offset;
+
+	m_pOwner->Send(msg);
+	SetTimer();
+}
+
+void Node::Snapshot::RequestProofs()
+{
+	// Both are built for the current tip of the peer, it's verified that it remains the same.
+	m_bCwp = false;
+
+	proto::GetProofChainWork msgCwp(Zero);
+	m_pOwner->Send(msgCwp);
+
+	proto::GetProofState msgState;
+	msgState.m_Height = m_Top.m_Height;
+	m_pOwner->Send(msgState);
+
+	SetTimer();
+}
+
+void Node::Snapshot::OnChunk(proto::SnapshotChunk& msg)
+{
+	Peer& p = *m_pOwner;
+
+	if (!msg.m_Top.m_Height)
+	{
+		LOG_INFO() << "Peer " << p.m_RemoteAddr << " has no snapshot";
+
+		if (m_Top.m_Height)
+			Restart(); // others may have a different one
+
+		DropOwner();
+		if (!m_pOwner)
+			OnDone(false);
+
+		return;
+	}
+
+	if (m_Top.m_Height)
+	{
+		if (!(m_Top == msg.m_Top))
+			Peer::ThrowUnexpected();
+	}
+	else
+	{
+		m_Top = msg.m_Top;
+		LOG_INFO() << "Downloading snapshot " << m_Top;
+	}
+
+	if ((m_Offset > msg.m_Size) ||
+		(msg.m_Data.size() > msg.m_Size - m_Offset) ||
+		(msg.m_Data.empty() && (m_Offset < msg.m_Size)))
+		Peer::ThrowUnexpected();
+
+	if (!m_Offset)
+	{
+		Block::BodyBase::RW rw;
+		FmtPath(rw);
+
+		std::string pArr[Block::BodyBase::RW::s_Datas];
+		rw.GetPathes(pArr);
+
+		m_File.Open(pArr[m_iData].c_str(), false, true);
+	}
+
+	if (!msg.m_Data.empty())
+		m_File.write(&msg.m_Data.front(), msg.m_Data.size());
+	m_Offset += msg.m_Data.size();
+
+	if (m_Offset < msg.m_Size)
+	{
+		RequestChunk();
+		return;
+	}
+
+	m_File.Close();
+	m_Offset = 0;
+
+	if (++m_iData < Block::BodyBase::RW::s_Datas)
+		RequestChunk();
+	else
+		RequestProofs();
+}
+
+void Node::Snapshot::OnProofs(const Merkle::HardProof& proof)
+{
+	Peer& p = *m_pOwner;
+	m_bCwp = false;
+
+	if (!m_Cwp.IsValid())
+		Peer::ThrowUnexpected();
+
+	Block::SystemState::Full sRoot;
+	m_Cwp.UnpackRoot(sRoot);
+
+	if (sRoot.m_ChainWork != p.m_TipWork)
+	{
+		// peer's tip has changed meanwhile
+		if (++m_nProofRetries <= s_ProofRetriesMax)
+		{
+			RequestProofs();
+			return;
+		}
+
+		LOG_WARNING() << "Peer " << p.m_RemoteAddr << " tip keeps changing, snapshot proofs abandoned";
+		DropOwner();
+
+		if (!m_pOwner)
+			get_ParentObj().RefreshCongestions();
+		return;
+	}
+
+	if (!sRoot.IsValidProofState(m_Top, proof))
+		Peer::ThrowUnexpected();
+
+	// Other peers may have advertised more work since the download started
+	for (PeerList::iterator it = get_ParentObj().m_lstPeers.begin(); get_ParentObj().m_lstPeers.end() != it; it++)
+	{
+		const Peer& p2 = *it;
+		if (p2.m_bPiRcvd && (p.m_TipWork < p2.m_TipWork))
+		{
+			LOG_WARNING() << "Peer " << p2.m_RemoteAddr << " has more work than " << p.m_RemoteAddr << ", snapshot discarded";
+
+			Restart(); // the heavier chain may have a different snapshot
+			DropOwner();
+
+			if (!m_pOwner)
+				get_ParentObj().RefreshCongestions();
+			return;
+		}
+	}
+
+	LOG_INFO() << "Snapshot " << m_Top << " is proven to be in the chain of " << p.m_TipHeight << ", importing...";
+
+	Block::BodyBase::RW rw;
+	FmtPath(rw);
+
+	bool bOk =
+		rw.Open(true) &&
+		get_ParentObj().m_Processor.ImportSnapshot(rw, m_Top);
+
+	rw.Close();
+
+	if (!bOk)
+	{
+		Restart();
+		Peer::ThrowUnexpected("snapshot import failed");
+	}
+
+	OnDone(true);
+}
+
+void Node::Snapshot::OnDone(bool bImported)
+{
+	m_pOwner = NULL;
+	m_bDone = true;
+	m_File.Close();
+
+	if (m_pTimer)
+		m_pTimer->cancel();
+
+	Block::BodyBase::RW rw;
+	FmtPath(rw);
+
+	Node& n = get_ParentObj();
+	if (bImported)
+	{
+		LOG_INFO() << "Snapshot sync done";
+
+		if (n.m_Compressor.m_bEnabled)
+		{
+			// keep it as the base for the subsequent history compression
+			Block::BodyBase::RW rwDst;
+			n.m_Compressor.FmtPath(rwDst, m_Top.m_Height, NULL);
+
+			std::string pSrc[Block::BodyBase::RW::s_Datas], pDst[Block::BodyBase::RW::s_Datas];
+			rw.GetPathes(pSrc);
+			rwDst.GetPathes(pDst);
+
+			size_t i = 0;
+			for (; i < _countof(pSrc); i++)
+			{
+#ifdef WIN32
+				bool bOk = (FALSE != MoveFileExA(pSrc[i].c_str(), pDst[i].c_str(), MOVEFILE_REPLACE_EXISTING));
+#else // WIN32
+				bool bOk = !rename(pSrc[i].c_str(), pDst[i].c_str());
+#endif // WIN32
+
+				if (!bOk)
+					break;
+			}
+
+			if (_countof(pSrc) == i)
+				n.m_Processor.get_DB().MacroblockIns(n.m_Processor.get_DB().StateFindSafe(m_Top));
+			else
+			{
+				LOG_WARNING() << "Failed to move the snapshot to the history";
+				rwDst.Delete();
+			}
+		}
+	}
+	else
+		LOG_INFO() << "Snapshot sync not possible, proceeding with the full sync";
+
+	rw.Delete();
+
+	n.RefreshCongestions();
+}
+
 struct Node::Beacon::OutCtx
 {
 	int m_Refs;
@@ -2455,6 +3709,7 @@ proto::PeerManager::PeerInfo* Node::PeerMan::AllocPeer()
 {
 	PeerInfoPlus* p = new PeerInfoPlus;
 	p->m_pLive = NULL;
+	p->m_bSnapshotRejected = false;
 	return p;
 }
 
@@ -21,6 +21,7 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/set.hpp>
 #include <condition_variable>
+#include <deque>
 
 namespace beam
 {
@@ -36,6 +37,7 @@ struct Node
 		std::vector<io::Address> m_Connect;
 
 		std::string m_sPathLocal;
+		std::string m_sPathTrees; // optional, image of the live trees for fast startup
         ECC::NoLeak<ECC::uintBig> m_WalletKey;
 		NodeProcessor::Horizon m_Horizon;
 
@@ -44,8 +46,10 @@ struct Node
 		struct Timeout {
 			uint32_t m_GetState_ms	= 1000 * 5;
 			uint32_t m_GetBlock_ms	= 1000 * 30;
+			uint32_t m_GetBlockStall_ms = 1000 * 5; // after that the pending blocks of the peer are requested from others too
 			uint32_t m_GetTx_ms		= 1000 * 5;
 			uint32_t m_GetBbsMsg_ms	= 1000 * 10;
+			uint32_t m_GetSnapshot_ms = 1000 * 30; // per snapshot request (chunk or proofs), after that other peers are tried
 			uint32_t m_MiningSoftRestart_ms = 100;
 			uint32_t m_TopPeersUpd_ms = 1000 * 60 * 10; // once in 10 minutes
 			uint32_t m_PeersUpdate_ms	= 1000; // reconsider every second
@@ -57,14 +61,28 @@ struct Node
 
 		uint32_t m_BbsIdealChannelPopulation = 100;
 		uint32_t m_MaxPoolTransactions = 100 * 1000;
+		uint64_t m_MaxPoolBytes = 256ULL << 20; // memory budget of the tx pool. The txs with the lowest fee rate are evicted
+		uint64_t m_BodyCacheBytes = 64ULL << 20; // recently served block bodies, kept serialized for other peers. 0 - disabled
 		uint32_t m_MiningThreads = 0; // by default disabled
 		uint32_t m_MinerID = 0; // used as a seed for miner nonce generation
 
-		// Number of verification threads for CPU-hungry cryptography. Currently used for block validation only.
-		// 0: single threaded
+		// Number of verification threads for CPU-hungry cryptography. Used for block and transaction validation.
+		// The budget is split: a quarter (at least 1 thread) verifies transactions, the rest verifies blocks.
+		// 0: single threaded, everything is verified in-context
 		// negative: number of cores minus number of mining threads. 
 		int m_VerificationThreads = 0;
 
+		// During the sync several consecutive new blocks are verified in a single batch. 0 or 1: disabled
+		uint32_t m_VerificationBatchBlocks = 16;
+
+		// Blocks are downloaded from several peers in parallel, with several requests pipelined per peer.
+		uint32_t m_BlockDownloadWindow = 8; // max pending block requests per peer
+		uint32_t m_BlockDownloadSpan = 128; // max consecutive missing blocks requested at once (per branch)
+
+		// On the first start (empty DB) bootstrap from the most recent history snapshot of a peer, instead of replaying all the blocks.
+		// The snapshot is downloaded into the HistoryCompression::m_sPathTmp, and verified wrt peer's chainwork proof.
+		bool m_SnapshotSync = false;
+
 		struct HistoryCompression
 		{
 			std::string m_sPathOutput;
@@ -74,6 +92,7 @@ struct Node
 			Height m_MinAggregate = 60 * 24;	// how many new blocks should produce new file
 			uint32_t m_Naggling = 32;			// combine up to 32 blocks in memory, before involving file system
 			uint32_t m_MaxBacklog = 7;
+			uint32_t m_Threads = 0;				// for squashing. 0: number of cores
 		} m_HistoryCompression;
 
 		struct TestMode {
@@ -99,6 +118,32 @@ struct Node
 	void ImportMacroblock(Height); // throws on err
 
 	NodeProcessor& get_Processor() { return m_Processor; } // for tests only!
+	NodeProcessor::TxPool& get_TxPool() { return m_TxPool; } // for tests only!
+
+	// m_VerificationThreads is the total budget, split between the block and tx verifiers
+	uint32_t get_BlockVerificationThreads() const;
+	uint32_t get_TxVerificationThreads() const;
+
+	struct CompressorStats
+	{
+		HeightRange m_Range; // being generated, zero if idle
+		Height m_Exported; // num of heights exported from the DB so far
+		uint32_t m_Merges; // squash operations completed
+		uint32_t m_MergesPending; // queued or in progress
+		uint32_t m_Elapsed_ms;
+	};
+
+	void get_CompressorStats(CompressorStats&);
+
+	struct TxPoolStats
+	{
+		uint32_t m_Txs;
+		uint64_t m_Bytes; // accounted memory
+		uint64_t m_Evicted; // txs dropped due to the pool limits, since the start
+		uint64_t m_EvictedBytes;
+	};
+
+	void get_TxPoolStats(TxPoolStats&);
 
 private:
 
@@ -110,16 +155,30 @@ private:
 		virtual void OnPeerInsane(const PeerID&) override;
 		virtual void OnNewState() override;
 		virtual void OnRolledBack() override;
+		virtual void OnBodyDeleted(const Block::SystemState::ID&) override;
 		virtual bool VerifyBlock(const Block::BodyBase&, TxBase::IReader&&, const HeightRange&) override;
+		virtual bool VerifyBlocks(const VerifyItem*, size_t nCount) override;
 		virtual bool ApproveState(const Block::SystemState::ID&) override;
+		virtual void HashLiveParallel(RadixHashTree::ParallelHasher&) override;
 
 		struct Verifier
 		{
 			typedef ECC::InnerProduct::BatchContextEx<100> MyBatch; // seems to be ok, for larger batches difference is marginal
 
-			const TxBase* m_pTx;
-			TxBase::IReader* m_pR;
-			TxBase::Context m_Context;
+			const VerifyItem* m_pItems;
+			std::vector<TxBase::Context> m_vContexts; // per item
+			RadixHashTree::ParallelHasher* m_pHasher; // if set - the threads run it instead of the verification
+			TxBase::Context::Scheduler::Shared m_Sched;
+
+			struct ThreadStats
+			{
+				uint32_t m_Tasks;
+				uint64_t m_Chunks;
+				uint64_t m_Cost; // of the verified elements
+				uint64_t m_Busy_us;
+			};
+
+			std::vector<ThreadStats> m_vStats; // protected by m_Mutex
 
 			bool m_bFail;
 			uint32_t m_iTask;
@@ -131,6 +190,7 @@ private:
 
 			std::vector<std::thread> m_vThreads;
 
+			void StartLocked(uint32_t nThreads);
 			void Thread(uint32_t);
 
 			IMPLEMENT_GET_PARENT_OBJ(Processor, m_Verifier)
@@ -146,6 +206,59 @@ private:
 
 	struct Peer;
 
+	struct TxVerifier
+	{
+		// Incoming transactions are verified asynchronously, in batches, on the dedicated threads.
+		// The results are posted back to the reactor thread.
+		// With no threads (verification disabled) the batch is verified in-context, the result is still posted.
+		struct Task
+			:public boost::intrusive::list_base_hook<> // verifier queue. Protected by the mutex
+		{
+			struct InPeer
+				:public boost::intrusive::list_base_hook<> // pending replies of the peer. Reactor thread only
+			{
+				IMPLEMENT_GET_PARENT_OBJ(Task, m_Peer)
+			} m_Peer;
+
+			Peer* m_pPeer; // set to NULL if the peer is gone
+			Transaction::Ptr m_pTx;
+			Transaction::KeyType m_Key;
+			Transaction::Context m_Ctx;
+			bool m_bValid;
+			bool m_bDone; // verified, and handled by the reactor thread
+		};
+
+		typedef boost::intrusive::list<Task> TaskList;
+		typedef boost::intrusive::list<Task::InPeer> PeerTaskList;
+
+		static const uint32_t s_BatchMax = 32; // transactions verified in a single batch
+
+		TaskList m_lstPending;
+		TaskList m_lstDone;
+
+		std::mutex m_Mutex;
+		std::condition_variable m_NewTask;
+		std::vector<std::thread> m_vThreads;
+		io::AsyncEvent::Ptr m_pEvtDone;
+		std::unique_ptr<Processor::Verifier::MyBatch> m_pBatch; // for the in-context verification
+		bool m_bStop;
+
+		void Start(uint32_t nThreads);
+		void Stop();
+		void Push(Task&);
+		void Thread();
+		void OnDone();
+
+		static void Verify(TaskList&, Processor::Verifier::MyBatch&);
+		static void DeleteAll(TaskList&);
+
+		~TxVerifier() { Stop(); }
+
+		IMPLEMENT_GET_PARENT_OBJ(Node, m_TxVerifier)
+	} m_TxVerifier;
+
+	void OnTransactionVerified(TxVerifier::Task&);
+
 	struct Task
 		:public boost::intrusive::set_base_hook<>
 		,public boost::intrusive::list_base_hook<>
@@ -154,6 +267,7 @@ private:
 		Key m_Key;
 
 		bool m_bRelevant;
+		bool m_bHedged; // also requested from another peer
 		Peer* m_pOwner;
 
 		bool operator < (const Task& t) const { return (m_Key < t.m_Key); }
@@ -166,6 +280,7 @@ private:
 	TaskSet m_setTasks;
 
 	void TryAssignTask(Task&, const PeerID*);
+	void HedgeTasks(Peer&);
 	bool ShouldAssignTask(Task&, Peer&);
 	void AssignTask(Task&, Peer&);
 	void DeleteUnassignedTask(Task&);
@@ -214,6 +329,45 @@ private:
 		IMPLEMENT_GET_PARENT_OBJ(Node, m_Wtx)
 	} m_Wtx;
 
+	struct BodyCache
+	{
+		// Recently served block bodies, serialized once. During the sync several peers usually request the same blocks, then for each of
+		// them it's only the copy into the output buffer with the encryption (no DB access, no serialization).
+		// An entry is dropped once the DB deletes the body (invalid block, pruned branch, fossil).
+		struct Entry
+			:public boost::intrusive::set_base_hook<>
+			,public boost::intrusive::list_base_hook<>
+		{
+			Block::SystemState::ID m_ID;
+			proto::Body m_Msg;
+			proto::NodeConnection::Broadcast m_Bc;
+			uint64_t m_nSize; // as accounted in m_nBytes
+
+			Entry() :m_Bc(m_Msg) {}
+			bool operator < (const Entry& x) const { return (m_ID < x.m_ID); }
+		};
+
+		typedef boost::intrusive::list<Entry> List; // least recently used first
+		typedef boost::intrusive::set<Entry> Set;
+
+		List m_lst;
+		Set m_set;
+		uint64_t m_nBytes = 0;
+
+		static uint64_t get_SizeMax(size_t nBody);
+		static uint64_t get_Size(const Entry&);
+
+		Entry* Find(const Block::SystemState::ID&);
+		Entry* Add(const Block::SystemState::ID&, ByteBuffer&, uint64_t nMaxBytes); // takes the body. NULL (body is left) if it's too large
+		void OnSent(Entry&, uint64_t nMaxBytes); // the serialized image may have been created, account for it
+		void Trim(const Entry&, uint64_t nMaxBytes); // evicts the least recently used, except the given one
+		void Delete(Entry&);
+		void Delete(const Block::SystemState::ID&);
+		void Clear();
+
+		~BodyCache() { Clear(); }
+	} m_BodyCache;
+
 	struct Bbs
 	{
 		struct WantedMsg :public Wanted {
@@ -267,6 +421,7 @@ private:
 			:public PeerInfo
 		{
 			Peer* m_pLive;
+			bool m_bSnapshotRejected; // doesn't have the snapshot we need, or failed to deliver it. Kept across reconnects
 		};
 
 		// PeerManager
@@ -302,8 +457,13 @@ private:
 		TaskList m_lstTasks;
 		std::set<Task::Key> m_setRejected; // data that shouldn't be requested from this peer. Reset after reconnection or on receiving NewTip
 
+		uint32_t m_FirstTask_ms; // when the current first task started
+		uint32_t m_BlockAvg_ms; // block delivery time (moving average), 0 if unknown
+
 		Bbs::Subscription::PeerSet m_Subscriptions;
 
+		TxVerifier::PeerTaskList m_lstTxPending; // replies must be sent in the order of arrival
+
 		io::Timer::Ptr m_pTimer;
 		io::Timer::Ptr m_pTimerPeers;
 
@@ -313,6 +473,9 @@ private:
 		void ReleaseTasks();
 		void ReleaseTask(Task&);
 		void SetTimerWrtFirstTask();
+		uint32_t get_BlocksPending();
+		uint64_t get_BlockScore();
+		uint32_t get_BlockStall_ms();
 		void Unsubscribe(Bbs::Subscription&);
 		void Unsubscribe();
 		void OnTimer();
@@ -321,7 +484,11 @@ private:
 		void OnResendPeers();
 		void SendBbsMsg(const NodeDB::WalkerBbs::Data&);
 		void DeleteSelf(bool bIsError, uint8_t nByeReason);
-		bool OnNewTransaction(Transaction::Ptr&&);
+		void OnNewTransaction(TxVerifier::Task&);
+		void SendTxReplies();
+		void ReleaseTxTasks();
+
+		struct ProofUtxoBuilder;
 
 		Task& get_FirstTask();
 		void OnFirstTaskDone();
@@ -339,6 +506,8 @@ private:
 		virtual void OnMsg(proto::DataMissing&&) override;
 		virtual void OnMsg(proto::GetHdr&&) override;
 		virtual void OnMsg(proto::Hdr&&) override;
+		virtual void OnMsg(proto::GetHdrPack&&) override;
+		virtual void OnMsg(proto::HdrPack&&) override;
 		virtual void OnMsg(proto::GetBody&&) override;
 		virtual void OnMsg(proto::Body&&) override;
 		virtual void OnMsg(proto::NewTransaction&&) override;
@@ -348,7 +517,12 @@ private:
 		virtual void OnMsg(proto::GetProofState&&) override;
 		virtual void OnMsg(proto::GetProofKernel&&) override;
 		virtual void OnMsg(proto::GetProofUtxo&&) override;
+		virtual void OnMsg(proto::GetProofUtxoMulti&&) override;
 		virtual void OnMsg(proto::GetProofChainWork&&) override;
+		virtual void OnMsg(proto::ProofChainWork&&) override;
+		virtual void OnMsg(proto::ProofState&&) override;
+		virtual void OnMsg(proto::GetSnapshotChunk&&) override;
+		virtual void OnMsg(proto::SnapshotChunk&&) override;
 		virtual void OnMsg(proto::PeerInfoSelf&&) override;
 		virtual void OnMsg(proto::PeerInfo&&) override;
 		virtual void OnMsg(proto::GetTime&&) override;
@@ -416,6 +590,7 @@ private:
 	struct Miner
 	{
 		std::vector<PerThread> m_vThreads;
+		std::vector<Block::PoW::ISolver::Ptr> m_vSolvers; // per thread, reused
 		io::AsyncEvent::Ptr m_pEvtMined;
 
 		struct Task
@@ -461,23 +636,83 @@ private:
 		void OnNotify();
 		void Proceed();
 		bool ProceedInternal();
-		bool SquashOnce(std::vector<HeightRange>&);
+		void ProceedExport();
+		void ScheduleMerges(bool bAny);
+		void WorkerThread();
+		void DeleteTmp(const HeightRange&);
+		bool SquashOnce(const HeightRange& hr0, const HeightRange& hr1);
 		bool SquashOnce(Block::BodyBase::RW&, Block::BodyBase::RW& rwSrc0, Block::BodyBase::RW& rwSrc1);
 
 		PerThread m_Link;
 		std::mutex m_Mutex;
-		std::condition_variable m_Cond;
+		std::condition_variable m_Cond; // progress, for the export thread
+		std::condition_variable m_CondWorker; // new merges, or stop
 
 		volatile bool m_bStop;
 		bool m_bEnabled;
 		bool m_bSuccess;
 
-		// current data exchanged
 		HeightRange m_hrNew; // requested range. If min is non-zero - should be merged with previously-generated
-		HeightRange m_hrInplaceRequest;
+
+		// The exported ranges are merged in a binary-counter tree. Independent merges run in parallel on the worker threads.
+		// All the following is protected by m_Mutex
+		struct Part
+		{
+			HeightRange m_hr;
+			uint32_t m_Level;
+			bool m_bReady; // otherwise still being merged
+		};
+
+		std::vector<Part> m_vParts; // adjacent, ascending
+		std::deque<std::pair<HeightRange, HeightRange> > m_qMerges;
+		std::vector<std::thread> m_vWorkers;
+		bool m_bFail;
+		bool m_bWorkersStop;
+
+		CompressorStats m_Stats;
+		uint32_t m_Start_ms;
 
 		IMPLEMENT_GET_PARENT_OBJ(Node, m_Compressor)
 	} m_Compressor;
+
+	struct Snapshot
+	{
+		void Init();
+		void TryStart();
+		void Start(Peer&);
+		void Restart(); // discard the downloaded data
+		void OnPeerLost(Peer&);
+		void DropOwner(); // the owner can't deliver it, switch to another peer if possible
+		void SetTimer();
+		void OnTimer();
+		void RequestChunk();
+		void RequestProofs();
+		void OnChunk(proto::SnapshotChunk&);
+		void OnProofs(const Merkle::HardProof&);
+		void OnDone(bool bImported);
+		void FmtPath(Block::BodyBase::RW&);
+		Peer* FindHeaviest(); // among those that may serve the snapshot
+
+		bool IsDownloading(const Peer& p) const { return &p == m_pOwner; }
+
+		Peer* m_pOwner; // download in progress
+		bool m_bDone; // imported, or not applicable anymore
+
+		Block::SystemState::ID m_Top; // zero if not chosen yet
+		uint8_t m_iData; // data stream being downloaded. s_Datas: all downloaded, the proofs are pending
+		uint64_t m_Offset;
+		std::FStream m_File;
+
+		Block::ChainWorkProof m_Cwp;
+		bool m_bCwp;
+
+		static const uint32_t s_ProofRetriesMax = 5; // the owner's tip keeps changing
+		uint32_t m_nProofRetries;
+
+		io::Timer::Ptr m_pTimer; // for the current request of the owner
+
+		IMPLEMENT_GET_PARENT_OBJ(Node, m_Snapshot)
+	} m_Snapshot;
 };
 
 } // namespace beam
@@ -123,6 +123,8 @@ void NodeDB::Close()
 		verify(SQLITE_OK == sqlite3_close(m_pDb));
 		m_pDb = NULL;
 	}
+
+	m_Cache.Clear();
 }
 
 NodeDB::Recordset::Recordset(NodeDB& db)
@@ -253,9 +255,19 @@ const void* NodeDB::Recordset::get_BlobStrict(int col, uint32_t n)
 	return x.p;
 }
 
-void NodeDB::Open(const char* szPath)
+void NodeDB::Open(const char* szPath, bool bReadOnly /* = false */)
 {
-	TestRet(sqlite3_open_v2(szPath, &m_pDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_CREATE, NULL));
+	int nFlags = bReadOnly ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	TestRet(sqlite3_open_v2(szPath, &m_pDb, nFlags | SQLITE_OPEN_NOMUTEX, NULL));
+
+	// The writer and the read-only connections may collide occasionally (e.g. during the checkpoint). Prefer to wait rather than fail
+	TestRet(sqlite3_busy_timeout(m_pDb, 5000));
+
+	if (!bReadOnly)
+	{
+		ExecQuick("PRAGMA journal_mode=WAL"); // readers don't block the writer, and vice versa
+		ExecQuick("PRAGMA temp_store=MEMORY");
+	}
 
 	bool bCreate;
 	{
@@ -268,6 +280,8 @@ void NodeDB::Open(const char* szPath)
 
 	if (bCreate)
 	{
+		if (bReadOnly)
+			ThrowError("no DB");
 		Transaction t(*this);
 		Create();
 		ParamSet(ParamID::DbVer, &nVersion, NULL);
@@ -279,6 +293,54 @@ void NodeDB::Open(const char* szPath)
 		if (nVersion != ParamIntGetDef(ParamID::DbVer))
 			ThrowError("wrong version");
 	}
+
+}
+
+void NodeDB::SetPhase(Phase::Enum e)
+{
+	if (Phase::Bulk == e)
+	{
+		// Durability is pointless here: an interrupted import is restarted anyway
+		ExecQuick("PRAGMA synchronous=OFF");
+		ExecQuick("PRAGMA cache_size=-262144"); // 256MB
+		ExecQuick("PRAGMA mmap_size=1073741824");
+		ExecQuick("PRAGMA wal_autocheckpoint=0"); // the WAL is checkpointed once, upon completion
+	}
+	else
+	{
+		// back to the sqlite defaults
+		ExecQuick("PRAGMA synchronous=FULL");
+		ExecQuick("PRAGMA cache_size=-2000");
+		ExecQuick("PRAGMA mmap_size=0");
+		ExecQuick("PRAGMA wal_autocheckpoint=1000");
+		ExecQuick("PRAGMA wal_checkpoint(PASSIVE)"); // doesn't wait for the readers
+	}
+}
+
+NodeDB::PhaseBulk::PhaseBulk(NodeDB& db)
+	:m_pDB(&db)
+{
+	db.SetPhase(Phase::Bulk);
+}
+
+NodeDB::PhaseBulk::~PhaseBulk()
+{
+	if (m_pDB)
+	{
+		try {
+			Leave();
+		} catch (std::exception&) {
+			// ignore, the phase is restored anyway upon the next Open
+		}
+	}
+}
+
+void NodeDB::PhaseBulk::Leave()
+{
+	NodeDB* pDB = m_pDB;
+	m_pDB = NULL;
+
+	pDB->SetPhase(Phase::Steady);
 }
 
 void NodeDB::Create()
@@ -511,6 +573,8 @@ void NodeDB::Transaction::Rollback()
 {
 	if (m_pDB)
 	{
+		m_pDB->m_Cache.Clear(); // may contain the rolled-back changes
+
 		try {
 			m_pDB->ExecStep(Query::Rollback, "ROLLBACK");
 		} catch (std::exception&) {
@@ -533,6 +597,13 @@ void NodeDB::Transaction::Rollback()
 
 void NodeDB::get_State(uint64_t rowid, Block::SystemState::Full& out)
 {
+	StateCache::Row* pRow = m_Cache.Find(rowid, CacheStats::Type::State);
+	if (pRow)
+	{
+		out = pRow->m_State;
+		return;
+	}
+
 #define THE_MACRO_1(dbname, extname) TblStates_##dbname
 	Recordset rs(*this, Query::StateGet, "SELECT " StateCvt_Fields(THE_MACRO_1, THE_MACRO_COMMA_S) " FROM " TblStates " WHERE rowid=?");
 #undef THE_MACRO_1
@@ -546,6 +617,8 @@ void NodeDB::get_State(uint64_t rowid, Block::SystemState::Full& out)
 #define THE_MACRO_1(dbname, extname) rs.get(iCol++, out.extname);
 	StateCvt_Fields(THE_MACRO_1, THE_MACRO_NOP0)
 #undef THE_MACRO_1
+
+	m_Cache.Set(rowid, CacheStats::Type::State).m_State = out;
 }
 
 uint64_t NodeDB::InsertState(const Block::SystemState::Full& s)
@@ -709,6 +782,8 @@ bool NodeDB::DeleteState(uint64_t rowid, uint64_t& rowPrev)
 	rs.Step();
 	TestChanged1Row();
 
+	m_Cache.Delete(rowid); // the rowid may be reused
+
 	return true;
 }
 
@@ -1000,6 +1075,16 @@ void NodeDB::GetStateBlock(uint64_t rowid, ByteBuffer& body, ByteBuffer& rollbac
 	}
 }
 
+void NodeDB::GetStateBody(uint64_t rowid, ByteBuffer& body)
+{
+	Recordset rs(*this, Query::StateGetBody, "SELECT " TblStates_Body " FROM " TblStates " WHERE rowid=?");
+	rs.put(0, rowid);
+	rs.StepStrict();
+
+	if (!rs.IsNull(0))
+		rs.get(0, body);
+}
+
 void NodeDB::SetStateRollback(uint64_t rowid, const Blob& rollback)
 {
 	Recordset rs(*this, Query::StateSetRollback, "UPDATE " TblStates " SET " TblStates_Rollback "=? WHERE rowid=?");
@@ -1025,10 +1110,16 @@ void NodeDB::SetFlags(uint64_t rowid, uint32_t n)
 
 	rs.Step();
 	TestChanged1Row();
+
+	m_Cache.Set(rowid, CacheStats::Type::Flags).m_Flags = n;
 }
 
 uint32_t NodeDB::GetStateFlags(uint64_t rowid)
 {
+	StateCache::Row* pRow = m_Cache.Find(rowid, CacheStats::Type::Flags);
+	if (pRow)
+		return pRow->m_Flags;
+
 	Recordset rs(*this, Query::StateGetFlags0, "SELECT " TblStates_Flags " FROM " TblStates " WHERE rowid=?");
 	rs.put(0, rowid);
 
@@ -1036,6 +1127,8 @@ uint32_t NodeDB::GetStateFlags(uint64_t rowid)
 	
 	uint32_t nFlags;
 	rs.get(0, nFlags);
+
+	m_Cache.Set(rowid, CacheStats::Type::Flags).m_Flags = nFlags;
 	return nFlags;
 }
 
@@ -1228,6 +1321,14 @@ bool NodeDB::WalkerState::MoveNext()
 bool NodeDB::get_Prev(uint64_t& rowid)
 {
 	assert(rowid);
+
+	StateCache::Row* pRow = m_Cache.Find(rowid, CacheStats::Type::Prev);
+	if (pRow)
+	{
+		rowid = pRow->m_RowPrev;
+		return true;
+	}
+
 	Recordset rs(*this, Query::StateGetPrev, "SELECT " TblStates_RowPrev " FROM " TblStates " WHERE rowid=?");
 	rs.put(0, rowid);
 
@@ -1236,7 +1337,11 @@ bool NodeDB::get_Prev(uint64_t& rowid)
 	if (rs.IsNull(0))
 		return false;
 
-	rs.get(0, rowid);
+	uint64_t rowPrev;
+	rs.get(0, rowPrev);
+
+	m_Cache.Set(rowid, CacheStats::Type::Prev).m_RowPrev = rowPrev;
+	rowid = rowPrev;
 	return true;
 }
 
@@ -1282,6 +1387,10 @@ void NodeDB::MoveBack(StateID& sid)
 	rs.Step();
 	TestChanged1Row();
 
+	StateCache::Row* pRow = m_Cache.Peek(sid.m_Row);
+	if (pRow)
+		pRow->m_Flags &= ~uint32_t(StateFlags::Active); // harmless if not valid
+
 	if (!get_Prev(sid))
 		sid.SetNull();
 
@@ -1296,23 +1405,128 @@ void NodeDB::MoveFwd(const StateID& sid)
 	rs.Step();
 	TestChanged1Row();
 
+	StateCache::Row* pRow = m_Cache.Peek(sid.m_Row);
+	if (pRow)
+		pRow->m_Flags |= StateFlags::Active;
+
 	put_Cursor(sid);
 }
 
+NodeDB::StateCache::StateCache()
+	:m_nMax(4096)
+{
+	ZeroObject(m_Stats);
+}
+
+void NodeDB::StateCache::Touch(List::iterator it)
+{
+	if (m_Lru.begin() != it)
+		m_Lru.splice(m_Lru.begin(), m_Lru, it);
+}
+
+NodeDB::StateCache::Row* NodeDB::StateCache::Peek(uint64_t rowid)
+{
+	auto it = m_Map.find(rowid);
+	return (m_Map.end() == it) ? NULL : &*it->second;
+}
+
+NodeDB::StateCache::Row* NodeDB::StateCache::Find(uint64_t rowid, CacheStats::Type::Enum e)
+{
+	auto it = m_Map.find(rowid);
+	if ((m_Map.end() != it) && ((1U << e) & it->second->m_Valid))
+	{
+		m_Stats.m_pHits[e]++;
+		Touch(it->second);
+		return &*it->second;
+	}
+
+	m_Stats.m_pMisses[e]++;
+	return NULL;
+}
+
+NodeDB::StateCache::Row& NodeDB::StateCache::Set(uint64_t rowid, CacheStats::Type::Enum e)
+{
+	auto it = m_Map.find(rowid);
+	if (m_Map.end() == it)
+	{
+		if (m_Map.size() < m_nMax)
+			m_Lru.emplace_front();
+		else
+		{
+			// reuse the least recent one
+			m_Map.erase(m_Lru.back().m_RowID);
+			Touch(--m_Lru.end());
+		}
+
+		Row& r = m_Lru.front();
+		r.m_RowID = rowid;
+		r.m_Valid = 0;
+		r.m_Mmr.clear();
+
+		m_Map[rowid] = m_Lru.begin();
+	}
+	else
+		Touch(it->second);
+
+	Row& r = m_Lru.front();
+	r.m_Valid |= (1U << e);
+	return r;
+}
+
+void NodeDB::StateCache::Delete(uint64_t rowid)
+{
+	auto it = m_Map.find(rowid);
+	if (m_Map.end() != it)
+	{
+		m_Lru.erase(it->second);
+		m_Map.erase(it);
+	}
+}
+
+void NodeDB::StateCache::Clear()
+{
+	m_Lru.clear();
+	m_Map.clear();
+}
+
+void NodeDB::StateCache::SetMax(uint32_t n)
+{
+	m_nMax = std::max(n, 1U);
+
+	for (; m_Map.size() > m_nMax; m_Lru.pop_back())
+		m_Map.erase(m_Lru.back().m_RowID);
+}
+
+void NodeDB::SetCacheSize(uint32_t nRows)
+{
+	m_Cache.SetMax(nRows);
+}
+
+const ByteBuffer& NodeDB::get_Mmr(uint64_t rowid)
+{
+	StateCache::Row* pRow = m_Cache.Find(rowid, CacheStats::Type::Mmr);
+	if (!pRow)
+	{
+		Recordset rs(*this, Query::MmrGet, "SELECT " TblStates_Mmr " FROM " TblStates " WHERE rowid=?");
+		rs.put(0, rowid);
+		rs.StepStrict();
+
+		pRow = &m_Cache.Set(rowid, CacheStats::Type::Mmr);
+		rs.get(0, pRow->m_Mmr);
+	}
+
+	return pRow->m_Mmr;
+}
+
 struct NodeDB::Dmmr
 	:public Merkle::DistributedMmr
 {
 	NodeDB& m_This;
-	Recordset m_Rs;
-	uint64_t m_RowLast;
 
 	Dmmr(NodeDB& x)
 		:m_This(x)
-		,m_Rs(x)
-		,m_RowLast(0)
 	{}
 
-	void Goto(uint64_t rowid);
 	void get_NodeHashInternal(Merkle::Hash&, Key);
 
 	// DistributedMmr
@@ -1320,25 +1534,14 @@ struct NodeDB::Dmmr
 	virtual void get_NodeHash(Merkle::Hash&, Key) const override;
 };
 
-void NodeDB::Dmmr::Goto(uint64_t rowid)
-{
-	if (m_RowLast == rowid)
-		return;
-	m_RowLast = rowid;
-
-	m_Rs.Reset(Query::MmrGet, "SELECT " TblStates_Mmr " FROM " TblStates " WHERE rowid=?");
-	m_Rs.put(0, rowid);
-	m_Rs.StepStrict();
-}
-
 const void* NodeDB::Dmmr::get_NodeData(Key rowid) const
 {
-	Dmmr* pThis = (Dmmr*) this;
-	pThis->Goto(rowid);
+	// valid until evicted, which can't happen during the immediate use
+	const ByteBuffer& buf = m_This.get_Mmr(rowid);
+	if (buf.empty())
+		ThrowInconsistent();
 
-	Blob b;
-	pThis->m_Rs.get(0, b);
-	return b.p;
+	return &buf.front();
 }
 
 void NodeDB::Dmmr::get_NodeHash(Merkle::Hash& hv, Key rowid) const
@@ -1353,12 +1556,21 @@ void NodeDB::Dmmr::get_NodeHash(Merkle::Hash& hv, Key rowid) const
 
 void NodeDB::Dmmr::get_NodeHashInternal(Merkle::Hash& hv, Key rowid)
 {
+	StateCache::Row* pRow = m_This.m_Cache.Find(rowid, CacheStats::Type::Hash);
+	if (pRow)
+	{
+		hv = pRow->m_Hash;
+		return;
+	}
+
 	Recordset rs(m_This, Query::HashForHist, "SELECT " TblStates_Hash " FROM " TblStates " WHERE rowid=?");
 	rs.put(0, rowid);
 
 	rs.StepStrict();
 
 	rs.get(0, hv);
+
+	m_This.m_Cache.Set(rowid, CacheStats::Type::Hash).m_Hash = hv;
 }
 
 void NodeDB::BuildMmr(uint64_t rowid, uint64_t rowPrev, Height h)
@@ -1371,12 +1583,11 @@ void NodeDB::BuildMmr(uint64_t rowid, uint64_t rowPrev, Height h)
 
 	assert((h > Rules::HeightGenesis) && rowPrev && (rowid != rowPrev));
 
-	Dmmr dmmr(*this);
-	dmmr.Goto(rowid);
-
-	if (!dmmr.m_Rs.IsNull(0))
+	if (!get_Mmr(rowid).empty())
 		return;
 
+	Dmmr dmmr(*this);
+
 	dmmr.m_Count = h - (Rules::HeightGenesis + 1);
 	dmmr.m_kLast = rowPrev;
 
@@ -1390,13 +1601,13 @@ void NodeDB::BuildMmr(uint64_t rowid, uint64_t rowPrev, Height h)
 
 	dmmr.Append(rowid, pRes.get(), hv);
 
-	dmmr.m_Rs.Reset();
-
 	Recordset rs(*this, Query::MmrSet, "UPDATE " TblStates " SET " TblStates_Mmr "=? WHERE rowid=?");
 	rs.put(0, b);
 	rs.put(1, rowid);
 	rs.Step();
 	TestChanged1Row();
+
+	m_Cache.Set(rowid, CacheStats::Type::Mmr).m_Mmr.assign(pRes.get(), pRes.get() + b.n);
 }
 
 void NodeDB::get_Proof(Merkle::IProofBuilder& bld, const StateID& sid, Height hPrev)
@@ -1456,6 +1667,83 @@ void NodeDB::AddSpendable(const Blob& key, const Blob* pBody, uint32_t nRefs, ui
 	}
 }
 
+void NodeDB::SpendableBulk::Add(const Blob& key, const Blob* pBody, uint32_t nRefs, uint32_t nUnspentCount)
+{
+	assert(nRefs > 0);
+
+	m_vEntries.emplace_back();
+	Entry& e = m_vEntries.back();
+
+	e.m_iPos = m_Data.size();
+	e.m_nKey = key.n;
+	e.m_nBody = pBody ? pBody->n : 0;
+	e.m_bBody = (NULL != pBody);
+	e.m_nRefs = nRefs;
+	e.m_nUnspentCount = nUnspentCount;
+
+	m_Data.resize(m_Data.size() + e.m_nKey + e.m_nBody);
+	if (e.m_nKey)
+		memcpy(&m_Data.front() + e.m_iPos, key.p, e.m_nKey);
+	if (e.m_nBody)
+		memcpy(&m_Data.front() + e.m_iPos + e.m_nKey, pBody->p, e.m_nBody);
+
+	if (m_vEntries.size() >= s_MaxPending)
+		Flush();
+}
+
+int NodeDB::SpendableBulk::CmpKey(const Entry& a, const Entry& b) const
+{
+	// same as sqlite BLOB comparison
+	const uint8_t* p = m_Data.empty() ? NULL : &m_Data.front();
+	int n = memcmp(p + a.m_iPos, p + b.m_iPos, std::min(a.m_nKey, b.m_nKey));
+	if (n)
+		return n;
+
+	return (a.m_nKey < b.m_nKey) ? -1 : (a.m_nKey > b.m_nKey);
+}
+
+void NodeDB::SpendableBulk::Flush()
+{
+	if (m_vEntries.empty())
+		return;
+
+	// stable, so that the body of the first occurrence is kept, as in AddSpendable
+	std::stable_sort(m_vEntries.begin(), m_vEntries.end(), [this](const Entry& a, const Entry& b) { return CmpKey(a, b) < 0; });
+
+	const uint8_t* p = m_Data.empty() ? NULL : &m_Data.front();
+
+	for (size_t i = 0; i < m_vEntries.size(); )
+	{
+		const Entry& e = m_vEntries[i];
+		uint32_t nRefs = e.m_nRefs;
+		uint32_t nUnspentCount = e.m_nUnspentCount;
+
+		for (i++; (i < m_vEntries.size()) && !CmpKey(e, m_vEntries[i]); i++)
+		{
+			nRefs += m_vEntries[i].m_nRefs;
+			nUnspentCount += m_vEntries[i].m_nUnspentCount;
+		}
+
+		Blob key(p + e.m_iPos, e.m_nKey);
+
+		{
+			Recordset rs(m_DB, Query::SpendableAddBulk, "INSERT OR IGNORE INTO " TblSpendable "(" TblSpendable_Key "," TblSpendable_Body "," TblSpendable_Refs "," TblSpendable_Unspent ") VALUES(?,?,?,?)");
+			rs.put(0, key);
+			if (e.m_bBody)
+				rs.put(1, Blob(p + e.m_iPos + e.m_nKey, e.m_nBody));
+			rs.put(2, nRefs);
+			rs.put(3, nUnspentCount);
+			rs.Step();
+		}
+
+		if (!m_DB.get_RowsChanged())
+			m_DB.ModifySpendableSafe(key, nRefs, nUnspentCount); // already in the DB
+	}
+
+	m_vEntries.clear();
+	m_Data.clear();
+}
+
 void NodeDB::ModifySpendableSafe(const Blob& key, int32_t nRefsDelta, int32_t nUnspentDelta)
 {
 	assert(nRefsDelta || nUnspentDelta);
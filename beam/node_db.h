@@ -17,6 +17,7 @@
 #include "../core/common.h"
 #include "../core/block_crypt.h"
 #include "../sqlite/sqlite3.h"
+#include <unordered_map>
 
 namespace beam {
 
@@ -95,7 +96,9 @@ public:
 			SpendableModify,
 			SpendableEnum,
 			SpendableGetBody,
+			SpendableAddBulk,
 			StateGetBlock,
+			StateGetBody,
 			StateSetBlock,
 			StateDelBlock,
 			StateSetRollback,
@@ -130,7 +133,24 @@ public:
 	~NodeDB();
 
 	void Close();
-	void Open(const char* szPath);
+	void Open(const char* szPath, bool bReadOnly = false); // read-only connections may be used concurrently from other threads
+
+	struct Phase {
+		enum Enum {
+			Steady, // normal operation, sqlite defaults
+			Bulk, // massive import: no fsync, big cache, no auto-checkpoint
+		};
+	};
+
+	void SetPhase(Phase::Enum); // not within a transaction
+
+	class PhaseBulk {
+		NodeDB* m_pDB;
+	public:
+		PhaseBulk(NodeDB&);
+		~PhaseBulk(); // back to Steady, unless already left
+		void Leave();
+	};
 
 	struct Blob {
 		const void* p;
@@ -218,6 +238,29 @@ public:
 
 	bool DeleteState(uint64_t rowid, uint64_t& rowPrev); // State must exist. Returns false if there are ancestors.
 
+	// Recently used state rows (header, hash, flags, prev-link, mmr data) are cached in memory, keyed by rowid.
+	// Assumes this connection is the only one that modifies the states.
+	struct CacheStats
+	{
+		struct Type {
+			enum Enum {
+				State,
+				Hash,
+				Flags,
+				Prev,
+				Mmr,
+
+				count
+			};
+		};
+
+		uint64_t m_pHits[Type::count];
+		uint64_t m_pMisses[Type::count];
+	};
+
+	const CacheStats& get_CacheStats() const { return m_Cache.m_Stats; }
+	void SetCacheSize(uint32_t nRows); // at least 1
+
 	uint32_t GetStateNextCount(uint64_t rowid);
 	uint32_t GetStateFlags(uint64_t rowid);
 	void SetFlags(uint64_t rowid, uint32_t);
@@ -230,6 +273,7 @@ public:
 
 	void SetStateBlock(uint64_t rowid, const Blob& body);
 	void GetStateBlock(uint64_t rowid, ByteBuffer& body, ByteBuffer& rollback);
+	void GetStateBody(uint64_t rowid, ByteBuffer& body); // w/o the rollback data, for serving to peers
 	void SetStateRollback(uint64_t rowid, const Blob& rollback);
 	void DelStateBlock(uint64_t rowid);
 
@@ -284,6 +328,35 @@ public:
 	void ModifySpendable(const Blob& key, int32_t nRefsDelta, int32_t nUnspentDelta); // will delete iff refs=0
 	bool GetSpendableBody(const Blob& key, Blob&);
 
+	// Accumulates the spendables in memory, and writes them sorted by key (i.e. in the b-tree order), duplicates merged.
+	// Same semantics as AddSpendable, but the pending elements are invisible to the DB until flushed.
+	class SpendableBulk
+	{
+		struct Entry
+		{
+			uint64_t m_iPos; // key, followed by the body
+			uint32_t m_nKey;
+			uint32_t m_nBody;
+			uint32_t m_nRefs;
+			uint32_t m_nUnspentCount;
+			bool m_bBody;
+		};
+
+		NodeDB& m_DB;
+		ByteBuffer m_Data;
+		std::vector<Entry> m_vEntries;
+
+		int CmpKey(const Entry&, const Entry&) const;
+
+	public:
+		static const size_t s_MaxPending = 0x100000; // flushed automatically when reached
+
+		SpendableBulk(NodeDB& db) :m_DB(db) {}
+
+		void Add(const Blob& key, const Blob* pBody, uint32_t nRefs, uint32_t nUnspentCount);
+		void Flush();
+	};
+
 	void assert_valid(); // diagnostic, for tests only
 
 	void SetMined(const StateID&, const Amount&);
@@ -377,6 +450,44 @@ private:
 
 	void TestChanged1Row();
 
+	class StateCache
+	{
+	public:
+		struct Row
+		{
+			uint64_t m_RowID;
+			uint32_t m_Valid; // bitmask of CacheStats::Type
+			Block::SystemState::Full m_State;
+			Merkle::Hash m_Hash;
+			uint32_t m_Flags;
+			uint64_t m_RowPrev; // cached only if not NULL. The NULL prev-link may be set by an arriving state
+			ByteBuffer m_Mmr;
+		};
+
+		CacheStats m_Stats;
+
+		StateCache();
+		void SetMax(uint32_t);
+
+		Row* Find(uint64_t rowid, CacheStats::Type::Enum); // if the specified field is valid. Updates the stats
+		Row* Peek(uint64_t rowid); // no stats, no LRU update
+		Row& Set(uint64_t rowid, CacheStats::Type::Enum); // marks the field valid, evicts the least recent row if necessary
+		void Delete(uint64_t rowid);
+		void Clear();
+
+	private:
+		typedef std::list<Row> List;
+		List m_Lru; // most recent first
+		uint32_t m_nMax;
+		std::unordered_map<uint64_t, List::iterator> m_Map;
+
+		void Touch(List::iterator);
+	};
+
+	StateCache m_Cache;
+
+	const ByteBuffer& get_Mmr(uint64_t rowid); // empty if NULL
+
 	struct Dmmr;
 };
 
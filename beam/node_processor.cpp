@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "node_processor.h"
+#include "../core/navigator.h"
 #include "../utility/serialize.h"
 #include "../core/serialization_adapters.h"
 #include "../utility/logger.h"
@@ -31,6 +32,157 @@ NodeProcessor::Horizon::Horizon()
 {
 }
 
+NodeProcessor::NodeProcessor()
+	:m_pSpendableBulk(NULL)
+	,m_VerifyBatchBlocks(0)
+	,m_RequestBlocksMax(0)
+	,m_bTreesLoaded(false)
+{
+	ZeroObject(m_Cursor);
+	m_CursorWindow.Reset();
+}
+
+NodeProcessor::~NodeProcessor()
+{
+	try {
+		SaveTrees();
+	}
+	catch (const std::exception& e) {
+		LOG_WARNING() << "Trees image not saved: " << e.what();
+	}
+}
+
+struct NodeProcessor::TreesImage
+{
+	static const uint8_t s_pSig[10];
+
+	struct Hdr
+	{
+		Block::SystemState::ID m_Cursor; // zero if the image isn't valid
+		uint64_t m_pSize[2]; // utxos, kernels
+		Merkle::Hash m_hvChecksum; // of the data. The loaded joint hashes are trusted, so the leaves must be exactly as saved
+	};
+
+	MappedFile m_File;
+	uint64_t m_nOffset; // of the data
+
+	void Open(const char* sz)
+	{
+		MappedFile::Defs d;
+		d.m_pSig = s_pSig;
+		d.m_nSizeSig = sizeof(s_pSig);
+		d.m_nBanks = 0;
+		d.m_nFixedHdr = sizeof(Hdr);
+
+		m_File.Open(sz, d);
+		m_nOffset = d.get_SizeMin();
+	}
+
+	Hdr& get_Hdr() const { return *(Hdr*) m_File.get_FixedHdr(); }
+
+	static void get_Checksum(Merkle::Hash& hv, const uint8_t* p, uint64_t n)
+	{
+		ECC::Hash::Processor hp;
+		hp << n;
+
+		while (n)
+		{
+			uint32_t nPortion = static_cast<uint32_t>(std::min<uint64_t>(n, 0x10000000));
+			hp.Write(p, nPortion);
+			p += nPortion;
+			n -= nPortion;
+		}
+
+		hp >> hv;
+	}
+};
+
+const uint8_t NodeProcessor::TreesImage::s_pSig[10] = { 'B', 'e', 'a', 'm', 'T', 'r', 'e', 'e', 's', '1' };
+
+void NodeProcessor::SaveTrees()
+{
+	if (m_sPathTrees.empty() || !m_Cursor.m_Sid.m_Row)
+		return;
+
+	// make sure all the hashes are evaluated, so that they're saved as clean
+	Merkle::Hash hv;
+	m_Utxos.get_Hash(hv);
+	m_Kernels.get_Hash(hv);
+
+	uint64_t pSize[] = { m_Utxos.get_ImageSize(), m_Kernels.get_ImageSize() };
+
+	TreesImage ti;
+	ti.Open(m_sPathTrees.c_str());
+	ZeroObject(ti.get_Hdr()); // invalidate, in case we fail in the middle
+
+	ti.m_File.SetSize(ti.m_nOffset + pSize[0] + pSize[1]);
+
+	uint8_t* p = NULL;
+	if (pSize[0] + pSize[1])
+	{
+		p = &ti.m_File.get_At<uint8_t>(ti.m_nOffset);
+		m_Utxos.SaveImage(p);
+		m_Kernels.SaveImage(p + pSize[0]);
+	}
+
+	TreesImage::Hdr& hdr = ti.get_Hdr();
+	memcpy(hdr.m_pSize, pSize, sizeof(pSize));
+	TreesImage::get_Checksum(hdr.m_hvChecksum, p, pSize[0] + pSize[1]);
+	hdr.m_Cursor = m_Cursor.m_ID;
+
+	LOG_INFO() << "Trees image saved, " << (pSize[0] + pSize[1]) << " bytes";
+}
+
+bool NodeProcessor::LoadTrees()
+{
+	if (m_sPathTrees.empty() || !m_Cursor.m_Sid.m_Row)
+		return false;
+
+	try {
+
+		TreesImage ti;
+		ti.Open(m_sPathTrees.c_str());
+
+		TreesImage::Hdr hdr = ti.get_Hdr();
+		if (hdr.m_Cursor != m_Cursor.m_ID)
+		{
+			LOG_INFO() << "Trees image is outdated";
+			return false;
+		}
+
+		if ((hdr.m_pSize[0] > ti.m_File.get_Size()) ||
+			(hdr.m_pSize[1] > ti.m_File.get_Size()) ||
+			(ti.m_nOffset + hdr.m_pSize[0] + hdr.m_pSize[1] > ti.m_File.get_Size()))
+			throw std::runtime_error("size mismatch");
+
+		const uint8_t* p = (hdr.m_pSize[0] + hdr.m_pSize[1]) ? &ti.m_File.get_At<uint8_t>(ti.m_nOffset) : NULL;
+
+		Merkle::Hash hv;
+		TreesImage::get_Checksum(hv, p, hdr.m_pSize[0] + hdr.m_pSize[1]);
+		if (hv != hdr.m_hvChecksum)
+			throw std::runtime_error("checksum mismatch");
+
+		if (!m_Utxos.LoadImage(p, hdr.m_pSize[0], UtxoTree::Key::s_Bits) ||
+			!m_Kernels.LoadImage(p + hdr.m_pSize[0], hdr.m_pSize[1], Merkle::Hash::nBits))
+			throw std::runtime_error("malformed");
+
+		// The cached hashes are loaded too. Make sure they match the current state
+		get_Definition(hv, false);
+		if (hv != m_Cursor.m_Full.m_Definition)
+			throw std::runtime_error("definition mismatch");
+
+		LOG_INFO() << "Trees loaded from image";
+		return true;
+	}
+	catch (const std::exception& e) {
+		LOG_WARNING() << "Trees image ignored: " << e.what();
+	}
+
+	m_Utxos.Clear();
+	m_Kernels.Clear();
+	return false;
+}
+
 struct NodeProcessor::UnspentWalker
 	:public NodeDB::WalkerSpendable
 {
@@ -115,11 +267,13 @@ void NodeProcessor::Initialize(const char* szPath)
 
 	InitCursor();
 
-	if (!m_Cursor.m_SubsidyOpen)
-		OnSubsidyOptionChanged(m_Cursor.m_SubsidyOpen);
-
 	// Load all the 'live' data
+	m_bTreesLoaded = LoadTrees(); // the image contains the subsidy-closed marker as well
+	if (!m_bTreesLoaded)
 	{
+		if (!m_Cursor.m_SubsidyOpen)
+			OnSubsidyOptionChanged(m_Cursor.m_SubsidyOpen);
+
 		struct Walker
 			:public UnspentWalker
 		{
@@ -150,6 +304,10 @@ void NodeProcessor::Initialize(const char* szPath)
 
 		Walker wlk(*this);
 		wlk.Traverse();
+
+		// the nodes were created in the DB order, lay them out in the tree order
+		m_Utxos.Compact();
+		m_Kernels.Compact();
 	}
 
 	NodeDB::Transaction t(m_DB);
@@ -175,27 +333,40 @@ void NodeProcessor::InitCursor()
 	else
 		ZeroObject(m_Cursor);
 
+	UpdateCursorWindow();
+
 	m_Cursor.m_DifficultyNext = get_NextDifficulty();
 	m_Cursor.m_SubsidyOpen = 0 != (m_DB.ParamIntGetDef(NodeDB::ParamID::SubsidyOpen, 1));
 }
 
 void NodeProcessor::EnumCongestions()
 {
+	// the lowest missing blocks of the branch, in a circular buffer (newer overwrite the higher ones)
+	std::vector<NodeDB::StateID> vBlocks(std::max(m_RequestBlocksMax, 1U));
+
 	// request all potentially missing data
 	NodeDB::WalkerState ws(m_DB);
 	for (m_DB.EnumTips(ws); ws.MoveNext(); )
 	{
 		NodeDB::StateID& sid = ws.m_Sid; // alias
-		if (NodeDB::StateFlags::Reachable & m_DB.GetStateFlags(sid.m_Row))
+		uint32_t nFlags = m_DB.GetStateFlags(sid.m_Row);
+		if (NodeDB::StateFlags::Reachable & nFlags)
 			continue;
 
 		if (sid.m_Height < m_Cursor.m_Sid.m_Height)
 			continue; // not interested in tips behind the current cursor
 
 		bool bBlock = true;
+		size_t nBlocks = 0;
 
-		while (sid.m_Height > Rules::HeightGenesis)
+		while (true)
 		{
+			if (!(NodeDB::StateFlags::Functional & nFlags))
+				vBlocks[nBlocks++ % vBlocks.size()] = sid;
+
+			if (sid.m_Height <= Rules::HeightGenesis)
+				break;
+
 			NodeDB::StateID sidThis = sid;
 			if (!m_DB.get_Prev(sid))
 			{
@@ -203,7 +374,8 @@ void NodeProcessor::EnumCongestions()
 				break;
 			}
 
-			if (NodeDB::StateFlags::Reachable & m_DB.GetStateFlags(sid.m_Row))
+			nFlags = m_DB.GetStateFlags(sid.m_Row);
+			if (NodeDB::StateFlags::Reachable & nFlags)
 			{
 				sid = sidThis;
 				break;
@@ -211,22 +383,33 @@ void NodeProcessor::EnumCongestions()
 		}
 
 		Block::SystemState::Full s;
-		m_DB.get_State(sid.m_Row, s);
-
 		Block::SystemState::ID id;
+		PeerID peer;
 
 		if (bBlock)
-			s.get_ID(id);
+		{
+			// starting from the lowest one
+			for (size_t i = 0; i < std::min(nBlocks, vBlocks.size()); i++)
+			{
+				const NodeDB::StateID& sidBlock = vBlocks[(nBlocks - 1 - i) % vBlocks.size()];
+
+				m_DB.get_State(sidBlock.m_Row, s);
+				s.get_ID(id);
+
+				bool bPeer = m_DB.get_Peer(sidBlock.m_Row, peer);
+				RequestData(id, true, bPeer ? &peer : NULL);
+			}
+		}
 		else
 		{
+			m_DB.get_State(sid.m_Row, s);
+
 			id.m_Height = s.m_Height - 1;
 			id.m_Hash = s.m_Prev;
-		}
 
-		PeerID peer;
-		bool bPeer = m_DB.get_Peer(sid.m_Row, peer);
-
-		RequestData(id, bBlock, bPeer ? &peer : NULL);
+			bool bPeer = m_DB.get_Peer(sid.m_Row, peer);
+			RequestData(id, false, bPeer ? &peer : NULL);
+		}
 	}
 }
 
@@ -282,11 +465,21 @@ void NodeProcessor::TryGoUp()
 		}
 
 		bool bPathOk = true;
+		size_t nBatch = 0;
+		bool bBatchOk = false;
 
 		for (size_t i = vPath.size(); i--; )
 		{
 			bDirty = true;
-			if (!GoForward(vPath[i]))
+
+			if (!nBatch)
+			{
+				nBatch = std::min(i + 1, (size_t) std::max(m_VerifyBatchBlocks, 1U));
+				bBatchOk = (nBatch > 1) && PreverifyBlocks(vPath, i, nBatch);
+			}
+			nBatch--;
+
+			if (!GoForward(vPath[i], bBatchOk))
 			{
 				bPathOk = false;
 				break;
@@ -327,8 +520,13 @@ void NodeProcessor::PruneOld()
 
 		do
 		{
+			Block::SystemState::ID id;
+			get_StateID(rowid, id);
+
 			if (!m_DB.DeleteState(rowid, rowid))
 				break;
+
+			OnBodyDeleted(id);
 		} while (rowid);
 	}
 
@@ -349,7 +547,7 @@ void NodeProcessor::PruneOld()
 
 		DereferenceFossilBlock(rowid);
 
-		m_DB.DelStateBlock(rowid);
+		DeleteBody(rowid);
 		m_DB.set_Peer(rowid, NULL);
 
 		++hFossil;
@@ -359,6 +557,13 @@ void NodeProcessor::PruneOld()
 
 void NodeProcessor::get_CurrentLive(Merkle::Hash& hv)
 {
+	RadixHashTree::ParallelHasher ph;
+	ph.Add(m_Utxos);
+	ph.Add(m_Kernels);
+
+	if (ph.ShouldRunParallel())
+		HashLiveParallel(ph);
+
 	m_Utxos.get_Hash(hv);
 
 	Merkle::Hash hv2;
@@ -399,19 +604,52 @@ struct NodeProcessor::RollbackData
 	}
 };
 
-bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
+bool NodeProcessor::PreverifyBlocks(const std::vector<uint64_t>& vPath, size_t iPos, size_t nCount)
 {
-	ByteBuffer bb;
-	RollbackData rbData;
-	m_DB.GetStateBlock(sid.m_Row, bb, rbData.m_Buf);
+	// Context-free verification of the consecutive blocks on the path, in a single batch.
+	// On failure each block is verified individually in HandleBlock, to find out the invalid one.
+	assert((nCount > 1) && (nCount <= iPos + 1));
 
-	Block::SystemState::Full s;
-	m_DB.get_State(sid.m_Row, s); // need it for logging anyway
+	// Fully decoded, each verifier thread walks all the blocks, sharing the decoded elements
+	std::vector<Block::Body> vBlocks(nCount);
+	std::vector<Block::Body::Reader> vReaders;
+	vReaders.reserve(nCount);
+	std::vector<VerifyItem> vItems(nCount);
 
-	Block::SystemState::ID id;
-	s.get_ID(id);
+	bool bSubsidyOpen = m_Cursor.m_SubsidyOpen;
+	ByteBuffer bb, bbRb;
 
-	Block::Body block;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		m_DB.GetStateBlock(vPath[iPos - i], bb, bbRb);
+		if (!bbRb.empty())
+			return false; // already interpreted before, no need to verify
+
+		Block::Body& block = vBlocks[i];
+		if (!DecodeBlock(bb, block))
+			return false;
+
+		vReaders.push_back(block.get_Reader());
+
+		VerifyItem& vi = vItems[i];
+		vi.m_pBlock = &block;
+		vi.m_pR = &vReaders.back();
+		vi.m_Height = m_Cursor.m_Sid.m_Height + 1 + i;
+		vi.m_SubsidyOpen = bSubsidyOpen;
+
+		if (block.m_SubsidyClosing)
+			bSubsidyOpen = false;
+	}
+
+	if (VerifyBlocks(&vItems.at(0), nCount))
+		return true;
+
+	LOG_WARNING() << "Batch verification of " << nCount << " blocks failed, verifying individually";
+	return false;
+}
+
+bool NodeProcessor::DecodeBlock(const ByteBuffer& bb, Block::Body& block)
+{
 	try {
 
 		Deserializer der;
@@ -419,20 +657,50 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 		der & block;
 	}
 	catch (const std::exception&) {
-		LOG_WARNING() << id << " Block deserialization failed";
 		return false;
 	}
 
-	bb.clear();
+	return true;
+}
 
-	bool bFirstTime = false;
+bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd, bool bPreverified)
+{
+	ByteBuffer bb;
+	RollbackData rbData;
+	m_DB.GetStateBlock(sid.m_Row, bb, rbData.m_Buf);
+
+	Block::SystemState::Full s;
+	m_DB.get_State(sid.m_Row, s); // need it for logging anyway
+
+	Block::SystemState::ID id;
+	s.get_ID(id);
+
+	bool bFirstTime = bFwd && rbData.m_Buf.empty();
+	bool bVerify = bFirstTime && !bPreverified;
+
+	// If the block is verified here - it's decoded fully, each verifier thread walks the whole block, sharing the decoded elements.
+	// Otherwise the elements are read directly from the buffer.
+	Block::Body blockFull;
+	Block::Body::Reader rFull = blockFull.get_Reader();
+	Block::Body::BufReader rBuf;
+
+	Block::BodyBase& block = blockFull;
+	TxBase::IReader& r = bVerify ? static_cast<TxBase::IReader&>(rFull) : rBuf;
+
+	bool bDecoded = bVerify ?
+		DecodeBlock(bb, blockFull) :
+		rBuf.Open(bb.empty() ? NULL : &bb.at(0), bb.size(), block);
+
+	if (!bDecoded)
+	{
+		LOG_WARNING() << id << " Block deserialization failed";
+		return false;
+	}
 
 	if (bFwd)
 	{
-		if (rbData.m_Buf.empty())
+		if (bFirstTime)
 		{
-			bFirstTime = true;
-
 			Difficulty::Raw wrk;
 			s.m_PoW.m_Difficulty.Inc(wrk, m_Cursor.m_Full.m_ChainWork);
 
@@ -460,7 +728,7 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 				return false;
 			}
 
-			if (!VerifyBlock(block, block.get_Reader(), sid.m_Height))
+			if (bVerify && !VerifyBlock(block, std::move(r), sid.m_Height))
 			{
 				LOG_WARNING() << id << " context-free verification failed";
 				return false;
@@ -470,7 +738,7 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 		assert(!rbData.m_Buf.empty());
 
 
-	bool bOk = HandleValidatedTx(block.get_Reader(), sid.m_Height, bFwd, rbData);
+	bool bOk = HandleValidatedTx(std::move(r), sid.m_Height, bFwd, rbData);
 	if (!bOk)
 		LOG_WARNING() << id << " invalid in its context";
 
@@ -510,7 +778,7 @@ bool NodeProcessor::HandleBlock(const NodeDB::StateID& sid, bool bFwd)
 			}
 
 			rbData.m_Inputs = 0;
-			verify(HandleValidatedTx(block.get_Reader(), sid.m_Height, false, rbData));
+			verify(HandleValidatedTx(std::move(r), sid.m_Height, false, rbData));
 		}
 	}
 
@@ -603,6 +871,9 @@ bool NodeProcessor::HandleValidatedTx(TxBase::IReader&& r, Height h, bool bFwd,
 		OnCorrupted();
 
 	// Rollback all the changes. Must succeed!
+	if (m_pSpendableBulk)
+		m_pSpendableBulk->Flush(); // the pending elements must be in the DB to be modified
+
 	r.Reset();
 
 	for (; nKrnOut--; r.NextKernelOut())
@@ -764,15 +1035,17 @@ bool NodeProcessor::HandleBlockElement(const Output& v, Height h, const Height*
 	if (bFwd)
 	{
 		if (bCreate)
-		{
 			p->m_Value.m_Count = 1;
-			m_DB.AddSpendable(blob, NULL, 1, 1);
-		}
 		else
-		{
 			p->m_Value.m_Count++;
-			m_DB.ModifySpendable(blob, 1, 1);
-		}
+
+		if (m_pSpendableBulk)
+			m_pSpendableBulk->Add(blob, NULL, 1, 1); // merged with the existing on flush
+		else
+			if (bCreate)
+				m_DB.AddSpendable(blob, NULL, 1, 1);
+			else
+				m_DB.ModifySpendable(blob, 1, 1);
 	} else
 	{
 		if (1 == p->m_Value.m_Count)
@@ -834,8 +1107,12 @@ bool NodeProcessor::HandleBlockElement(const TxKernel& v, bool bFwd, bool bIsInp
 			NodeDB::Blob body;
 			if (v.m_pHashLock)
 				body = NodeDB::Blob(v.m_pHashLock->m_Preimage);
+			const NodeDB::Blob* pBody = v.m_pHashLock ? &body : NULL;
 
-			m_DB.AddSpendable(blob, v.m_pHashLock ? &body : NULL, 1, 1);
+			if (m_pSpendableBulk)
+				m_pSpendableBulk->Add(blob, pBody, 1, 1);
+			else
+				m_DB.AddSpendable(blob, pBody, 1, 1);
 		} else
 			m_DB.ModifySpendable(blob, -1, -1);
 
@@ -849,13 +1126,9 @@ void NodeProcessor::DereferenceFossilBlock(uint64_t rowid)
 
 	m_DB.GetStateBlock(rowid, bbBlock, rbData.m_Buf);
 
-	Block::Body block;
-
-	Deserializer der;
-	der.reset(&bbBlock.at(0), bbBlock.size());
-	der & block;
-
-	Block::Body::Reader r = block.get_Reader();
+	Block::BodyBase block;
+	Block::Body::BufReader r;
+	verify(r.Open(&bbBlock.at(0), bbBlock.size(), block)); // was already validated
 	r.Reset();
 
 	for (; r.m_pUtxoIn; r.NextUtxoIn())
@@ -879,20 +1152,36 @@ void NodeProcessor::DereferenceFossilBlock(uint64_t rowid)
 	}
 }
 
-bool NodeProcessor::GoForward(uint64_t row)
+void NodeProcessor::get_StateID(uint64_t rowid, Block::SystemState::ID& id)
+{
+	Block::SystemState::Full s;
+	m_DB.get_State(rowid, s);
+	s.get_ID(id);
+}
+
+void NodeProcessor::DeleteBody(uint64_t rowid)
+{
+	m_DB.DelStateBlock(rowid);
+
+	Block::SystemState::ID id;
+	get_StateID(rowid, id);
+	OnBodyDeleted(id);
+}
+
+bool NodeProcessor::GoForward(uint64_t row, bool bPreverified)
 {
 	NodeDB::StateID sid;
 	sid.m_Height = m_Cursor.m_Sid.m_Height + 1;
 	sid.m_Row = row;
 
-	if (HandleBlock(sid, true))
+	if (HandleBlock(sid, true, bPreverified))
 	{
 		m_DB.MoveFwd(sid);
 		InitCursor();
 		return true;
 	}
 
-	m_DB.DelStateBlock(row);
+	DeleteBody(row);
 	m_DB.SetStateNotFunctional(row);
 
 	PeerID peer;
@@ -911,7 +1200,7 @@ void NodeProcessor::Rollback()
 	m_DB.MoveBack(m_Cursor.m_Sid);
 	InitCursor();
 
-	if (!HandleBlock(sid, false))
+	if (!HandleBlock(sid, false, false))
 		OnCorrupted();
 
 	InitCursor(); // needed to refresh subsidy-open flag. Otherwise isn't necessary
@@ -985,6 +1274,68 @@ NodeProcessor::DataStatus::Enum NodeProcessor::OnState(const Block::SystemState:
 	return ret;
 }
 
+NodeProcessor::DataStatus::Enum NodeProcessor::OnStatePack(const Block::SystemState::Sequence::Prefix& prefix, const std::vector<Block::SystemState::Sequence::Element>& v, const Block::SystemState::ID& idTop, const PeerID& peer)
+{
+	if (v.empty())
+		return DataStatus::Invalid;
+
+	// reconstruct the full states
+	std::vector<Block::SystemState::Full> vStates(v.size());
+
+	Block::SystemState::Full& s0 = vStates.front();
+	(Block::SystemState::Sequence::Prefix&) s0 = prefix;
+	(Block::SystemState::Sequence::Element&) s0 = v.front();
+
+	for (size_t i = 1; i < v.size(); i++)
+	{
+		Block::SystemState::Full& s = vStates[i];
+		s = vStates[i - 1];
+		s.NextPrefix();
+		(Block::SystemState::Sequence::Element&) s = v[i];
+		s.m_PoW.m_Difficulty.Inc(s.m_ChainWork);
+	}
+
+	Block::SystemState::ID id;
+	vStates.back().get_ID(id);
+	if (id != idTop)
+	{
+		LOG_WARNING() << "Header pack mismatch. Expected " << idTop << ", actual " << id;
+		return DataStatus::Invalid;
+	}
+
+	NodeDB::Transaction t(m_DB);
+	uint32_t nAccepted = 0;
+
+	for (size_t i = 0; i < vStates.size(); i++)
+	{
+		const Block::SystemState::Full& s = vStates[i];
+
+		switch (OnStateInternal(s, id))
+		{
+		case DataStatus::Invalid:
+			return DataStatus::Invalid; // rolled back
+
+		case DataStatus::Accepted:
+			{
+				uint64_t rowid = m_DB.InsertState(s);
+				m_DB.set_Peer(rowid, &peer);
+				nAccepted++;
+			}
+
+		default: // suppress the warning of not handling all the enum values
+			break;
+		}
+	}
+
+	if (!nAccepted)
+		return DataStatus::Rejected;
+
+	t.Commit();
+
+	LOG_INFO() << nAccepted << " Headers accepted, Top: " << idTop;
+	return DataStatus::Accepted;
+}
+
 NodeProcessor::DataStatus::Enum NodeProcessor::OnBlock(const Block::SystemState::ID& id, const NodeDB::Blob& block, const PeerID& peer)
 {
 	if (block.n > Rules::get().MaxBodySize)
@@ -1029,14 +1380,19 @@ bool NodeProcessor::IsStateNeeded(const Block::SystemState::ID& id)
 
 uint64_t NodeProcessor::FindActiveAtStrict(Height h)
 {
-	NodeDB::WalkerState ws(m_DB);
-	m_DB.EnumStatesAt(ws, h);
+	return FindActiveAtStrict(m_DB, h);
+}
+
+uint64_t NodeProcessor::FindActiveAtStrict(NodeDB& db, Height h)
+{
+	NodeDB::WalkerState ws(db);
+	db.EnumStatesAt(ws, h);
 	while (true)
 	{
 		if (!ws.MoveNext())
 			OnCorrupted();
 
-		if (NodeDB::StateFlags::Active & m_DB.GetStateFlags(ws.m_Sid.m_Row))
+		if (NodeDB::StateFlags::Active & db.GetStateFlags(ws.m_Sid.m_Row))
 			return ws.m_Sid.m_Row;
 	}
 }
@@ -1045,33 +1401,112 @@ uint64_t NodeProcessor::FindActiveAtStrict(Height h)
 // TxPool
 bool NodeProcessor::ValidateTx(const Transaction& tx, Transaction::Context& ctx)
 {
-	if (!tx.IsValid(ctx))
-		return false;
+	return
+		tx.IsValid(ctx) &&
+		ValidateTxWrtHeight(ctx);
+}
 
+bool NodeProcessor::ValidateTxWrtHeight(const Transaction::Context& ctx)
+{
 	return ctx.m_Height.IsInRange(m_Cursor.m_Sid.m_Height + 1);
 }
 
+NodeProcessor::TxPool::TxPool()
+	:m_nBytes(0)
+{
+	ZeroObject(m_Stats);
+}
+
+void NodeProcessor::TxPool::Element::get_Value(Transaction& tx) const
+{
+	Deserializer der;
+	der.reset(&m_Blob.at(0), m_Blob.size());
+	der & tx;
+}
+
 void NodeProcessor::TxPool::AddValidTx(Transaction::Ptr&& pValue, const Transaction::Context& ctx, const Transaction::KeyType& key)
 {
 	assert(pValue);
+	const Transaction& tx = *pValue;
 
-	SerializerSizeCounter ssc;
-	ssc & pValue;
+	Serializer ser;
+	ser & tx;
+	SerializeBuffer sb = ser.buffer();
 
 	Element* p = new Element;
-	p->m_pValue = std::move(pValue);
+	p->m_Blob.assign(sb.first, sb.first + sb.second); // exact size, no spare capacity
+
+	p->m_nInputs = (uint32_t) tx.m_vInputs.size();
+	p->m_vPoints.reserve(tx.m_vInputs.size() + tx.m_vOutputs.size());
+	for (size_t i = 0; i < tx.m_vInputs.size(); i++)
+		p->m_vPoints.push_back(tx.m_vInputs[i]->m_Commitment);
+	for (size_t i = 0; i < tx.m_vOutputs.size(); i++)
+		p->m_vPoints.push_back(tx.m_vOutputs[i]->m_Commitment);
+
+	pValue.reset(); // not needed anymore
+
+	// rough, but proportional to the actual usage: the object, the blob, and the map nodes per commitment
+	p->m_nBytes = (uint32_t) (sizeof(Element) + p->m_Blob.size() + p->m_vPoints.size() * (sizeof(ECC::Point) + sizeof(PointMap::value_type) + sizeof(void*) * 4));
+
+	p->m_bTemplate = false;
+	p->m_bPackage = false;
 	p->m_Threshold.m_Value	= ctx.m_Height.m_Max;
 	p->m_Profit.m_Fee	= ctx.m_Fee.Hi ? Amount(-1) : ctx.m_Fee.Lo; // ignore huge fees (which are  highly unlikely), saturate.
-	p->m_Profit.m_nSize	= (uint32_t) ssc.m_Counter.m_Value;
+	p->m_Profit.m_nSize	= (uint32_t) p->m_Blob.size();
 	p->m_Tx.m_Key = key;
 
 	m_setThreshold.insert(p->m_Threshold);
 	m_setProfit.insert(p->m_Profit);
 	m_setTxs.insert(p->m_Tx);
+
+	for (uint32_t i = 0; i < p->m_vPoints.size(); i++)
+		((i < p->m_nInputs) ? m_mapInputs : m_mapOutputs).insert(std::make_pair(p->m_vPoints[i], p));
+
+	m_nBytes += p->m_nBytes;
+
+	if (m_Template.m_bValid)
+	{
+		if (HasTemplateSpenders(*p))
+			ResetTemplate(); // the parent arrived after its child, must precede it
+		else
+			if ((PackageStatus::Added != AddToTemplate(*p)) && (!m_Template.m_pWorst || (p->m_Profit < m_Template.m_pWorst->m_Profit)))
+				ResetTemplate(); // could displace something
+	}
+}
+
+bool NodeProcessor::TxPool::HasTemplateSpenders(const Element& x) const
+{
+	for (uint32_t i = x.m_nInputs; i < x.m_vPoints.size(); i++)
+	{
+		const ECC::Point& key = x.m_vPoints[i];
+		for (PointMap::const_iterator it = m_mapInputs.lower_bound(key); (m_mapInputs.end() != it) && (it->first == key); it++)
+			if (it->second->m_bTemplate)
+				return true;
+	}
+	return false;
+}
+
+void NodeProcessor::TxPool::DeleteFromMap(PointMap& m, const ECC::Point& key, const Element& x)
+{
+	for (PointMap::iterator it = m.lower_bound(key); (m.end() != it) && (it->first == key); it++)
+		if (&x == it->second)
+		{
+			m.erase(it);
+			break;
+		}
 }
 
 void NodeProcessor::TxPool::Delete(Element& x)
 {
+	if (x.m_bTemplate)
+		ResetTemplate();
+
+	for (uint32_t i = 0; i < x.m_vPoints.size(); i++)
+		DeleteFromMap((i < x.m_nInputs) ? m_mapInputs : m_mapOutputs, x.m_vPoints[i], x);
+
+	assert(m_nBytes >= x.m_nBytes);
+	m_nBytes -= x.m_nBytes;
+
 	m_setThreshold.erase(ThresholdSet::s_iterator_to(x.m_Threshold));
 	m_setProfit.erase(ProfitSet::s_iterator_to(x.m_Profit));
 	m_setTxs.erase(TxSet::s_iterator_to(x.m_Tx));
@@ -1090,16 +1525,195 @@ void NodeProcessor::TxPool::DeleteOutOfBound(Height h)
 	}
 }
 
-void NodeProcessor::TxPool::ShrinkUpTo(uint32_t nCount)
+void NodeProcessor::TxPool::ShrinkUpTo(uint32_t nCount, uint64_t nBytes)
 {
-	while (m_setProfit.size() > nCount)
-		Delete(m_setProfit.rbegin()->get_ParentObj());
+	while ((m_setProfit.size() > nCount) || (m_nBytes > nBytes))
+	{
+		Element& x = m_setProfit.rbegin()->get_ParentObj();
+
+		m_Stats.m_Evicted++;
+		m_Stats.m_EvictedBytes += x.m_nBytes;
+
+		Delete(x);
+	}
 }
 
 void NodeProcessor::TxPool::Clear()
 {
 	while (!m_setThreshold.empty())
 		Delete(m_setThreshold.begin()->get_ParentObj());
+
+	ResetTemplate();
+}
+
+NodeProcessor::TxPool::Template::Template()
+	:m_pWorst(NULL)
+	,m_nSize(0)
+	,m_nSizeMax(0)
+	,m_bValid(false)
+{
+}
+
+void NodeProcessor::TxPool::ResetTemplate()
+{
+	for (size_t i = 0; i < m_Template.m_vElements.size(); i++)
+		m_Template.m_vElements[i]->m_bTemplate = false;
+
+	m_Template.m_vElements.clear();
+	m_Template.m_pWorst = NULL;
+	m_Template.m_nSize = 0;
+	m_Template.m_bValid = false;
+}
+
+bool NodeProcessor::TxPool::CollectPackage(Element& x, std::vector<Element*>& vPkg, size_t& nSize, uint32_t nDepth)
+{
+	if (x.m_bTemplate || x.m_bPackage)
+		return true;
+
+	if (nDepth > 64)
+		return false; // too deep (or cyclic)
+
+	for (uint32_t i = 0; i < x.m_nInputs; i++)
+	{
+		const ECC::Point& key = x.m_vPoints[i];
+
+		// double-spend of what's already selected?
+		for (PointMap::iterator it = m_mapInputs.lower_bound(key); (m_mapInputs.end() != it) && (it->first == key); it++)
+		{
+			const Element& y = *it->second;
+			if ((&x != &y) && (y.m_bTemplate || y.m_bPackage))
+				return false;
+		}
+
+		// spends a pooled output? Pull its creator as well. Otherwise assume it's in the UTXO set, verified when the block is generated.
+		PointMap::iterator it = m_mapOutputs.find(key);
+		if ((m_mapOutputs.end() != it) && !CollectPackage(*it->second, vPkg, nSize, nDepth + 1))
+			return false;
+	}
+
+	x.m_bPackage = true;
+	vPkg.push_back(&x);
+	nSize += x.m_Profit.m_nSize;
+
+	return true;
+}
+
+NodeProcessor::TxPool::PackageStatus::Enum NodeProcessor::TxPool::AddToTemplate(Element& x)
+{
+	if (x.m_bTemplate)
+		return PackageStatus::Added; // pulled by a child
+
+	std::vector<Element*> vPkg;
+	size_t nSize = 0;
+	bool bOk = CollectPackage(x, vPkg, nSize, 0);
+
+	for (size_t i = 0; i < vPkg.size(); i++)
+		vPkg[i]->m_bPackage = false;
+
+	if (!bOk)
+		return PackageStatus::Conflict;
+
+	if (m_Template.m_nSize + nSize > m_Template.m_nSizeMax)
+		return PackageStatus::NoRoom;
+
+	for (size_t i = 0; i < vPkg.size(); i++)
+	{
+		vPkg[i]->m_bTemplate = true;
+		m_Template.m_vElements.push_back(vPkg[i]);
+	}
+
+	m_Template.m_nSize += nSize;
+
+	if (!m_Template.m_pWorst || (m_Template.m_pWorst->m_Profit < x.m_Profit))
+		m_Template.m_pWorst = &x;
+
+	return PackageStatus::Added;
+}
+
+void NodeProcessor::TxPool::RebuildTemplate()
+{
+	ResetTemplate();
+
+	for (ProfitSet::iterator it = m_setProfit.begin(); m_setProfit.end() != it; )
+	{
+		Element& x = (it++)->get_ParentObj();
+
+		if (x.m_Profit.m_nSize > m_Template.m_nSizeMax)
+		{
+			LOG_INFO() << "Tx is very big. It's deleted.";
+			Delete(x);
+			continue;
+		}
+
+		AddToTemplate(x);
+	}
+
+	m_Template.m_bValid = true;
+}
+
+const std::vector<NodeProcessor::TxPool::Element*>& NodeProcessor::TxPool::UpdateTemplate(size_t nSizeMax)
+{
+	if (!m_Template.m_bValid || (m_Template.m_nSizeMax != nSizeMax))
+	{
+		m_Template.m_nSizeMax = nSizeMax;
+		RebuildTemplate();
+	}
+
+	return m_Template.m_vElements;
+}
+
+void NodeProcessor::DeleteSpentTxs(TxPool& txp)
+{
+	std::vector<TxPool::Element*> vSpent;
+
+	do
+	{
+		vSpent.clear();
+
+		for (TxPool::TxSet::iterator it = txp.m_setTxs.begin(); txp.m_setTxs.end() != it; it++)
+		{
+			TxPool::Element& x = it->get_ParentObj();
+
+			for (uint32_t i = 0; i < x.m_nInputs; i++)
+			{
+				const ECC::Point& pt = x.m_vPoints[i];
+				if ((txp.m_mapOutputs.end() == txp.m_mapOutputs.find(pt)) && !IsUtxo(pt))
+				{
+					vSpent.push_back(&x);
+					break;
+				}
+			}
+		}
+
+		// their children (if any) are caught on the next pass
+		for (size_t i = 0; i < vSpent.size(); i++)
+			txp.Delete(*vSpent[i]);
+
+	} while (!vSpent.empty());
+}
+
+bool NodeProcessor::IsUtxo(const ECC::Point& pt)
+{
+	struct Traveler :public UtxoTree::ITraveler {
+		virtual bool OnLeaf(const RadixTree::Leaf& x) override {
+			return false; // stop iteration
+		}
+	} t;
+
+	UtxoTree::Key kMin, kMax;
+	UtxoTree::Key::Data d;
+	d.m_Commitment = pt;
+	d.m_Maturity = 0;
+	kMin = d;
+	d.m_Maturity = MaxHeight;
+	kMax = d;
+
+	UtxoTree::Cursor cu;
+	t.m_pCu = &cu;
+	t.m_pBound[0] = kMin.m_pArr;
+	t.m_pBound[1] = kMax.m_pArr;
+
+	return !m_Utxos.Traverse(t);
 }
 
 bool NodeProcessor::TxPool::Element::Profit::operator < (const Profit& t) const
@@ -1125,13 +1739,23 @@ Difficulty NodeProcessor::get_NextDifficulty()
 		return m_Cursor.m_Full.m_PoW.m_Difficulty; // no change
 
 	// review the difficulty
-	uint64_t rowid = FindActiveAtStrict(m_Cursor.m_Full.m_Height - Rules::get().DifficultyReviewCycle);
+	Height hAnchor = m_Cursor.m_Full.m_Height - Rules::get().DifficultyReviewCycle;
+	Timestamp tsAnchor;
+
+	if (m_CursorWindow.m_Review.m_Height == hAnchor)
+		tsAnchor = m_CursorWindow.m_Review.m_TimeStamp;
+	else
+	{
+		// the cursor jumped recently
+		uint64_t rowid = FindActiveAtStrict(hAnchor);
 
-	Block::SystemState::Full s2;
-	m_DB.get_State(rowid, s2);
+		Block::SystemState::Full s2;
+		m_DB.get_State(rowid, s2);
+		tsAnchor = s2.m_TimeStamp;
+	}
 
 	Difficulty ret = m_Cursor.m_Full.m_PoW.m_Difficulty;
-	Rules::get().AdjustDifficulty(ret, s2.m_TimeStamp, m_Cursor.m_Full.m_TimeStamp);
+	Rules::get().AdjustDifficulty(ret, tsAnchor, m_Cursor.m_Full.m_TimeStamp);
 	return ret;
 }
 
@@ -1140,24 +1764,152 @@ Timestamp NodeProcessor::get_MovingMedian()
 	if (!m_Cursor.m_Sid.m_Row)
 		return 0;
 
-	std::vector<Timestamp> vTs;
+	assert(m_CursorWindow.m_Top == m_Cursor.m_ID);
+	return *m_CursorWindow.m_Hi.begin();
+}
+
+void NodeProcessor::CursorWindow::Reset()
+{
+	m_vStates.clear();
+	m_Lo.clear();
+	m_Hi.clear();
+	m_bComplete = false;
+	ZeroObject(m_Top);
+	ZeroObject(m_Review);
+}
+
+void NodeProcessor::CursorWindow::Insert(Timestamp ts)
+{
+	// m_Hi is never smaller than m_Lo, hence it's empty only if both are
+	if (m_Hi.empty() || (ts >= *m_Hi.begin()))
+		m_Hi.insert(ts);
+	else
+		m_Lo.insert(ts);
+
+	Balance();
+}
+
+void NodeProcessor::CursorWindow::Erase(Timestamp ts)
+{
+	if (!m_Lo.empty() && (ts <= *m_Lo.rbegin()))
+		m_Lo.erase(m_Lo.find(ts));
+	else
+		m_Hi.erase(m_Hi.find(ts));
+
+	Balance();
+}
+
+void NodeProcessor::CursorWindow::Balance()
+{
+	// the median is the element at n/2 in the sorted order, i.e. m_Lo must contain exactly n/2 elements
+	size_t n = (m_Lo.size() + m_Hi.size()) >> 1;
+
+	while (m_Lo.size() > n)
+	{
+		auto it = --m_Lo.end();
+		m_Hi.insert(*it);
+		m_Lo.erase(it);
+	}
+
+	while (m_Lo.size() < n)
+	{
+		auto it = m_Hi.begin();
+		m_Lo.insert(*it);
+		m_Hi.erase(it);
+	}
+}
+
+void NodeProcessor::UpdateCursorWindow()
+{
+	CursorWindow& w = m_CursorWindow;
+
+	if (!m_Cursor.m_Sid.m_Row)
+	{
+		w.Reset();
+		return;
+	}
+
+	if (w.m_Top == m_Cursor.m_ID)
+		return; // unchanged
+
+	const size_t nWindow = Rules::get().WindowForMedian;
+
+	if (!w.m_vStates.empty())
+	{
+		if ((w.m_Top.m_Height + 1 == m_Cursor.m_ID.m_Height) && (w.m_Top.m_Hash == m_Cursor.m_Full.m_Prev))
+		{
+			// one up
+			if (!((w.m_Top.m_Height - Rules::HeightGenesis) % Rules::get().DifficultyReviewCycle))
+			{
+				w.m_Review.m_Height = w.m_Top.m_Height;
+				w.m_Review.m_TimeStamp = w.m_vStates.back().m_TimeStamp;
+			}
+
+			w.m_vStates.emplace_back();
+			w.m_vStates.back().m_Row = m_Cursor.m_Sid.m_Row;
+			w.m_vStates.back().m_TimeStamp = m_Cursor.m_Full.m_TimeStamp;
+
+			w.Insert(m_Cursor.m_Full.m_TimeStamp);
+
+			if (w.m_vStates.size() > nWindow)
+				w.Erase(w.m_vStates[w.m_vStates.size() - nWindow - 1].m_TimeStamp);
+
+			if (w.m_vStates.size() > nWindow * 2)
+			{
+				w.m_vStates.pop_front();
+				w.m_bComplete = false;
+			}
+
+			w.m_Top = m_Cursor.m_ID;
+			return;
+		}
+
+		if ((w.m_Top.m_Height == m_Cursor.m_ID.m_Height + 1) &&
+			(w.m_vStates.size() > 1) &&
+			(w.m_vStates[w.m_vStates.size() - 2].m_Row == m_Cursor.m_Sid.m_Row) &&
+			(w.m_bComplete || (w.m_vStates.size() > nWindow)))
+		{
+			// one down
+			w.Erase(w.m_vStates.back().m_TimeStamp);
+			w.m_vStates.pop_back();
+
+			if (w.m_vStates.size() >= nWindow)
+				w.Insert(w.m_vStates[w.m_vStates.size() - nWindow].m_TimeStamp);
+
+			if (w.m_Review.m_Height >= m_Cursor.m_ID.m_Height)
+				w.m_Review.m_Height = 0;
+
+			w.m_Top = m_Cursor.m_ID;
+			return;
+		}
+	}
+
+	// reload
+	w.Reset();
 
 	for (uint64_t row = m_Cursor.m_Sid.m_Row; ; )
 	{
 		Block::SystemState::Full s;
 		m_DB.get_State(row, s);
-		vTs.push_back(s.m_TimeStamp);
 
-		if (vTs.size() >= Rules::get().WindowForMedian)
+		w.m_vStates.emplace_front();
+		w.m_vStates.front().m_Row = row;
+		w.m_vStates.front().m_TimeStamp = s.m_TimeStamp;
+
+		if (w.m_vStates.size() >= nWindow * 2)
 			break;
 
 		if (!m_DB.get_Prev(row))
+		{
+			w.m_bComplete = true;
 			break;
+		}
 	}
 
-	std::sort(vTs.begin(), vTs.end()); // there's a better algorithm to find a median (or whatever order), however our array isn't too big, so it's ok.
+	for (size_t i = w.m_vStates.size() - std::min(w.m_vStates.size(), nWindow); i < w.m_vStates.size(); i++)
+		w.Insert(w.m_vStates[i].m_TimeStamp);
 
-	return vTs[vTs.size() >> 1];
+	w.m_Top = m_Cursor.m_ID;
 }
 
 void NodeProcessor::DeriveKeys(const ECC::Kdf& kdf, Height h, Amount fees, ECC::Scalar::Native& kCoinbase, ECC::Scalar::Native& kFee, ECC::Scalar::Native& kKernel, ECC::Scalar::Native& kOffset)
@@ -1194,22 +1946,15 @@ bool NodeProcessor::GenerateNewBlock(TxPool& txp, Block::SystemState::Full& s, B
 
 	ECC::Scalar::Native offset = res.m_Offset;
 
-	for (TxPool::ProfitSet::iterator it = txp.m_setProfit.begin(); txp.m_setProfit.end() != it; )
-	{
-		TxPool::Element& x = (it++)->get_ParentObj();
-
-		if (x.m_Profit.m_nSize > nSizeThreshold)
-		{
-			LOG_INFO() << "Tx is very big. It's deleted.";
-			txp.Delete(x);
-			continue;
-		}
+	const std::vector<TxPool::Element*>& vTemplate = txp.UpdateTemplate(nSizeThreshold);
+	std::vector<TxPool::Element*> vFailed;
 
-		if (nBlockSize + x.m_Profit.m_nSize > nSizeThreshold)
-			continue;
-			//break;
+	for (size_t i = 0; i < vTemplate.size(); i++)
+	{
+		TxPool::Element& x = *vTemplate[i];
 
-		Transaction& tx = *x.m_pValue;
+		Transaction tx;
+		x.get_Value(tx);
 
 		if (HandleValidatedTx(tx.get_Reader(), h, true, rbData))
 		{
@@ -1221,9 +1966,12 @@ bool NodeProcessor::GenerateNewBlock(TxPool& txp, Block::SystemState::Full& s, B
 			++nAmount;
 		}
 		else
-			txp.Delete(x); // isn't available in this context
+			vFailed.push_back(&x); // isn't available in this context
 	}
 
+	for (size_t i = 0; i < vFailed.size(); i++)
+		txp.Delete(*vFailed[i]); // invalidates the template
+
 	LOG_INFO() << "GenerateNewBlock: size of block = " << nBlockSize << "; amount of tx = " << nAmount;
 
 	ECC::Scalar::Native kCoinbase, kFee, kKernel;
@@ -1332,14 +2080,29 @@ bool NodeProcessor::GenerateNewBlock(TxPool& txp, Block::SystemState::Full& s, B
 
 		bool bRes = GenerateNewBlock(txp, s, res, fees, h, rbData);
 
+		// Txs may spend outputs of their parents in the same block. Such pairs must be cut-through, since the block is interpreted
+		// all inputs first. Match them by the actually consumed UTXO maturity, to distinguish from older UTXOs with the same commitment.
+		rbData.m_Inputs = 0;
+		for (size_t i = 0; i < res.m_vInputs.size(); i++)
+			res.m_vInputs[i]->m_Maturity = rbData.NextInput(false).m_Maturity;
+
 		rbData.m_Inputs = 0;
 		verify(HandleValidatedTx(res.get_Reader(), h, false, rbData)); // undo changes
 
 		if (!bRes)
 			return false;
 
+		for (size_t i = 0; i < res.m_vOutputs.size(); i++)
+			res.m_vOutputs[i]->m_Maturity = res.m_vOutputs[i]->get_MinMaturity(h);
+
 		res.Sort(); // can sort only after the changes are undone.
 		res.DeleteIntermediateOutputs();
+
+		// explicit maturities are only for macroblocks. Resetting them keeps the order.
+		for (size_t i = 0; i < res.m_vInputs.size(); i++)
+			res.m_vInputs[i]->m_Maturity = 0;
+		for (size_t i = 0; i < res.m_vOutputs.size(); i++)
+			res.m_vOutputs[i]->m_Maturity = 0;
 	}
 
 	Serializer ser;
@@ -1356,11 +2119,28 @@ bool NodeProcessor::VerifyBlock(const Block::BodyBase& block, TxBase::IReader&&
 	return block.IsValid(hr, m_Cursor.m_SubsidyOpen, std::move(r));
 }
 
+bool NodeProcessor::VerifyBlocks(const VerifyItem* pItems, size_t nCount)
+{
+	for (size_t i = 0; i < nCount; i++)
+	{
+		const VerifyItem& vi = pItems[i];
+		if (!vi.m_pBlock->IsValid(vi.m_Height, vi.m_SubsidyOpen, std::move(*vi.m_pR)))
+			return false;
+	}
+
+	return true;
+}
+
 void NodeProcessor::ExtractBlockWithExtra(Block::Body& block, const NodeDB::StateID& sid)
+{
+	ExtractBlockWithExtra(m_DB, block, sid);
+}
+
+void NodeProcessor::ExtractBlockWithExtra(NodeDB& db, Block::Body& block, const NodeDB::StateID& sid)
 {
 	ByteBuffer bb;
 	RollbackData rbData;
-	m_DB.GetStateBlock(sid.m_Row, bb, rbData.m_Buf);
+	db.GetStateBlock(sid.m_Row, bb, rbData.m_Buf);
 
 	Deserializer der;
 	der.reset(bb.empty() ? NULL : &bb.at(0), bb.size());
@@ -1393,10 +2173,15 @@ void NodeProcessor::SquashOnce(std::vector<Block::Body>& v)
 }
 
 void NodeProcessor::ExportMacroBlock(Block::BodyBase::IMacroWriter& w, const HeightRange& hr)
+{
+	ExportMacroBlock(m_DB, w, hr);
+}
+
+void NodeProcessor::ExportMacroBlock(NodeDB& db, Block::BodyBase::IMacroWriter& w, const HeightRange& hr)
 {
 	assert(hr.m_Min <= hr.m_Max);
 	NodeDB::StateID sid;
-	sid.m_Row = FindActiveAtStrict(hr.m_Max);
+	sid.m_Row = FindActiveAtStrict(db, hr.m_Max);
 	sid.m_Height = hr.m_Max;
 
 	std::vector<Block::Body> vBlocks;
@@ -1404,12 +2189,12 @@ void NodeProcessor::ExportMacroBlock(Block::BodyBase::IMacroWriter& w, const Hei
 	for (uint32_t i = 0; ; i++)
 	{
 		vBlocks.resize(vBlocks.size() + 1);
-		ExtractBlockWithExtra(vBlocks.back(), sid);
+		ExtractBlockWithExtra(db, vBlocks.back(), sid);
 
 		if (hr.m_Min == sid.m_Height)
 			break;
 
-		if (!m_DB.get_Prev(sid))
+		if (!db.get_Prev(sid))
 			OnCorrupted();
 
 		for (uint32_t j = i; 1 & j; j >>= 1)
@@ -1421,7 +2206,7 @@ void NodeProcessor::ExportMacroBlock(Block::BodyBase::IMacroWriter& w, const Hei
 
 	std::vector<Block::SystemState::Sequence::Element> vElem;
 	Block::SystemState::Sequence::Prefix prefix;
-	ExportHdrRange(hr, prefix, vElem);
+	ExportHdrRange(db, hr, prefix, vElem);
 
 	w.put_Start(vBlocks[0], prefix);
 
@@ -1432,6 +2217,11 @@ void NodeProcessor::ExportMacroBlock(Block::BodyBase::IMacroWriter& w, const Hei
 }
 
 void NodeProcessor::ExportHdrRange(const HeightRange& hr, Block::SystemState::Sequence::Prefix& prefix, std::vector<Block::SystemState::Sequence::Element>& v)
+{
+	ExportHdrRange(m_DB, hr, prefix, v);
+}
+
+void NodeProcessor::ExportHdrRange(NodeDB& db, const HeightRange& hr, Block::SystemState::Sequence::Prefix& prefix, std::vector<Block::SystemState::Sequence::Element>& v)
 {
 	if (hr.m_Min > hr.m_Max) // can happen for empty range
 		ZeroObject(prefix);
@@ -1440,13 +2230,13 @@ void NodeProcessor::ExportHdrRange(const HeightRange& hr, Block::SystemState::Se
 		v.resize(hr.m_Max - hr.m_Min + 1);
 
 		NodeDB::StateID sid;
-		sid.m_Row = FindActiveAtStrict(hr.m_Max);
+		sid.m_Row = FindActiveAtStrict(db, hr.m_Max);
 		sid.m_Height = hr.m_Max;
 
 		while (true)
 		{
 			Block::SystemState::Full s;
-			m_DB.get_State(sid.m_Row, s);
+			db.get_State(sid.m_Row, s);
 
 			v[sid.m_Height - hr.m_Min] = s;
 
@@ -1456,13 +2246,81 @@ void NodeProcessor::ExportHdrRange(const HeightRange& hr, Block::SystemState::Se
 				break;
 			}
 
-			if (!m_DB.get_Prev(sid))
+			if (!db.get_Prev(sid))
 				OnCorrupted();
 		}
 	}
 }
 
+bool NodeProcessor::ExportHdrPack(const Block::SystemState::ID& idTop, uint32_t nCount, Block::SystemState::Sequence::Prefix& prefix, std::vector<Block::SystemState::Sequence::Element>& v)
+{
+	NodeDB::StateID sid;
+	sid.m_Row = m_DB.StateFindSafe(idTop);
+	if (!sid.m_Row || !nCount)
+		return false;
+	sid.m_Height = idTop.m_Height;
+
+	Height dh = sid.m_Height - Rules::HeightGenesis + 1;
+	if (nCount > dh)
+		nCount = static_cast<uint32_t>(dh);
+
+	v.resize(nCount);
+
+	Block::SystemState::Full s;
+	for (uint32_t i = nCount; ; )
+	{
+		m_DB.get_State(sid.m_Row, s);
+		v[--i] = s;
+
+		if (!i)
+			break;
+
+		if (!m_DB.get_Prev(sid))
+		{
+			v.erase(v.begin(), v.begin() + i); // gap
+			break;
+		}
+	}
+
+	prefix = s;
+	return true;
+}
+
 bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
+{
+	return ImportMacroBlockInternal(r, NULL);
+}
+
+bool NodeProcessor::ImportSnapshot(Block::BodyBase::IMacroReader& r, const Block::SystemState::ID& idTop)
+{
+	if (m_Cursor.m_Sid.m_Row)
+	{
+		LOG_WARNING() << "Snapshot import requires an empty node. My Tip: " << m_Cursor.m_ID;
+		return false;
+	}
+
+	return ImportMacroBlockInternal(r, &idTop);
+}
+
+bool NodeProcessor::LoadSnapshotElements(TxBase::IReader&& r, Height hMax)
+{
+	// The snapshot is cut-through since genesis, hence no inputs. The trees are empty, so no rollback data is needed.
+	r.Reset();
+	if (r.m_pUtxoIn || r.m_pKernelIn)
+		return false;
+
+	for (; r.m_pUtxoOut; r.NextUtxoOut())
+		if (!HandleBlockElement(*r.m_pUtxoOut, Rules::HeightGenesis, &hMax, true))
+			return false;
+
+	for (; r.m_pKernelOut; r.NextKernelOut())
+		if (!HandleBlockElement(*r.m_pKernelOut, true, false))
+			return false;
+
+	return true;
+}
+
+bool NodeProcessor::ImportMacroBlockInternal(Block::BodyBase::IMacroReader& r, const Block::SystemState::ID* pSnapshotTop)
 {
 	Block::BodyBase body;
 	Block::SystemState::Full s;
@@ -1486,6 +2344,7 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 		return false;
 	}
 
+	NodeDB::PhaseBulk phase(m_DB); // must outlive the transaction
 	NodeDB::Transaction t(m_DB);
 
 	LOG_INFO() << "Verifying headers...";
@@ -1529,20 +2388,60 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 		OnCorrupted();
 	m_DB.get_State(rowid, s);
 
-	LOG_INFO() << "Context-free validation...";
-
-	if (!VerifyBlock(body, std::move(r), HeightRange(cu.m_ID.m_Height + 1, id.m_Height)))
+	if (pSnapshotTop)
 	{
-		LOG_WARNING() << "Context-free verification failed";
-		return false;
+		if (!(id == *pSnapshotTop))
+		{
+			LOG_WARNING() << "Snapshot ends at " << id << ", expected " << *pSnapshotTop;
+			return false;
+		}
+	}
+	else
+	{
+		LOG_INFO() << "Context-free validation...";
+
+		if (!VerifyBlock(body, std::move(r), HeightRange(cu.m_ID.m_Height + 1, id.m_Height)))
+		{
+			LOG_WARNING() << "Context-free verification failed";
+			return false;
+		}
 	}
 
 	LOG_INFO() << "Applying macroblock...";
 
+	// Millions of elements. Write the new ones in the key order, rather than in the (random) commitment/hash order.
+	// The inputs are handled before the outputs, hence they never refer to the pending elements
+	NodeDB::SpendableBulk bulk(m_DB);
+
+	struct Scope
+	{
+		NodeDB::SpendableBulk*& m_p;
+		Scope(NodeDB::SpendableBulk*& p, NodeDB::SpendableBulk& x) :m_p(p) { m_p = &x; }
+		~Scope() { m_p = NULL; }
+	};
+
 	RollbackData rbData;
-	if (!HandleValidatedTx(std::move(r), cu.m_ID.m_Height + 1, true, rbData, &id.m_Height))
+	bool bOk;
+	{
+		Scope scope(m_pSpendableBulk, bulk);
+
+		bOk = pSnapshotTop ?
+			LoadSnapshotElements(std::move(r), id.m_Height) :
+			HandleValidatedTx(std::move(r), cu.m_ID.m_Height + 1, true, rbData, &id.m_Height);
+
+		if (bOk)
+			bulk.Flush();
+	}
+
+	if (!bOk)
 	{
 		LOG_WARNING() << "Invalid in its context";
+
+		if (pSnapshotTop)
+		{
+			m_Utxos.Clear();
+			m_Kernels.Clear();
+		}
 		return false;
 	}
 
@@ -1568,6 +2467,7 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 		m_DB.SetStateFunctional(sid.m_Row);
 
 		m_DB.DelStateBlock(sid.m_Row); // if somehow it was downloaded
+		OnBodyDeleted(id);
 		m_DB.set_Peer(sid.m_Row, NULL);
 
 		sid.m_Height = id.m_Height;
@@ -1589,15 +2489,25 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 	{
 		LOG_WARNING() << "Definition mismatch";
 
-		if (m_Cursor.m_SubsidyOpen != cu.m_SubsidyOpen)
-			OnSubsidyOptionChanged(cu.m_SubsidyOpen);
+		if (pSnapshotTop)
+		{
+			// the trees were empty
+			m_Utxos.Clear();
+			m_Kernels.Clear();
+		}
+		else
+		{
+			if (m_Cursor.m_SubsidyOpen != cu.m_SubsidyOpen)
+				OnSubsidyOptionChanged(cu.m_SubsidyOpen);
 
-		rbData.m_Inputs = 0;
-		verify(HandleValidatedTx(std::move(r), cu.m_ID.m_Height + 1, false, rbData, &id.m_Height));
+			rbData.m_Inputs = 0;
+			verify(HandleValidatedTx(std::move(r), cu.m_ID.m_Height + 1, false, rbData, &id.m_Height));
+		}
 
 		// DB changes are not reverted explicitly, but they will be reverted by DB transaction rollback.
 
 		m_Cursor = cu;
+		UpdateCursorWindow();
 
 		return false;
 	}
@@ -1607,6 +2517,7 @@ bool NodeProcessor::ImportMacroBlock(Block::BodyBase::IMacroReader& r)
 	// everything's fine
 	m_DB.ParamSet(NodeDB::ParamID::FossilHeight, &id.m_Height, NULL);
 	t.Commit();
+	phase.Leave();
 
 	LOG_INFO() << "Macroblock import succeeded";
 
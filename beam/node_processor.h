@@ -15,6 +15,9 @@
 #pragma once
 
 #include <boost/intrusive/set.hpp>
+#include <deque>
+#include <map>
+#include <set>
 #include "../core/radixtree.h"
 #include "node_db.h"
 
@@ -25,6 +28,7 @@ class NodeProcessor
 	NodeDB m_DB;
 	UtxoTree m_Utxos;
 	RadixHashOnlyTree m_Kernels;
+	NodeDB::SpendableBulk* m_pSpendableBulk; // if set - new spendables are accumulated there
 
 	struct DbType {
 		static const uint8_t Utxo	= 0;
@@ -33,20 +37,26 @@ class NodeProcessor
 
 	void TryGoUp();
 
-	bool GoForward(uint64_t);
+	bool GoForward(uint64_t, bool bPreverified);
 	void Rollback();
 	void PruneOld();
 	void DereferenceFossilBlock(uint64_t);
+	void DeleteBody(uint64_t); // with the notification
+	void get_StateID(uint64_t, Block::SystemState::ID&);
 
 	struct RollbackData;
 
-	bool HandleBlock(const NodeDB::StateID&, bool bFwd);
+	bool HandleBlock(const NodeDB::StateID&, bool bFwd, bool bPreverified);
+	static bool DecodeBlock(const ByteBuffer&, Block::Body&);
+	bool PreverifyBlocks(const std::vector<uint64_t>& vPath, size_t iPos, size_t nCount);
 	bool HandleValidatedTx(TxBase::IReader&&, Height, bool bFwd, RollbackData&, const Height* = NULL);
 	void AdjustCumulativeParams(const Block::BodyBase&, bool bFwd);
 	bool HandleBlockElement(const Input&, Height, const Height*, bool bFwd, RollbackData&);
 	bool HandleBlockElement(const Output&, Height, const Height*, bool bFwd);
 	bool HandleBlockElement(const TxKernel&, bool bFwd, bool bIsInput);
+	bool LoadSnapshotElements(TxBase::IReader&&, Height hMax);
 	void OnSubsidyOptionChanged(bool);
+	bool ImportMacroBlockInternal(Block::BodyBase::IMacroReader&, const Block::SystemState::ID* pSnapshotTop);
 
 	static void SquashOnce(std::vector<Block::Body>&);
 
@@ -55,13 +65,48 @@ class NodeProcessor
 	void get_Definition(Merkle::Hash&, bool bForNextState);
 	bool IsRelevantHeight(Height);
 	Difficulty get_NextDifficulty();
-	Timestamp get_MovingMedian();
+
+	// Recent timestamps of the active branch and the difficulty review anchor. Follows the cursor incrementally,
+	// reloaded from the DB only after jumps (or deep rollbacks).
+	struct CursorWindow
+	{
+		struct Entry {
+			uint64_t m_Row;
+			Timestamp m_TimeStamp;
+		};
+
+		std::deque<Entry> m_vStates; // ends at m_Top. Up to twice the median window, the excess is for rollbacks
+		Block::SystemState::ID m_Top;
+		bool m_bComplete; // starts at genesis
+
+		// the median window, split into halves: m_Lo holds the lower half, the median is the lowest in m_Hi
+		std::multiset<Timestamp> m_Lo;
+		std::multiset<Timestamp> m_Hi;
+
+		struct Anchor {
+			Height m_Height; // the most recent review height below the cursor, 0 if unknown
+			Timestamp m_TimeStamp;
+		} m_Review;
+
+		void Reset();
+		void Insert(Timestamp);
+		void Erase(Timestamp);
+		void Balance();
+	} m_CursorWindow;
+
+	void UpdateCursorWindow();
 
 	struct UtxoSig;
 	struct UnspentWalker;
 
+	struct TreesImage;
+	bool LoadTrees();
+	void SaveTrees();
+
 public:
 
+	NodeProcessor();
+	~NodeProcessor();
 	void Initialize(const char* szPath);
 
 	struct Horizon {
@@ -73,6 +118,14 @@ public:
 
 	} m_Horizon;
 
+	uint32_t m_VerifyBatchBlocks; // max num of consecutive new blocks verified in a single batch. 0 or 1: disabled
+	uint32_t m_RequestBlocksMax; // max num of consecutive missing blocks requested at once per branch. 0 or 1: only the first one
+
+	// Optional. If specified - the live trees (UTXOs and kernels) are saved there on exit, and loaded on the next start,
+	// instead of being rebuilt from the DB. The image is used only if it corresponds to the current cursor.
+	std::string m_sPathTrees;
+	bool m_bTreesLoaded; // diagnostic, set by Initialize if the trees were loaded from the image
+
 	struct Cursor
 	{
 		// frequently used data
@@ -92,7 +145,18 @@ public:
 	void ExtractBlockWithExtra(Block::Body&, const NodeDB::StateID&);
 	void ExportMacroBlock(Block::BodyBase::IMacroWriter&, const HeightRange&);
 	void ExportHdrRange(const HeightRange&, Block::SystemState::Sequence::Prefix&, std::vector<Block::SystemState::Sequence::Element>&);
+
+	// The same, but can be used with another (read-only) connection to the DB, i.e. from another thread.
+	static void ExtractBlockWithExtra(NodeDB&, Block::Body&, const NodeDB::StateID&);
+	static void ExportMacroBlock(NodeDB&, Block::BodyBase::IMacroWriter&, const HeightRange&);
+	static void ExportHdrRange(NodeDB&, const HeightRange&, Block::SystemState::Sequence::Prefix&, std::vector<Block::SystemState::Sequence::Element>&);
+	// Headers ending at the specified state (not necessarily active). Stops earlier if a predecessor is missing.
+	bool ExportHdrPack(const Block::SystemState::ID& idTop, uint32_t nCount, Block::SystemState::Sequence::Prefix&, std::vector<Block::SystemState::Sequence::Element>&);
 	bool ImportMacroBlock(Block::BodyBase::IMacroReader&);
+	// Bootstrap of an empty node. The macroblock must start at genesis and end at the specified state, which the caller has proven
+	// to belong to the best chain. The elements are loaded into the live trees without cryptographic verification, the result is
+	// checked against the Definition of the top header instead.
+	bool ImportSnapshot(Block::BodyBase::IMacroReader&, const Block::SystemState::ID& idTop);
 
 	struct DataStatus {
 		enum Enum {
@@ -103,6 +167,7 @@ public:
 	};
 
 	DataStatus::Enum OnState(const Block::SystemState::Full&, const PeerID&);
+	DataStatus::Enum OnStatePack(const Block::SystemState::Sequence::Prefix&, const std::vector<Block::SystemState::Sequence::Element>&, const Block::SystemState::ID& idTop, const PeerID&); // all-or-nothing, single DB transaction
 	DataStatus::Enum OnBlock(const Block::SystemState::ID&, const NodeDB::Blob& block, const PeerID&);
 
 	// use only for data retrieval for peers
@@ -118,11 +183,28 @@ public:
 	virtual void OnPeerInsane(const PeerID&) {}
 	virtual void OnNewState() {}
 	virtual void OnRolledBack() {}
+	virtual void OnBodyDeleted(const Block::SystemState::ID&) {} // the block body is no longer in the DB (invalid, pruned or fossil)
 	virtual bool VerifyBlock(const Block::BodyBase&, TxBase::IReader&&, const HeightRange&);
+
+	struct VerifyItem
+	{
+		const Block::BodyBase* m_pBlock;
+		TxBase::IReader* m_pR;
+		HeightRange m_Height;
+		bool m_SubsidyOpen;
+	};
+
+	// context-free verification of several blocks at once. Fails if any of them is invalid
+	virtual bool VerifyBlocks(const VerifyItem*, size_t nCount);
 	virtual bool ApproveState(const Block::SystemState::ID&) { return true; }
 
+	// run the hasher of the live trees on several threads. If not overridden - the trees are hashed on the current thread
+	virtual void HashLiveParallel(RadixHashTree::ParallelHasher&) {}
+
 	bool IsStateNeeded(const Block::SystemState::ID&);
+	Timestamp get_MovingMedian(); // of the recent active states. The next block's timestamp must be higher
 	uint64_t FindActiveAtStrict(Height);
+	static uint64_t FindActiveAtStrict(NodeDB&, Height);
 
 	ECC::Kdf m_Kdf;
 
@@ -132,7 +214,16 @@ public:
 	{
 		struct Element
 		{
-			Transaction::Ptr m_pValue;
+			// Stored serialized, decoded on demand. Much more compact than the Transaction object with its per-element allocations.
+			ByteBuffer m_Blob;
+			std::vector<ECC::Point> m_vPoints; // commitments of the inputs, then the outputs. Enough to track the dependencies
+			uint32_t m_nInputs;
+			uint32_t m_nBytes; // accounted memory, including the indexes
+
+			bool m_bTemplate; // included in the block template
+			bool m_bPackage; // temporary mark, while collecting a package
+
+			void get_Value(Transaction&) const;
 
 			struct Tx
 				:public boost::intrusive::set_base_hook<>
@@ -173,19 +264,71 @@ public:
 		ProfitSet m_setProfit;
 		ThresholdSet m_setThreshold;
 
+		uint64_t m_nBytes; // total accounted memory
+
+		struct Stats
+		{
+			uint64_t m_Evicted; // txs dropped due to the pool limits
+			uint64_t m_EvictedBytes;
+		} m_Stats;
+
+		// Dependencies between the pooled txs: the same input spent by several txs (conflicts), and txs spending the outputs of others (chains)
+		typedef std::multimap<ECC::Point, Element*> PointMap;
+		PointMap m_mapInputs; // commitment -> spenders
+		PointMap m_mapOutputs; // commitment -> creators
+
+		// The txs for the next block, without conflicts, parents before children. A child with a better fee pulls its pooled ancestors
+		// (child-pays-for-parent). Extended as txs arrive, rebuilt (without touching the live trees) only if a member is deleted, or a better tx doesn't fit.
+		// On the new tip the txs with spent inputs are deleted (see DeleteSpentTxs), the rest are verified once the block is generated.
+		struct Template
+		{
+			std::vector<Element*> m_vElements;
+			const Element* m_pWorst; // among those added by their own profit
+			size_t m_nSize;
+			size_t m_nSizeMax;
+			bool m_bValid;
+
+			Template();
+		} m_Template;
+
+		const std::vector<Element*>& UpdateTemplate(size_t nSizeMax);
+
 		void AddValidTx(Transaction::Ptr&&, const Transaction::Context&, const Transaction::KeyType&);
 		void Delete(Element&);
 		void Clear();
 
+		struct PackageStatus {
+			enum Enum {
+				Added,
+				NoRoom,
+				Conflict
+			};
+		};
+
+		PackageStatus::Enum AddToTemplate(Element&);
+		bool CollectPackage(Element&, std::vector<Element*>& vPkg, size_t& nSize, uint32_t nDepth);
+		void ResetTemplate();
+		void RebuildTemplate();
+
+		bool HasTemplateSpenders(const Element&) const;
+		static void DeleteFromMap(PointMap&, const ECC::Point&, const Element&);
+
 		void DeleteOutOfBound(Height);
-		void ShrinkUpTo(uint32_t nCount);
+		void ShrinkUpTo(uint32_t nCount, uint64_t nBytes); // evicts the txs with the lowest fee rate
 
+		TxPool();
 		~TxPool() { Clear(); }
 
 	};
 
 	bool ValidateTx(const Transaction&, Transaction::Context&); // wrt height of the next block
 
+	// Deletes the pooled txs whose inputs are neither in the UTXO set nor created by other pooled txs (mined, or double-spent).
+	// Should be called on the new tip, so that the template doesn't keep them
+	void DeleteSpentTxs(TxPool&);
+	bool IsUtxo(const ECC::Point&); // with any maturity
+	bool ValidateTxWrtHeight(const Transaction::Context&); // context-free validation must have already been done
+
 	bool GenerateNewBlock(TxPool&, Block::SystemState::Full&, ByteBuffer&, Amount& fees, Block::Body& blockInOut);
 	bool GenerateNewBlock(TxPool&, Block::SystemState::Full&, ByteBuffer&, Amount& fees);
 
@@ -20,8 +20,13 @@
 #include "../../core/block_crypt.h"
 #include "../../utility/serialize.h"
 #include "../../utility/test_helpers.h"
+#include "../../utility/helpers.h"
 #include "../../core/serialization_adapters.h"
 
+#ifndef WIN32
+#	include <signal.h>
+#endif // WIN32
+
 #define LOG_VERBOSE_ENABLED 0
 #include "utility/logger.h"
 
@@ -283,6 +288,56 @@ namespace beam
 			;
 		verify_test(sid.m_Height == Rules::HeightGenesis);
 
+		// the proofs are built mostly from the cached rows
+		const NodeDB::CacheStats& cs = db.get_CacheStats();
+		verify_test(cs.m_pHits[NodeDB::CacheStats::Type::Mmr] > cs.m_pMisses[NodeDB::CacheStats::Type::Mmr]);
+		verify_test(cs.m_pHits[NodeDB::CacheStats::Type::Prev] > cs.m_pMisses[NodeDB::CacheStats::Type::Prev]);
+
+		{
+			// the same results with constant evictions
+			db.SetCacheSize(2);
+
+			NodeDB::StateID sid3;
+			sid3.m_Row = pRows[hMax - 1];
+			sid3.m_Height = hMax - 1 + Rules::HeightGenesis;
+
+			Merkle::ProofBuilderStd bld;
+			db.get_Proof(bld, sid3, Rules::HeightGenesis + 7);
+
+			Merkle::Hash hv;
+			vStates[7].get_Hash(hv);
+			Merkle::Interpret(hv, bld.m_Proof);
+			Merkle::Interpret(hv, hvZero, true);
+			verify_test(hv == vStates[hMax - 1].m_Definition);
+
+			Block::SystemState::Full s2;
+			db.get_State(pRows[7], s2);
+			db.get_State(pRows[7], s2); // from the cache
+
+			Merkle::Hash hv2;
+			s2.get_Hash(hv2);
+			vStates[7].get_Hash(hv);
+			verify_test(hv == hv2);
+
+			db.SetCacheSize(4096);
+		}
+
+		tr.Commit();
+
+		{
+			// rolled-back changes must not survive in the cache
+			uint32_t nFlags = db.GetStateFlags(pRows[1]);
+
+			NodeDB::Transaction tr2(db);
+			db.SetFlags(pRows[1], nFlags ^ NodeDB::StateFlags::Active);
+			verify_test(db.GetStateFlags(pRows[1]) != nFlags);
+			tr2.Rollback();
+
+			verify_test(db.GetStateFlags(pRows[1]) == nFlags);
+		}
+
+		tr.Start(db);
+
 		db.SetStateNotFunctional(pRows[0]);
 		db.assert_valid();
 		verify_test(CountTips(db, true) == 0);
@@ -420,10 +475,12 @@ namespace beam
 		const char* g_sz = "mytest.db";
 		const char* g_sz2 = "mytest2.db";
 		const char* g_sz3 = "macroblock_";
+		const char* g_sz4 = "mytest_trees.bin";
 #else // WIN32
 		const char* g_sz = "/tmp/mytest.db";
 		const char* g_sz2 = "/tmp/mytest2.db";
 		const char* g_sz3 = "/tmp/macroblock_";
+		const char* g_sz4 = "/tmp/mytest_trees.bin";
 #endif // WIN32
 
 	void TestNodeDB()
@@ -436,6 +493,132 @@ namespace beam
 		}
 	}
 
+	struct SyntheticSpendables
+	{
+		// Keys are laid out as in the processor: type, followed by the utxo key (commitment + maturity) or the kernel hash.
+		// Some keys are repeated, some kernels have bodies (hash lock preimage).
+		uint64_t m_Seed;
+		uint32_t m_i;
+		uint8_t m_pKey[1 + 33 + 8];
+		uint8_t m_pBody[32];
+		NodeDB::Blob m_Key;
+		NodeDB::Blob m_Body;
+		bool m_bBody;
+
+		void Reset()
+		{
+			m_Seed = 0x2545f4914f6cdd1dULL;
+			m_i = 0;
+			m_Key = NodeDB::Blob(m_pKey, 0);
+			m_Body = NodeDB::Blob(m_pBody, sizeof(m_pBody));
+			memset(m_pBody, 0x5a, sizeof(m_pBody));
+		}
+
+		uint64_t Rnd()
+		{
+			// xorshift64, deterministic
+			m_Seed ^= m_Seed << 13;
+			m_Seed ^= m_Seed >> 7;
+			m_Seed ^= m_Seed << 17;
+			return m_Seed;
+		}
+
+		void Next()
+		{
+			bool bRepeat = m_i && !(m_i % 16);
+			m_i++;
+			if (bRepeat)
+				return;
+
+			bool bKrn = !(m_i % 3);
+			m_pKey[0] = bKrn ? 1 : 0;
+			m_Key.n = bKrn ? (1 + 32) : sizeof(m_pKey);
+			m_bBody = bKrn && !(m_i % 100);
+
+			for (uint32_t i = 1; i < m_Key.n; i += sizeof(uint64_t))
+			{
+				uint64_t x = Rnd();
+				memcpy(m_pKey + i, &x, std::min((uint32_t) sizeof(x), m_Key.n - i));
+			}
+		}
+	};
+
+	void TestNodeDBBulk(uint32_t nCount) // spendables of a synthetic macroblock
+	{
+
+		SyntheticSpendables gen;
+		uint32_t pUnique[2];
+
+		for (uint32_t iPass = 0; iPass < 2; iPass++)
+		{
+			DeleteFileA(g_sz);
+
+			NodeDB db;
+			db.Open(g_sz);
+
+			gen.Reset();
+			uint64_t t0 = local_timestamp_msec();
+
+			if (iPass)
+			{
+				NodeDB::PhaseBulk phase(db);
+				NodeDB::Transaction t(db);
+				NodeDB::SpendableBulk bulk(db);
+
+				for (uint32_t i = 0; i < nCount; i++)
+				{
+					gen.Next();
+					bulk.Add(gen.m_Key, gen.m_bBody ? &gen.m_Body : NULL, 1, 1);
+				}
+
+				bulk.Flush();
+				t.Commit();
+				phase.Leave();
+			}
+			else
+			{
+				NodeDB::Transaction t(db);
+
+				for (uint32_t i = 0; i < nCount; i++)
+				{
+					gen.Next();
+					db.AddSpendable(gen.m_Key, gen.m_bBody ? &gen.m_Body : NULL, 1, 1);
+				}
+
+				t.Commit();
+			}
+
+			uint64_t dt_ms = local_timestamp_msec() - t0;
+			printf("%-32s: %u elements, %.0f/sec\n", iPass ? "Spendables bulk" : "Spendables per-element", nCount, nCount * 1e3 / std::max<uint64_t>(dt_ms, 1));
+
+			uint64_t nUnspent = 0;
+			pUnique[iPass] = 0;
+
+			{
+				NodeDB::WalkerSpendable wlk(db);
+				for (db.EnumUnpsent(wlk); wlk.MoveNext(); pUnique[iPass]++)
+					nUnspent += wlk.m_nUnspentCount;
+			}
+
+			verify_test(nUnspent == nCount);
+
+			uint8_t pBody[sizeof(gen.m_pBody)];
+			NodeDB::Blob body(pBody, sizeof(pBody));
+
+			gen.Reset();
+			for (uint32_t i = 0; i < 300; i++)
+			{
+				gen.Next();
+				verify_test(db.GetSpendableBody(gen.m_Key, body) == gen.m_bBody);
+				if (gen.m_bBody)
+					verify_test(!memcmp(pBody, gen.m_pBody, sizeof(pBody)));
+			}
+		}
+
+		verify_test(pUnique[0] == pUnique[1]);
+		verify_test(pUnique[0] < nCount); // duplicates merged
+	}
+
 	struct MiniWallet
 	{
 		ECC::Kdf m_Kdf;
@@ -513,6 +696,8 @@ namespace beam
 		typedef std::vector<MyKernel> KernelList;
 		KernelList m_MyKernels;
 
+		UtxoQueue::iterator m_itChange; // of the last tx, if any
+
 
 		bool MakeTx(Transaction::Ptr& pTx, Height h, Height hIncubation)
 		{
@@ -523,6 +708,11 @@ namespace beam
 			if (it->first > h)
 				return false; // not spendable yet
 
+			return MakeTx(pTx, it, h, hIncubation, 1090000);
+		}
+
+		bool MakeTx(Transaction::Ptr& pTx, UtxoQueue::iterator it, Height h, Height hIncubation, Amount fee)
+		{
 			pTx = std::make_shared<Transaction>();
 
 			const MyUtxo& utxo = it->second;
@@ -530,7 +720,7 @@ namespace beam
 
 			m_MyKernels.resize(m_MyKernels.size() + 1);
 			MyKernel& mk = m_MyKernels.back();
-			mk.m_Fee = 1090000;
+			mk.m_Fee = fee;
 			mk.m_bUseHashlock = 0 != (1 & h);
 
 			Input::Ptr pInp(new Input);
@@ -540,6 +730,8 @@ namespace beam
 			ECC::Scalar::Native kOffset = utxo.m_Key;
 			ECC::Scalar::Native k;
 
+			m_itChange = m_MyUtxos.end();
+
 			if (mk.m_Fee >= utxo.m_Value)
 				mk.m_Fee = utxo.m_Value;
 			else
@@ -552,7 +744,7 @@ namespace beam
 
 				utxoOut.ToOutput(*pTx, kOffset, hIncubation);
 
-				m_MyUtxos.insert(std::make_pair(h + hIncubation, utxoOut));
+				m_itChange = m_MyUtxos.insert(std::make_pair(h + hIncubation, utxoOut));
 			}
 
 			m_MyUtxos.erase(it);
@@ -588,7 +780,12 @@ namespace beam
 		{
 			ECC::SetRandom(m_Kdf.m_Secret.V);
 			m_Wallet.m_Kdf = m_Kdf;
-	}
+		}
+
+		virtual void OnNewState() override
+		{
+			DeleteSpentTxs(m_TxPool); // as the node does
+		}
 	};
 
 	struct BlockPlus
@@ -599,6 +796,219 @@ namespace beam
 		ByteBuffer m_Body;
 	};
 
+	struct BroadcastPeers
+	{
+		struct ErrorHandler
+			:public IErrorHandler
+		{
+			virtual void on_protocol_error(uint64_t, ProtocolError) override {}
+			virtual void on_connection_error(uint64_t, io::ErrorCode) override {}
+		} m_Eh;
+
+		// two sets of connections with identical cipher states: one for the regular per-connection path, one for the broadcast
+		std::vector<std::unique_ptr<proto::ProtocolPlus> > m_pV[2];
+
+		void Init(uint32_t nCount)
+		{
+			for (uint32_t i = 0; i < nCount; i++)
+			{
+				ECC::Scalar::Native skMy, skRemote;
+				ECC::SetRandom(skMy);
+				ECC::SetRandom(skRemote);
+
+				PeerID pidMy, pidRemote;
+				proto::Sk2Pk(pidMy, skMy);
+				proto::Sk2Pk(pidRemote, skRemote);
+
+				for (uint32_t j = 0; j < _countof(m_pV); j++)
+				{
+					m_pV[j].emplace_back(new proto::ProtocolPlus(0xAA, 0xBB, 0xCC, 100, m_Eh, 20000));
+					proto::ProtocolPlus& p = *m_pV[j].back();
+
+					p.m_MyNonce = skMy;
+					p.m_RemoteNonce = pidRemote;
+					p.InitCipher();
+					p.m_Mode = proto::ProtocolPlus::Mode::Duplex;
+				}
+			}
+		}
+
+		template <typename T>
+		static io::SharedBuffer SendRegular(proto::ProtocolPlus& p, uint8_t nCode, const T& msg)
+		{
+			SerializedMsg sm;
+			MsgSerializer& ser = p.serializeNoFinalize(sm, nCode, msg);
+			p.Encrypt(sm, ser);
+			return io::normalize(sm);
+		}
+
+		template <typename T>
+		void Test(const char* szName, uint8_t nCode, const T& msg, uint32_t nTotal)
+		{
+			// 1. Both paths must produce the same stream
+			SerializedMsg sm;
+			MsgSerializer& ser = m_pV[1][0]->serializeNoFinalize(sm, nCode, msg);
+			m_pV[1][0]->Finalize(sm, ser);
+
+			size_t nSize = 0;
+			for (size_t i = 0; i < sm.size(); i++)
+				nSize += sm[i].size;
+
+			ByteBuffer buf(nSize);
+
+			for (size_t i = 0; i < m_pV[0].size(); i++)
+			{
+				io::SharedBuffer bufRegular = SendRegular(*m_pV[0][i], nCode, msg);
+				m_pV[1][i]->EncryptTo(&buf.at(0), sm, nSize);
+
+				verify_test(bufRegular.size == nSize);
+				verify_test(!memcmp(bufRegular.data, &buf.at(0), nSize));
+			}
+
+			// 2. Fan-out cost vs number of peers
+			const uint32_t pPeers[] = { 1, 10, 50, 200 };
+
+			for (uint32_t iPeers = 0; iPeers < _countof(pPeers); iPeers++)
+			{
+				uint32_t nPeers = std::min(pPeers[iPeers], (uint32_t) m_pV[0].size());
+				uint32_t nRounds = std::max(nTotal / nPeers, 1U);
+
+				uint64_t t0 = local_timestamp_msec();
+
+				for (uint32_t iRound = 0; iRound < nRounds; iRound++)
+					for (uint32_t i = 0; i < nPeers; i++)
+						SendRegular(*m_pV[0][i], nCode, msg);
+
+				uint64_t t1 = local_timestamp_msec();
+
+				for (uint32_t iRound = 0; iRound < nRounds; iRound++)
+				{
+					SerializedMsg smOnce;
+					MsgSerializer& serOnce = m_pV[1][0]->serializeNoFinalize(smOnce, nCode, msg);
+					m_pV[1][0]->Finalize(smOnce, serOnce);
+
+					std::unique_ptr<uint8_t[]> pSlab(new uint8_t[nSize * nPeers]);
+					for (uint32_t i = 0; i < nPeers; i++)
+						m_pV[1][i]->EncryptTo(pSlab.get() + nSize * i, smOnce, nSize);
+				}
+
+				uint64_t t2 = local_timestamp_msec();
+
+				printf("%-12s %3u peers, %5u bytes: per-peer %.2f us, broadcast %.2f us (per message per peer)\n", szName, nPeers, (uint32_t) nSize,
+					(t1 - t0) * 1e3 / (nRounds * nPeers), (t2 - t1) * 1e3 / (nRounds * nPeers));
+			}
+		}
+	};
+
+	void TestBroadcast()
+	{
+		BroadcastPeers bp;
+		bp.Init(200);
+
+		proto::NewTip msgTip;
+		ECC::SetRandom(msgTip.m_ID.m_Hash);
+		msgTip.m_ID.m_Height = 12345;
+		ECC::SetRandom(msgTip.m_ChainWork);
+
+		bp.Test("NewTip", 1, msgTip, 20000);
+
+		proto::BbsMsg msgBbs;
+		msgBbs.m_Channel = 5;
+		msgBbs.m_TimePosted = 1000;
+		msgBbs.m_Message.resize(1024);
+		for (size_t i = 0; i < msgBbs.m_Message.size(); i++)
+			msgBbs.m_Message[i] = (uint8_t) i;
+
+		bp.Test("BbsMsg", 40, msgBbs, 20000);
+
+		// block body, spans several serialization fragments
+		proto::Body msgBody;
+		msgBody.m_Buffer.resize(256 * 1024);
+		for (size_t i = 0; i < msgBody.m_Buffer.size(); i++)
+			msgBody.m_Buffer[i] = (uint8_t) (i * 7);
+
+		bp.Test("Body", 7, msgBody, 400);
+	}
+
+	void TestTxPool()
+	{
+		NodeProcessor::TxPool txp;
+
+		const uint32_t nCount = 300;
+		Transaction::KeyType pKey[nCount];
+
+		for (uint32_t i = 0; i < nCount; i++)
+		{
+			// synthetic txs of different shape. The pool doesn't verify them
+			Transaction::Ptr pTx = std::make_shared<Transaction>();
+
+			for (uint32_t j = 0; j <= i % 3; j++)
+			{
+				Input::Ptr pInp(new Input);
+				ECC::SetRandom(pInp->m_Commitment.m_X);
+				pInp->m_Commitment.m_Y = false;
+				pTx->m_vInputs.push_back(std::move(pInp));
+			}
+
+			TxKernel::Ptr pKrn(new TxKernel);
+			pKrn->m_Fee = 1000 * (i + 1); // dominates the size differences
+			pTx->m_vKernelsOutput.push_back(std::move(pKrn));
+
+			Transaction::Context ctx;
+			ctx.m_Fee.Lo = pTx->m_vKernelsOutput[0]->m_Fee;
+			ctx.m_Fee.Hi = 0;
+			ctx.m_Height.m_Min = 0;
+			ctx.m_Height.m_Max = MaxHeight;
+
+			ECC::SetRandom(pKey[i]);
+			txp.AddValidTx(std::move(pTx), ctx, pKey[i]);
+		}
+
+		verify_test(txp.m_setTxs.size() == nCount);
+
+		uint64_t nBytes = 0;
+		for (NodeProcessor::TxPool::TxSet::iterator it = txp.m_setTxs.begin(); txp.m_setTxs.end() != it; it++)
+		{
+			const NodeProcessor::TxPool::Element& x = it->get_ParentObj();
+			verify_test(x.m_nBytes > x.m_Blob.size());
+			nBytes += x.m_nBytes;
+
+			// decoded view
+			Transaction tx;
+			x.get_Value(tx);
+			verify_test(tx.m_vInputs.size() == x.m_nInputs);
+			verify_test(tx.m_vKernelsOutput.size() == 1);
+			verify_test(tx.m_vKernelsOutput[0]->m_Fee == x.m_Profit.m_Fee);
+
+			for (uint32_t i = 0; i < x.m_nInputs; i++)
+				verify_test(tx.m_vInputs[i]->m_Commitment == x.m_vPoints[i]);
+		}
+		verify_test(txp.m_nBytes == nBytes);
+
+		// evict by the memory budget
+		uint64_t nBudget = nBytes / 2;
+		txp.ShrinkUpTo(nCount, nBudget);
+		verify_test(txp.m_nBytes <= nBudget);
+		verify_test(txp.m_Stats.m_Evicted + txp.m_setTxs.size() == nCount);
+		verify_test(txp.m_Stats.m_EvictedBytes + txp.m_nBytes == nBytes);
+
+		// the best fee rate remains, the worst is evicted
+		NodeProcessor::TxPool::Element::Tx key;
+		key.m_Key = pKey[nCount - 1];
+		verify_test(txp.m_setTxs.end() != txp.m_setTxs.find(key));
+		key.m_Key = pKey[0];
+		verify_test(txp.m_setTxs.end() == txp.m_setTxs.find(key));
+
+		// by count
+		txp.ShrinkUpTo(10, nBudget);
+		verify_test(txp.m_setTxs.size() == 10);
+		verify_test(txp.m_Stats.m_Evicted == nCount - 10);
+
+		txp.Clear();
+		verify_test(!txp.m_nBytes);
+		verify_test(txp.m_mapInputs.empty() && txp.m_mapOutputs.empty());
+	}
+
 	void TestNodeProcessor1(std::vector<BlockPlus::Ptr>& blockChain)
 	{
 		MyNodeProcessor1 np;
@@ -673,6 +1083,167 @@ namespace beam
 
 			rwData.Delete();
 		}
+
+		{
+			// trees image
+			DeleteFileA(g_sz4);
+
+			Merkle::Hash hv0, hv1;
+
+			{
+				NodeProcessor np2;
+				np2.m_sPathTrees = g_sz4;
+				np2.Initialize(g_sz2); // no image yet, rebuilt from the DB
+				verify_test(!np2.m_bTreesLoaded);
+				np2.get_CurrentLive(hv0);
+			}
+
+			{
+				NodeProcessor np2;
+				np2.m_sPathTrees = g_sz4;
+				np2.Initialize(g_sz2); // loaded from the image
+				verify_test(np2.m_bTreesLoaded);
+				np2.get_CurrentLive(hv1);
+				verify_test(hv0 == hv1);
+			}
+
+			{
+				// corrupt the last leaf
+				FILE* pF = fopen(g_sz4, "r+b");
+				verify_test(pF && !fseek(pF, -1, SEEK_END));
+				int x = fgetc(pF) ^ 1;
+				fseek(pF, -1, SEEK_END);
+				fputc(x, pF);
+				fclose(pF);
+			}
+
+			{
+				NodeProcessor np2;
+				np2.m_sPathTrees = g_sz4;
+				np2.Initialize(g_sz2); // the image is rejected, rebuilt from the DB
+				verify_test(!np2.m_bTreesLoaded);
+				np2.get_CurrentLive(hv1);
+				verify_test(hv0 == hv1);
+			}
+
+			DeleteFileA(g_sz4);
+		}
+
+		{
+			// header packs
+			DeleteFileA(g_sz2);
+
+			NodeProcessor np2;
+			np2.Initialize(g_sz2);
+
+			Block::SystemState::ID idTop, idMid;
+			blockChain.back()->m_Hdr.get_ID(idTop);
+			blockChain[hMid - Rules::HeightGenesis]->m_Hdr.get_ID(idMid);
+
+			Block::SystemState::Sequence::Prefix prefix;
+			std::vector<Block::SystemState::Sequence::Element> vElem;
+
+			verify_test(np.ExportHdrPack(idMid, 10, prefix, vElem));
+			verify_test(vElem.size() == 10);
+
+			verify_test(np2.OnStatePack(prefix, vElem, idTop, PeerID()) == NodeProcessor::DataStatus::Invalid); // wrong top
+			verify_test(np2.OnStatePack(prefix, vElem, idMid, PeerID()) == NodeProcessor::DataStatus::Accepted);
+			verify_test(np2.OnStatePack(prefix, vElem, idMid, PeerID()) == NodeProcessor::DataStatus::Rejected); // dups
+
+			// overlapping with the existing range, but larger than the whole chain
+			verify_test(np.ExportHdrPack(idTop, static_cast<uint32_t>(blockChain.size()) + 5, prefix, vElem));
+			verify_test(vElem.size() == blockChain.size());
+			verify_test(np2.OnStatePack(prefix, vElem, idTop, PeerID()) == NodeProcessor::DataStatus::Accepted);
+
+			for (size_t i = 0; i < blockChain.size(); i++)
+			{
+				Block::SystemState::ID id;
+				blockChain[i]->m_Hdr.get_ID(id);
+				verify_test(np2.get_DB().StateFindSafe(id));
+			}
+
+			// np2 has no gaps now, but only the headers. Any pack from it must stop at the genesis
+			verify_test(np2.ExportHdrPack(idMid, 1000, prefix, vElem));
+			verify_test(vElem.size() == hMid - Rules::HeightGenesis + 1);
+			verify_test(prefix.m_Height == Rules::HeightGenesis);
+
+			// tampered
+			vElem[vElem.size() / 2].m_TimeStamp++;
+			verify_test(np2.OnStatePack(prefix, vElem, idMid, PeerID()) == NodeProcessor::DataStatus::Invalid);
+		}
+
+		{
+			// dependent txs in the pool
+			NodeProcessor::TxPool& txp = np.m_TxPool;
+			Height h = np.m_Cursor.m_Sid.m_Height + 1;
+			Amount fees = 0;
+
+			BlockPlus::Ptr pBlock(new BlockPlus);
+
+			// the mined txs are already deleted on the new tip
+			verify_test(txp.m_setTxs.empty());
+			txp.UpdateTemplate(txp.m_Template.m_nSizeMax);
+			verify_test(txp.m_Template.m_bValid && txp.m_Template.m_vElements.empty());
+
+			MiniWallet::UtxoQueue::iterator it = np.m_Wallet.m_MyUtxos.begin();
+			verify_test((np.m_Wallet.m_MyUtxos.end() != it) && (it->first <= h));
+			std::pair<Height, MiniWallet::MyUtxo> utxo = *it;
+
+			// low-fee parent, a child that spends its output, and a rival that double-spends the parent input
+			Transaction::Ptr pParent, pChild, pRival;
+			verify_test(np.m_Wallet.MakeTx(pParent, it, h, 0, 100));
+			verify_test(np.m_Wallet.m_MyUtxos.end() != np.m_Wallet.m_itChange);
+			verify_test(np.m_Wallet.MakeTx(pChild, np.m_Wallet.m_itChange, h, 0, 2000));
+			verify_test(np.m_Wallet.MakeTx(pRival, np.m_Wallet.m_MyUtxos.insert(utxo), h, 0, 50));
+
+			Transaction::Ptr* ppTx[] = { &pParent, &pChild, &pRival };
+			const NodeProcessor::TxPool::Element* pElem[_countof(ppTx)];
+
+			for (size_t i = 0; i < _countof(ppTx); i++)
+			{
+				Transaction::Context ctx;
+				verify_test(np.ValidateTx(**ppTx[i], ctx));
+
+				Transaction::KeyType key;
+				(*ppTx[i])->get_Key(key);
+
+				txp.AddValidTx(std::move(*ppTx[i]), ctx, key);
+
+				NodeProcessor::TxPool::Element::Tx keyTx;
+				keyTx.m_Key = key;
+
+				NodeProcessor::TxPool::TxSet::iterator itTx = txp.m_setTxs.find(keyTx);
+				verify_test(txp.m_setTxs.end() != itTx);
+				pElem[i] = &itTx->get_ParentObj();
+			}
+
+			// updated incrementally: the parent pulled in, the rival rejected without a rebuild
+			verify_test(txp.m_Template.m_bValid);
+			verify_test(txp.m_Template.m_vElements.size() == 2);
+			verify_test(txp.m_Template.m_vElements[0] == pElem[0]);
+			verify_test(txp.m_Template.m_vElements[1] == pElem[1]);
+
+			// rebuilt from scratch, by profit: the child goes first and pays for the parent
+			txp.UpdateTemplate(txp.m_Template.m_nSizeMax + 1);
+			verify_test(txp.m_Template.m_vElements.size() == 2);
+			verify_test(txp.m_Template.m_vElements[0] == pElem[0]);
+			verify_test(txp.m_Template.m_vElements[1] == pElem[1]);
+
+			verify_test(np.GenerateNewBlock(txp, pBlock->m_Hdr, pBlock->m_Body, fees));
+			verify_test(fees == 2100);
+			verify_test(txp.m_setTxs.size() == 3);
+
+			np.OnState(pBlock->m_Hdr, PeerID());
+
+			Block::SystemState::ID id;
+			pBlock->m_Hdr.get_ID(id);
+			np.OnBlock(id, pBlock->m_Body, PeerID());
+			verify_test(np.m_Cursor.m_ID == id);
+
+			// on the new tip the mined txs are deleted, and the rival as well (its input is spent)
+			verify_test(txp.m_setTxs.empty());
+			verify_test(!txp.m_Template.m_bValid);
+		}
 	}
 
 
@@ -770,40 +1341,590 @@ namespace beam
 			}
 		}
 
-	}
+		{
+			// several consecutive missing blocks are requested at once
+			DeleteFileA(g_sz2);
 
-	const uint16_t g_Port = 25003; // don't use the default port to prevent collisions with running nodes, beacons and etc.
+			struct MyNodeProcessor3
+				:public MyNodeProcessor2
+			{
+				std::vector<Block::SystemState::ID> m_vRequested;
 
-	void TestNodeConversation()
-	{
-		// Testing configuration: Node0 <-> Node1 <-> Client.
+				virtual void RequestData(const Block::SystemState::ID& id, bool bBlock, const PeerID* pPreferredPeer) override
+				{
+					verify_test(bBlock);
+					m_vRequested.push_back(id);
+				}
+			};
 
-		io::Reactor::Ptr pReactor(io::Reactor::create());
-		io::Reactor::Scope scope(*pReactor);
+			MyNodeProcessor3 np;
+			np.m_RequestBlocksMax = 5;
+			np.Initialize(g_sz2);
 
-		Node node, node2;
-		node.m_Cfg.m_sPathLocal = g_sz;
-		node.m_Cfg.m_Listen.port(g_Port);
-		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+			PeerID peer;
+			ZeroObject(peer);
 
-		node.m_Cfg.m_Timeout.m_GetBlock_ms = 1000 * 60;
-		node.m_Cfg.m_Timeout.m_GetState_ms = 1000 * 60;
+			std::vector<Block::SystemState::ID> vIDs(blockChain.size());
+			for (size_t i = 0; i < blockChain.size(); i++)
+			{
+				np.OnState(blockChain[i]->m_Hdr, peer);
+				blockChain[i]->m_Hdr.get_ID(vIDs[i]);
+			}
 
-		node2.m_Cfg.m_sPathLocal = g_sz2;
-		node2.m_Cfg.m_Listen.port(g_Port + 1);
-		node2.m_Cfg.m_Listen.ip(INADDR_ANY);
-		node2.m_Cfg.m_Timeout = node.m_Cfg.m_Timeout;
+			np.EnumCongestions();
+			verify_test(np.m_vRequested.size() == 5);
+			for (size_t i = 0; i < np.m_vRequested.size(); i++)
+				verify_test(np.m_vRequested[i] == vIDs[i]);
+
+			// out of order
+			np.OnBlock(vIDs[2], blockChain[2]->m_Body, peer);
+			np.OnBlock(vIDs[0], blockChain[0]->m_Body, peer);
+			verify_test(np.m_Cursor.m_Sid.m_Height == Rules::HeightGenesis);
+
+			np.m_vRequested.clear();
+			np.EnumCongestions();
+			verify_test(np.m_vRequested.size() == 5);
+			verify_test(np.m_vRequested[0] == vIDs[1]);
+			for (size_t i = 1; i < np.m_vRequested.size(); i++)
+				verify_test(np.m_vRequested[i] == vIDs[i + 2]);
+
+			np.OnBlock(vIDs[1], blockChain[1]->m_Body, peer);
+			verify_test(np.m_Cursor.m_Sid.m_Height == Rules::HeightGenesis + 2);
+		}
 
-		node2.m_Cfg.m_BeaconPort = g_Port;
+		DeleteFileA(g_sz2);
+	}
 
-		ECC::SetRandom(node.m_Cfg.m_WalletKey.V);
-		ECC::SetRandom(node2.m_Cfg.m_WalletKey.V);
+	struct MyNodeProcessorBatch
+		:public MyNodeProcessor2
+	{
+		uint32_t m_nBatches;
+		uint32_t m_nBatchesFailed;
+		std::vector<Height> m_vVerified; // verified individually
+		std::vector<Height> m_vRejected;
+
+		MyNodeProcessorBatch()
+			:m_nBatches(0)
+			,m_nBatchesFailed(0)
+		{
+		}
 
-		node.Initialize();
-		node2.Initialize();
+		void ResetStats()
+		{
+			m_nBatches = 0;
+			m_nBatchesFailed = 0;
+			m_vVerified.clear();
+			m_vRejected.clear();
+		}
 
-		struct MyClient
-			:public proto::NodeConnection
+		virtual bool VerifyBlock(const Block::BodyBase& block, TxBase::IReader&& r, const HeightRange& hr) override
+		{
+			m_vVerified.push_back(hr.m_Min);
+
+			if (MyNodeProcessor2::VerifyBlock(block, std::move(r), hr))
+				return true;
+
+			m_vRejected.push_back(hr.m_Min);
+			return false;
+		}
+
+		virtual bool VerifyBlocks(const VerifyItem* pItems, size_t nCount) override
+		{
+			bool bOk = MyNodeProcessor2::VerifyBlocks(pItems, nCount);
+			if (nCount > 1)
+			{
+				m_nBatches++;
+				if (!bOk)
+					m_nBatchesFailed++;
+			}
+			return bOk;
+		}
+	};
+
+	void FeedBlocksBatched(MyNodeProcessorBatch& np, std::vector<BlockPlus::Ptr>& blockChain, size_t iBad, const ByteBuffer& bbBad)
+	{
+		size_t nMid = blockChain.size() / 2;
+
+		PeerID peer;
+		ZeroObject(peer);
+
+		for (size_t i = 0; i < blockChain.size(); i++)
+			np.OnState(blockChain[i]->m_Hdr, peer);
+
+		for (size_t i = 0; i < nMid; i++)
+		{
+			Block::SystemState::ID id;
+			blockChain[i]->m_Hdr.get_ID(id);
+			np.OnBlock(id, blockChain[i]->m_Body, peer);
+		}
+
+		verify_test(np.m_Cursor.m_Sid.m_Height == Rules::HeightGenesis + nMid - 1);
+
+		// one at a time, no batches
+		verify_test(!np.m_nBatches);
+		verify_test(np.m_vVerified.size() == nMid);
+		verify_test(np.m_vRejected.empty());
+		np.ResetStats();
+
+		// in reverse order, so that all the remaining blocks are interpreted at once (with batch verification)
+		for (size_t i = blockChain.size(); i-- > nMid; )
+		{
+			Block::SystemState::ID id;
+			blockChain[i]->m_Hdr.get_ID(id);
+			np.OnBlock(id, (i == iBad) ? bbBad : blockChain[i]->m_Body, peer);
+		}
+	}
+
+	void TestNodeProcessorBatch(std::vector<BlockPlus::Ptr>& blockChain)
+	{
+		NodeProcessor::Horizon horz;
+		horz.m_Branching = 12;
+		horz.m_Schwarzschild = 12;
+
+		const uint32_t nBatch = 5;
+		size_t nMid = blockChain.size() / 2;
+		size_t nRest = blockChain.size() - nMid;
+		verify_test(nRest > nBatch);
+
+		{
+			DeleteFileA(g_sz2);
+
+			MyNodeProcessorBatch np;
+			np.m_Horizon = horz;
+			np.m_VerifyBatchBlocks = nBatch;
+			np.Initialize(g_sz2);
+
+			FeedBlocksBatched(np, blockChain, blockChain.size(), ByteBuffer());
+
+			verify_test(np.m_Cursor.m_Sid.m_Height == Rules::HeightGenesis + blockChain.size() - 1);
+
+			// all verified in batches, none individually
+			verify_test(np.m_nBatches == (nRest + nBatch - 1) / nBatch);
+			verify_test(!np.m_nBatchesFailed);
+			verify_test(np.m_vVerified.empty());
+		}
+
+		{
+			// a block with a tampered kernel signature in the 1st batch
+			DeleteFileA(g_sz2);
+
+			size_t iBad = nMid + 2;
+
+			Block::Body block;
+			{
+				Deserializer der;
+				der.reset(&blockChain[iBad]->m_Body.at(0), blockChain[iBad]->m_Body.size());
+				der & block;
+			}
+
+			verify_test(!block.m_vKernelsOutput.empty());
+			block.m_vKernelsOutput.front()->m_Signature.m_k.m_Value.m_pData[ECC::uintBig::nBytes - 1] ^= 1;
+
+			ByteBuffer bbBad;
+			{
+				Serializer ser;
+				ser & block;
+				ser.swap_buf(bbBad);
+			}
+
+			MyNodeProcessorBatch np;
+			np.m_Horizon = horz;
+			np.m_VerifyBatchBlocks = nBatch;
+			np.Initialize(g_sz2);
+
+			FeedBlocksBatched(np, blockChain, iBad, bbBad);
+
+			// the batch fails, then its blocks are verified individually up to the bad one
+			verify_test(np.m_nBatches == 1);
+			verify_test(np.m_nBatchesFailed == 1);
+
+			verify_test(np.m_vVerified.size() == iBad - nMid + 1);
+			for (size_t i = 0; i < np.m_vVerified.size(); i++)
+				verify_test(np.m_vVerified[i] == Rules::HeightGenesis + nMid + i);
+
+			verify_test(np.m_vRejected.size() == 1);
+			verify_test(np.m_vRejected[0] == Rules::HeightGenesis + iBad);
+
+			verify_test(np.m_Cursor.m_Sid.m_Height == Rules::HeightGenesis + iBad - 1);
+		}
+	}
+
+	Timestamp GetMovingMedianSlow(NodeProcessor& np)
+	{
+		std::vector<Timestamp> vTs;
+
+		for (uint64_t row = np.m_Cursor.m_Sid.m_Row; row; )
+		{
+			Block::SystemState::Full s;
+			np.get_DB().get_State(row, s);
+			vTs.push_back(s.m_TimeStamp);
+
+			if ((vTs.size() >= Rules::get().WindowForMedian) || !np.get_DB().get_Prev(row))
+				break;
+		}
+
+		if (vTs.empty())
+			return 0;
+
+		std::sort(vTs.begin(), vTs.end());
+		return vTs[vTs.size() >> 1];
+	}
+
+	void TestNodeProcessorReorg()
+	{
+		// short review cycle, so that the difficulty is reviewed several times along the chain
+		const uint32_t nCycle0 = Rules::get().DifficultyReviewCycle;
+		Rules::get().DifficultyReviewCycle = 8;
+		Rules::get().UpdateChecksum();
+
+		const uint32_t nChain = 40, nFork = 20, nBranch = 6;
+		std::vector<BlockPlus::Ptr> vChain;
+
+		{
+			DeleteFileA(g_sz2);
+
+			MyNodeProcessor2 np;
+			np.Initialize(g_sz2);
+
+			for (uint32_t i = 0; i < nChain; i++)
+			{
+				BlockPlus::Ptr pBlock(new BlockPlus);
+
+				NodeProcessor::TxPool txp;
+				Amount fees = 0;
+				verify_test(np.GenerateNewBlock(txp, pBlock->m_Hdr, pBlock->m_Body, fees));
+
+				Block::SystemState::ID id;
+				pBlock->m_Hdr.get_ID(id);
+
+				verify_test(np.OnState(pBlock->m_Hdr, PeerID()) == NodeProcessor::DataStatus::Accepted);
+				verify_test(np.OnBlock(id, pBlock->m_Body, PeerID()) == NodeProcessor::DataStatus::Accepted);
+				verify_test(np.m_Cursor.m_ID == id);
+				verify_test(np.get_MovingMedian() == GetMovingMedianSlow(np));
+
+				vChain.push_back(std::move(pBlock));
+			}
+		}
+
+		DeleteFileA(g_sz2);
+
+		{
+			// another node follows the chain, switches to its own branch, then back to the (longer) chain
+			DeleteFileA(g_sz4);
+
+			MyNodeProcessor2 np;
+			np.Initialize(g_sz4);
+
+			for (uint32_t i = 0; i < nChain; i++)
+			{
+				if (nFork == i)
+				{
+					for (uint32_t j = 0; j < nBranch; j++)
+					{
+						NodeProcessor::TxPool txp;
+						BlockPlus bp;
+						Amount fees = 0;
+						verify_test(np.GenerateNewBlock(txp, bp.m_Hdr, bp.m_Body, fees));
+
+						Block::SystemState::ID id;
+						bp.m_Hdr.get_ID(id);
+
+						verify_test(np.OnState(bp.m_Hdr, PeerID()) == NodeProcessor::DataStatus::Accepted);
+						verify_test(np.OnBlock(id, bp.m_Body, PeerID()) == NodeProcessor::DataStatus::Accepted);
+						verify_test(np.m_Cursor.m_ID == id);
+						verify_test(np.get_MovingMedian() == GetMovingMedianSlow(np));
+					}
+				}
+
+				const BlockPlus& bp = *vChain[i];
+
+				Block::SystemState::ID id;
+				bp.m_Hdr.get_ID(id);
+
+				np.OnState(bp.m_Hdr, PeerID());
+				np.OnBlock(id, bp.m_Body, PeerID());
+
+				verify_test(np.get_MovingMedian() == GetMovingMedianSlow(np));
+			}
+
+			Block::SystemState::ID idTop;
+			vChain.back()->m_Hdr.get_ID(idTop);
+			verify_test(np.m_Cursor.m_ID == idTop);
+		}
+
+		DeleteFileA(g_sz4);
+
+		Rules::get().DifficultyReviewCycle = nCycle0;
+		Rules::get().UpdateChecksum();
+	}
+
+	void TestNodeHistoryCompression(const std::vector<BlockPlus::Ptr>& blockChain)
+	{
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		Height hTrg = 0;
+
+		{
+			Node node;
+			node.m_Cfg.m_sPathLocal = g_sz;
+			node.m_Cfg.m_HistoryCompression.m_sPathOutput = g_sz3;
+			node.m_Cfg.m_HistoryCompression.m_sPathTmp = g_sz3;
+			node.m_Cfg.m_HistoryCompression.m_Threshold = 5;
+			node.m_Cfg.m_HistoryCompression.m_MinAggregate = blockChain.size() - 10;
+			node.m_Cfg.m_HistoryCompression.m_Naggling = 3; // many small ranges, to get a deep tree
+			node.m_Cfg.m_HistoryCompression.m_Threads = 4;
+			node.m_Cfg.m_Horizon.m_Branching = 8; // the range is clamped behind it
+
+			ECC::SetRandom(node.m_Cfg.m_WalletKey.V);
+			node.Initialize();
+
+			PeerID peer;
+			ZeroObject(peer);
+
+			// the generation is started in the middle, and runs concurrently with the DB updates
+			for (size_t i = 0; i < blockChain.size(); i++)
+			{
+				node.get_Processor().OnState(blockChain[i]->m_Hdr, peer);
+
+				Block::SystemState::ID id;
+				blockChain[i]->m_Hdr.get_ID(id);
+				node.get_Processor().OnBlock(id, blockChain[i]->m_Body, peer);
+			}
+
+			Node::CompressorStats st;
+			node.get_CompressorStats(st);
+			hTrg = st.m_Range.m_Max;
+			verify_test(hTrg && !st.m_Range.m_Min);
+
+			uint32_t nCycles = 0;
+			io::Timer::Ptr pTimer = io::Timer::create(pReactor);
+			pTimer->start(100, true, [&]() {
+				node.get_CompressorStats(st);
+				if (!st.m_Range.m_Max || (++nCycles > 600))
+					io::Reactor::get_Current().stop();
+			});
+
+			pReactor->run();
+
+			verify_test(!st.m_Range.m_Max);
+			verify_test(st.m_Exported == hTrg);
+			verify_test(st.m_Merges && !st.m_MergesPending);
+
+			NodeDB::WalkerState ws(node.get_Processor().get_DB());
+			node.get_Processor().get_DB().EnumMacroblocks(ws);
+			verify_test(ws.MoveNext() && (ws.m_Sid.m_Height == hTrg));
+		}
+
+		// import it
+		DeleteFileA(g_sz2);
+
+		Block::BodyBase::RW rw;
+		rw.m_sPath = std::string(g_sz3) + "mb_" + std::to_string(hTrg);
+		verify_test(rw.Open(true));
+
+		{
+			NodeProcessor np;
+			np.Initialize(g_sz2);
+			verify_test(np.ImportMacroBlock(rw));
+
+			Block::SystemState::ID id;
+			blockChain[hTrg - Rules::HeightGenesis]->m_Hdr.get_ID(id);
+			verify_test(np.m_Cursor.m_ID == id);
+		}
+
+		rw.Close();
+		rw.Delete();
+
+		DeleteFileA(g_sz2);
+	}
+
+	const uint16_t g_Port = 25003; // don't use the default port to prevent collisions with running nodes, beacons and etc.
+
+	void TestNodeSnapshotSync(const std::vector<BlockPlus::Ptr>& blockChain, bool bStallerDisconnects)
+	{
+		// node has the blocks and the history macroblock in the middle of the chain, node2 bootstraps from it.
+		// The first peer of node2 advertises the tip, but doesn't deliver the snapshot (stalls or disconnects).
+		// node shows up only after that
+		DeleteFileA(g_sz);
+		DeleteFileA(g_sz2);
+
+		const Height hSnapshot = Rules::HeightGenesis + blockChain.size() / 2;
+		Block::SystemState::ID idTip;
+		Difficulty::Raw chainWork;
+
+		Block::BodyBase::RW rwMb;
+		rwMb.m_sPath = std::string(g_sz3) + "mb_" + std::to_string(hSnapshot);
+
+		{
+			NodeProcessor np;
+			np.Initialize(g_sz);
+
+			PeerID peer;
+			ZeroObject(peer);
+
+			for (size_t i = 0; i < blockChain.size(); i++)
+			{
+				np.OnState(blockChain[i]->m_Hdr, peer);
+
+				Block::SystemState::ID id;
+				blockChain[i]->m_Hdr.get_ID(id);
+				np.OnBlock(id, blockChain[i]->m_Body, peer);
+			}
+
+			idTip = np.m_Cursor.m_ID;
+			chainWork = np.m_Cursor.m_Full.m_ChainWork;
+			verify_test(idTip.m_Height == Rules::HeightGenesis + blockChain.size() - 1);
+
+			verify_test(rwMb.Open(false));
+			np.ExportMacroBlock(rwMb, HeightRange(Rules::HeightGenesis, hSnapshot));
+			rwMb.Close();
+
+			np.get_DB().MacroblockIns(np.FindActiveAtStrict(hSnapshot));
+		}
+
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		Node node, node2;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Connect.resize(1);
+		node.m_Cfg.m_Connect[0].resolve("127.0.0.1");
+		node.m_Cfg.m_Connect[0].port(g_Port + 1);
+		node.m_Cfg.m_HistoryCompression.m_sPathOutput = g_sz3;
+		node.m_Cfg.m_HistoryCompression.m_sPathTmp = g_sz3;
+		node.m_Cfg.m_HistoryCompression.m_Threshold = static_cast<Height>(-1) / 2; // no new history
+
+		node2.m_Cfg.m_sPathLocal = g_sz2;
+		node2.m_Cfg.m_Listen.port(g_Port + 1);
+		node2.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node2.m_Cfg.m_BeaconPeriod_ms = 0;
+		node2.m_Cfg.m_Connect.resize(1);
+		node2.m_Cfg.m_Connect[0].resolve("127.0.0.1");
+		node2.m_Cfg.m_Connect[0].port(g_Port + 2);
+		node2.m_Cfg.m_HistoryCompression.m_sPathTmp = g_sz3;
+		node2.m_Cfg.m_SnapshotSync = true;
+		node2.m_Cfg.m_Timeout.m_GetSnapshot_ms = 1000;
+
+		ECC::SetRandom(node.m_Cfg.m_WalletKey.V);
+		ECC::SetRandom(node2.m_Cfg.m_WalletKey.V);
+
+		struct BadPeer
+			:public proto::NodeConnection
+			,public proto::NodeConnection::Server
+		{
+			Node* m_pNodeGood;
+			bool m_bDisconnect;
+			uint32_t m_nRequests = 0;
+
+			Block::SystemState::ID m_Tip;
+			Difficulty::Raw m_TipWork;
+			ECC::Scalar::Native m_sk; // the same ID across reconnects
+			io::Timer::Ptr m_pTimer;
+
+			BadPeer() {
+				m_pTimer = io::Timer::create(io::Reactor::get_Current().shared_from_this());
+			}
+
+			virtual void OnAccepted(io::TcpStream::Ptr&& newStream, int errorCode) override
+			{
+				if (newStream)
+				{
+					Reset();
+					Accept(std::move(newStream));
+					SecureConnect();
+				}
+			}
+
+			virtual void OnConnectedSecure() override
+			{
+				ProveID(m_sk, proto::IDType::Node);
+
+				proto::Config msgCfg;
+				msgCfg.m_CfgChecksum = Rules::get().Checksum;
+				Send(msgCfg);
+
+				proto::NewTip msg;
+				msg.m_ID = m_Tip;
+				msg.m_ChainWork = m_TipWork;
+				Send(msg);
+			}
+
+			virtual void OnMsg(proto::GetSnapshotChunk&&) override
+			{
+				if (!m_nRequests++)
+					m_pNodeGood->Initialize();
+
+				if (m_bDisconnect)
+					m_pTimer->start(100, false, [this]() { Reset(); }); // as if the message is unknown
+				// otherwise just ignore it
+			}
+		};
+
+		BadPeer bp;
+		bp.m_pNodeGood = &node;
+		bp.m_bDisconnect = bStallerDisconnects;
+		bp.m_Tip = idTip;
+		bp.m_TipWork = chainWork;
+		ECC::SetRandom(bp.m_sk);
+
+		io::Address addr;
+		addr.port(g_Port + 2);
+		bp.Listen(addr);
+
+		node2.Initialize();
+
+		uint32_t nCycles = 0;
+		io::Timer::Ptr pTimer = io::Timer::create(pReactor);
+		pTimer->start(100, true, [&]() {
+			if ((node2.get_Processor().m_Cursor.m_ID == idTip) || (++nCycles > 600))
+				io::Reactor::get_Current().stop();
+		});
+
+		pReactor->run();
+
+		verify_test(bp.m_nRequests);
+		if (!bp.m_nRequests)
+			node.Initialize(); // must be initialized before destruction
+
+		verify_test(node2.get_Processor().m_Cursor.m_ID == idTip);
+
+		// the blocks below the snapshot weren't downloaded
+		verify_test(node2.get_Processor().get_DB().ParamIntGetDef(NodeDB::ParamID::FossilHeight) == hSnapshot);
+
+		rwMb.Delete();
+	}
+
+	void TestNodeConversation()
+	{
+		// Testing configuration: Node0 <-> Node1 <-> Client.
+
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		Node node, node2;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+
+		node.m_Cfg.m_Timeout.m_GetBlock_ms = 1000 * 60;
+		node.m_Cfg.m_Timeout.m_GetState_ms = 1000 * 60;
+
+		node2.m_Cfg.m_sPathLocal = g_sz2;
+		node2.m_Cfg.m_Listen.port(g_Port + 1);
+		node2.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node2.m_Cfg.m_Timeout = node.m_Cfg.m_Timeout;
+
+		node2.m_Cfg.m_BeaconPort = g_Port;
+
+		ECC::SetRandom(node.m_Cfg.m_WalletKey.V);
+		ECC::SetRandom(node2.m_Cfg.m_WalletKey.V);
+
+		node.Initialize();
+		node2.Initialize();
+
+		struct MyClient
+			:public proto::NodeConnection
 		{
 			Node* m_ppNode[2];
 			unsigned int m_iNode;
@@ -929,6 +2050,7 @@ namespace beam
 
 			std::set<ECC::Point> m_UtxosConfirmed;
 			std::list<ECC::Point> m_queProofsExpected;
+			std::list<std::vector<ECC::Point> > m_queProofsMultiExpected;
 			std::list<uint32_t> m_queProofsStateExpected;
 			std::list<uint32_t> m_queProofsKrnExpected;
 			uint32_t m_nChainWorkProofsPending = 0;
@@ -988,6 +2110,7 @@ namespace beam
 			{
 				return
 					m_queProofsExpected.empty() &&
+					m_queProofsMultiExpected.empty() &&
 					m_queProofsKrnExpected.empty() &&
 					m_queProofsStateExpected.empty() &&
 					!m_nChainWorkProofsPending;
@@ -1056,6 +2179,16 @@ namespace beam
 					m_queProofsExpected.push_back(msgOut.m_Utxo.m_Commitment);
 				}
 
+				{
+					// the same, batched
+					proto::GetProofUtxoMulti msgOut;
+					for (auto it = m_Wallet.m_MyUtxos.begin(); m_Wallet.m_MyUtxos.end() != it; it++)
+						msgOut.m_Utxos.push_back(ECC::Commitment(it->second.m_Key, it->second.m_Value));
+
+					Send(msgOut);
+					m_queProofsMultiExpected.push_back(std::move(msgOut.m_Utxos));
+				}
+
 				for (uint32_t i = 0; i < m_Wallet.m_MyKernels.size(); i++)
 				{
 					const MiniWallet::MyKernel mk = m_Wallet.m_MyKernels[i];
@@ -1130,6 +2263,70 @@ namespace beam
 					fail_test("unexpected proof");
 			}
 
+			virtual void OnMsg(proto::ProofUtxoMulti&& msg) override
+			{
+				if (!m_queProofsMultiExpected.empty())
+				{
+					// replied after the single queries above, wrt the same tip
+					const std::vector<ECC::Point>& vUtxos = m_queProofsMultiExpected.front();
+					const Input::MultiProof& mp = msg.m_Proofs;
+
+					verify_test(mp.m_vCounts.size() == vUtxos.size());
+
+					Input::MultiProof::Reader r(mp);
+					Input::MultiProof::Verifier v(mp, m_vStates.back().m_Definition);
+					Input::Proof p;
+					Input::State s;
+					bool bValid = false;
+					size_t nNodes = 0;
+
+					for (size_t i = 0; i < vUtxos.size(); i++)
+					{
+						Input inp;
+						inp.m_Commitment = vUtxos[i];
+
+						if (!mp.m_vCounts[i])
+							verify_test(m_UtxosConfirmed.end() == m_UtxosConfirmed.find(inp.m_Commitment));
+
+						for (uint32_t j = 0; j < mp.m_vCounts[i]; j++)
+						{
+							verify_test(r.Read(p));
+							verify_test(m_vStates.back().IsValidProofUtxo(inp, p));
+							nNodes += p.m_Proof.size();
+
+							verify_test(v.Read(inp, s, bValid) && bValid && (s.m_Maturity == p.m_State.m_Maturity));
+						}
+					}
+
+					verify_test(!r.Read(p)); // all consumed
+					verify_test(!v.Read(Input(), s, bValid));
+
+					if (!mp.m_vStates.empty())
+					{
+						// wrong definition
+						Merkle::Hash hvWrong = m_vStates.back().m_Definition;
+						hvWrong.m_pData[0] ^= 1;
+
+						size_t i = 0;
+						while (!mp.m_vCounts[i])
+							i++;
+
+						Input inp;
+						inp.m_Commitment = vUtxos[i];
+
+						Input::MultiProof::Verifier v2(mp, hvWrong);
+						verify_test(v2.Read(inp, s, bValid) && !bValid);
+					}
+					verify_test(mp.m_vHashes.size() <= nNodes);
+					if (mp.m_vStates.size() > 1)
+						verify_test(mp.m_vHashes.size() < nNodes); // at least the top nodes are shared
+
+					m_queProofsMultiExpected.pop_front();
+				}
+				else
+					fail_test("unexpected proof");
+			}
+
 			virtual void OnMsg(proto::ProofKernel&& msg) override
 			{
 				if (!m_queProofsKrnExpected.empty())
@@ -1159,6 +2356,15 @@ namespace beam
 				verify_test(m_nChainWorkProofsPending);
 				verify_test(!m_vStates.empty() && (msg.m_Proof.m_Heading.m_Prefix.m_Height + msg.m_Proof.m_Heading.m_vElements.size() - 1 == m_vStates.back().m_Height));
 				verify_test(msg.m_Proof.IsValid());
+
+				Block::SystemState::Full s;
+				msg.m_Proof.UnpackRoot(s);
+
+				Merkle::Hash hv0, hv1;
+				s.get_Hash(hv0);
+				m_vStates.back().get_Hash(hv1);
+				verify_test(hv0 == hv1);
+
 				m_nChainWorkProofsPending--;
 			}
 
@@ -1372,6 +2578,151 @@ namespace beam
 	};
 
 
+	void TestNodeTxVerifier(int nVerificationThreads)
+	{
+		// Node <-> Client: the transactions are verified asynchronously, the replies must come in order.
+		// Then the node is shut down with transactions still in flight.
+
+		io::Reactor::Ptr pReactor(io::Reactor::create());
+		io::Reactor::Scope scope(*pReactor);
+
+		struct MyClient
+			:public proto::NodeConnection
+		{
+			MiniWallet m_Wallet;
+			Height m_hTx = 0;
+
+			std::list<bool> m_queExpected;
+			std::vector<Transaction::KeyType> m_vValid;
+			std::vector<Transaction::KeyType> m_vInvalid;
+			bool m_bFlooded = false;
+			uint32_t m_nReplies = 0;
+
+			io::Timer::Ptr m_pTimer;
+
+			virtual void OnConnectedSecure() override
+			{
+				m_pTimer = io::Timer::create(io::Reactor::get_Current().shared_from_this());
+				m_pTimer->start(60 * 1000, false, []() {
+					fail_test("Timeout");
+					io::Reactor::get_Current().stop();
+				});
+
+				proto::Config msgCfg;
+				msgCfg.m_CfgChecksum = Rules::get().Checksum;
+				Send(msgCfg);
+
+				// sent at once, so that the valid and invalid ones may get into the same batch
+				SendTx(true);
+				SendTx(false);
+				SendTx(true);
+				SendTx(false);
+			}
+
+			void SendTx(bool bValid)
+			{
+				m_hTx++; // distinct keys for each tx
+
+				m_Wallet.m_MyUtxos.clear();
+				m_Wallet.AddMyUtxo(Rules::Coin * 10, m_hTx, KeyType::Regular);
+
+				proto::NewTransaction msg;
+				verify_test(m_Wallet.MakeTx(msg.m_Transaction, m_Wallet.m_MyUtxos.begin(), m_hTx, 0, 100));
+
+				if (!bValid)
+					msg.m_Transaction->m_vKernelsOutput[0]->m_Fee++; // the signature is broken
+
+				Transaction::KeyType key;
+				msg.m_Transaction->get_Key(key);
+				(bValid ? m_vValid : m_vInvalid).push_back(key);
+
+				m_queExpected.push_back(bValid);
+				Send(msg);
+			}
+
+			virtual void OnMsg(proto::Boolean&& msg) override
+			{
+				if (m_queExpected.empty())
+				{
+					fail_test("unexpected reply");
+					return;
+				}
+
+				verify_test(msg.m_Value == m_queExpected.front());
+				m_queExpected.pop_front();
+				m_nReplies++;
+
+				if (m_bFlooded)
+				{
+					// don't wait for the rest
+					io::Reactor::get_Current().stop();
+					return;
+				}
+
+				if (m_queExpected.empty())
+				{
+					for (uint32_t i = 0; i < 300; i++)
+						SendTx(true);
+
+					m_bFlooded = true;
+				}
+			}
+
+			virtual void OnDisconnect(const DisconnectReason&) override {
+				fail_test("OnDisconnect");
+				io::Reactor::get_Current().stop();
+			}
+		};
+
+		MyClient cl;
+		ECC::SetRandom(cl.m_Wallet.m_Kdf.m_Secret.V);
+
+		// the node is destroyed first, while the client is still connected
+		Node node;
+		node.m_Cfg.m_sPathLocal = g_sz;
+		node.m_Cfg.m_Listen.port(g_Port);
+		node.m_Cfg.m_Listen.ip(INADDR_ANY);
+		node.m_Cfg.m_VerificationThreads = nVerificationThreads;
+
+		node.Initialize();
+
+		// the budget is split, not doubled
+		verify_test(node.get_TxVerificationThreads() + node.get_BlockVerificationThreads() == (uint32_t) nVerificationThreads);
+		if (nVerificationThreads)
+			verify_test(node.get_TxVerificationThreads() && (node.get_TxVerificationThreads() < (uint32_t) nVerificationThreads));
+
+		io::Address addr;
+		addr.resolve("127.0.0.1");
+		addr.port(g_Port);
+
+		cl.Connect(addr);
+
+		pReactor->run();
+
+		verify_test(cl.m_bFlooded);
+		verify_test(cl.m_nReplies > 4);
+
+		NodeProcessor::TxPool::Element::Tx key;
+
+		for (size_t i = 0; i < cl.m_vInvalid.size(); i++)
+		{
+			key.m_Key = cl.m_vInvalid[i];
+			verify_test(node.get_TxPool().m_setTxs.end() == node.get_TxPool().m_setTxs.find(key));
+		}
+
+		for (size_t i = 0; i < 2; i++)
+		{
+			key.m_Key = cl.m_vValid[i];
+			verify_test(node.get_TxPool().m_setTxs.end() != node.get_TxPool().m_setTxs.find(key));
+		}
+
+		// the node is destroyed now, with the flooded transactions still in flight.
+		// In-context they're all verified already, but the replies may be pending as well
+		if (nVerificationThreads)
+			verify_test(!cl.m_queExpected.empty());
+	}
+
+
 	void TestChainworkProof()
 	{
 		ChainContext cc;
@@ -1422,6 +2773,11 @@ int main()
 	//	ports, wrong beacon and etc.
 	verify_test(beam::helpers::ProcessWideLock("/tmp/BEAM_node_test_lock"));
 
+#ifndef WIN32
+	// Some peers disconnect deliberately, the writes to them must not kill the process (the node binaries handle it as well)
+	signal(SIGPIPE, SIG_IGN);
+#endif // WIN32
+
 	DeleteFileA(beam::g_sz);
 	DeleteFileA(beam::g_sz2);
 
@@ -1431,6 +2787,23 @@ int main()
 	beam::TestNodeDB();
 	DeleteFileA(beam::g_sz);
 
+	printf("NodeDB bulk ingest test...\n");
+	fflush(stdout);
+
+	beam::TestNodeDBBulk(200000);
+	//beam::TestNodeDBBulk(5000000); // benchmark, takes a couple of minutes
+	DeleteFileA(beam::g_sz);
+
+	printf("TxPool test...\n");
+	fflush(stdout);
+
+	beam::TestTxPool();
+
+	printf("Broadcast test...\n");
+	fflush(stdout);
+
+	beam::TestBroadcast();
+
 	{
 		printf("NodeProcessor test1...\n");
 		fflush(stdout);
@@ -1446,6 +2819,35 @@ int main()
 
 		beam::TestNodeProcessor2(blockChain);
 		DeleteFileA(beam::g_sz);
+
+		printf("NodeProcessor batch verification test...\n");
+		fflush(stdout);
+
+		beam::TestNodeProcessorBatch(blockChain);
+		DeleteFileA(beam::g_sz2);
+
+		printf("NodeProcessor reorg test...\n");
+		fflush(stdout);
+
+		beam::TestNodeProcessorReorg();
+
+		printf("History compression test...\n");
+		fflush(stdout);
+
+		beam::TestNodeHistoryCompression(blockChain);
+		DeleteFileA(beam::g_sz);
+
+		printf("Snapshot sync test, stalling peer...\n");
+		fflush(stdout);
+
+		beam::TestNodeSnapshotSync(blockChain, false);
+
+		printf("Snapshot sync test, failing peer...\n");
+		fflush(stdout);
+
+		beam::TestNodeSnapshotSync(blockChain, true);
+		DeleteFileA(beam::g_sz);
+		DeleteFileA(beam::g_sz2);
 	}
 
 	printf("NodeX2 concurrent test...\n");
@@ -1462,5 +2864,14 @@ int main()
 	DeleteFileA(beam::g_sz);
 	DeleteFileA(beam::g_sz2);
 
+	printf("Node tx verification test...\n");
+	fflush(stdout);
+
+	beam::TestNodeTxVerifier(4);
+	DeleteFileA(beam::g_sz);
+
+	beam::TestNodeTxVerifier(0);
+	DeleteFileA(beam::g_sz);
+
 	return g_TestsFailed ? -1 : 0;
 }
@@ -1,6 +1,19 @@
 #include <assert.h>
+#include <string.h>
 #include "aes.h"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#	define BEAM_AES_X86
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#		define BEAM_AES_TARGET(x)
+#	else
+#		include <cpuid.h>
+#		define BEAM_AES_TARGET(x) __attribute__((target(x)))
+#	endif
+#endif // x86
+
 /*
 *  FIPS-197 compliant AES implementation
 *
@@ -824,8 +837,229 @@ void AES::StreamCipher::PerfXor(uint8_t* pBuf, uint32_t nSize)
 		pBuf[i] ^= pXor[i];
 }
 
+/* Hardware-accelerated CTR */
+
+#ifdef BEAM_AES_X86
+
+static void AesCpuId(uint32_t* p, uint32_t nLeaf)
+{
+#ifdef _MSC_VER
+	__cpuidex((int*) p, (int) nLeaf, 0);
+#else
+	__cpuid_count(nLeaf, 0, p[0], p[1], p[2], p[3]);
+#endif
+}
+
+static uint64_t AesXgetbv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t a, d;
+	__asm__ volatile ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return (uint64_t(d) << 32) | a;
+#endif
+}
+
+/* the round keys are kept as big-endian words, AES-NI wants them as bytes */
+static void AesLoadKeys(__m128i* pK, const uint32_t* pErk)
+{
+	for (int i = 0; i <= AES::Nr; i++)
+	{
+		uint8_t p[AES::s_BlockSize];
+		for (int j = 0; j < 4; j++)
+			PUT_UINT32(pErk[i * 4 + j], p, j * 4);
+
+		pK[i] = _mm_loadu_si128((const __m128i*) p);
+	}
+}
+
+static uint64_t AesBswap64(uint64_t x)
+{
+#ifdef _MSC_VER
+	return _byteswap_uint64(x);
+#else
+	return __builtin_bswap64(x);
+#endif
+}
+
+/* the big-endian counter, kept in native form during the bulk processing */
+struct AesCounter
+{
+	uint64_t m_Hi;
+	uint64_t m_Lo;
+
+	void Load(const AES::StreamCipher::Counter& ctr)
+	{
+		memcpy(&m_Hi, ctr.m_pData, sizeof(m_Hi));
+		memcpy(&m_Lo, ctr.m_pData + sizeof(m_Hi), sizeof(m_Lo));
+		m_Hi = AesBswap64(m_Hi);
+		m_Lo = AesBswap64(m_Lo);
+	}
+
+	void Save(AES::StreamCipher::Counter& ctr) const
+	{
+		uint64_t hi = AesBswap64(m_Hi), lo = AesBswap64(m_Lo);
+		memcpy(ctr.m_pData, &hi, sizeof(hi));
+		memcpy(ctr.m_pData + sizeof(hi), &lo, sizeof(lo));
+	}
+
+	__m128i Next()
+	{
+		__m128i x = _mm_set_epi64x((long long) AesBswap64(m_Lo), (long long) AesBswap64(m_Hi));
+		if (!++m_Lo)
+			m_Hi++;
+		return x;
+	}
+};
+
+/* several independent blocks per iteration, to hide the latency of the aesenc */
+BEAM_AES_TARGET("aes,sse2")
+static void XCryptNi(const uint32_t* pErk, AES::StreamCipher::Counter& ctr, uint8_t* p, uint32_t nBlocks)
+{
+	const uint32_t nLanes = 8;
+
+	__m128i pK[AES::Nr + 1];
+	AesLoadKeys(pK, pErk);
+
+	AesCounter c;
+	c.Load(ctr);
+
+	for (; nBlocks; )
+	{
+		uint32_t n = (nBlocks < nLanes) ? 1 : nLanes;
+
+		__m128i x[nLanes];
+		for (uint32_t i = 0; i < n; i++)
+			x[i] = _mm_xor_si128(c.Next(), pK[0]);
+
+		for (int r = 1; r < AES::Nr; r++)
+			for (uint32_t i = 0; i < n; i++)
+				x[i] = _mm_aesenc_si128(x[i], pK[r]);
+
+		for (uint32_t i = 0; i < n; i++)
+		{
+			__m128i* pDst = ((__m128i*) p) + i;
+			x[i] = _mm_aesenclast_si128(x[i], pK[AES::Nr]);
+			_mm_storeu_si128(pDst, _mm_xor_si128(x[i], _mm_loadu_si128(pDst)));
+		}
+
+		nBlocks -= n;
+		p += n * AES::s_BlockSize;
+	}
+
+	c.Save(ctr);
+}
+
+/* 2 blocks per register */
+BEAM_AES_TARGET("vaes,avx2,aes")
+static void XCryptVaes(const uint32_t* pErk, AES::StreamCipher::Counter& ctr, uint8_t* p, uint32_t nBlocks)
+{
+	const uint32_t nLanes = 4;
+
+	__m128i pK1[AES::Nr + 1];
+	AesLoadKeys(pK1, pErk);
+
+	__m256i pK[AES::Nr + 1];
+	for (int i = 0; i <= AES::Nr; i++)
+		pK[i] = _mm256_broadcastsi128_si256(pK1[i]);
+
+	AesCounter c;
+	c.Load(ctr);
+
+	for (; nBlocks >= nLanes * 2; nBlocks -= nLanes * 2, p += nLanes * 2 * AES::s_BlockSize)
+	{
+		__m256i x[nLanes];
+		for (uint32_t i = 0; i < nLanes; i++)
+		{
+			__m128i c0 = c.Next();
+			__m128i c1 = c.Next();
+			x[i] = _mm256_xor_si256(_mm256_inserti128_si256(_mm256_castsi128_si256(c0), c1, 1), pK[0]);
+		}
+
+		for (int r = 1; r < AES::Nr; r++)
+			for (uint32_t i = 0; i < nLanes; i++)
+				x[i] = _mm256_aesenc_epi128(x[i], pK[r]);
+
+		for (uint32_t i = 0; i < nLanes; i++)
+		{
+			__m256i* pDst = ((__m256i*) p) + i;
+			x[i] = _mm256_aesenclast_epi128(x[i], pK[AES::Nr]);
+			_mm256_storeu_si256(pDst, _mm256_xor_si256(x[i], _mm256_loadu_si256(pDst)));
+		}
+	}
+
+	c.Save(ctr);
+
+	if (nBlocks)
+		XCryptNi(pErk, ctr, p, nBlocks);
+}
+
+AES::StreamCipher::Impl::Enum AES::StreamCipher::Impl::get_Max()
+{
+	uint32_t p[4];
+	AesCpuId(p, 0);
+	uint32_t nLeafMax = p[0];
+	if (nLeafMax < 1)
+		return Portable;
+
+	AesCpuId(p, 1);
+	if (!(p[2] & (1 << 25))) // AES
+		return Portable;
+
+	// VAES needs AVX2, and the OS should preserve the ymm registers
+	const uint32_t nOsAvx = (1 << 27) | (1 << 28); // OSXSAVE, AVX
+	if ((nLeafMax >= 7) && ((p[2] & nOsAvx) == nOsAvx) && ((AesXgetbv() & 6) == 6))
+	{
+		AesCpuId(p, 7);
+		if ((p[1] & (1 << 5)) && (p[2] & (1 << 9))) // AVX2, VAES
+			return Vaes;
+	}
+
+	return AesNi;
+}
+
+#else // BEAM_AES_X86
+
+AES::StreamCipher::Impl::Enum AES::StreamCipher::Impl::get_Max()
+{
+	return Portable;
+}
+
+#endif // BEAM_AES_X86
+
+AES::StreamCipher::Impl::Enum AES::StreamCipher::Impl::s_Selected = AES::StreamCipher::Impl::get_Max();
+
 void AES::StreamCipher::XCrypt(const Encoder& enc, uint8_t* pBuf, uint32_t nSize)
 {
+#ifdef BEAM_AES_X86
+	if (Impl::Portable != Impl::s_Selected)
+	{
+		if (m_nBuf)
+		{
+			uint32_t n = (m_nBuf < nSize) ? m_nBuf : nSize;
+			PerfXor(pBuf, n);
+			pBuf += n;
+			nSize -= n;
+		}
+
+		uint32_t nBlocks = nSize / s_BlockSize;
+		if (nBlocks)
+		{
+			if (Impl::Vaes == Impl::s_Selected)
+				XCryptVaes(enc.m_erk, m_Counter, pBuf, nBlocks);
+			else
+				XCryptNi(enc.m_erk, m_Counter, pBuf, nBlocks);
+
+			pBuf += nBlocks * s_BlockSize;
+			nSize -= nBlocks * s_BlockSize;
+		}
+
+		if (!nSize)
+			return;
+	}
+#endif // BEAM_AES_X86
+
 	while (true)
 	{
 		if (!m_nBuf)
@@ -24,7 +24,20 @@ struct AES
 
 	struct StreamCipher
 	{
-		beam::uintBig_t<(s_BlockSize << 3)> m_Counter; // CTR mode
+		typedef beam::uintBig_t<(s_BlockSize << 3)> Counter;
+		Counter m_Counter; // CTR mode
+
+		// Whole blocks are processed by AES-NI (or VAES), if supported by the CPU. Detected at runtime.
+		struct Impl {
+			enum Enum {
+				Portable,
+				AesNi,
+				Vaes
+			};
+
+			static Enum get_Max(); // supported by the CPU
+			static Enum s_Selected; // initialized to get_Max(), may be lowered (i.e. for tests)
+		};
 
 		// generated cipherstream
 		uint8_t m_pBuf[s_BlockSize];
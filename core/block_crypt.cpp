@@ -117,6 +117,114 @@ namespace beam
 		return cmp_CaM(v);
 	}
 
+	void Input::MultiProof::Builder::Add(const Proof& p)
+	{
+		assert(!m_This.m_vCounts.empty());
+		m_This.m_vCounts.back()++;
+
+		m_This.m_vStates.push_back(p.m_State);
+		m_This.m_vPath.push_back((uint32_t) p.m_Proof.size());
+
+		for (size_t i = 0; i < p.m_Proof.size(); i++)
+		{
+			const Merkle::Node& n = p.m_Proof[i];
+
+			auto res = m_mapHashes.insert(std::make_pair(n.second, (uint32_t) m_This.m_vHashes.size()));
+			if (res.second)
+				m_This.m_vHashes.push_back(n.second);
+
+			m_This.m_vPath.push_back((res.first->second << 1) | (n.first ? 1 : 0));
+		}
+	}
+
+	bool Input::MultiProof::Reader::Read(Proof& p)
+	{
+		if ((m_iState >= m_This.m_vStates.size()) || (m_iPath >= m_This.m_vPath.size()))
+			return false;
+
+		p.m_State = m_This.m_vStates[m_iState++];
+
+		uint32_t nLen = m_This.m_vPath[m_iPath++];
+		if (nLen > m_This.m_vPath.size() - m_iPath)
+			return false;
+
+		p.m_Proof.resize(nLen);
+		for (uint32_t i = 0; i < nLen; i++)
+		{
+			uint32_t x = m_This.m_vPath[m_iPath++];
+			uint32_t iHash = x >> 1;
+			if (iHash >= m_This.m_vHashes.size())
+				return false;
+
+			p.m_Proof[i].first = (1 & x) != 0;
+			p.m_Proof[i].second = m_This.m_vHashes[iHash];
+		}
+
+		return true;
+	}
+
+	bool Input::MultiProof::Verifier::IsSamePath(size_t iPos, const std::pair<size_t, uint32_t>& x, uint32_t nLen) const
+	{
+		return
+			(x.second == nLen) &&
+			std::equal(m_This.m_vPath.begin() + iPos, m_This.m_vPath.begin() + iPos + nLen, m_This.m_vPath.begin() + x.first);
+	}
+
+	bool Input::MultiProof::Verifier::Read(const Input& inp, State& s, bool& bValid)
+	{
+		if ((m_iState >= m_This.m_vStates.size()) || (m_iPath >= m_This.m_vPath.size()))
+			return false;
+
+		s = m_This.m_vStates[m_iState++];
+
+		uint32_t nLen = m_This.m_vPath[m_iPath++];
+		if (nLen > m_This.m_vPath.size() - m_iPath)
+			return false;
+
+		size_t iPos = m_iPath;
+		m_iPath += nLen;
+
+		for (uint32_t i = 0; i < nLen; i++)
+			if ((m_This.m_vPath[iPos + i] >> 1) >= m_This.m_vHashes.size())
+				return false;
+
+		// same as Block::SystemState::Sequence::Element::IsValidProofUtxo: the last node should be at left, the one before at right
+		bValid =
+			(nLen >= 2) &&
+			!(1 & m_This.m_vPath[iPos + nLen - 1]) &&
+			(1 & m_This.m_vPath[iPos + nLen - 2]);
+
+		if (!bValid)
+			return true;
+
+		m_vNodes.resize(nLen);
+
+		Merkle::Hash hv;
+		s.get_ID(hv, inp);
+
+		uint32_t i = 0;
+		for (; i < nLen; i++)
+		{
+			auto it = m_mapVerified.find(hv);
+			if ((m_mapVerified.end() != it) && IsSamePath(iPos + i, it->second, nLen - i))
+				break; // the rest is already verified
+
+			m_vNodes[i] = hv;
+
+			uint32_t x = m_This.m_vPath[iPos + i];
+			Merkle::Interpret(hv, m_This.m_vHashes[x >> 1], (1 & x) != 0);
+		}
+
+		if (nLen == i)
+			bValid = (hv == m_hvDefinition);
+
+		if (bValid)
+			for (uint32_t j = 0; j < i; j++)
+				m_mapVerified.insert(std::make_pair(m_vNodes[j], std::make_pair(iPos + j, nLen - j)));
+
+		return true;
+	}
+
 	/////////////
 	// Output
 	bool Output::IsValid(ECC::Point::Native& comm) const
@@ -385,7 +493,7 @@ namespace beam
 	{
 		size_t nDel = 0;
 
-		size_t i1 = m_vOutputs.size();
+		size_t i1 = 0;
 		for (size_t i0 = 0; i0 < m_vInputs.size(); i0++)
 		{
 			Input::Ptr& pInp = m_vInputs[i0];
@@ -402,6 +510,7 @@ namespace beam
 						pInp.reset();
 						pOut.reset();
 						nDel++;
+						i1++;
 					}
 					break;
 				}
@@ -719,11 +828,11 @@ namespace beam
 		return m_PoW.IsValid(hv.m_pData, hv.nBytes);
 	}
 
-	bool Block::SystemState::Full::GeneratePoW(const PoW::Cancel& fnCancel)
+	bool Block::SystemState::Full::GeneratePoW(const PoW::Cancel& fnCancel, PoW::ISolver* pSolver)
 	{
 		Merkle::Hash hv;
 		get_HashForPoW(hv);
-		return m_PoW.Solve(hv.m_pData, hv.nBytes, fnCancel);
+		return m_PoW.Solve(hv.m_pData, hv.nBytes, fnCancel, pSolver);
 	}
 
 	bool Block::SystemState::Sequence::Element::IsValidProofUtxo(const Input& inp, const Input::Proof& p) const
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #pragma once
+#include <atomic>
 #include "ecc_native.h"
 #include "merkle.h"
 
@@ -184,6 +185,68 @@ namespace beam
 			static const uint32_t s_EntriesMax = 20; // if this is the size of the vector - the result is probably trunacted
 		};
 
+		// Proofs for several UTXOs wrt the same state, for batched queries.
+		// Proofs of the neighbor UTXOs share most of their nodes, and the top ones (incl. kernels and history) are shared by all of them.
+		// Each distinct hash is stored once, the proof paths refer to it by index.
+		struct MultiProof
+		{
+			std::vector<Merkle::Hash> m_vHashes; // distinct proof nodes
+			std::vector<uint32_t> m_vCounts; // number of proofs for each requested UTXO
+			std::vector<State> m_vStates; // for each proof
+			std::vector<uint32_t> m_vPath; // for each proof: its length, followed by its nodes, each is (index in m_vHashes << 1) | (is on the right)
+
+			template <typename Archive>
+			void serialize(Archive& ar)
+			{
+				ar
+					& m_vHashes
+					& m_vCounts
+					& m_vStates
+					& m_vPath;
+			}
+
+			class Builder
+			{
+				MultiProof& m_This;
+				std::map<Merkle::Hash, uint32_t> m_mapHashes;
+			public:
+				Builder(MultiProof& x) :m_This(x) {}
+
+				void NextUtxo() { m_This.m_vCounts.push_back(0); }
+				void Add(const Proof&); // for the last UTXO
+			};
+
+			class Reader
+			{
+				const MultiProof& m_This;
+				size_t m_iState;
+				size_t m_iPath;
+			public:
+				Reader(const MultiProof& x) :m_This(x) ,m_iState(0) ,m_iPath(0) {}
+
+				bool Read(Proof&); // the next proof, in order. False if the encoding is malformed
+			};
+
+			// Verifies all the proofs wrt the same definition in one pass. Once a path node is proven to lead to the definition,
+			// the proofs that reach it via the same remaining path stop there, i.e. the shared nodes are evaluated once.
+			class Verifier
+			{
+				const MultiProof& m_This;
+				const Merkle::Hash& m_hvDefinition;
+				size_t m_iState;
+				size_t m_iPath;
+				std::map<Merkle::Hash, std::pair<size_t, uint32_t> > m_mapVerified; // node -> its remaining path (position in m_vPath, length)
+				std::vector<Merkle::Hash> m_vNodes; // of the current proof
+
+				bool IsSamePath(size_t iPos, const std::pair<size_t, uint32_t>&, uint32_t nLen) const;
+			public:
+				Verifier(const MultiProof& x, const Merkle::Hash& hvDefinition) :m_This(x) ,m_hvDefinition(hvDefinition) ,m_iState(0) ,m_iPath(0) {}
+
+				// the next proof, in order. False if the encoding is malformed, otherwise bValid tells if the proof is valid
+				bool Read(const Input&, State&, bool& bValid);
+			};
+		};
+
 		int cmp(const Input&) const;
 		COMPARISON_VIA_CMP
 	};
@@ -399,12 +462,28 @@ namespace beam
 			bool IsValid(const void* pInput, uint32_t nSizeInput) const;
 
 			using Cancel = std::function<bool(bool bRetrying)>;
+
+			struct Helper; // equihash state for the specific input and nonce
+
+			// Solver backend. Not thread-safe, but should be reused for many nonces (the memory is allocated once)
+			struct ISolver
+			{
+				typedef std::unique_ptr<ISolver> Ptr;
+				typedef std::function<bool(const uint8_t* pSol)> SolutionFn; // nSolutionBytes. Returns true if accepted
+
+				virtual ~ISolver() {}
+
+				// returns false if no solution was accepted, or cancelled
+				virtual bool Solve(const Helper&, const SolutionFn&, const Cancel&) = 0;
+
+				static Ptr CreateDefault(); // bucketed radix sort, SIMD row generation
+				static Ptr CreateReference(); // the original implementation
+			};
+
 			// Difficulty and Nonce must be initialized. During the solution it's incremented each time by 1.
 			// returns false only if cancelled
-			bool Solve(const void* pInput, uint32_t nSizeInput, const Cancel& = [](bool) { return false; });
-
-		private:
-			struct Helper;
+			// If no solver is specified - the default one is used, created once per thread
+			bool Solve(const void* pInput, uint32_t nSizeInput, const Cancel& = [](bool) { return false; }, ISolver* = NULL);
 		};
 
 		struct SystemState
@@ -450,7 +529,7 @@ namespace beam
 
 				bool IsSane() const;
 				bool IsValidPoW() const;
-				bool GeneratePoW(const PoW::Cancel& = [](bool) { return false; });
+				bool GeneratePoW(const PoW::Cancel& = [](bool) { return false; }, PoW::ISolver* = NULL);
 
 				// the most robust proof verification - verifies the whole proof structure
 				bool IsValidProofState(const ID&, const Merkle::HardProof&) const;
@@ -510,6 +589,9 @@ namespace beam
 			{
 				return BodyBase::IsValid(hr, bSubsidyOpen, get_Reader());
 			}
+
+			// reads the serialized body directly, without full deserialization
+			class BufReader;
 		};
 
 		struct ChainWorkProof;
@@ -534,8 +616,10 @@ namespace beam
 
 	class TxBase::Context
 	{
-		bool ShouldVerify(uint32_t& iV) const;
+		bool ShouldVerify(uint32_t nCost);
 		bool ShouldAbort() const;
+		static uint32_t get_KernelCost(const TxKernel&);
+		static uint32_t get_OutputCost(const Output&);
 
 		bool HandleElementHeight(const HeightRange&);
 
@@ -568,9 +652,47 @@ namespace beam
 		// i.e. different elements may have non-overlapping valid range, and it's valid.
 		// Suitable for merged block validation
 
-		// for multi-tasking, parallel verification
-		uint32_t m_nVerifiers;
-		uint32_t m_iVerifier;
+		// for multi-tasking, parallel verification.
+		// Elements are split into chunks of roughly equal verification cost. Each verifier walks through all the elements
+		// (which is cheap), and verifies only those in the chunks it has grabbed. Once it passes its chunk - it grabs the next free one.
+		// Chunks are numbered consequently, so that the walk may continue across several transactions (blocks).
+		struct Scheduler
+		{
+			struct Cost
+			{
+				static const uint32_t Input = 1;
+				static const uint32_t OutputPublic = 4;
+				static const uint32_t OutputConfidential = 24;
+				static const uint32_t Kernel = 8; // per kernel, including nested
+				static const uint32_t Offset = 1;
+
+				static const uint32_t ChunkDef = 64;
+			};
+
+			struct Shared
+			{
+				std::atomic<uint32_t> m_iNext;
+				uint32_t m_ChunkCost;
+
+				Shared() { Reset(); }
+				void Reset();
+			};
+
+			Shared* m_pShared;
+
+			uint32_t m_iChunk; // of the current element
+			uint32_t m_iChunkMine;
+			uint32_t m_CostInChunk;
+
+			// stats
+			uint32_t m_nChunks;
+			uint64_t m_CostVerified;
+
+			Scheduler(Shared&);
+			bool ShouldVerify(uint32_t nCost);
+		};
+
+		Scheduler* m_pScheduler; // if not set - all the elements are verified
 		volatile bool* m_pAbort;
 
 		Context() { Reset(); }
@@ -645,7 +767,54 @@ namespace beam
 		virtual void put_NextHdr(const SystemState::Sequence::Element&) override;
 	};
 
-	struct Block::ChainWorkProof
+	class Block::Body::BufReader
+		:public TxBase::IReader
+	{
+		struct Stream
+		{
+			const uint8_t* m_pPos;
+			const uint8_t* m_pEnd;
+			uint64_t m_nRemaining; // elements
+		};
+
+		Stream m_pStart[4];
+		Stream m_pS[4];
+
+		// Each element is decoded into one of 2 slots alternately (the pointer must stay valid during the consequent call).
+		// No allocations once the slots are warmed-up.
+		Input m_pSlotUtxoIn[2];
+		Output m_pSlotUtxoOut[2];
+		TxKernel m_pSlotKernelIn[2];
+		TxKernel m_pSlotKernelOut[2];
+		uint8_t m_pSlot[4];
+
+		template <typename T>
+		static void Decode(Stream&, T&);
+
+		template <typename T>
+		static const uint8_t* Locate(Stream&, const uint8_t* pPos, const uint8_t* pEnd, T& slot);
+
+		template <typename T>
+		static void LoadInternal(const T*& pPtr, Stream&, T* pSlot, uint8_t& iSlot);
+
+	public:
+
+		BufReader();
+
+		// Decodes the BodyBase, and locates the element vectors (all the elements are decoded once to find their boundaries).
+		// Returns false if the buffer is malformed. The buffer must remain valid while the reader (and its clones) is used.
+		bool Open(const void* p, size_t n, BodyBase&);
+
+		// IReader
+		virtual void Clone(Ptr&) override;
+		virtual void Reset() override;
+		virtual void NextUtxoIn() override;
+		virtual void NextUtxoOut() override;
+		virtual void NextKernelIn() override;
+		virtual void NextKernelOut() override;
+	};
+
+	struct Block::ChainWorkProof
 	{
 		// Compressed consecutive states (likely to appear at the end)
 		struct Heading {
@@ -677,6 +846,7 @@ namespace beam
 		bool IsValid() const;
 		bool Crop(); // according to current bound
 		bool IsEmpty() const { return m_Heading.m_vElements.empty(); }
+		void UnpackRoot(SystemState::Full&) const; // must not be empty
 
 		template <typename Archive>
 		void serialize(Archive& ar)
@@ -209,6 +209,141 @@ namespace beam
 		arc & v;
 	}
 
+	/////////////
+	// BufReader
+	Block::Body::BufReader::BufReader()
+	{
+		ZeroObject(m_pStart);
+		ZeroObject(m_pS);
+		ZeroObject(m_pSlot);
+
+		m_pUtxoIn = NULL;
+		m_pUtxoOut = NULL;
+		m_pKernelIn = NULL;
+		m_pKernelOut = NULL;
+	}
+
+	template <typename T>
+	void Block::Body::BufReader::Decode(Stream& s, T& v)
+	{
+		detail::SerializeIstream is;
+		is.reset(s.m_pPos, s.m_pEnd - s.m_pPos);
+
+		yas::binary_iarchive<detail::SerializeIstream, SERIALIZE_OPTIONS> arc(is);
+
+		bool b; // same encoding as std::unique_ptr
+		arc & b;
+		if (!b)
+			throw std::runtime_error("invalid NULL ptr");
+
+		arc & v;
+
+		s.m_pPos = reinterpret_cast<const uint8_t*>(is.cur);
+		s.m_nRemaining--;
+	}
+
+	template <typename T>
+	const uint8_t* Block::Body::BufReader::Locate(Stream& s, const uint8_t* pPos, const uint8_t* pEnd, T& slot)
+	{
+		detail::SerializeIstream is;
+		is.reset(pPos, pEnd - pPos);
+
+		yas::binary_iarchive<detail::SerializeIstream, SERIALIZE_OPTIONS> arc(is);
+
+		s.m_nRemaining = arc.read_seq_size();
+		s.m_pPos = reinterpret_cast<const uint8_t*>(is.cur);
+		s.m_pEnd = pEnd;
+
+		Stream s2 = s;
+		while (s2.m_nRemaining)
+			Decode(s2, slot);
+
+		return s2.m_pPos;
+	}
+
+	bool Block::Body::BufReader::Open(const void* p, size_t n, BodyBase& body)
+	{
+		const uint8_t* pEnd = reinterpret_cast<const uint8_t*>(p) + n;
+
+		try
+		{
+			detail::SerializeIstream is;
+			is.reset(p, n);
+
+			yas::binary_iarchive<detail::SerializeIstream, SERIALIZE_OPTIONS> arc(is);
+			arc & body;
+
+			const uint8_t* pPos = reinterpret_cast<const uint8_t*>(is.cur);
+
+			// same order as TxVectors serialization
+			pPos = Locate(m_pStart[0], pPos, pEnd, m_pSlotUtxoIn[0]);
+			pPos = Locate(m_pStart[1], pPos, pEnd, m_pSlotUtxoOut[0]);
+			pPos = Locate(m_pStart[2], pPos, pEnd, m_pSlotKernelIn[0]);
+			Locate(m_pStart[3], pPos, pEnd, m_pSlotKernelOut[0]);
+		}
+		catch (const std::exception&)
+		{
+			ZeroObject(m_pStart);
+			return false;
+		}
+
+		return true;
+	}
+
+	void Block::Body::BufReader::Clone(Ptr& pOut)
+	{
+		BufReader* pRet = new BufReader;
+		pOut.reset(pRet);
+
+		static_assert(sizeof(pRet->m_pStart) == sizeof(m_pStart), "");
+		memcpy(pRet->m_pStart, m_pStart, sizeof(m_pStart));
+	}
+
+	void Block::Body::BufReader::Reset()
+	{
+		static_assert(sizeof(m_pS) == sizeof(m_pStart), "");
+		memcpy(m_pS, m_pStart, sizeof(m_pStart));
+
+		// the buffer was already validated in Open(), decoding can't fail
+		LoadInternal(m_pUtxoIn, m_pS[0], m_pSlotUtxoIn, m_pSlot[0]);
+		LoadInternal(m_pUtxoOut, m_pS[1], m_pSlotUtxoOut, m_pSlot[1]);
+		LoadInternal(m_pKernelIn, m_pS[2], m_pSlotKernelIn, m_pSlot[2]);
+		LoadInternal(m_pKernelOut, m_pS[3], m_pSlotKernelOut, m_pSlot[3]);
+	}
+
+	void Block::Body::BufReader::NextUtxoIn()
+	{
+		LoadInternal(m_pUtxoIn, m_pS[0], m_pSlotUtxoIn, m_pSlot[0]);
+	}
+
+	void Block::Body::BufReader::NextUtxoOut()
+	{
+		LoadInternal(m_pUtxoOut, m_pS[1], m_pSlotUtxoOut, m_pSlot[1]);
+	}
+
+	void Block::Body::BufReader::NextKernelIn()
+	{
+		LoadInternal(m_pKernelIn, m_pS[2], m_pSlotKernelIn, m_pSlot[2]);
+	}
+
+	void Block::Body::BufReader::NextKernelOut()
+	{
+		LoadInternal(m_pKernelOut, m_pS[3], m_pSlotKernelOut, m_pSlot[3]);
+	}
+
+	template <typename T>
+	void Block::Body::BufReader::LoadInternal(const T*& pPtr, Stream& s, T* pSlot, uint8_t& iSlot)
+	{
+		if (s.m_nRemaining)
+		{
+			iSlot ^= 1;
+			Decode(s, pSlot[iSlot]);
+			pPtr = pSlot + iSlot;
+		}
+		else
+			pPtr = NULL;
+	}
+
 	void TxBase::IWriter::Dump(IReader&& r)
 	{
 		r.Reset();
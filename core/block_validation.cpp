@@ -26,21 +26,71 @@ namespace beam
 		ZeroObject(m_Coinbase);
 		m_Height.Reset();
 		m_bBlockMode = false;
-		m_nVerifiers = 1;
-		m_iVerifier = 0;
+		m_pScheduler = NULL;
 		m_pAbort = NULL;
 	}
 
-	bool TxBase::Context::ShouldVerify(uint32_t& iV) const
+	void TxBase::Context::Scheduler::Shared::Reset()
 	{
-		if (iV)
+		m_iNext = 0;
+		m_ChunkCost = Cost::ChunkDef;
+	}
+
+	TxBase::Context::Scheduler::Scheduler(Shared& s)
+		:m_pShared(&s)
+		,m_iChunk(0)
+		,m_CostInChunk(0)
+		,m_nChunks(1)
+		,m_CostVerified(0)
+	{
+		m_iChunkMine = m_pShared->m_iNext++;
+	}
+
+	bool TxBase::Context::Scheduler::ShouldVerify(uint32_t nCost)
+	{
+		if (m_iChunk > m_iChunkMine)
 		{
-			iV--;
-			return false;
+			// grab the next one. Since chunks are grabbed in ascending order - it can't be behind us
+			m_iChunkMine = m_pShared->m_iNext++;
+			m_nChunks++;
 		}
 
-		iV = m_nVerifiers - 1;
-		return true;
+		assert(m_iChunkMine >= m_iChunk);
+		bool bMine = (m_iChunk == m_iChunkMine);
+
+		if (bMine)
+			m_CostVerified += nCost;
+
+		m_CostInChunk += nCost;
+		if (m_CostInChunk >= m_pShared->m_ChunkCost)
+		{
+			m_iChunk++;
+			m_CostInChunk = 0;
+		}
+
+		return bMine;
+	}
+
+	bool TxBase::Context::ShouldVerify(uint32_t nCost)
+	{
+		return !m_pScheduler || m_pScheduler->ShouldVerify(nCost);
+	}
+
+	uint32_t TxBase::Context::get_KernelCost(const TxKernel& krn)
+	{
+		uint32_t nCost = Scheduler::Cost::Kernel;
+		for (size_t i = 0; i < krn.m_vNested.size(); i++)
+			nCost += get_KernelCost(*krn.m_vNested[i]);
+
+		return nCost;
+	}
+
+	uint32_t TxBase::Context::get_OutputCost(const Output& outp)
+	{
+		if (outp.m_pConfidential)
+			return Scheduler::Cost::OutputConfidential;
+
+		return Scheduler::Cost::OutputPublic;
 	}
 
 	bool TxBase::Context::ShouldAbort() const
@@ -82,9 +132,6 @@ namespace beam
 		m_Sigma = -m_Sigma;
 		AmountBig feeInp; // dummy var
 
-		assert(m_nVerifiers);
-		uint32_t iV = m_iVerifier;
-
 		// Inputs
 		r.Reset();
 
@@ -95,7 +142,7 @@ namespace beam
 			if (ShouldAbort())
 				return false;
 
-			if (ShouldVerify(iV))
+			if (ShouldVerify(Scheduler::Cost::Input))
 			{
 				if (pPrev && (*pPrev > *r.m_pUtxoIn))
 					return false;
@@ -133,7 +180,7 @@ namespace beam
 				}
 			}
 
-			if (ShouldVerify(iV))
+			if (ShouldVerify(get_KernelCost(*r.m_pKernelIn)))
 			{
 				if (pPrev && (*pPrev > *r.m_pKernelIn))
 					return false;
@@ -153,7 +200,7 @@ namespace beam
 			if (ShouldAbort())
 				return false;
 
-			if (ShouldVerify(iV))
+			if (ShouldVerify(get_OutputCost(*r.m_pUtxoOut)))
 			{
 				if (pPrev && (*pPrev > *r.m_pUtxoOut))
 					return false;
@@ -179,7 +226,7 @@ namespace beam
 			if (ShouldAbort())
 				return false;
 
-			if (ShouldVerify(iV))
+			if (ShouldVerify(get_KernelCost(*r.m_pKernelOut)))
 			{
 				if (pPrev && (*pPrev > *r.m_pKernelOut))
 					return false;
@@ -192,7 +239,7 @@ namespace beam
 			}
 		}
 
-		if (ShouldVerify(iV))
+		if (ShouldVerify(Scheduler::Cost::Offset))
 			m_Sigma += ECC::Context::get().G * txb.m_Offset;
 
 		assert(!m_Height.IsEmpty());
@@ -213,6 +213,21 @@ namespace beam
 			(m_Proof.m_vData.size() == iHash);
 	}
 
+	void Block::ChainWorkProof::UnpackRoot(SystemState::Full& s) const
+	{
+		assert(!IsEmpty());
+
+		((SystemState::Sequence::Prefix&) s) = m_Heading.m_Prefix;
+		((SystemState::Sequence::Element&) s) = m_Heading.m_vElements.back();
+
+		for (size_t i = m_Heading.m_vElements.size() - 1; i--; )
+		{
+			s.NextPrefix();
+			((SystemState::Sequence::Element&) s) = m_Heading.m_vElements[i];
+			s.m_PoW.m_Difficulty.Inc(s.m_ChainWork);
+		}
+	}
+
 	bool Block::ChainWorkProof::Crop()
 	{
 		size_t iState, iHash;
@@ -88,6 +88,16 @@ namespace std
 		m_F.seekg(0);
 	}
 
+	void FStream::Seek(uint64_t nPos)
+	{
+		m_Remaining += m_F.tellg();
+		if (nPos > m_Remaining)
+			nPos = m_Remaining;
+
+		m_F.seekg(nPos);
+		m_Remaining -= nPos;
+	}
+
 	void FStream::NotImpl()
 	{
 		throw runtime_error("not impl");
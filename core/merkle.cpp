@@ -16,14 +16,25 @@
 #include "merkle.h"
 #include "ecc_native.h"
 
+// The SIMD implementations are chosen at compile time, according to the target CPU
+#if defined(__SSE2__) || defined(_M_X64)
+#	define BEAM_MERKLE_MULTI_SSE2
+#	include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#	define BEAM_MERKLE_MULTI_AVX2
+#	include <immintrin.h>
+#endif
+
+#if defined(__SHA__) && defined(__SSE4_1__)
+#	define BEAM_MERKLE_SHANI
+#	include <immintrin.h>
+#endif
+
 namespace beam {
 namespace Merkle {
 
-void Interpret(Hash& out, const Hash& hLeft, const Hash& hRight)
-{
-	ECC::Hash::Processor() << hLeft << hRight >> out;
-}
-
 void Interpret(Hash& hOld, const Hash& hNew, bool bNewOnRight)
 {
 	if (bNewOnRight)
@@ -43,6 +54,317 @@ void Interpret(Hash& hash, const Proof& p)
 		Interpret(hash, *it);
 }
 
+/////////////////////////////
+// Multi-buffer hashing
+// Each pair is a single 64-byte message, i.e. 2 SHA-256 blocks. The 2nd one is the padding only, its message schedule is constant.
+namespace
+{
+	const uint32_t s_pK[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	const uint32_t s_pH0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	struct PaddingSchedule
+	{
+		uint32_t m_pKW[64]; // K + W of the padding block
+
+		static uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+		PaddingSchedule()
+		{
+			uint32_t pW[64] = { 0x80000000 };
+			pW[15] = 512; // message length in bits
+
+			for (int i = 16; i < 64; i++)
+			{
+				uint32_t s0 = Rotr(pW[i - 15], 7) ^ Rotr(pW[i - 15], 18) ^ (pW[i - 15] >> 3);
+				uint32_t s1 = Rotr(pW[i - 2], 17) ^ Rotr(pW[i - 2], 19) ^ (pW[i - 2] >> 10);
+				pW[i] = pW[i - 16] + s0 + pW[i - 7] + s1;
+			}
+
+			for (int i = 0; i < 64; i++)
+				m_pKW[i] = s_pK[i] + pW[i];
+		}
+	};
+
+	const PaddingSchedule s_Padding;
+
+	uint32_t LoadBE(const uint8_t* p)
+	{
+		return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+	}
+
+	void StoreBE(uint8_t* p, uint32_t n)
+	{
+		p[0] = uint8_t(n >> 24);
+		p[1] = uint8_t(n >> 16);
+		p[2] = uint8_t(n >> 8);
+		p[3] = uint8_t(n);
+	}
+
+	// Several independent SHA-256 computations, a lane per message
+	template <typename T>
+	struct Sha256Lanes
+	{
+		typedef typename T::V V;
+
+		template <int n>
+		static V Rotr(V x) { return T::Or(T::template Shr<n>(x), T::template Shl<32 - n>(x)); }
+
+		static V Ch(V e, V f, V g) { return T::Xor(T::And(e, f), T::AndNot(e, g)); }
+		static V Maj(V a, V b, V c) { return T::Or(T::And(a, b), T::And(c, T::Or(a, b))); }
+
+		static V Sigma0(V a) { return T::Xor(T::Xor(Rotr<2>(a), Rotr<13>(a)), Rotr<22>(a)); }
+		static V Sigma1(V e) { return T::Xor(T::Xor(Rotr<6>(e), Rotr<11>(e)), Rotr<25>(e)); }
+		static V sigma0(V w) { return T::Xor(T::Xor(Rotr<7>(w), Rotr<18>(w)), T::template Shr<3>(w)); }
+		static V sigma1(V w) { return T::Xor(T::Xor(Rotr<17>(w), Rotr<19>(w)), T::template Shr<10>(w)); }
+
+		static void Round(V* s, V kw)
+		{
+			V t1 = T::Add(T::Add(T::Add(s[7], Sigma1(s[4])), Ch(s[4], s[5], s[6])), kw);
+			V t2 = T::Add(Sigma0(s[0]), Maj(s[0], s[1], s[2]));
+
+			s[7] = s[6];
+			s[6] = s[5];
+			s[5] = s[4];
+			s[4] = T::Add(s[3], t1);
+			s[3] = s[2];
+			s[2] = s[1];
+			s[1] = s[0];
+			s[0] = T::Add(t1, t2);
+		}
+
+		static V LoadWord(const Hash* const* pp, uint32_t iWord)
+		{
+			uint32_t p[T::s_Lanes];
+			for (uint32_t j = 0; j < T::s_Lanes; j++)
+				p[j] = LoadBE(pp[j]->m_pData + iWord * 4);
+			return T::Load(p);
+		}
+
+		static void Process(Hash* const* ppOut, const Hash* const* ppLeft, const Hash* const* ppRight)
+		{
+			V pW[16];
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				pW[i] = LoadWord(ppLeft, i);
+				pW[i + 8] = LoadWord(ppRight, i);
+			}
+
+			V pS[8], pMid[8];
+			for (int i = 0; i < 8; i++)
+				pS[i] = T::Set(s_pH0[i]);
+
+			for (int i = 0; i < 64; i++)
+			{
+				if (i >= 16)
+					pW[i & 0xf] = T::Add(T::Add(T::Add(pW[i & 0xf], sigma0(pW[(i + 1) & 0xf])), pW[(i + 9) & 0xf]), sigma1(pW[(i + 14) & 0xf]));
+
+				Round(pS, T::Add(pW[i & 0xf], T::Set(s_pK[i])));
+			}
+
+			for (int i = 0; i < 8; i++)
+				pMid[i] = pS[i] = T::Add(pS[i], T::Set(s_pH0[i]));
+
+			for (int i = 0; i < 64; i++)
+				Round(pS, T::Set(s_Padding.m_pKW[i]));
+
+			for (int i = 0; i < 8; i++)
+			{
+				uint32_t pRes[T::s_Lanes];
+				T::Store(pRes, T::Add(pS[i], pMid[i]));
+
+				for (uint32_t j = 0; j < T::s_Lanes; j++)
+					StoreBE(ppOut[j]->m_pData + i * 4, pRes[j]);
+			}
+		}
+
+		// returns the number of the processed pairs (multiple of lanes)
+		static uint32_t ProcessAll(Hash* const* ppOut, const Hash* const* ppLeft, const Hash* const* ppRight, uint32_t nCount)
+		{
+			uint32_t i = 0;
+			for (; i + T::s_Lanes <= nCount; i += T::s_Lanes)
+				Process(ppOut + i, ppLeft + i, ppRight + i);
+			return i;
+		}
+	};
+
+#ifdef BEAM_MERKLE_MULTI_SSE2
+	struct LanesSse2
+	{
+		static const uint32_t s_Lanes = 4;
+		typedef __m128i V;
+
+		static V Add(V a, V b) { return _mm_add_epi32(a, b); }
+		static V Xor(V a, V b) { return _mm_xor_si128(a, b); }
+		static V And(V a, V b) { return _mm_and_si128(a, b); }
+		static V AndNot(V a, V b) { return _mm_andnot_si128(a, b); }
+		static V Or(V a, V b) { return _mm_or_si128(a, b); }
+		static V Set(uint32_t n) { return _mm_set1_epi32((int) n); }
+		template <int n> static V Shr(V x) { return _mm_srli_epi32(x, n); }
+		template <int n> static V Shl(V x) { return _mm_slli_epi32(x, n); }
+		static V Load(const uint32_t* p) { return _mm_loadu_si128((const V*) p); }
+		static void Store(uint32_t* p, V x) { _mm_storeu_si128((V*) p, x); }
+	};
+#endif // BEAM_MERKLE_MULTI_SSE2
+
+#ifdef BEAM_MERKLE_MULTI_AVX2
+	struct LanesAvx2
+	{
+		static const uint32_t s_Lanes = 8;
+		typedef __m256i V;
+
+		static V Add(V a, V b) { return _mm256_add_epi32(a, b); }
+		static V Xor(V a, V b) { return _mm256_xor_si256(a, b); }
+		static V And(V a, V b) { return _mm256_and_si256(a, b); }
+		static V AndNot(V a, V b) { return _mm256_andnot_si256(a, b); }
+		static V Or(V a, V b) { return _mm256_or_si256(a, b); }
+		static V Set(uint32_t n) { return _mm256_set1_epi32((int) n); }
+		template <int n> static V Shr(V x) { return _mm256_srli_epi32(x, n); }
+		template <int n> static V Shl(V x) { return _mm256_slli_epi32(x, n); }
+		static V Load(const uint32_t* p) { return _mm256_loadu_si256((const V*) p); }
+		static void Store(uint32_t* p, V x) { _mm256_storeu_si256((V*) p, x); }
+	};
+#endif // BEAM_MERKLE_MULTI_AVX2
+
+#ifdef BEAM_MERKLE_SHANI
+	// A single message, but the dedicated instructions are faster than several lanes of the generic code
+	struct Sha256Ni
+	{
+		static __m128i get_Mask() { return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); } // byte order within the words
+
+		static void Rounds4(__m128i& s0, __m128i& s1, __m128i kw)
+		{
+			s1 = _mm_sha256rnds2_epu32(s1, s0, kw);
+			s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(kw, 0x0E));
+		}
+
+		static void Process(Hash& out, const Hash& hLeft, const Hash& hRight)
+		{
+			const __m128i mask = get_Mask();
+
+			__m128i m[4];
+			m[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) hLeft.m_pData), mask);
+			m[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (hLeft.m_pData + 16)), mask);
+			m[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) hRight.m_pData), mask);
+			m[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (hRight.m_pData + 16)), mask);
+
+			// the state is kept as ABEF/CDGH
+			__m128i t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) s_pH0), 0xB1); // CDAB
+			__m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) (s_pH0 + 4)), 0x1B); // EFGH
+			__m128i s0 = _mm_alignr_epi8(t, s1, 8); // ABEF
+			s1 = _mm_blend_epi16(s1, t, 0xF0); // CDGH
+
+			__m128i s0Prev = s0, s1Prev = s1;
+
+			for (int i = 0; i < 16; i++)
+			{
+				if (i >= 4)
+				{
+					// m[i & 3] is the group i-4, m[(i + 1) & 3] is i-3, etc.
+					t = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+					t = _mm_add_epi32(t, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+					m[i & 3] = _mm_sha256msg2_epu32(t, m[(i + 3) & 3]);
+				}
+
+				Rounds4(s0, s1, _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i*) (s_pK + i * 4))));
+			}
+
+			s0Prev = s0 = _mm_add_epi32(s0, s0Prev);
+			s1Prev = s1 = _mm_add_epi32(s1, s1Prev);
+
+			for (int i = 0; i < 16; i++)
+				Rounds4(s0, s1, _mm_loadu_si128((const __m128i*) (s_Padding.m_pKW + i * 4)));
+
+			s0 = _mm_add_epi32(s0, s0Prev);
+			s1 = _mm_add_epi32(s1, s1Prev);
+
+			t = _mm_shuffle_epi32(s0, 0x1B); // FEBA
+			s1 = _mm_shuffle_epi32(s1, 0xB1); // DCHG
+			s0 = _mm_blend_epi16(t, s1, 0xF0); // DCBA
+			s1 = _mm_alignr_epi8(s1, t, 8); // HGFE
+
+			_mm_storeu_si128((__m128i*) out.m_pData, _mm_shuffle_epi8(s0, mask));
+			_mm_storeu_si128((__m128i*) (out.m_pData + 16), _mm_shuffle_epi8(s1, mask));
+		}
+	};
+#endif // BEAM_MERKLE_SHANI
+
+	void InterpretScalar(Hash& out, const Hash& hLeft, const Hash& hRight)
+	{
+		ECC::Hash::Processor() << hLeft << hRight >> out;
+	}
+
+} // namespace
+
+HashImpl::Enum HashImpl::get_Max()
+{
+#if defined(BEAM_MERKLE_SHANI)
+	return ShaNi;
+#elif defined(BEAM_MERKLE_MULTI_AVX2)
+	return Avx2;
+#elif defined(BEAM_MERKLE_MULTI_SSE2)
+	return Sse2;
+#else
+	return Scalar;
+#endif
+}
+
+HashImpl::Enum HashImpl::s_Selected = HashImpl::get_Max();
+
+void InterpretMulti(Hash* const* ppOut, const Hash* const* ppLeft, const Hash* const* ppRight, uint32_t nCount)
+{
+	uint32_t i = 0;
+
+	switch (HashImpl::s_Selected)
+	{
+#ifdef BEAM_MERKLE_SHANI
+	case HashImpl::ShaNi:
+		for (; i < nCount; i++)
+			Sha256Ni::Process(*ppOut[i], *ppLeft[i], *ppRight[i]);
+		break;
+#endif // BEAM_MERKLE_SHANI
+
+#ifdef BEAM_MERKLE_MULTI_AVX2
+	case HashImpl::Avx2:
+		i = Sha256Lanes<LanesAvx2>::ProcessAll(ppOut, ppLeft, ppRight, nCount);
+		// no break, the remaining pairs are processed by the narrower implementations
+#endif // BEAM_MERKLE_MULTI_AVX2
+
+#ifdef BEAM_MERKLE_MULTI_SSE2
+	case HashImpl::Sse2:
+		i += Sha256Lanes<LanesSse2>::ProcessAll(ppOut + i, ppLeft + i, ppRight + i, nCount - i);
+		// no break
+#endif // BEAM_MERKLE_MULTI_SSE2
+
+	default:
+		for (; i < nCount; i++)
+			InterpretScalar(*ppOut[i], *ppLeft[i], *ppRight[i]);
+	}
+}
+
+void Interpret(Hash& out, const Hash& hLeft, const Hash& hRight)
+{
+#ifdef BEAM_MERKLE_SHANI
+	if (HashImpl::ShaNi == HashImpl::s_Selected)
+	{
+		Sha256Ni::Process(out, hLeft, hRight);
+		return;
+	}
+#endif // BEAM_MERKLE_SHANI
+
+	InterpretScalar(out, hLeft, hRight);
+}
 
 /////////////////////////////
 // Mmr
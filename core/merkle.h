@@ -61,6 +61,23 @@ namespace Merkle {
 	void Interpret(Hash&, const Hash& hLeft, const Hash& hRight);
 	void Interpret(Hash&, const Hash& hNew, bool bNewOnRight);
 
+	// Multiple independent Interpret(out, left, right). Hashed simultaneously (multi-buffer SHA-256) where supported.
+	// Output may alias the input of the same pair.
+	void InterpretMulti(Hash* const* ppOut, const Hash* const* ppLeft, const Hash* const* ppRight, uint32_t nCount);
+
+	struct HashImpl
+	{
+		enum Enum {
+			Scalar,
+			Sse2, // 4 lanes
+			Avx2, // 8 lanes
+			ShaNi, // dedicated instructions, single message
+		};
+
+		static Enum get_Max(); // the best one compiled in (according to the target CPU)
+		static Enum s_Selected; // get_Max() by default, can be lowered (for tests)
+	};
+
 	struct Mmr
 	{
 		uint64_t m_Count;
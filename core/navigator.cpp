@@ -244,6 +244,13 @@ namespace beam
 		m_nBanks = d.m_nBanks;
 	}
 
+	void MappedFile::SetSize(Offset n)
+	{
+		CloseMapping();
+		Resize(n);
+		OpenMapping();
+	}
+
 	void* MappedFile::get_FixedHdr() const
 	{
 		return m_pMapping + m_nBank0 + m_nBanks * sizeof(Bank);
@@ -71,6 +71,9 @@ namespace beam
 
 		void* get_FixedHdr() const;
 
+		Offset get_Size() const { return m_nMapping; }
+		void SetSize(Offset); // the file is re-mapped, all the pointers are invalidated
+
 		template <typename T> T& get_At(Offset n) const
 		{
 			assert(m_pMapping && (m_nMapping >= n + sizeof(T)));
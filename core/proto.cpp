@@ -75,21 +75,65 @@ void ProtocolPlus::get_HMac(ECC::Hash::Mac& hm, MacValue& res)
 	res = hv;
 }
 
-void ProtocolPlus::Encrypt(SerializedMsg& sm, MsgSerializer& ser)
+void ProtocolPlus::Finalize(SerializedMsg& sm, MsgSerializer& ser)
 {
-	MacValue hmac;
-
 	if (Mode::Plaintext != m_Mode)
 	{
-		// 1. append dummy of the needed size
-		hmac = Zero;
+		// append dummy of the needed size
+		MacValue hmac = Zero;
 		ser & hmac;
 	}
 
 	ser.finalize(sm);
+}
+
+void ProtocolPlus::EncryptTo(uint8_t* pDst, const SerializedMsg& sm, size_t nSize)
+{
+	bool bSecure = (Mode::Plaintext != m_Mode);
+	assert(!bSecure || (nSize >= MacValue::nBytes));
+	size_t n2 = bSecure ? (nSize - MacValue::nBytes) : nSize; // w/o the MAC placeholder
+
+	ECC::Hash::Mac hm = m_HMac;
+
+	// Single pass: each fragment is copied, hashed and encrypted while it's still in cache. The stream cipher doesn't depend on the MAC,
+	// only the MAC itself (at the end) is encrypted after all the rest.
+	uint8_t* p = pDst;
+	for (size_t i = 0; i < sm.size(); i++)
+	{
+		const io::IOVec& iov = sm[i];
+		memcpy(p, iov.data, iov.size);
+
+		size_t nOffs = p - pDst;
+		if (bSecure && (nOffs < n2))
+		{
+			uint32_t nPart = (uint32_t) std::min(iov.size, n2 - nOffs);
+			hm.Write(p, nPart);
+			m_CipherOut.XCrypt(m_Enc, p, nPart);
+		}
+
+		p += iov.size;
+	}
+
+	assert(p == pDst + nSize);
+
+	if (bSecure)
+	{
+		MacValue hmac;
+		get_HMac(hm, hmac);
+		memcpy(pDst + n2, hmac.m_pData, hmac.nBytes);
+
+		m_CipherOut.XCrypt(m_Enc, pDst + n2, hmac.nBytes);
+	}
+}
+
+void ProtocolPlus::Encrypt(SerializedMsg& sm, MsgSerializer& ser)
+{
+	// 1. append dummy of the needed size
+	Finalize(sm, ser);
 
 	if (Mode::Plaintext != m_Mode)
 	{
+		MacValue hmac;
 		// 2. get size
 		size_t n = 0;
 
@@ -261,6 +305,70 @@ bool BbsDecrypt(uint8_t*& p, uint32_t& n, ECC::Scalar::Native& privateAddr)
 	return (hvMac == hvMac2);
 }
 
+bool BbsTrialDecryptor::Init(const void* p, uint32_t n)
+{
+	m_p = (const uint8_t*) p;
+	m_n = n;
+
+	if (m_n < PeerID::nBytes + ECC::Hash::Value::nBytes)
+		return false;
+
+	ECC::Point pt;
+	memcpy(pt.m_X.m_pData, m_p, PeerID::nBytes);
+	pt.m_Y = false;
+
+	ECC::Point::Native ptRemote;
+	if (!ptRemote.Import(pt))
+		return false;
+
+	m_Remote.Init(ptRemote);
+	return true;
+}
+
+bool BbsTrialDecryptor::Try(ByteBuffer& res, const ECC::Scalar::Native& privateAddr, const PeerID& publicAddr) const
+{
+	// same as InitViaDiffieHellman, but the public key is known, and the point is already prepared
+	ECC::MultiMac::Casual mc = m_Remote;
+	mc.m_K = privateAddr;
+
+	ECC::MultiMac mm;
+	mm.m_pCasual = &mc;
+	mm.m_Casual = 1;
+
+	ECC::Point::Native ptSecret;
+	mm.Calculate(ptSecret);
+
+	ECC::NoLeak<ECC::Hash::Processor> hp;
+	ECC::NoLeak<ECC::Hash::Value> hvSecret;
+	hp.V << ptSecret >> hvSecret.V;
+
+	AES::Encoder enc;
+	enc.Init(hvSecret.V.m_pData);
+
+	ECC::Hash::Mac hmac;
+	hmac.Reset(hvSecret.V.m_pData, hvSecret.V.nBytes);
+
+	AES::StreamCipher cIn;
+	InitCipherIV(cIn, hvSecret.V, publicAddr);
+
+	res.assign(m_p + PeerID::nBytes, m_p + m_n);
+	cIn.XCrypt(enc, res.data(), (uint32_t) res.size());
+
+	ECC::Hash::Value hvMac, hvMac2;
+	memcpy(hvMac.m_pData, res.data(), hvMac.nBytes);
+
+	uint32_t nPayload = static_cast<uint32_t>(res.size() - hvMac.nBytes); // Init guarantees the mac is present
+	if (nPayload)
+		hmac.Write(res.data() + hvMac.nBytes, nPayload);
+	hmac >> hvMac2;
+
+	if (!(hvMac == hvMac2))
+		return false;
+
+	res.erase(res.begin(), res.begin() + hvMac.nBytes);
+	return true;
+}
+
 /////////////////////////
 // NodeConnection
 NodeConnection::NodeConnection()
@@ -457,6 +565,97 @@ bool NodeConnection::OnMsgInternal(uint64_t, msg##_NoInit&& v) \
 BeamNodeMsgsAll(THE_MACRO)
 #undef THE_MACRO
 
+NodeConnection::Broadcast::Broadcast(const void* pObj, SerializeFunc pfn)
+	:m_pObj(pObj)
+	,m_pfnSerialize(pfn)
+	,m_pSlabPos(NULL)
+	,m_nSlabRemaining(0)
+{
+	m_pSize[0] = m_pSize[1] = 0;
+}
+
+template <typename T, uint8_t nCode>
+MsgSerializer& BroadcastSerialize(ProtocolPlus& p, SerializedMsg& sm, const void* pObj)
+{
+	return p.serializeNoFinalize(sm, nCode, *(const T*) pObj);
+}
+
+#define THE_MACRO(code, msg) \
+NodeConnection::Broadcast::Broadcast(const msg& v) \
+	:Broadcast(&v, &BroadcastSerialize<msg, code>) \
+{ \
+}
+
+BeamNodeMsgsAll(THE_MACRO)
+#undef THE_MACRO
+
+uint8_t* NodeConnection::Broadcast::AllocateRaw(size_t nSize, io::SharedMem& guard)
+{
+	uint8_t* p = (uint8_t*) malloc(nSize);
+	if (!p)
+		throw std::bad_alloc();
+
+	guard.reset(p, [](void* p) { free(p); });
+	return p;
+}
+
+void NodeConnection::Broadcast::Allocate(io::SharedBuffer& buf, size_t nSize)
+{
+	if (nSize >= s_SlabSize)
+	{
+		// large message (such as a block body). Dedicated buffer, released once written, not retained by the broadcast (which may be kept for long)
+		io::SharedMem guard;
+		uint8_t* p = AllocateRaw(nSize, guard);
+		buf.assign(p, nSize, std::move(guard));
+		return;
+	}
+
+	if (m_nSlabRemaining < nSize)
+	{
+		// the previous slab (if any) is released once all the recipients have written their parts
+		m_pSlabPos = AllocateRaw(s_SlabSize, m_pSlab);
+		m_nSlabRemaining = s_SlabSize;
+	}
+
+	buf.assign(m_pSlabPos, nSize, m_pSlab);
+	m_pSlabPos += nSize;
+	m_nSlabRemaining -= nSize;
+}
+
+void NodeConnection::Send(Broadcast& bc)
+{
+	if (m_pAsyncFail)
+		return;
+
+	bool bSecure = (ProtocolPlus::Mode::Plaintext != m_Protocol.m_Mode);
+	SerializedMsg& sm = bc.m_pMsg[bSecure];
+	size_t& nSize = bc.m_pSize[bSecure];
+
+	if (sm.empty())
+	{
+		MsgSerializer& ser = bc.m_pfnSerialize(m_Protocol, sm, bc.m_pObj);
+		m_Protocol.Finalize(sm, ser);
+
+		for (size_t i = 0; i < sm.size(); i++)
+			nSize += sm[i].size;
+	}
+
+	if (bSecure)
+	{
+		io::SharedBuffer buf;
+		bc.Allocate(buf, nSize);
+		m_Protocol.EncryptTo((uint8_t*) buf.data, sm, nSize);
+
+		io::Result res = m_Connection->write_msg(buf);
+		TestIoResultAsync(res);
+	}
+	else
+	{
+		io::Result res = m_Connection->write_msg(sm); // the fragments are shared, no copy
+		TestIoResultAsync(res);
+	}
+}
+
 void NodeConnection::TestInputMsgContext(uint8_t code)
 {
 	if (!IsSecureIn())
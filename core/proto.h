@@ -38,6 +38,14 @@ namespace proto {
 #define BeamNodeMsg_Hdr(macro) \
 	macro(Block::SystemState::Full, Description)
 
+#define BeamNodeMsg_GetHdrPack(macro) \
+	macro(Block::SystemState::ID, Top) \
+	macro(uint32_t, Count)
+
+#define BeamNodeMsg_HdrPack(macro) \
+	macro(Block::SystemState::Sequence::Prefix, Prefix) \
+	macro(std::vector<Block::SystemState::Sequence::Element>, vElements)
+
 #define BeamNodeMsg_DataMissing(macro)
 
 #define BeamNodeMsg_Boolean(macro) \
@@ -70,12 +78,28 @@ namespace proto {
 #define BeamNodeMsg_ProofUtxo(macro) \
 	macro(std::vector<Input::Proof>, Proofs)
 
+#define BeamNodeMsg_GetProofUtxoMulti(macro) \
+	macro(std::vector<ECC::Point>, Utxos) /* up to g_ProofUtxoMultiMaxSize */
+
+#define BeamNodeMsg_ProofUtxoMulti(macro) \
+	macro(Input::MultiProof, Proofs) /* wrt the current tip, in the order of the request */
+
 #define BeamNodeMsg_ProofState(macro) \
 	macro(Merkle::HardProof, Proof)
 
 #define BeamNodeMsg_ProofChainWork(macro) \
 	macro(Block::ChainWorkProof, Proof)
 
+#define BeamNodeMsg_GetSnapshotChunk(macro) \
+	macro(Block::SystemState::ID, Top) /* zero: the most recent one */ \
+	macro(uint8_t, Data) /* index of the macroblock data stream */ \
+	macro(uint64_t, Offset)
+
+#define BeamNodeMsg_SnapshotChunk(macro) \
+	macro(Block::SystemState::ID, Top) /* zero if not available */ \
+	macro(uint64_t, Size) /* of the whole data stream */ \
+	macro(ByteBuffer, Data)
+
 #define BeamNodeMsg_GetMined(macro) \
 	macro(Height, HeightMin)
 
@@ -87,7 +111,9 @@ namespace proto {
 	macro(bool, SpreadingTransactions) \
 	macro(bool, Bbs) \
 	macro(bool, SendPeers) \
-	macro(bool, AutoSendHdr) /* prefer the header in addition to the NewTip message */
+	macro(bool, AutoSendHdr) /* prefer the header in addition to the NewTip message */ \
+	macro(bool, HdrPack) /* GetHdrPack is supported */ \
+	macro(bool, ProofUtxoMulti) /* GetProofUtxoMulti is supported */
 
 #define BeamNodeMsg_Ping(macro)
 #define BeamNodeMsg_Pong(macro)
@@ -176,6 +202,8 @@ namespace proto {
 	macro(23, NewTransaction) \
 	macro(24, HaveTransaction) \
 	macro(25, GetTransaction) \
+	macro(26, GetHdrPack) \
+	macro(27, HdrPack) /* headers in ascending order, the last one is the requested Top */ \
 	macro(29, Bye) \
 	macro(31, PeerInfoSelf) \
 	macro(32, PeerInfo) \
@@ -183,12 +211,16 @@ namespace proto {
 	macro(34, Time) \
 	macro(35, GetExternalAddr) \
 	macro(36, ExternalAddr) \
+	macro(37, GetSnapshotChunk) \
+	macro(38, SnapshotChunk) /* continuous part of the data stream, starting at the requested offset */ \
 	macro(40, BbsMsg) \
 	macro(41, BbsHaveMsg) \
 	macro(42, BbsGetMsg) \
 	macro(43, BbsSubscribe) \
 	macro(44, BbsPickChannel) \
 	macro(45, BbsPickChannelRes) \
+	macro(46, GetProofUtxoMulti) \
+	macro(47, ProofUtxoMulti) \
 	macro(61, SChannelInitiate) \
 	macro(62, SChannelReady) \
 	macro(63, Authentication) \
@@ -218,6 +250,10 @@ namespace proto {
 		static const uint8_t Owner		= 'O';
 	};
 
+	static const uint32_t g_HdrPackMaxSize = 2048; // about 280K
+	static const uint32_t g_SnapshotChunkMaxSize = 1024 * 1024;
+	static const uint32_t g_ProofUtxoMultiMaxSize = 1024;
+
 	enum Unused_ { Unused };
 	enum Uninitialized_ { Uninitialized };
 
@@ -235,8 +271,10 @@ namespace proto {
 	inline void ZeroInit(ByteBuffer&) { }
 	inline void ZeroInit(Block::SystemState::ID& x) { ZeroObject(x); }
 	inline void ZeroInit(Block::SystemState::Full& x) { ZeroObject(x); }
+	inline void ZeroInit(Block::SystemState::Sequence::Prefix& x) { ZeroObject(x); }
 	inline void ZeroInit(Block::ChainWorkProof& x) {}
 	inline void ZeroInit(Input& x) { ZeroObject(x); }
+	inline void ZeroInit(Input::MultiProof&) { }
 	inline void ZeroInit(ECC::Signature& x) { ZeroObject(x); }
 
 
@@ -301,12 +339,30 @@ namespace proto {
 		virtual bool VerifyMsg(const uint8_t*, uint32_t nSize) override;
 
 		void Encrypt(SerializedMsg&, MsgSerializer&);
+
+		// Split version of the above, for messages sent to many connections: the message is finalized once (incl. the MAC placeholder
+		// iff the mode requires it), and then copied for each connection into a contiguous buffer, where the MAC and the encryption are applied.
+		void Finalize(SerializedMsg&, MsgSerializer&);
+		void EncryptTo(uint8_t* pDst, const SerializedMsg&, size_t nSize);
 	};
 
 	void Sk2Pk(PeerID&, ECC::Scalar::Native&); // will negate the scalar iff necessary
 	bool BbsEncrypt(ByteBuffer& res, const PeerID& publicAddr, ECC::Scalar::Native& nonce, const void*, uint32_t); // will fail iff addr is invalid
 	bool BbsDecrypt(uint8_t*& p, uint32_t& n, ECC::Scalar::Native& privateAddr);
 
+	// For the case where the recipient is one of many own addresses. The sender nonce is imported and prepared for multiplication once,
+	// and each key is tried without the extra work BbsDecrypt does (public key derivation). The message is left intact, decrypted into
+	// the result only on match. Try() is const, may be called from several threads simultaneously.
+	struct BbsTrialDecryptor
+	{
+		const uint8_t* m_p;
+		uint32_t m_n;
+		ECC::MultiMac::Casual m_Remote;
+
+		bool Init(const void* p, uint32_t n); // fails if malformed
+		bool Try(ByteBuffer& res, const ECC::Scalar::Native& privateAddr, const PeerID& publicAddr) const;
+	};
+
 	struct INodeMsgHandler
 		:public IErrorHandler
 	{
@@ -413,6 +469,43 @@ namespace proto {
 		BeamNodeMsgsAll(THE_MACRO)
 #undef THE_MACRO
 
+		// Message to be sent to many connections. It's serialized once (on the first Send), then for each secure connection only the MAC
+		// and the encryption are applied, into a slab shared by all the recipients. Plaintext connections get the serialized fragments as-is.
+		// Refers to the original message, which must be alive while sending.
+		class Broadcast
+		{
+			friend class NodeConnection;
+
+			typedef MsgSerializer& (*SerializeFunc)(ProtocolPlus&, SerializedMsg&, const void*);
+
+			const void* m_pObj;
+			SerializeFunc m_pfnSerialize;
+
+			SerializedMsg m_pMsg[2]; // plaintext and secure
+			size_t m_pSize[2];
+
+			io::SharedMem m_pSlab;
+			uint8_t* m_pSlabPos;
+			size_t m_nSlabRemaining;
+
+			Broadcast(const void*, SerializeFunc);
+			void Allocate(io::SharedBuffer&, size_t);
+			static uint8_t* AllocateRaw(size_t, io::SharedMem&);
+
+		public:
+
+			static const size_t s_SlabSize = 0x4000; // larger messages get dedicated buffers
+
+			// retained memory: the serialized images (plaintext and secure, once sent in that mode), and the current slab
+			size_t get_Size() const { return m_pSize[0] + m_pSize[1] + (m_pSlab ? s_SlabSize : 0); }
+
+#define THE_MACRO(code, msg) Broadcast(const msg& v);
+			BeamNodeMsgsAll(THE_MACRO)
+#undef THE_MACRO
+		};
+
+		void Send(Broadcast&);
+
 		struct Server
 		{
 			io::TcpServer::Ptr m_pServer; // just delete it to stop listening
@@ -17,6 +17,78 @@
 
 namespace beam {
 
+/////////////////////////////
+// SlabAllocator
+SlabAllocator::SlabAllocator(uint32_t nElement, uint32_t nSlab)
+	:m_pSlabs(NULL)
+	,m_pFree(NULL)
+	,m_nCount(0)
+	,m_nSlabs(0)
+{
+	m_nElement = (std::max<uint32_t>(nElement, sizeof(FreeElement)) + s_Align - 1) & ~(s_Align - 1);
+	m_nSlab = std::max(nSlab, s_SlabHdr + m_nElement);
+	m_nSlabUsed = m_nSlab; // no room
+}
+
+SlabAllocator::~SlabAllocator()
+{
+	assert(!m_nCount);
+	Release();
+}
+
+void SlabAllocator::Release()
+{
+	while (m_pSlabs)
+	{
+		Slab* p = m_pSlabs;
+		m_pSlabs = p->m_pNext;
+		delete[] (uint8_t*) p;
+	}
+
+	m_pFree = NULL;
+	m_nSlabs = 0;
+	m_nSlabUsed = m_nSlab;
+}
+
+void* SlabAllocator::Allocate()
+{
+	void* pRet;
+	if (m_pFree)
+	{
+		pRet = m_pFree;
+		m_pFree = m_pFree->m_pNext;
+	}
+	else
+	{
+		if (m_nSlabUsed + m_nElement > m_nSlab)
+		{
+			Slab* p = (Slab*) new uint8_t[m_nSlab];
+			p->m_pNext = m_pSlabs;
+			m_pSlabs = p;
+			m_nSlabs++;
+			m_nSlabUsed = s_SlabHdr;
+		}
+
+		pRet = ((uint8_t*) m_pSlabs) + m_nSlabUsed;
+		m_nSlabUsed += m_nElement;
+	}
+
+	m_nCount++;
+	return pRet;
+}
+
+void SlabAllocator::Free(void* p)
+{
+	assert(p && m_nCount);
+
+	FreeElement* pE = (FreeElement*) p;
+	pE->m_pNext = m_pFree;
+	m_pFree = pE;
+
+	if (!--m_nCount)
+		Release();
+}
+
 /////////////////////////////
 // RadixTree
 uint16_t RadixTree::Node::get_Bits() const
@@ -57,12 +129,139 @@ void RadixTree::DeleteNode(Node* p)
 		Joint* p1 = (Joint*) p;
 
 		for (size_t i = 0; i < _countof(p1->m_ppC); i++)
-			DeleteNode(p1->m_ppC[i]);
+			if (p1->m_ppC[i]) // may be missing in a partially loaded image
+				DeleteNode(p1->m_ppC[i]);
 
 		DeleteJoint(p1);
 	}
 }
 
+struct RadixTree::ImageReader
+{
+	const uint8_t* m_p;
+	uint64_t m_nRemaining;
+	uint32_t m_nKeyBits;
+
+	const uint8_t* Read(uint32_t n)
+	{
+		if (m_nRemaining < n)
+			return NULL;
+
+		const uint8_t* pRet = m_p;
+		m_p += n;
+		m_nRemaining -= n;
+		return pRet;
+	}
+};
+
+uint64_t RadixTree::get_ImageSize() const
+{
+	return m_pRoot ? get_ImageSize(*m_pRoot) : 0;
+}
+
+uint64_t RadixTree::get_ImageSize(const Node& n) const
+{
+	bool bLeaf = (Node::s_Leaf & n.m_Bits) != 0;
+	uint64_t nRet = sizeof(n.m_Bits) + get_ImageDataSize(bLeaf);
+
+	if (!bLeaf)
+	{
+		const Joint& x = (const Joint&) n;
+		for (size_t i = 0; i < _countof(x.m_ppC); i++)
+			nRet += get_ImageSize(*x.m_ppC[i]);
+	}
+
+	return nRet;
+}
+
+void RadixTree::SaveImage(uint8_t* p) const
+{
+	if (m_pRoot)
+		SaveImage(*m_pRoot, p);
+}
+
+uint8_t* RadixTree::SaveImage(const Node& n, uint8_t* p) const
+{
+	memcpy(p, &n.m_Bits, sizeof(n.m_Bits));
+	p += sizeof(n.m_Bits);
+
+	bool bLeaf = (Node::s_Leaf & n.m_Bits) != 0;
+	SaveImageData(n, p);
+	p += get_ImageDataSize(bLeaf);
+
+	if (!bLeaf)
+	{
+		const Joint& x = (const Joint&) n;
+		for (size_t i = 0; i < _countof(x.m_ppC); i++)
+			p = SaveImage(*x.m_ppC[i], p);
+	}
+
+	return p;
+}
+
+bool RadixTree::LoadImage(const uint8_t* p, uint64_t nSize, uint32_t nKeyBits)
+{
+	assert(!m_pRoot);
+	if (!nSize)
+		return true;
+
+	ImageReader r;
+	r.m_p = p;
+	r.m_nRemaining = nSize;
+	r.m_nKeyBits = nKeyBits;
+
+	if (LoadImage(m_pRoot, r, 0) && !r.m_nRemaining)
+		return true;
+
+	Clear();
+	return false;
+}
+
+bool RadixTree::LoadImage(Node*& pTrg, ImageReader& r, uint32_t nBitsUsed)
+{
+	uint16_t nBitsRaw;
+	const uint8_t* p = r.Read(sizeof(nBitsRaw));
+	if (!p)
+		return false;
+	memcpy(&nBitsRaw, p, sizeof(nBitsRaw));
+
+	bool bLeaf = (Node::s_Leaf & nBitsRaw) != 0;
+
+	p = r.Read(get_ImageDataSize(bLeaf));
+	if (!p)
+		return false;
+
+	Node* pN;
+	if (bLeaf)
+		pN = CreateLeaf();
+	else
+	{
+		Joint* pJ = CreateJoint();
+		ZeroObject(pJ->m_ppC);
+		pN = pJ;
+	}
+
+	pTrg = pN; // attached, would be deleted on failure
+	pN->m_Bits = nBitsRaw;
+	LoadImageData(*pN, p);
+
+	nBitsUsed += pN->get_Bits();
+
+	if (bLeaf)
+		return (nBitsUsed == r.m_nKeyBits);
+
+	if (++nBitsUsed >= r.m_nKeyBits)
+		return false;
+
+	Joint& x = (Joint&) *pN;
+	for (size_t i = 0; i < _countof(x.m_ppC); i++)
+		if (!LoadImage(x.m_ppC[i], r, nBitsUsed))
+			return false;
+
+	x.m_pKeyPtr = get_NodeKey(*x.m_ppC[0]); // any descendant would do
+	return true;
+}
+
 uint8_t RadixTree::CursorBase::get_BitRawStat(const uint8_t* p0, uint32_t nBit)
 {
 	return p0[nBit >> 3] >> (7 ^ (7 & nBit));
@@ -441,13 +640,50 @@ size_t RadixTree::Count() const
 	return t.m_Count;
 }
 
+uint32_t RadixTree::get_KeyBits() const
+{
+	assert(m_pRoot);
+	uint32_t nRet = 0;
+
+	for (const Node* p = m_pRoot; ; p = ((const Joint*) p)->m_ppC[0])
+	{
+		nRet += p->get_Bits();
+		if (Node::s_Leaf & p->m_Bits)
+			break;
+		nRet++;
+	}
+
+	return nRet;
+}
+
+void RadixTree::Compact()
+{
+	if (!m_pRoot)
+		return;
+
+	uint32_t nKeyBits = get_KeyBits();
+
+	std::vector<uint8_t> vImage;
+	vImage.resize(get_ImageSize());
+	SaveImage(&vImage.front());
+
+	Clear(); // all the nodes are freed, the allocator starts over
+	verify(LoadImage(&vImage.front(), vImage.size(), nKeyBits));
+}
+
 /////////////////////////////
 // RadixHashTree
 void RadixHashTree::get_Hash(Merkle::Hash& hv)
 {
 	Node* p = get_Root();
 	if (p)
+	{
+		ParallelHasher ph;
+		ph.Add(*this);
+		ph.Execute(); // on the current thread, but the subtrees are hashed in multi-buffer mode
+
 		hv = get_Hash(*p, hv);
+	}
 	else
 		hv = Zero;
 }
@@ -479,6 +715,116 @@ const Merkle::Hash& RadixHashTree::get_Hash(Node& n, Merkle::Hash& hv)
 	return x.m_Hash;
 }
 
+uint32_t RadixHashTree::CollectDirty(Node& n, JointLevels& v)
+{
+	// returns the level of the joint + 1, or 0 if there's nothing to collect
+	if ((Node::s_Leaf | Node::s_Clean) & n.m_Bits)
+		return 0;
+
+	MyJoint& x = (MyJoint&) n;
+	uint32_t nLevel = std::max(CollectDirty(*x.m_ppC[0], v), CollectDirty(*x.m_ppC[1], v));
+
+	if (v.size() <= nLevel)
+		v.resize(nLevel + 1);
+	v[nLevel].push_back(&x);
+
+	return nLevel + 1;
+}
+
+void RadixHashTree::HashMulti(MyJoint& x)
+{
+	JointLevels vLevels;
+	CollectDirty(x, vLevels);
+
+	const uint32_t nBatch = 16;
+
+	Merkle::Hash pLeaf[2][nBatch]; // leaf hashes may be evaluated on-demand
+	const Merkle::Hash* ppIn[2][nBatch];
+	Merkle::Hash* ppOut[nBatch];
+
+	for (size_t iLevel = 0; iLevel < vLevels.size(); iLevel++)
+	{
+		const std::vector<MyJoint*>& v = vLevels[iLevel];
+
+		for (size_t i0 = 0; i0 < v.size(); i0 += nBatch)
+		{
+			uint32_t n = (uint32_t) std::min<size_t>(nBatch, v.size() - i0);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				MyJoint& y = *v[i0 + i];
+
+				// children are either leaves, or already hashed
+				for (size_t j = 0; j < _countof(y.m_ppC); j++)
+					ppIn[j][i] = &get_Hash(*y.m_ppC[j], pLeaf[j][i]);
+
+				ppOut[i] = &y.m_Hash;
+				y.m_Bits |= Node::s_Clean;
+			}
+
+			Merkle::InterpretMulti(ppOut, ppIn[0], ppIn[1], n);
+		}
+	}
+}
+
+void RadixHashTree::ParallelHasher::Add(RadixHashTree& t)
+{
+	Node* p = t.get_Root();
+	if (p)
+		Add(t, *p, 0);
+}
+
+void RadixHashTree::ParallelHasher::Add(RadixHashTree& t, Node& n, uint32_t nDepth)
+{
+	if ((Node::s_Leaf | Node::s_Clean) & n.m_Bits)
+		return;
+
+	Joint& x = (Joint&) n;
+	if (nDepth == s_Depth)
+	{
+		m_vTasks.emplace_back();
+		m_vTasks.back().m_pTree = &t;
+		m_vTasks.back().m_pJoint = &x;
+	}
+	else
+		for (size_t i = 0; i < _countof(x.m_ppC); i++)
+			Add(t, *x.m_ppC[i], nDepth + 1);
+}
+
+void RadixHashTree::ParallelHasher::Execute()
+{
+	while (true)
+	{
+		size_t i = m_iNext++;
+		if (i >= m_vTasks.size())
+			break;
+
+		const Task& t = m_vTasks[i];
+		t.m_pTree->HashMulti((MyJoint&) *t.m_pJoint);
+	}
+}
+
+uint32_t RadixHashTree::get_ImageDataSize(bool bLeaf) const
+{
+	return bLeaf ? get_ImageLeafSize() : Merkle::Hash::nBytes;
+}
+
+void RadixHashTree::SaveImageData(const Node& n, uint8_t* p) const
+{
+	if (Node::s_Leaf & n.m_Bits)
+		SaveImageLeaf((const Leaf&) n, p);
+	else
+		memcpy(p, ((const MyJoint&) n).m_Hash.m_pData, Merkle::Hash::nBytes);
+}
+
+void RadixHashTree::LoadImageData(Node& n, const uint8_t* p)
+{
+	if (Node::s_Leaf & n.m_Bits)
+		LoadImageLeaf((Leaf&) n, p);
+	else
+		memcpy(((MyJoint&) n).m_Hash.m_pData, p, Merkle::Hash::nBytes);
+}
+
 void RadixHashTree::get_Proof(Merkle::Proof& proof, const CursorBase& cu)
 {
 	uint32_t n = cu.get_Depth();
@@ -536,6 +882,20 @@ const Merkle::Hash& UtxoTree::get_LeafHash(Node& n, Merkle::Hash& hv)
 	return hv;
 }
 
+void UtxoTree::SaveImageLeaf(const Leaf& n, uint8_t* p) const
+{
+	const MyLeaf& x = (const MyLeaf&) n;
+	memcpy(p, x.m_Key.m_pArr, Key::s_Bytes);
+	memcpy(p + Key::s_Bytes, &x.m_Value.m_Count, sizeof(x.m_Value.m_Count));
+}
+
+void UtxoTree::LoadImageLeaf(Leaf& n, const uint8_t* p)
+{
+	MyLeaf& x = (MyLeaf&) n;
+	memcpy(x.m_Key.m_pArr, p, Key::s_Bytes);
+	memcpy(&x.m_Value.m_Count, p + Key::s_Bytes, sizeof(x.m_Value.m_Count));
+}
+
 void UtxoTree::SaveIntenral(ISerializer& s) const
 {
 	uint32_t n = (uint32_t) Count();
@@ -19,6 +19,42 @@
 namespace beam
 {
 
+// Fixed-size elements allocated from big slabs. No per-element heap overhead, and consecutive allocations are adjacent in memory.
+// Freed elements are reused, the slabs are released once all the elements are freed.
+class SlabAllocator
+{
+	struct Slab {
+		Slab* m_pNext;
+	};
+
+	struct FreeElement {
+		FreeElement* m_pNext;
+	};
+
+	Slab* m_pSlabs;
+	FreeElement* m_pFree;
+	uint32_t m_nSlabUsed; // within the most recent slab
+	uint32_t m_nElement;
+	uint32_t m_nSlab;
+	size_t m_nCount;
+	size_t m_nSlabs;
+
+	static const uint32_t s_Align = sizeof(uint64_t);
+	static const uint32_t s_SlabHdr = (sizeof(Slab) + s_Align - 1) & ~(s_Align - 1);
+
+	void Release();
+
+public:
+	SlabAllocator(uint32_t nElement, uint32_t nSlab = 0x10000);
+	~SlabAllocator();
+
+	void* Allocate();
+	void Free(void*);
+
+	size_t get_Count() const { return m_nCount; }
+	uint64_t get_Bytes() const { return uint64_t(m_nSlabs) * m_nSlab; }
+};
+
 class RadixTree
 {
 protected:
@@ -53,6 +89,11 @@ protected:
 	virtual void DeleteJoint(Joint*) = 0;
 	virtual void DeleteLeaf(Leaf*) = 0;
 
+	// node data in the image (besides the bits and flags)
+	virtual uint32_t get_ImageDataSize(bool bLeaf) const = 0;
+	virtual void SaveImageData(const Node&, uint8_t*) const = 0;
+	virtual void LoadImageData(Node&, const uint8_t*) = 0;
+
 public:
 
 	RadixTree();
@@ -121,10 +162,27 @@ public:
 
 	size_t Count() const; // implemented via the whole tree traversing, shouldn't use frequently.
 
+	// Re-creates all the nodes in DFS order (via the image), to restore the locality after many insertions/deletions.
+	// Temporarily needs the memory for the image.
+	void Compact();
+
+	// Flat image of the tree, suitable for persistence (i.e. in a mapped file).
+	// Nodes are in DFS pre-order, so that the links are implicit (1st child follows its parent immediately, then the 2nd child subtree).
+	// Loading it involves neither key comparisons nor (for hash trees) hash recalculation.
+	uint64_t get_ImageSize() const;
+	void SaveImage(uint8_t*) const;
+	bool LoadImage(const uint8_t*, uint64_t nSize, uint32_t nKeyBits); // returns false if the image is malformed. The tree must be empty
+
 private:
 	Node* m_pRoot;
 
+	struct ImageReader;
+
 	void DeleteNode(Node*);
+	uint32_t get_KeyBits() const;
+	uint64_t get_ImageSize(const Node&) const;
+	uint8_t* SaveImage(const Node&, uint8_t*) const;
+	bool LoadImage(Node*&, ImageReader&, uint32_t nBitsUsed);
 	void ReplaceTip(CursorBase& cu, Node* pNew);
 	bool Traverse(const Node&, ITraveler&) const;
 
@@ -141,16 +199,58 @@ public:
 		Merkle::Hash m_Hash;
 	};
 
+	RadixHashTree() :m_Joints(sizeof(MyJoint)) {}
+
 	void get_Hash(Merkle::Hash&);
 	void get_Proof(Merkle::Proof&, const CursorBase&);
 
+	// The dirty subtrees at the fixed depth are independent, and can be hashed by several threads simultaneously.
+	// The remaining top part is then hashed by get_Hash as usual.
+	struct ParallelHasher
+	{
+		static const uint32_t s_Depth = 8; // in joints, up to 256 subtrees per tree
+		static const uint32_t s_MinParallel = 16; // for less subtrees it's not worth it
+
+		struct Task {
+			RadixHashTree* m_pTree;
+			Joint* m_pJoint;
+		};
+
+		std::vector<Task> m_vTasks;
+		std::atomic<size_t> m_iNext;
+
+		ParallelHasher() :m_iNext(0) {}
+
+		void Add(RadixHashTree&);
+		bool ShouldRunParallel() const { return m_vTasks.size() >= s_MinParallel; }
+		void Execute(); // can be called by several threads simultaneously
+
+	private:
+		void Add(RadixHashTree&, Node&, uint32_t nDepth);
+	};
+
 protected:
+	SlabAllocator m_Joints;
+
 	// RadixTree
-	virtual Joint* CreateJoint() override { return new MyJoint; }
-	virtual void DeleteJoint(Joint* p) override { delete (MyJoint*) p; }
+	virtual Joint* CreateJoint() override { return new (m_Joints.Allocate()) MyJoint; }
+	virtual void DeleteJoint(Joint* p) override { m_Joints.Free(p); }
+	virtual uint32_t get_ImageDataSize(bool bLeaf) const override;
+	virtual void SaveImageData(const Node&, uint8_t*) const override;
+	virtual void LoadImageData(Node&, const uint8_t*) override;
+
+	// leaf data in the image
+	virtual uint32_t get_ImageLeafSize() const = 0;
+	virtual void SaveImageLeaf(const Leaf&, uint8_t*) const = 0;
+	virtual void LoadImageLeaf(Leaf&, const uint8_t*) = 0;
 
 	const Merkle::Hash& get_Hash(Node&, Merkle::Hash&);
 
+	// The dirty joints are hashed bottom-up, level by level, so that several sibling pairs are hashed at once
+	typedef std::vector<std::vector<MyJoint*> > JointLevels;
+	static uint32_t CollectDirty(Node&, JointLevels&);
+	void HashMulti(MyJoint&);
+
 	virtual const Merkle::Hash& get_LeafHash(Node&, Merkle::Hash&) = 0;
 };
 
@@ -174,13 +274,19 @@ public:
 		return (MyLeaf*) RadixTree::Find(cu, key.m_pData, ECC::nBits, bCreate);
 	}
 
+	RadixHashOnlyTree() :m_Leaves(sizeof(MyLeaf)) {}
 	~RadixHashOnlyTree() { Clear(); }
 
 protected:
-	virtual Leaf* CreateLeaf() override { return new MyLeaf; }
+	SlabAllocator m_Leaves;
+
+	virtual Leaf* CreateLeaf() override { return new (m_Leaves.Allocate()) MyLeaf; }
 	virtual uint8_t* GetLeafKey(const Leaf& x) const override { return ((MyLeaf&) x).m_Hash.m_pData; }
-	virtual void DeleteLeaf(Leaf* p) override { delete (MyLeaf*) p; }
+	virtual void DeleteLeaf(Leaf* p) override { m_Leaves.Free(p); }
 	virtual const Merkle::Hash& get_LeafHash(Node& n, Merkle::Hash&) override { return ((MyLeaf&) n).m_Hash; }
+	virtual uint32_t get_ImageLeafSize() const override { return Merkle::Hash::nBytes; }
+	virtual void SaveImageLeaf(const Leaf& x, uint8_t* p) const override { memcpy(p, ((MyLeaf&) x).m_Hash.m_pData, Merkle::Hash::nBytes); }
+	virtual void LoadImageLeaf(Leaf& x, const uint8_t* p) override { memcpy(((MyLeaf&) x).m_Hash.m_pData, p, Merkle::Hash::nBytes); }
 };
 
 
@@ -233,6 +339,7 @@ public:
 		return (MyLeaf*) RadixTree::Find(cu, key.m_pArr, key.s_Bits, bCreate);
 	}
 
+	UtxoTree() :m_Leaves(sizeof(MyLeaf)) {}
 	~UtxoTree() { Clear(); }
 
     template<typename Archive>
@@ -253,10 +360,15 @@ public:
 
 
 protected:
-	virtual Leaf* CreateLeaf() override { return new MyLeaf; }
+	SlabAllocator m_Leaves;
+
+	virtual Leaf* CreateLeaf() override { return new (m_Leaves.Allocate()) MyLeaf; }
 	virtual uint8_t* GetLeafKey(const Leaf& x) const override { return ((MyLeaf&) x).m_Key.m_pArr; }
-	virtual void DeleteLeaf(Leaf* p) override { delete (MyLeaf*) p; }
+	virtual void DeleteLeaf(Leaf* p) override { m_Leaves.Free(p); }
 	virtual const Merkle::Hash& get_LeafHash(Node&, Merkle::Hash&) override;
+	virtual uint32_t get_ImageLeafSize() const override { return Key::s_Bytes + sizeof(Input::Count); }
+	virtual void SaveImageLeaf(const Leaf&, uint8_t*) const override;
+	virtual void LoadImageLeaf(Leaf&, const uint8_t*) override;
 
 	struct ISerializer {
 		virtual void Process(uint32_t&) = 0;
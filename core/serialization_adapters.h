@@ -383,6 +383,8 @@ namespace detail
 
 			if (0x2 & nFlags)
 				ar & input.m_Maturity;
+			else
+				input.m_Maturity = 0;
 
             return ar;
         }
@@ -429,23 +431,34 @@ namespace detail
 			output.m_Commitment.m_Y = 0 != (1 & nFlags);
 			output.m_Coinbase = 0 != (2 & nFlags);
 
+			// the object may be reused (decoded in-place), reset the absent members, and keep the allocated ones
 			if (4 & nFlags)
 			{
-				output.m_pConfidential = std::make_unique<ECC::RangeProof::Confidential>();
+				if (!output.m_pConfidential)
+					output.m_pConfidential = std::make_unique<ECC::RangeProof::Confidential>();
 				ar & *output.m_pConfidential;
 			}
+			else
+				output.m_pConfidential.reset();
 
 			if (8 & nFlags)
 			{
-				output.m_pPublic = std::make_unique<ECC::RangeProof::Public>();
+				if (!output.m_pPublic)
+					output.m_pPublic = std::make_unique<ECC::RangeProof::Public>();
 				ar & *output.m_pPublic;
 			}
+			else
+				output.m_pPublic.reset();
 
 			if (0x10 & nFlags)
 				ar & output.m_Incubation;
+			else
+				output.m_Incubation = 0;
 
 			if (0x20 & nFlags)
 				ar & output.m_Maturity;
+			else
+				output.m_Maturity = 0;
 
             return ar;
         }
@@ -542,9 +555,12 @@ namespace detail
 
 			if (0x20 & nFlags)
 			{
-				val.m_pHashLock.reset(new beam::TxKernel::HashLock);
+				if (!val.m_pHashLock)
+					val.m_pHashLock.reset(new beam::TxKernel::HashLock);
 				ar & *val.m_pHashLock;
 			}
+			else
+				val.m_pHashLock.reset();
 
 			if (0x40 & nFlags)
 			{
@@ -557,10 +573,13 @@ namespace detail
 				for (uint32_t i = 0; i < nCount; i++)
 				{
 					std::unique_ptr<beam::TxKernel>& v = val.m_vNested[i];
-					v = std::make_unique<beam::TxKernel>();
+					if (!v)
+						v = std::make_unique<beam::TxKernel>();
 					load_Recursive(ar, *v, nRecusion);
 				}
 			}
+			else
+				val.m_vNested.clear();
 
             return ar;
         }
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <iostream>
+#include <thread>
 #include "../ecc_native.h"
 #include "../block_crypt.h"
 #include "../../utility/serialize.h"
@@ -696,6 +697,52 @@ struct TransactionMaker
 	}
 };
 
+beam::SerializeBuffer SerializeBody(beam::Serializer& ser, const beam::Block::Body& body)
+{
+	ser & body;
+	return ser.buffer();
+}
+
+void TestBodyBufReader(const beam::Transaction& tx)
+{
+	beam::Block::Body body;
+	body.ZeroInit();
+	body.m_Offset = tx.m_Offset;
+	beam::Block::Body::Writer(body).Dump(tx.get_Reader());
+
+	// elements without the optional members, decoded into the slots used by the previous ones
+	body.m_vOutputs.emplace_back(new beam::Output);
+	body.m_vOutputs.back()->m_Incubation = 7;
+	body.m_vKernelsOutput.emplace_back(new beam::TxKernel);
+
+	beam::Serializer ser;
+	beam::SerializeBuffer sb = SerializeBody(ser, body);
+
+	beam::Block::Body::BufReader r;
+	beam::Block::Body body2, body3;
+	verify_test(r.Open(sb.first, sb.second, body2));
+	verify_test(body2.m_Offset.m_Value == body.m_Offset.m_Value);
+	(beam::Block::BodyBase&) body3 = body2;
+
+	beam::TxBase::IReader::Ptr pClone;
+	r.Clone(pClone);
+
+	beam::Block::Body::Writer(body2).Dump(std::move(r));
+	beam::Block::Body::Writer(body3).Dump(std::move(*pClone));
+
+	beam::Serializer ser2, ser3;
+	beam::SerializeBuffer sb2 = SerializeBody(ser2, body2);
+	beam::SerializeBuffer sb3 = SerializeBody(ser3, body3);
+
+	verify_test((sb2.second == sb.second) && !memcmp(sb2.first, sb.first, sb.second));
+	verify_test((sb3.second == sb.second) && !memcmp(sb3.first, sb.first, sb.second));
+
+	// malformed
+	verify_test(!r.Open(sb.first, sb.second - 1, body2));
+	r.Reset();
+	verify_test(!r.m_pUtxoIn && !r.m_pUtxoOut && !r.m_pKernelIn && !r.m_pKernelOut);
+}
+
 void TestTransaction()
 {
 	TransactionMaker tm;
@@ -721,6 +768,8 @@ void TestTransaction()
 	beam::TxBase::Context ctx;
 	verify_test(tm.m_Trans.IsValid(ctx));
 	verify_test(!ctx.m_Fee.Hi && (ctx.m_Fee.Lo == fee1 + fee2));
+
+	TestBodyBufReader(tm.m_Trans);
 }
 
 void TestTransactionKernelConsuming()
@@ -773,6 +822,101 @@ void TestTransactionKernelConsuming()
 	beam::TxBase::Context ctx;
 	verify_test(t.IsValid(ctx));
 	verify_test(ctx.m_Fee.Lo == 0);
+
+	// parallel verification, the elements are split into small chunks
+	beam::TxBase::Context::Scheduler::Shared sched;
+	sched.m_ChunkCost = 10;
+
+	const uint32_t nVerifiers = 3;
+	beam::TxBase::Context pCtx[nVerifiers];
+	bool pValid[nVerifiers];
+	std::thread pThreads[nVerifiers];
+
+	for (uint32_t i = 0; i < nVerifiers; i++)
+		pThreads[i] = std::thread([&t, &sched, &pCtx, &pValid, i]() {
+			beam::TxBase::Context::Scheduler s(sched);
+			pCtx[i].m_pScheduler = &s;
+			pValid[i] = pCtx[i].ValidateAndSummarize(t, t.get_Reader());
+			pCtx[i].m_pScheduler = NULL;
+		});
+
+	beam::TxBase::Context ctx2;
+	for (uint32_t i = 0; i < nVerifiers; i++)
+	{
+		pThreads[i].join();
+		verify_test(pValid[i]);
+		verify_test(ctx2.Merge(pCtx[i]));
+	}
+
+	verify_test(ctx2.IsValidTransaction());
+}
+
+void TestAesCtr(const uint8_t* pKey)
+{
+	// CTR mode, F.5.5 of https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38a.pdf
+	const uint8_t pCounter[AES::s_BlockSize] = {
+		0xF0,0xF1,0xF2,0xF3,0xF4,0xF5,0xF6,0xF7,0xF8,0xF9,0xFA,0xFB,0xFC,0xFD,0xFE,0xFF
+	};
+
+	const uint8_t pPlaintext[AES::s_BlockSize * 4] = {
+		0x6B,0xC1,0xBE,0xE2,0x2E,0x40,0x9F,0x96,0xE9,0x3D,0x7E,0x11,0x73,0x93,0x17,0x2A,
+		0xAE,0x2D,0x8A,0x57,0x1E,0x03,0xAC,0x9C,0x9E,0xB7,0x6F,0xAC,0x45,0xAF,0x8E,0x51,
+		0x30,0xC8,0x1C,0x46,0xA3,0x5C,0xE4,0x11,0xE5,0xFB,0xC1,0x19,0x1A,0x0A,0x52,0xEF,
+		0xF6,0x9F,0x24,0x45,0xDF,0x4F,0x9B,0x17,0xAD,0x2B,0x41,0x7B,0xE6,0x6C,0x37,0x10
+	};
+
+	const uint8_t pCiphertext[AES::s_BlockSize * 4] = {
+		0x60,0x1E,0xC3,0x13,0x77,0x57,0x89,0xA5,0xB7,0xA7,0xF5,0x04,0xBB,0xF3,0xD2,0x28,
+		0xF4,0x43,0xE3,0xCA,0x4D,0x62,0xB5,0x9A,0xCA,0x84,0xE9,0x90,0xCA,0xCA,0xF5,0xC5,
+		0x2B,0x09,0x30,0xDA,0xA2,0x3D,0xE9,0x4C,0xE8,0x70,0x17,0xBA,0x2D,0x84,0x98,0x8D,
+		0xDF,0xC9,0xC5,0x8D,0xB6,0x7A,0xAD,0xA6,0x13,0xC2,0xDD,0x08,0x45,0x79,0x41,0xA6
+	};
+
+	AES::Encoder enc;
+	enc.Init(pKey);
+
+	const AES::StreamCipher::Impl::Enum eMax = AES::StreamCipher::Impl::s_Selected;
+
+	// reference stream (portable), with counter wrap-around in the middle
+	uint8_t pRef[0x400];
+	memset(pRef, 0, sizeof(pRef));
+
+	AES::StreamCipher::Impl::s_Selected = AES::StreamCipher::Impl::Portable;
+	AES::StreamCipher asc;
+	asc.Reset();
+	memset(asc.m_Counter.m_pData, 0xff, sizeof(asc.m_Counter.m_pData));
+	asc.m_Counter.m_pData[AES::s_BlockSize - 1] = 0xf0;
+	AES::StreamCipher::Counter ctr0 = asc.m_Counter;
+	asc.XCrypt(enc, pRef, sizeof(pRef));
+
+	for (int iImpl = AES::StreamCipher::Impl::Portable; iImpl <= eMax; iImpl++)
+	{
+		AES::StreamCipher::Impl::s_Selected = (AES::StreamCipher::Impl::Enum) iImpl;
+
+		uint8_t pBuf[sizeof(pRef)];
+		memcpy(pBuf, pPlaintext, sizeof(pPlaintext));
+
+		asc.Reset();
+		memcpy(asc.m_Counter.m_pData, pCounter, sizeof(pCounter));
+		asc.XCrypt(enc, pBuf, sizeof(pPlaintext));
+		verify_test(!memcmp(pBuf, pCiphertext, sizeof(pCiphertext)));
+
+		// arbitrary chunks, must match the reference
+		memset(pBuf, 0, sizeof(pBuf));
+		asc.Reset();
+		asc.m_Counter = ctr0;
+
+		for (uint32_t nDone = 0; nDone < sizeof(pBuf); )
+		{
+			uint32_t n = std::min<uint32_t>(sizeof(pBuf) - nDone, rand() % 200);
+			asc.XCrypt(enc, pBuf + nDone, n);
+			nDone += n;
+		}
+
+		verify_test(!memcmp(pBuf, pRef, sizeof(pRef)));
+	}
+
+	AES::StreamCipher::Impl::s_Selected = eMax;
 }
 
 void TestAES()
@@ -818,6 +962,8 @@ void TestAES()
 
 	sd.dec.Proceed(pBuf, pBuf); // inplace decode
 	verify_test(!memcmp(pBuf, pBuf, sizeof(pPlaintext)));
+
+	TestAesCtr(pKey);
 }
 
 void TestBbs()
@@ -1371,17 +1517,27 @@ void RunBenchmark()
 
 		uint8_t pBuf[0x400];
 
-		BenchmarkMeter bm("AES.XCrypt-1MB");
-		bm.N = 10;
-		do
+		const AES::StreamCipher::Impl::Enum eMax = AES::StreamCipher::Impl::s_Selected;
+		const char* szNames[] = { "AES.XCrypt-1MB", "AES.XCrypt-1MB (AES-NI)", "AES.XCrypt-1MB (VAES)" };
+
+		for (int iImpl = AES::StreamCipher::Impl::Portable; iImpl <= eMax; iImpl++)
 		{
-			for (uint32_t i = 0; i < bm.N; i++)
+			AES::StreamCipher::Impl::s_Selected = (AES::StreamCipher::Impl::Enum) iImpl;
+
+			BenchmarkMeter bm(szNames[iImpl]);
+			bm.N = 10;
+			do
 			{
-				for (size_t nSize = 0; nSize < 0x100000; nSize += sizeof(pBuf))
-					asc.XCrypt(enc, pBuf, sizeof(pBuf));
-			}
+				for (uint32_t i = 0; i < bm.N; i++)
+				{
+					for (size_t nSize = 0; nSize < 0x100000; nSize += sizeof(pBuf))
+						asc.XCrypt(enc, pBuf, sizeof(pBuf));
+				}
 
-		} while (bm.ShouldContinue());
+			} while (bm.ShouldContinue());
+		}
+
+		AES::StreamCipher::Impl::s_Selected = eMax;
 	}
 
 
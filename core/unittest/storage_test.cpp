@@ -13,12 +13,18 @@
 // limitations under the License.
 
 #include <iostream>
+#include <chrono>
+#include <thread>
 #include "../radixtree.h"
 #include "../navigator.h"
+#include "../ecc_native.h"
 #include "../../utility/serialize.h"
 
 #ifndef WIN32
 #	include <unistd.h>
+#	ifdef __GLIBC__
+#		include <malloc.h>
+#	endif // __GLIBC__
 #endif // WIN32
 
 int g_TestsFailed = 0;
@@ -333,6 +339,57 @@ namespace beam
 		t.get_Hash(hv2);
 		verify_test(hv2 == hv1);
 
+		// image
+		{
+			std::vector<uint8_t> vImg((size_t) t.get_ImageSize());
+			t.SaveImage(&vImg.at(0));
+
+			UtxoTree t3;
+			verify_test(t3.LoadImage(&vImg.at(0), vImg.size(), UtxoTree::Key::s_Bits));
+			verify_test(t3.Count() == vKeys.size());
+
+			t3.get_Hash(hv2);
+			verify_test(hv2 == hv1);
+
+			// modify both trees, make sure the loaded one is fully functional
+			for (uint32_t i = 0; i < vKeys.size(); i += 3)
+			{
+				UtxoTree* ppT[] = { &t, &t3 };
+				for (size_t j = 0; j < _countof(ppT); j++)
+				{
+					UtxoTree::Cursor cu;
+					bool bCreate = false;
+					verify_test(ppT[j]->Find(cu, vKeys[i], bCreate));
+					ppT[j]->Delete(cu);
+				}
+			}
+
+			t.get_Hash(hv1);
+			t3.get_Hash(hv2);
+			verify_test(hv2 == hv1);
+
+			// compaction
+			size_t nCount = t3.Count();
+			t3.Compact();
+			verify_test(t3.Count() == nCount);
+
+			t3.get_Hash(hv2);
+			verify_test(hv2 == hv1);
+
+			for (uint32_t i = 1; i < vKeys.size(); i += 3)
+			{
+				UtxoTree::Cursor cu;
+				bool bCreate = false;
+				verify_test(t3.Find(cu, vKeys[i], bCreate));
+			}
+
+			// malformed
+			UtxoTree t4;
+			verify_test(!t4.LoadImage(&vImg.at(0), vImg.size() - 1, UtxoTree::Key::s_Bits));
+			verify_test(!t4.LoadImage(&vImg.at(0), vImg.size(), UtxoTree::Key::s_Bits - 1));
+			verify_test(!t4.Count());
+		}
+
 		// narrow traverse
 		struct Traveler
 			:public RadixTree::ITraveler
@@ -364,6 +421,305 @@ namespace beam
 		t.Traverse(t2);
 	}
 
+	uint64_t get_RssBytes()
+	{
+#ifdef WIN32
+		return 0;
+#else // WIN32
+#ifdef __GLIBC__
+		malloc_trim(0); // return the memory freed by the previous tests, otherwise it's reused and not accounted
+#endif // __GLIBC__
+		uint64_t nRet = 0;
+		FILE* pF = fopen("/proc/self/statm", "r");
+		if (pF)
+		{
+			unsigned long nSize, nRss;
+			if (2 == fscanf(pF, "%lu %lu", &nSize, &nRss))
+				nRet = uint64_t(nRss) * sysconf(_SC_PAGESIZE);
+			fclose(pF);
+		}
+		return nRet;
+#endif // WIN32
+	}
+
+	struct BenchmarkTimer
+	{
+		const char* m_sz;
+		uint32_t m_nOps;
+		std::chrono::steady_clock::time_point m_Start;
+
+		BenchmarkTimer(const char* sz, uint32_t nOps)
+			:m_sz(sz)
+			,m_nOps(nOps)
+			,m_Start(std::chrono::steady_clock::now())
+		{
+		}
+
+		~BenchmarkTimer()
+		{
+			double dt_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_Start).count();
+			printf("%-32s: %.3f us, %.0f/sec\n", m_sz, dt_us / m_nOps, m_nOps * 1e6 / dt_us);
+		}
+	};
+
+	struct TreeInvalidator
+		:public RadixTree::ITraveler
+	{
+		virtual bool OnLeaf(const RadixTree::Leaf&) override
+		{
+			m_pCu->Invalidate();
+			return true;
+		}
+	};
+
+	void HashParallel(RadixHashTree& t, uint32_t nThreads)
+	{
+		RadixHashTree::ParallelHasher ph;
+		ph.Add(t);
+
+		std::vector<std::thread> vThreads(nThreads);
+		for (uint32_t i = 0; i < nThreads; i++)
+			vThreads[i] = std::thread(&RadixHashTree::ParallelHasher::Execute, &ph);
+
+		for (uint32_t i = 0; i < nThreads; i++)
+			vThreads[i].join();
+	}
+
+	void TestParallelHash()
+	{
+		// multi-buffer, all the implementations compiled in
+		const Merkle::HashImpl::Enum eMax = Merkle::HashImpl::get_Max();
+
+		for (int iImpl = Merkle::HashImpl::Scalar; iImpl <= eMax; iImpl++)
+		{
+			Merkle::HashImpl::s_Selected = (Merkle::HashImpl::Enum) iImpl;
+
+			const uint32_t nPairs = 19; // not a multiple of lanes
+			Merkle::Hash pIn[2][nPairs], pOut[nPairs], hv;
+			Merkle::Hash* ppOut[nPairs];
+			const Merkle::Hash* ppIn[2][nPairs];
+
+			for (uint32_t i = 0; i < nPairs; i++)
+			{
+				for (uint32_t j = 0; j < 2; j++)
+				{
+					for (uint32_t k = 0; k < Merkle::Hash::nBytes; k++)
+						pIn[j][i].m_pData[k] = (uint8_t) rand();
+					ppIn[j][i] = pIn[j] + i;
+				}
+				ppOut[i] = pOut + i;
+			}
+
+			ppOut[5] = pIn[0] + 5; // in-place
+			pOut[5] = pIn[0][5];
+
+			Merkle::InterpretMulti(ppOut, ppIn[0], ppIn[1], nPairs);
+
+			for (uint32_t i = 0; i < nPairs; i++)
+			{
+				const Merkle::Hash& hvLeft = (5 == i) ? pOut[i] : pIn[0][i];
+
+				ECC::Hash::Processor() << hvLeft << pIn[1][i] >> hv;
+				verify_test(hv == *ppOut[i]);
+
+				Merkle::Interpret(hv, hvLeft, pIn[1][i]);
+				verify_test(hv == *ppOut[i]);
+			}
+		}
+
+		Merkle::HashImpl::s_Selected = eMax;
+
+		// trees
+		UtxoTree t;
+		for (uint32_t i = 0; i < 30000; i++)
+		{
+			UtxoTree::Key::Data d;
+			SetRandomUtxoKey(d);
+			UtxoTree::Key key;
+			key = d;
+
+			UtxoTree::Cursor cu;
+			bool bCreate = true;
+			t.Find(cu, key, bCreate)->m_Value.m_Count = i;
+		}
+
+		Merkle::Hash hv0, hv1;
+		t.get_Hash(hv0);
+
+		UtxoTree::Cursor cu;
+		TreeInvalidator ti;
+		ti.m_pCu = &cu;
+		t.Traverse(ti);
+
+		HashParallel(t, 4);
+		t.get_Hash(hv1);
+		verify_test(hv0 == hv1);
+	}
+
+	void BenchmarkInterpret()
+	{
+		const uint32_t nPairs = 1024, nRounds = 200;
+		std::vector<Merkle::Hash> vHashes(nPairs * 2);
+		std::vector<Merkle::Hash*> vOut(nPairs);
+		std::vector<const Merkle::Hash*> vLeft(nPairs), vRight(nPairs);
+
+		for (uint32_t i = 0; i < nPairs; i++)
+		{
+			for (uint32_t k = 0; k < Merkle::Hash::nBytes; k++)
+				vHashes[i * 2].m_pData[k] = (uint8_t) rand();
+
+			vOut[i] = &vHashes[i * 2];
+			vLeft[i] = &vHashes[i * 2];
+			vRight[i] = &vHashes[i * 2 + 1];
+		}
+
+		static const char* s_szNames[] = {
+			"Merkle.Interpret (scalar)",
+			"Merkle.InterpretMulti (SSE2)",
+			"Merkle.InterpretMulti (AVX2)",
+			"Merkle.InterpretMulti (SHA-NI)",
+		};
+
+		const Merkle::HashImpl::Enum eMax = Merkle::HashImpl::get_Max();
+		for (int iImpl = Merkle::HashImpl::Scalar; iImpl <= eMax; iImpl++)
+		{
+			Merkle::HashImpl::s_Selected = (Merkle::HashImpl::Enum) iImpl;
+
+			BenchmarkTimer bt(s_szNames[iImpl], nPairs * nRounds);
+			for (uint32_t i = 0; i < nRounds; i++)
+				Merkle::InterpretMulti(&vOut.front(), &vLeft.front(), &vRight.front(), nPairs);
+		}
+
+		Merkle::HashImpl::s_Selected = eMax;
+	}
+
+	struct UtxoTreeHeap
+		:public UtxoTree
+	{
+		// the baseline allocator: each node is a separate heap block
+		~UtxoTreeHeap() { Clear(); }
+
+	protected:
+		virtual Joint* CreateJoint() override { return new MyJoint; }
+		virtual void DeleteJoint(Joint* p) override { delete (MyJoint*) p; }
+		virtual Leaf* CreateLeaf() override { return new MyLeaf; }
+		virtual void DeleteLeaf(Leaf* p) override { delete (MyLeaf*) p; }
+	};
+
+	uint64_t BenchmarkUtxoTreeFill(UtxoTree& t, const std::vector<UtxoTree::Key>& vKeys, const char* szInsert, const char* szMemory)
+	{
+		const uint32_t nCount = (uint32_t) vKeys.size();
+		uint64_t nRss0 = get_RssBytes();
+
+		{
+			BenchmarkTimer bt(szInsert, nCount);
+			for (uint32_t i = 0; i < nCount; i++)
+			{
+				UtxoTree::Cursor cu;
+				bool bCreate = true;
+				t.Find(cu, vKeys[i], bCreate)->m_Value.m_Count = i;
+			}
+		}
+
+		uint64_t nRss1 = get_RssBytes();
+		uint64_t nBytes = (nRss1 > nRss0) ? (nRss1 - nRss0) : 0;
+		if (nBytes)
+			printf("%-32s: %.1f bytes per element\n", szMemory, double(nBytes) / nCount);
+
+		// churn: delete and re-insert a half, which scatters the nodes over the memory
+		for (uint32_t i = 0; i < nCount; i += 2)
+		{
+			UtxoTree::Cursor cu;
+			bool bCreate = false;
+			t.Find(cu, vKeys[i], bCreate);
+			t.Delete(cu);
+		}
+
+		for (uint32_t i = 0; i < nCount; i += 2)
+		{
+			UtxoTree::Cursor cu;
+			bool bCreate = true;
+			t.Find(cu, vKeys[i], bCreate)->m_Value.m_Count = i;
+		}
+
+		return nBytes;
+	}
+
+	void BenchmarkUtxoTreeWalk(UtxoTree& t, const std::vector<UtxoTree::Key>& vKeys, const char* szHash, const char* szFind, Merkle::Hash& hv)
+	{
+		const uint32_t nCount = (uint32_t) vKeys.size();
+
+		UtxoTree::Cursor cu;
+		TreeInvalidator ti;
+		ti.m_pCu = &cu;
+		t.Traverse(ti);
+
+		{
+			BenchmarkTimer bt(szHash, nCount);
+			t.get_Hash(hv);
+		}
+
+		{
+			BenchmarkTimer bt(szFind, nCount);
+			for (uint32_t i = 0; i < nCount; i++)
+			{
+				bool bCreate = false;
+				t.Find(cu, vKeys[(i * 7919) % nCount], bCreate);
+			}
+		}
+	}
+
+	void BenchmarkUtxoTree()
+	{
+		const uint32_t nCount = 500000;
+
+		std::vector<UtxoTree::Key> vKeys;
+		vKeys.resize(nCount);
+
+		for (uint32_t i = 0; i < nCount; i++)
+		{
+			UtxoTree::Key::Data d;
+			SetRandomUtxoKey(d);
+			vKeys[i] = d;
+		}
+
+		// Both trees are alive simultaneously, so that the memory freed by one isn't reused by the other
+		UtxoTreeHeap t0;
+		UtxoTree t;
+
+		uint64_t nBytes0 = BenchmarkUtxoTreeFill(t0, vKeys, "UtxoTree.Insert (heap)", "UtxoTree memory (heap)");
+		uint64_t nBytes1 = BenchmarkUtxoTreeFill(t, vKeys, "UtxoTree.Insert", "UtxoTree memory");
+		if (nBytes0 && nBytes1)
+			printf("%-32s: %.1f%%\n", "UtxoTree memory saved vs heap", 100. * (1. - double(nBytes1) / double(nBytes0)));
+
+		Merkle::Hash hv0, hv1;
+
+		BenchmarkUtxoTreeWalk(t0, vKeys, "UtxoTree.Hash (heap)", "UtxoTree.Find (heap)", hv0);
+		BenchmarkUtxoTreeWalk(t, vKeys, "UtxoTree.Hash", "UtxoTree.Find", hv1);
+		verify_test(hv0 == hv1);
+
+		{
+			BenchmarkTimer bt("UtxoTree.Compact", nCount);
+			t.Compact();
+		}
+
+		BenchmarkUtxoTreeWalk(t, vKeys, "UtxoTree.Hash (compacted)", "UtxoTree.Find (compacted)", hv1);
+		verify_test(hv0 == hv1);
+
+		UtxoTree::Cursor cu;
+		TreeInvalidator ti;
+		ti.m_pCu = &cu;
+		t.Traverse(ti);
+
+		{
+			BenchmarkTimer bt("UtxoTree.Hash (4 threads)", nCount);
+			HashParallel(t, 4);
+			t.get_Hash(hv1);
+		}
+
+		verify_test(hv0 == hv1);
+	}
+
 	struct MyMmr
 		:public Merkle::Mmr
 	{
@@ -565,6 +921,9 @@ int main()
 {
 	beam::TestNavigator();
 	beam::TestUtxoTree();
+	beam::TestParallelHash();
+	beam::BenchmarkInterpret();
+	beam::BenchmarkUtxoTree();
 	beam::TestMmr();
 
 	return g_TestsFailed ? -1 : 0;
@@ -12,8 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include "core/block_crypt.h"
-#include "impl/crypto/equihash.h"
+#include "equihash_helper.h"
 #include "impl/uint256.h"
 #include "impl/arith_uint256.h"
 #include <utility>
@@ -21,65 +20,68 @@
 namespace beam
 {
 
-struct Block::PoW::Helper
+struct SolverReference
+	:public Block::PoW::ISolver
 {
-	blake2b_state m_Blake;
 	Equihash<Block::PoW::N, Block::PoW::K> m_Eh;
 
-	void Reset(const void* pInput, uint32_t nSizeInput, const NonceType& nonce)
+	virtual bool Solve(const Block::PoW::Helper& hlp, const SolutionFn& fnValid, const Block::PoW::Cancel& fnCancel) override
 	{
-		m_Eh.InitialiseState(m_Blake);
+		std::function<bool(const beam::ByteBuffer&)> fnValidInternal = [&fnValid](const beam::ByteBuffer& solution)
+		{
+			assert(solution.size() == Block::PoW::nSolutionBytes);
+			return fnValid(&solution.front());
+		};
 
-		// H(I||...
-		blake2b_update(&m_Blake, (uint8_t*) pInput, nSizeInput);
-		blake2b_update(&m_Blake, nonce.m_pData, nonce.nBytes);
-	}
+		std::function<bool(EhSolverCancelCheck)> fnCancelInternal = [&fnCancel](EhSolverCancelCheck pos) {
+			return fnCancel(false);
+		};
 
-	bool TestDifficulty(const uint8_t* pSol, uint32_t nSol, Difficulty d) const
-	{
-		ECC::Hash::Value hv;
+		try {
 
-		blake2b_state b2s = m_Blake;
-		blake2b_update(&b2s, pSol, nSol);
-		blake2b_final(&b2s, hv.m_pData, hv.nBytes);
+			return m_Eh.OptimisedSolve(hlp.m_Blake, fnValidInternal, fnCancelInternal);
 
-		return d.IsTargetReached(hv);
+		} catch (const EhSolverCancelledException&) {
+			return false;
+		}
 	}
 };
 
-bool Block::PoW::Solve(const void* pInput, uint32_t nSizeInput, const Cancel& fnCancel)
+Block::PoW::ISolver::Ptr Block::PoW::ISolver::CreateReference()
 {
+	return Ptr(new SolverReference);
+}
+
+bool Block::PoW::Solve(const void* pInput, uint32_t nSizeInput, const Cancel& fnCancel, ISolver* pSolver)
+{
+	if (!pSolver)
+	{
+		// the solver memory is large, keep it for the subsequent calls on this thread
+		thread_local ISolver::Ptr pSolverDef;
+		if (!pSolverDef)
+			pSolverDef = ISolver::CreateDefault();
+		pSolver = pSolverDef.get();
+	}
+
 	Helper hlp;
 
-	std::function<bool(const beam::ByteBuffer&)> fnValid = [this, &hlp](const beam::ByteBuffer& solution)
+	ISolver::SolutionFn fnValid = [this, &hlp](const uint8_t* pSol)
 		{
-			if (!hlp.TestDifficulty(&solution.front(), (uint32_t) solution.size(), m_Difficulty))
+			if (!hlp.TestDifficulty(pSol, nSolutionBytes, m_Difficulty))
 				return false;
-			assert(solution.size() == m_Indices.size());
-            std::copy(solution.begin(), solution.end(), m_Indices.begin());
-            return true;
-        };
-
-
-    std::function<bool(EhSolverCancelCheck)> fnCancelInternal = [fnCancel](EhSolverCancelCheck pos) {
-        return fnCancel(false);
-    };
+			std::copy(pSol, pSol + nSolutionBytes, m_Indices.begin());
+			return true;
+		};
 
     while (true)
     {
 		hlp.Reset(pInput, nSizeInput, m_Nonce);
 
-		try {
-
-			if (hlp.m_Eh.OptimisedSolve(hlp.m_Blake, fnValid, fnCancelInternal))
-				break;
-
-		} catch (const EhSolverCancelledException&) {
-			return false;
-		}
+		if (pSolver->Solve(hlp, fnValid, fnCancel))
+			break;
 
 		if (fnCancel(true))
-			return false; // retry not allowed
+			return false; // cancelled, or retry not allowed
 
         m_Nonce.Inc();
     }
@@ -99,4 +101,3 @@ bool Block::PoW::IsValid(const void* pInput, uint32_t nSizeInput) const
 }
 
 } // namespace beam
-
@@ -0,0 +1,451 @@
+// Copyright 2018 The Beam Team
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "equihash_helper.h"
+#include <algorithm>
+
+#ifdef __AVX2__
+#	include <immintrin.h>
+#endif
+
+namespace beam
+{
+
+namespace
+{
+#ifdef __AVX2__
+	// BLAKE2b finalization of 4 copies of the same state, each one after appending its own 32-bit index.
+	// Suitable for the Equihash row generation: all the data fits the last block, so there's a single compression per hash.
+	struct Blake2bx4
+	{
+		typedef __m256i V;
+
+		static V Add(V a, V b) { return _mm256_add_epi64(a, b); }
+		static V Xor(V a, V b) { return _mm256_xor_si256(a, b); }
+
+		template <int n>
+		static V Rotr(V x) { return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n)); }
+
+		static void G(V& a, V& b, V& c, V& d, V x, V y)
+		{
+			a = Add(Add(a, b), x);
+			d = Rotr<32>(Xor(d, a));
+			c = Add(c, d);
+			b = Rotr<24>(Xor(b, c));
+			a = Add(Add(a, b), y);
+			d = Rotr<16>(Xor(d, a));
+			c = Add(c, d);
+			b = Rotr<63>(Xor(b, c));
+		}
+
+		static bool IsSupported(const blake2b_state& s)
+		{
+			return s.buflen + sizeof(uint32_t) <= BLAKE2B_BLOCKBYTES;
+		}
+
+		static void Final(const blake2b_state& s, uint32_t g0, uint64_t pOut[4][8])
+		{
+			static const uint64_t s_pIV[8] = {
+				0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+				0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+			};
+
+			static const uint8_t s_pSigma[10][16] = {
+				{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+				{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+				{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+				{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+				{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+				{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+				{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+				{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+				{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+				{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+			};
+
+			// the last block of each lane (little-endian words, as the target is x86)
+			uint64_t pM[4][16];
+			for (uint32_t iLane = 0; iLane < 4; iLane++)
+			{
+				uint8_t* pBlock = reinterpret_cast<uint8_t*>(pM[iLane]);
+				memcpy(pBlock, s.buf, s.buflen);
+
+				uint32_t g = g0 + iLane;
+				for (uint32_t i = 0; i < sizeof(g); i++)
+					pBlock[s.buflen + i] = static_cast<uint8_t>(g >> (i << 3));
+
+				memset(pBlock + s.buflen + sizeof(g), 0, BLAKE2B_BLOCKBYTES - s.buflen - sizeof(g));
+			}
+
+			V pW[16];
+			for (uint32_t i = 0; i < 16; i++)
+				pW[i] = _mm256_set_epi64x(pM[3][i], pM[2][i], pM[1][i], pM[0][i]);
+
+			uint64_t t0 = s.t[0] + s.buflen + sizeof(uint32_t);
+			uint64_t t1 = s.t[1] + (t0 < s.t[0]);
+
+			V v[16];
+			for (uint32_t i = 0; i < 8; i++)
+				v[i] = _mm256_set1_epi64x(s.h[i]);
+			for (uint32_t i = 0; i < 4; i++)
+				v[i + 8] = _mm256_set1_epi64x(s_pIV[i]);
+
+			v[12] = _mm256_set1_epi64x(s_pIV[4] ^ t0);
+			v[13] = _mm256_set1_epi64x(s_pIV[5] ^ t1);
+			v[14] = _mm256_set1_epi64x(~s_pIV[6]); // last block
+			v[15] = _mm256_set1_epi64x(s.last_node ? ~s_pIV[7] : s_pIV[7]);
+
+			for (uint32_t iRound = 0; iRound < 12; iRound++)
+			{
+				const uint8_t* pS = s_pSigma[iRound % 10];
+
+				G(v[0], v[4], v[8], v[12], pW[pS[0]], pW[pS[1]]);
+				G(v[1], v[5], v[9], v[13], pW[pS[2]], pW[pS[3]]);
+				G(v[2], v[6], v[10], v[14], pW[pS[4]], pW[pS[5]]);
+				G(v[3], v[7], v[11], v[15], pW[pS[6]], pW[pS[7]]);
+				G(v[0], v[5], v[10], v[15], pW[pS[8]], pW[pS[9]]);
+				G(v[1], v[6], v[11], v[12], pW[pS[10]], pW[pS[11]]);
+				G(v[2], v[7], v[8], v[13], pW[pS[12]], pW[pS[13]]);
+				G(v[3], v[4], v[9], v[14], pW[pS[14]], pW[pS[15]]);
+			}
+
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				uint64_t pH[4];
+				_mm256_storeu_si256(reinterpret_cast<V*>(pH), Xor(_mm256_set1_epi64x(s.h[i]), Xor(v[i], v[i + 8])));
+
+				for (uint32_t iLane = 0; iLane < 4; iLane++)
+					pOut[iLane][i] = pH[iLane];
+			}
+		}
+	};
+#endif // __AVX2__
+
+	// Collision search via bucketed radix sort. Each round rows are scattered into buckets by the upper bits of the current digit,
+	// then each bucket (small enough to stay in cache) is sorted by the rest of the digit, and all the colliding pairs are emitted.
+	// Rows keep only the remaining hash bits and a reference to the pair they're made of, indices are recovered for the solutions only.
+	// All the memory is allocated once, and reused for consequent nonces.
+	template <uint32_t N, uint32_t K>
+	class SolverCpu
+		:public Block::PoW::ISolver
+	{
+		static const uint32_t s_DigitBits = N / (K + 1);
+		static const uint32_t s_IndexBits = s_DigitBits + 1;
+		static const uint32_t s_Rows0 = 1U << s_IndexBits;
+		static const uint32_t s_HashBytes = N / 8;
+		static const uint32_t s_IndicesPerHash = 512 / N;
+		static const uint32_t s_HashOutput = s_IndicesPerHash * s_HashBytes;
+		static const uint32_t s_Words = (N + 63) / 64;
+		static const uint32_t s_MaxRows = s_Rows0 + (s_Rows0 >> 2); // the excess is dropped (very rare)
+
+		static const uint32_t s_BucketBits = (s_DigitBits > 12) ? 12 : s_DigitBits;
+		static const uint32_t s_Buckets = 1U << s_BucketBits;
+		static const uint32_t s_SubBits = s_DigitBits - s_BucketBits;
+		static const uint32_t s_Subs = 1U << s_SubBits;
+
+		static_assert(!(N % 8), "");
+		static_assert(!(s_Rows0 % s_IndicesPerHash), "");
+		static_assert(s_DigitBits * 2 <= 64, "");
+		static_assert(s_SubBits <= 16, "");
+		static_assert((1U << K) * s_IndexBits == Block::PoW::nSolutionBits, "");
+
+		struct Row
+		{
+			uint64_t m_pH[s_Words]; // remaining hash bits, MSB-aligned
+			uint32_t m_Ref; // index for the initial rows, pair index otherwise
+		};
+
+		std::vector<Row> m_vRows;
+		std::vector<Row> m_vTmp;
+		std::vector<uint32_t> m_pPairs[K - 1];
+		std::vector<uint32_t> m_vBuckets;
+		std::vector<uint32_t> m_vOrder;
+		uint32_t m_nRows;
+
+		static uint32_t get_Bucket(const Row& r)
+		{
+			return static_cast<uint32_t>(r.m_pH[0] >> (64 - s_BucketBits));
+		}
+
+		static uint32_t get_Sub(const Row& r)
+		{
+			return static_cast<uint32_t>(r.m_pH[0] >> (64 - s_DigitBits)) & (s_Subs - 1);
+		}
+
+		void Allocate()
+		{
+			if (!m_vRows.empty())
+				return;
+
+			m_vRows.resize(s_MaxRows);
+			m_vTmp.resize(s_MaxRows);
+
+			for (uint32_t i = 0; i < _countof(m_pPairs); i++)
+				m_pPairs[i].resize(s_MaxRows * 2);
+
+			m_vBuckets.resize(s_Buckets + 1);
+		}
+
+		void LoadHashes(uint32_t g, const uint8_t* pHash)
+		{
+			for (uint32_t j = 0; j < s_IndicesPerHash; j++, pHash += s_HashBytes)
+			{
+				Row& r = m_vRows[g * s_IndicesPerHash + j];
+				r.m_Ref = g * s_IndicesPerHash + j;
+
+				for (uint32_t i = 0; i < s_Words; i++)
+				{
+					uint64_t val = 0;
+					for (uint32_t k = i * 8; k < (i + 1) * 8; k++)
+						val = (val << 8) | ((k < s_HashBytes) ? pHash[k] : 0);
+
+					r.m_pH[i] = val;
+				}
+			}
+		}
+
+		void Generate(const blake2b_state& s)
+		{
+			const uint32_t nHashes = s_Rows0 / s_IndicesPerHash;
+			uint32_t g = 0;
+
+#ifdef __AVX2__
+			if (Blake2bx4::IsSupported(s))
+				for (; g + 4 <= nHashes; g += 4)
+				{
+					uint64_t pOut[4][8];
+					Blake2bx4::Final(s, g, pOut);
+
+					for (uint32_t iLane = 0; iLane < 4; iLane++)
+						LoadHashes(g + iLane, reinterpret_cast<const uint8_t*>(pOut[iLane]));
+				}
+#endif // __AVX2__
+
+			for (; g < nHashes; g++)
+			{
+				uint8_t pG[sizeof(uint32_t)];
+				for (uint32_t i = 0; i < sizeof(pG); i++)
+					pG[i] = static_cast<uint8_t>(g >> (i << 3)); // little-endian
+
+				blake2b_state s2 = s;
+				blake2b_update(&s2, pG, sizeof(pG));
+
+				uint8_t pHash[BLAKE2B_OUTBYTES];
+				blake2b_final(&s2, pHash, static_cast<uint8_t>(s_HashOutput));
+
+				LoadHashes(g, pHash);
+			}
+
+			m_nRows = s_Rows0;
+		}
+
+		const uint32_t* get_Pair(uint32_t iLevel, uint32_t iRef) const
+		{
+			return &m_pPairs[iLevel - 1][iRef << 1];
+		}
+
+		void Expand(uint32_t* pIdx, uint32_t iLevel, uint32_t iRef) const
+		{
+			if (!iLevel)
+			{
+				*pIdx = iRef;
+				return;
+			}
+
+			const uint32_t* pPair = get_Pair(iLevel, iRef);
+			const uint32_t nHalf = 1U << (iLevel - 1);
+
+			Expand(pIdx, iLevel - 1, pPair[0]);
+			Expand(pIdx + nHalf, iLevel - 1, pPair[1]);
+
+			// canonical order
+			if (pIdx[0] > pIdx[nHalf])
+				std::swap_ranges(pIdx, pIdx + nHalf, pIdx + nHalf);
+		}
+
+		bool OnCandidate(const Row& a, const Row& b, const SolutionFn& fnValid) const
+		{
+			const uint32_t nHalf = 1U << (K - 1);
+			uint32_t pIdx[nHalf * 2];
+
+			Expand(pIdx, K - 1, a.m_Ref);
+			Expand(pIdx + nHalf, K - 1, b.m_Ref);
+
+			if (pIdx[0] > pIdx[nHalf])
+				std::swap_ranges(pIdx, pIdx + nHalf, pIdx + nHalf);
+
+			uint32_t pSorted[nHalf * 2];
+			std::copy(pIdx, pIdx + nHalf * 2, pSorted);
+			std::sort(pSorted, pSorted + nHalf * 2);
+			if (std::adjacent_find(pSorted, pSorted + nHalf * 2) != pSorted + nHalf * 2)
+				return false; // duplicate indices
+
+			// minimal encoding, big-endian
+			uint8_t pSol[Block::PoW::nSolutionBytes];
+			uint8_t* pDst = pSol;
+			uint64_t nAcc = 0;
+			uint32_t nBits = 0;
+
+			for (uint32_t i = 0; i < nHalf * 2; i++)
+			{
+				nAcc = (nAcc << s_IndexBits) | pIdx[i];
+				for (nBits += s_IndexBits; nBits >= 8; )
+				{
+					nBits -= 8;
+					*pDst++ = static_cast<uint8_t>(nAcc >> nBits);
+				}
+			}
+
+			return fnValid(pSol);
+		}
+
+		void Emit(const Row& a, const Row& b, uint32_t iRound)
+		{
+			if (m_nRows >= s_MaxRows)
+				return;
+
+			if (iRound > 1)
+			{
+				// pairs sharing an element would lead to duplicate indices
+				const uint32_t* pA = get_Pair(iRound - 1, a.m_Ref);
+				const uint32_t* pB = get_Pair(iRound - 1, b.m_Ref);
+
+				if ((pA[0] == pB[0]) || (pA[0] == pB[1]) || (pA[1] == pB[0]) || (pA[1] == pB[1]))
+					return;
+			}
+
+			uint32_t* pPair = &m_pPairs[iRound - 1][m_nRows << 1];
+			pPair[0] = a.m_Ref;
+			pPair[1] = b.m_Ref;
+
+			Row& r = m_vRows[m_nRows];
+			r.m_Ref = m_nRows++;
+
+			// xor, and drop the collided digit
+			for (uint32_t i = 0; i < s_Words; i++)
+			{
+				uint64_t val = (a.m_pH[i] ^ b.m_pH[i]) << s_DigitBits;
+				if (i + 1 < s_Words)
+					val |= (a.m_pH[i + 1] ^ b.m_pH[i + 1]) >> (64 - s_DigitBits);
+				r.m_pH[i] = val;
+			}
+		}
+
+		bool CollideBucket(const Row* pRows, uint32_t nRows, uint32_t iRound, const SolutionFn& fnValid)
+		{
+			if (m_vOrder.size() < nRows)
+				m_vOrder.resize(nRows);
+
+			uint32_t pPos[s_Subs + 1] = { 0 };
+			for (uint32_t i = 0; i < nRows; i++)
+				pPos[get_Sub(pRows[i]) + 1]++;
+
+			for (uint32_t i = 0; i < s_Subs; i++)
+				pPos[i + 1] += pPos[i];
+
+			for (uint32_t i = 0; i < nRows; i++)
+				m_vOrder[pPos[get_Sub(pRows[i])]++] = i;
+
+			// now pPos[i] is the end of the i-th group
+			for (uint32_t iSub = 0, i0 = 0; iSub < s_Subs; i0 = pPos[iSub++])
+			{
+				const uint32_t i1 = pPos[iSub];
+
+				for (uint32_t x = i0; x + 1 < i1; x++)
+				{
+					const Row& a = pRows[m_vOrder[x]];
+
+					for (uint32_t y = x + 1; y < i1; y++)
+					{
+						const Row& b = pRows[m_vOrder[y]];
+
+						if (iRound < K)
+							Emit(a, b, iRound);
+						else
+						{
+							// the last 2 digits must collide
+							if ((a.m_pH[0] ^ b.m_pH[0]) >> (64 - s_DigitBits * 2))
+								continue;
+
+							if (OnCandidate(a, b, fnValid))
+								return true;
+						}
+					}
+				}
+			}
+
+			return false;
+		}
+
+		bool Collide(uint32_t iRound, const SolutionFn& fnValid)
+		{
+			// scatter into buckets
+			uint32_t* pPos = &m_vBuckets.front();
+			memset(pPos, 0, sizeof(uint32_t) * (s_Buckets + 1));
+
+			for (uint32_t i = 0; i < m_nRows; i++)
+				pPos[get_Bucket(m_vRows[i]) + 1]++;
+
+			for (uint32_t i = 0; i < s_Buckets; i++)
+				pPos[i + 1] += pPos[i];
+
+			for (uint32_t i = 0; i < m_nRows; i++)
+			{
+				const Row& r = m_vRows[i];
+				m_vTmp[pPos[get_Bucket(r)]++] = r;
+			}
+
+			// now pPos[i] is the end of the i-th bucket. The new rows overwrite the old ones
+			m_nRows = 0;
+
+			for (uint32_t iBucket = 0, i0 = 0; iBucket < s_Buckets; i0 = pPos[iBucket++])
+			{
+				const uint32_t i1 = pPos[iBucket];
+				if ((i1 - i0 > 1) && CollideBucket(&m_vTmp[i0], i1 - i0, iRound, fnValid))
+					return true;
+			}
+
+			return false;
+		}
+
+	public:
+
+		SolverCpu() :m_nRows(0) {}
+
+		virtual bool Solve(const Block::PoW::Helper& hlp, const SolutionFn& fnValid, const Block::PoW::Cancel& fnCancel) override
+		{
+			Allocate();
+			Generate(hlp.m_Blake);
+
+			for (uint32_t iRound = 1; iRound <= K; iRound++)
+			{
+				if (fnCancel(false))
+					return false;
+
+				if (Collide(iRound, fnValid))
+					return true;
+			}
+
+			return false;
+		}
+	};
+
+} // namespace
+
+Block::PoW::ISolver::Ptr Block::PoW::ISolver::CreateDefault()
+{
+	return Ptr(new SolverCpu<N, K>);
+}
+
+} // namespace beam
@@ -0,0 +1,48 @@
+// Copyright 2018 The Beam Team
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+#include "core/block_crypt.h"
+#include "impl/crypto/equihash.h"
+
+namespace beam
+{
+
+struct Block::PoW::Helper
+{
+	blake2b_state m_Blake;
+	Equihash<Block::PoW::N, Block::PoW::K> m_Eh;
+
+	void Reset(const void* pInput, uint32_t nSizeInput, const NonceType& nonce)
+	{
+		m_Eh.InitialiseState(m_Blake);
+
+		// H(I||...
+		blake2b_update(&m_Blake, (uint8_t*) pInput, nSizeInput);
+		blake2b_update(&m_Blake, nonce.m_pData, nonce.nBytes);
+	}
+
+	bool TestDifficulty(const uint8_t* pSol, uint32_t nSol, Difficulty d) const
+	{
+		ECC::Hash::Value hv;
+
+		blake2b_state b2s = m_Blake;
+		blake2b_update(&b2s, pSol, nSol);
+		blake2b_final(&b2s, hv.m_pData, hv.nBytes);
+
+		return d.IsTargetReached(hv);
+	}
+};
+
+} // namespace beam
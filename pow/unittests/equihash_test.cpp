@@ -14,17 +14,51 @@
 
 #include "core/block_crypt.h"
 #include <iostream>
+#include <chrono>
 
-int main()
+namespace
 {
-    uint8_t pInput[] = {1, 2, 3, 4, 56};
+	// solves several inputs, verifies and measures
+	bool SolveAndVerify(beam::Block::PoW::ISolver& solver, const char* szName, uint32_t nSolutions)
+	{
+		uint8_t pInput[] = {1, 2, 3, 4, 56};
+
+		beam::Block::PoW pow;
+		pow.m_Difficulty = 0; // d=0, runtime ~48 sec. d=1,2 - almost close to this. d=4 - runtime 4 miuntes, several cycles until solution is achieved.
+		pow.m_Nonce = 0x010204U;
+
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+		for (uint32_t i = 0; i < nSolutions; i++)
+		{
+			pInput[0] = static_cast<uint8_t>(i + 1);
+
+			pow.Solve(pInput, sizeof(pInput), [](bool) { return false; }, &solver);
+
+			if (!pow.IsValid(pInput, sizeof(pInput)))
+			{
+				std::cout << szName << ": invalid solution\n";
+				return false;
+			}
+
+			pow.m_Nonce.Inc();
+		}
 
-	beam::Block::PoW pow;
-	pow.m_Difficulty = 0; // d=0, runtime ~48 sec. d=1,2 - almost close to this. d=4 - runtime 4 miuntes, several cycles until solution is achieved.
-	pow.m_Nonce = 0x010204U;
-	pow.Solve(pInput, sizeof(pInput));
+		double dt_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		printf("%-24s: %.3f sec/solution, %.3f solutions/sec\n", szName, dt_s / nSolutions, nSolutions / dt_s);
+
+		return true;
+	}
+}
+
+int main()
+{
+	beam::Block::PoW::ISolver::Ptr pSolver = beam::Block::PoW::ISolver::CreateDefault();
+	if (!SolveAndVerify(*pSolver, "Equihash (default)", 8))
+		return -1;
 
-    if (!pow.IsValid(pInput, sizeof(pInput)))
+	pSolver = beam::Block::PoW::ISolver::CreateReference();
+	if (!SolveAndVerify(*pSolver, "Equihash (reference)", 1))
 		return -1;
 
     std::cout << "Solution is correct\n";
@@ -21,6 +21,10 @@
 #include <iostream>
 #include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include <algorithm>
 
 namespace beam {
@@ -30,6 +34,7 @@ using namespace std;
 Logger* Logger::g_logger = 0;
 
 class LoggerImpl : public Logger {
+    friend class AsyncLogger;
     mutex _mutex;
 protected:
     static const size_t MAX_HEADER_SIZE = 256;
@@ -53,12 +58,6 @@ protected:
         if (minLevel <= 0) throw runtime_error("logger: minimal level out of range");
     }
 
-    virtual ~LoggerImpl() {
-        if (this == g_logger) {
-            g_logger = 0;
-        }
-    }
-
     void set_header_formatter(LogMessageHeaderFormatter formatter) override {
         if (formatter) _headerFormatter = formatter;
     }
@@ -86,6 +85,12 @@ protected:
     }
 
 public:
+    virtual ~LoggerImpl() {
+        if (this == g_logger) {
+            g_logger = 0;
+        }
+    }
+
     bool level_accepted(int level) override {
         return level >= _minLevel;
     }
@@ -97,6 +102,16 @@ public:
         fwrite(msg, 1, size, _sink);
         if (level >= _flushLevel) fflush(_sink);
     }
+
+    virtual void flush() {
+        if (!_sink) return;
+        lock_guard<mutex> lock(_mutex);
+        fflush(_sink);
+    }
+
+    virtual void set_flush_level(int flushLevel) {
+        _flushLevel = flushLevel;
+    }
 };
 
 class ConsoleLogger : public LoggerImpl {
@@ -189,6 +204,280 @@ public:
     void rotate() override {
         _fileSink.rotate();
     }
+
+    void flush() override {
+        _consoleSink.flush();
+        _fileSink.flush();
+    }
+
+    void set_flush_level(int flushLevel) override {
+        LoggerImpl::set_flush_level(flushLevel);
+        _consoleSink.set_flush_level(flushLevel);
+        _fileSink.set_flush_level(flushLevel);
+    }
+};
+
+/// Single producer (the owning thread), single consumer (the writer thread) ring of variable-size records
+class LogRing {
+public:
+    static constexpr size_t CAPACITY = 1 << 18;
+    static constexpr size_t MAX_TEXT_SIZE = CAPACITY / 4; // longer messages are truncated
+
+    std::atomic<bool> orphaned { false }; // the owning thread has exited
+    std::atomic<uint64_t> dropped { 0 };
+    std::atomic<uint64_t> stalled { 0 };
+    uint64_t droppedReported = 0; // writer-side
+
+    LogRing() : _buf(new char[CAPACITY]) {}
+
+    bool push(const LogMessageHeader& header, const char* text, size_t size) {
+        size = std::min(size, MAX_TEXT_SIZE);
+        size_t total = align(sizeof(Record) + size);
+
+        uint64_t head = _head.load(memory_order_relaxed);
+        uint64_t tail = _tail.load(memory_order_acquire);
+
+        size_t pos = head & (CAPACITY - 1);
+        size_t contiguous = CAPACITY - pos;
+        size_t padding = (contiguous < total) ? contiguous : 0;
+
+        if (head + padding + total - tail > CAPACITY) {
+            return false;
+        }
+
+        if (padding) {
+            Record* r = (Record*)(_buf.get() + pos);
+            r->size = uint32_t(padding);
+            r->textSize = PADDING;
+            head += padding;
+            pos = 0;
+        }
+
+        Record* r = (Record*)(_buf.get() + pos);
+        r->size = uint32_t(total);
+        r->textSize = uint32_t(size);
+        r->header = header;
+        memcpy(r + 1, text, size);
+
+        _head.store(head + total, memory_order_release);
+        return true;
+    }
+
+    template <typename Func> bool drain(Func&& func) {
+        uint64_t tail = _tail.load(memory_order_relaxed);
+        uint64_t head = _head.load(memory_order_acquire);
+
+        while (tail != head) {
+            const Record* r = (const Record*)(_buf.get() + (tail & (CAPACITY - 1)));
+            if (r->textSize != PADDING) {
+                func(r->header, (const char*)(r + 1), r->textSize);
+            }
+            tail += r->size;
+            _tail.store(tail, memory_order_release);
+        }
+        return (tail == _head.load(memory_order_acquire));
+    }
+
+private:
+    static constexpr uint32_t PADDING = uint32_t(-1);
+
+    struct Record {
+        uint32_t size; // whole record, aligned
+        uint32_t textSize;
+        LogMessageHeader header;
+    };
+
+    static size_t align(size_t n) {
+        const size_t a = alignof(Record);
+        return (n + a - 1) & ~(a - 1);
+    }
+
+    std::unique_ptr<char[]> _buf;
+    std::atomic<uint64_t> _head { 0 }; // producer
+    std::atomic<uint64_t> _tail { 0 }; // consumer
+};
+
+namespace {
+
+struct LogRingRef {
+    uint64_t generation = 0;
+    std::shared_ptr<LogRing> ring;
+
+    ~LogRingRef() {
+        if (ring) ring->orphaned = true;
+    }
+};
+
+LogRingRef& get_ring_ref() {
+    static thread_local LogRingRef ref;
+    return ref;
+}
+
+std::atomic<uint64_t> g_asyncGeneration { 0 };
+
+} //namespace
+
+/// Puts the messages into the per-thread rings (no locks, no syscalls on the calling thread).
+/// The writer thread formats the headers and writes the records into the wrapped sink, flushing it once per batch.
+/// The order is preserved per thread, messages of different threads may be interleaved slightly out of order.
+class AsyncLogger : public Logger {
+    std::unique_ptr<LoggerImpl> _sink;
+    const uint64_t _generation;
+    const int _flushLevel; // messages at this level and above are never dropped, and written asap
+
+    mutex _ringsMutex; // only to register new threads
+    std::vector<std::shared_ptr<LogRing>> _rings;
+
+    mutex _sinkMutex; // writer vs. the settings
+    mutex _wakeMutex;
+    condition_variable _cv;
+    std::atomic<bool> _wake { false };
+    std::atomic<bool> _stop { false };
+    std::atomic<uint64_t> _written { 0 };
+    std::atomic<uint64_t> _droppedTotal { 0 };
+    std::atomic<uint64_t> _stalledTotal { 0 };
+    std::thread _thread;
+
+    static constexpr int WRITE_PERIOD_MSEC = 20;
+
+public:
+    explicit AsyncLogger(std::unique_ptr<LoggerImpl>&& sink) :
+        _sink(std::move(sink)),
+        _generation(++g_asyncGeneration),
+        _flushLevel(_sink->_flushLevel)
+    {
+        _sink->set_flush_level(LOG_LEVEL_CRITICAL + 1); // the writer flushes once per batch
+        _thread = std::thread(&AsyncLogger::thread_func, this);
+    }
+
+    ~AsyncLogger() {
+        if (this == g_logger) {
+            g_logger = 0;
+        }
+        _stop = true;
+        wake();
+        _thread.join();
+    }
+
+    void set_header_formatter(LogMessageHeaderFormatter formatter) override {
+        lock_guard<mutex> lock(_sinkMutex);
+        _sink->set_header_formatter(formatter);
+    }
+
+    void set_time_format(const char* format, bool printMilliseconds) override {
+        lock_guard<mutex> lock(_sinkMutex);
+        _sink->set_time_format(format, printMilliseconds);
+    }
+
+    void rotate() override {
+        lock_guard<mutex> lock(_sinkMutex);
+        _sink->rotate();
+    }
+
+    void get_stats(Stats& s) override {
+        s.written = _written;
+        s.dropped = _droppedTotal;
+        s.stalled = _stalledTotal;
+    }
+
+protected:
+    bool level_accepted(int level) override {
+        return _sink->level_accepted(level);
+    }
+
+    void write_message(const LogMessageHeader& header, const char* buf, size_t size) override {
+        LogRing& ring = get_ring();
+
+        if (!ring.push(header, buf, size)) {
+            if (header.level < _flushLevel) {
+                ring.dropped.fetch_add(1, memory_order_relaxed);
+                _droppedTotal.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+
+            // important message, wait for the space
+            ring.stalled.fetch_add(1, memory_order_relaxed);
+            _stalledTotal.fetch_add(1, memory_order_relaxed);
+            do {
+                wake();
+                std::this_thread::yield();
+            } while (!ring.push(header, buf, size));
+        }
+
+        if (header.level >= _flushLevel) {
+            wake();
+        }
+    }
+
+private:
+    LogRing& get_ring() {
+        LogRingRef& ref = get_ring_ref();
+        if (ref.generation != _generation) {
+            if (ref.ring) ref.ring->orphaned = true; // left from the previous logger
+            ref.ring = std::make_shared<LogRing>();
+            ref.generation = _generation;
+
+            lock_guard<mutex> lock(_ringsMutex);
+            _rings.push_back(ref.ring);
+        }
+        return *ref.ring;
+    }
+
+    void wake() {
+        _wake = true;
+        _cv.notify_one();
+    }
+
+    void thread_func() {
+        while (true) {
+            {
+                unique_lock<mutex> lock(_wakeMutex);
+                _cv.wait_for(lock, std::chrono::milliseconds(WRITE_PERIOD_MSEC), [this]() { return _wake.exchange(false) || _stop; });
+            }
+
+            bool stop = _stop; // everything logged before the stop is written
+            write_all();
+            if (stop) break;
+        }
+    }
+
+    void write_all() {
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            lock_guard<mutex> lock(_ringsMutex);
+            rings = _rings;
+        }
+
+        lock_guard<mutex> lock(_sinkMutex);
+
+        uint64_t written = 0;
+        for (const auto& ring : rings) {
+            bool orphaned = ring->orphaned;
+
+            bool empty = ring->drain([&](const LogMessageHeader& header, const char* text, size_t size) {
+                _sink->write_message(header, text, size);
+                written++;
+            });
+
+            uint64_t dropped = ring->dropped.load(memory_order_relaxed);
+            if (dropped != ring->droppedReported) {
+                char msg[128];
+                int n = snprintf(msg, sizeof(msg), "logger: %llu message(s) dropped\n", (unsigned long long)(dropped - ring->droppedReported));
+                ring->droppedReported = dropped;
+                _sink->write_message(LogMessageHeader(LOG_LEVEL_WARNING, 0, 0, 0), msg, size_t(n));
+            }
+
+            if (orphaned && empty) {
+                lock_guard<mutex> lockRings(_ringsMutex);
+                _rings.erase(std::find(_rings.begin(), _rings.end(), ring));
+            }
+        }
+
+        if (written) {
+            _sink->flush();
+            _written += written;
+        }
+    }
 };
 
 std::shared_ptr<Logger> Logger::create(
@@ -196,13 +485,14 @@ std::shared_ptr<Logger> Logger::create(
     int consoleLevel,
     int fileLevel,
     const std::string& fileNamePrefix,
-    const std::string& dstPath
+    const std::string& dstPath,
+    bool async
 ) {
     if (g_logger) {
         throw runtime_error("logger already initialized");
     }
 
-    std::shared_ptr<Logger> logger;
+    std::unique_ptr<LoggerImpl> sink;
 
     int what = 0;
 
@@ -211,18 +501,25 @@ std::shared_ptr<Logger> Logger::create(
 
     switch (what) {
         case 3:
-            logger.reset(new CombinedLogger(flushLevel, consoleLevel, fileLevel, fileNamePrefix, dstPath));
+            sink.reset(new CombinedLogger(flushLevel, consoleLevel, fileLevel, fileNamePrefix, dstPath));
             break;
         case 2:
-            logger.reset(new FileLogger(flushLevel, fileLevel, fileNamePrefix, dstPath));
+            sink.reset(new FileLogger(flushLevel, fileLevel, fileNamePrefix, dstPath));
             break;
         case 1:
-            logger.reset(new ConsoleLogger(flushLevel, consoleLevel));
+            sink.reset(new ConsoleLogger(flushLevel, consoleLevel));
             break;
         default:
             throw runtime_error("no logger sink configured");
     }
 
+    std::shared_ptr<Logger> logger;
+    if (async) {
+        logger.reset(new AsyncLogger(std::move(sink)));
+    } else {
+        logger.reset(sink.release());
+    }
+
     g_logger = logger.get();
     return logger;
 }
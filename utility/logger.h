@@ -143,7 +143,10 @@ public:
         const std::string& fileNamePrefix = std::string(),
 
         // path to log file
-        const std::string& dstPath = std::string()
+        const std::string& dstPath = std::string(),
+
+        // if set - the calling threads only put the messages into their per-thread buffers, the sinks are written by the background thread
+        bool async = false
     );
 
     virtual ~Logger() {}
@@ -157,6 +160,15 @@ public:
     /// Rotates file name, called externally
     virtual void rotate() = 0;
 
+    struct Stats {
+        uint64_t written=0; // by the background thread
+        uint64_t dropped=0; // messages below the flush level, lost due to full buffers
+        uint64_t stalled=0; // messages at (or above) the flush level, which had to wait for the buffer space
+    };
+
+    /// Async logger statistics, for sync one all are zero
+    virtual void get_stats(Stats& s) { s = Stats(); }
+
     static bool will_log(int level) {
         return g_logger && g_logger->level_accepted(level);
     }
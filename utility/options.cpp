@@ -27,6 +27,9 @@ namespace beam
         const char* PORT = "port";
         const char* PORT_FULL = "port,p";
         const char* STORAGE = "storage";
+        const char* TREES_IMAGE = "trees_image";
+        const char* SNAPSHOT_SYNC = "snapshot_sync";
+        const char* POOL_MAX_MB = "pool_max_mb";
         const char* WALLET_STORAGE = "wallet_path";
         const char* BBS_STORAGE = "bbs_keystore_path";
         const char* HISTORY = "history_dir";
@@ -98,6 +101,9 @@ namespace beam
         po::options_description node_options("Node options");
         node_options.add_options()
             (cli::STORAGE, po::value<string>()->default_value("node.db"), "node storage path")
+            (cli::TREES_IMAGE, po::value<string>(), "optional file for the image of the live UTXO/kernel trees, speeds-up the startup")
+            (cli::SNAPSHOT_SYNC, po::value<bool>()->default_value(false), "on the first start bootstrap from the history snapshot of a peer, instead of downloading all the blocks")
+            (cli::POOL_MAX_MB, po::value<uint32_t>()->default_value(256), "memory budget of the transaction pool (MB), the txs with the lowest fee rate are evicted")
             (cli::HISTORY, po::value<string>()->default_value(szLocalDir), "directory for compressed history")
             (cli::TEMP, po::value<string>()->default_value(szTempDir), "temp directory for compressed history, must be on the same volume")
 			(cli::TREASURY_BLOCK, po::value<string>()->default_value("treasury.mw"), "Block pack to import treasury from")
@@ -29,6 +29,9 @@ namespace beam
         extern const char* PORT;
         extern const char* PORT_FULL;
         extern const char* STORAGE;
+        extern const char* TREES_IMAGE;
+        extern const char* SNAPSHOT_SYNC;
+        extern const char* POOL_MAX_MB;
         extern const char* WALLET_STORAGE;
         extern const char* BBS_STORAGE;
         extern const char* HISTORY;
@@ -14,7 +14,9 @@
 
 #include "logger_checkpoints.h"
 #include "helpers.h"
+#include <boost/filesystem.hpp>
 #include <thread>
+#include <vector>
 
 using namespace beam;
 
@@ -79,6 +81,64 @@ void test_ndc_2(bool exc)
     }
 }
 
+bool test_async_logger() {
+    static const char* PATH = "./logs_async_test";
+    static const int THREADS = 4;
+    static const int MESSAGES = 20000;
+    static const int ERRORS = 100;
+
+    bool ok = true;
+    {
+        auto logger = Logger::create(LOG_LEVEL_ERROR, LOG_SINK_DISABLED, LOG_LEVEL_INFO, "async_", PATH, true);
+
+        uint64_t t0 = local_timestamp_msec();
+
+        std::vector<std::thread> threads;
+        for (int i=0; i<THREADS; ++i) {
+            threads.emplace_back([i]() {
+                XXX xxx;
+                for (int j=0; j<MESSAGES; ++j) {
+                    LOG_INFO() << "thread " << i << " message " << j << ' ' << xxx;
+                    if (!(j % (MESSAGES / ERRORS))) {
+                        LOG_ERROR() << "thread " << i << " error " << j;
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        uint64_t t1 = local_timestamp_msec();
+
+        // wait for the writer
+        Logger::Stats stats;
+        const uint64_t total = THREADS * (MESSAGES + ERRORS);
+        for (int i=0; i<500; ++i) {
+            logger->get_stats(stats);
+            if (stats.written + stats.dropped >= total) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        printf("async logger: %llu messages, %.0f ns per message on the calling thread, written=%llu dropped=%llu stalled=%llu\n",
+            (unsigned long long) total, (t1 - t0) * 1e6 / total,
+            (unsigned long long) stats.written, (unsigned long long) stats.dropped, (unsigned long long) stats.stalled);
+
+        if (stats.written + stats.dropped != total) {
+            printf("async logger: messages lost\n");
+            ok = false;
+        }
+        if (stats.written < THREADS * ERRORS) {
+            printf("async logger: errors must never be dropped\n");
+            ok = false;
+        }
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(PATH, ec);
+    return ok;
+}
+
 int main() {
     test_logger_1();
     test_ndc_1();
@@ -87,4 +147,6 @@ int main() {
         test_ndc_2(true);
     }
     catch(...) {}
+
+    return test_async_logger() ? 0 : 1;
 }
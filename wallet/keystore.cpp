@@ -3,6 +3,11 @@
 #include <boost/filesystem.hpp>
 #include <stdexcept>
 #include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 namespace beam {
 
@@ -141,12 +146,151 @@ void write_keystore_file(const KeyPairs& in, const std::string& fileName, const
     boost::filesystem::rename(newFileName, fileName);
 }
 
+/// Worker threads for the trial decryption, shared by all keystores and started on demand.
+/// The calling thread participates too
+class TrialDecryptPool {
+public:
+    // below this the thread synchronization costs more than it saves
+    static const size_t PARALLEL_THRESHOLD = 8;
+    struct Candidate {
+        size_t index;
+        const PubKey* pubKey;
+        const PrivKey* privKey;
+    };
+
+    struct Job {
+        const proto::BbsTrialDecryptor& decryptor;
+        const std::vector<Candidate>& candidates;
+        ByteBuffer& out;
+        size_t maxThreads;
+        std::atomic<size_t> next;
+        std::atomic<bool> found;
+        size_t matched;
+        std::exception_ptr error;
+
+        Job(const proto::BbsTrialDecryptor& d, const std::vector<Candidate>& c, ByteBuffer& o, size_t nMaxThreads) :
+            decryptor(d), candidates(c), out(o), maxThreads(nMaxThreads), next(0), found(false), matched(0)
+        {}
+    };
+
+    static TrialDecryptPool& get() {
+        static TrialDecryptPool s_pool;
+        return s_pool;
+    }
+
+    ~TrialDecryptPool() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cvJob.notify_all();
+        for (auto& t : _threads) {
+            t.join();
+        }
+    }
+
+    /// Rethrows the first exception raised by any participant, after all of them are done with the job
+    void run(Job& job) {
+        std::unique_lock<std::mutex> runLock(_runMutex);
+
+        // grow only as much as the job can use, never past the hardware (unless the limit is set explicitly)
+        size_t nMax = job.maxThreads ? job.maxThreads : std::thread::hardware_concurrency();
+        size_t nWanted = job.candidates.size() / PARALLEL_THRESHOLD;
+        if (nWanted > nMax)
+            nWanted = nMax;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            // new workers start from the current job number, so that they only pick up the job published below
+            while (_threads.size() + 1 < nWanted) {
+                _threads.emplace_back(&TrialDecryptPool::thread_func, this, _jobNum);
+            }
+
+            _job = &job;
+            _pending = _threads.size();
+            ++_jobNum;
+        }
+        _cvJob.notify_all();
+
+        proceed(job);
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cvDone.wait(lock, [this]() { return !_pending; });
+            _job = 0;
+        }
+
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+
+private:
+    void thread_func(uint64_t jobNum) {
+        while (true) {
+            Job* job = 0;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cvJob.wait(lock, [&]() { return _stop || (_jobNum != jobNum); });
+                if (_stop) return;
+                jobNum = _jobNum;
+                job = _job;
+            }
+
+            proceed(*job);
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!--_pending) {
+                _cvDone.notify_one();
+            }
+        }
+    }
+
+    void proceed(Job& job) {
+        try {
+            ByteBuffer buf;
+            while (!job.found) {
+                size_t i = job.next++;
+                if (i >= job.candidates.size()) break;
+
+                const Candidate& c = job.candidates[i];
+                if (job.decryptor.Try(buf, *c.privKey, *c.pubKey)) {
+                    if (!job.found.exchange(true)) {
+                        job.matched = i;
+                        job.out.swap(buf);
+                    }
+                    break;
+                }
+            }
+        } catch (...) {
+            // stop the others and hand the error over to the caller
+            job.next = job.candidates.size();
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+        }
+    }
+
+    std::vector<std::thread> _threads;
+    std::mutex _runMutex;
+    std::mutex _mutex;
+    std::condition_variable _cvJob;
+    std::condition_variable _cvDone;
+    Job* _job=0;
+    uint64_t _jobNum=0;
+    size_t _pending=0;
+    bool _stop=false;
+};
+
 } //namespace
 
 class LocalFileKeystore : public IKeyStore {
 public:
     LocalFileKeystore(const IKeyStore::Options& options, const void* password, size_t passwordLen) :
-        _fileName(options.fileName)
+        _fileName(options.fileName),
+        _trialDecryptThreads(options.trialDecryptThreads)
     {
         hash_from_password(_pass, password, passwordLen);
         bool allEnabled = (options.flags & Options::enable_all_keys) != 0;
@@ -267,7 +411,42 @@ private:
         return proto::BbsDecrypt(out, size, (PrivKey&)it->second.V);
     }
 
+    bool decrypt(ByteBuffer& out, size_t& iKey, const ByteBuffer& buffer, const std::vector<PubKey>& pubKeys) override {
+        proto::BbsTrialDecryptor decryptor;
+        if (buffer.empty() || !decryptor.Init(&buffer.at(0), (uint32_t)buffer.size())) {
+            return false;
+        }
+
+        std::vector<TrialDecryptPool::Candidate> candidates;
+        candidates.reserve(pubKeys.size());
+        for (size_t i=0; i<pubKeys.size(); ++i) {
+            auto it = _keyPairs.find(pubKeys[i]);
+            if (it != _keyPairs.end()) {
+                candidates.push_back({ i, &it->first, &it->second.V });
+            }
+        }
+
+        if (candidates.size() < 2 * TrialDecryptPool::PARALLEL_THRESHOLD) {
+            for (const auto& c : candidates) {
+                if (decryptor.Try(out, *c.privKey, *c.pubKey)) {
+                    iKey = c.index;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        TrialDecryptPool::Job job(decryptor, candidates, out, _trialDecryptThreads);
+        TrialDecryptPool::get().run(job);
+        if (!job.found) {
+            return false;
+        }
+        iKey = candidates[job.matched].index;
+        return true;
+    }
+
     std::string _fileName;
+    size_t _trialDecryptThreads;
     KeyPairs _keyPairs;
     KeyPairs _unsaved;
 
@@ -28,6 +28,7 @@ struct IKeyStore {
         int flags=0;
         std::string fileName;
         std::set<PubKey> enableKeys;
+        size_t trialDecryptThreads=0; // max threads for the trial decryption, 0: as many as the hardware supports
     };
 
     /// Creates or opens the keystore based on options
@@ -68,6 +69,10 @@ struct IKeyStore {
     /// In-place decrypts the message given in buffer using private key associated with pubKey.
     /// Returns false if private key is missing for pubKey or decription process fails
     virtual bool decrypt(uint8_t*& out, uint32_t& size, ByteBuffer& buffer, const PubKey& pubKey) = 0;
+
+    /// Trial-decrypts the message addressed to one of the given keys (the recipient is unknown). Large key sets are tried in parallel.
+    /// On success out receives the decrypted message, and iKey the index of the matching key. The source buffer is not modified
+    virtual bool decrypt(ByteBuffer& out, size_t& iKey, const ByteBuffer& buffer, const std::vector<PubKey>& pubKeys) = 0;
 };
 
 } //namespace
@@ -2,6 +2,7 @@
 #include "wallet/secstring.h"
 #include "utility/logger.h"
 #include <boost/filesystem.hpp>
+#include <chrono>
 
 namespace {
 
@@ -138,6 +139,144 @@ int keystore_test_normal() {
     return 0;
 }
 
+int keystore_test_trial() {
+    KeystoreCleanup c;
+
+    static const char DATA[] = "sdkjfhsdkjfh2394871298347jhsdfkjhsdkjfhskdjhfksjdhf";
+
+    using namespace beam;
+
+    IKeyStore::Options options;
+    options.flags = IKeyStore::Options::local_file | IKeyStore::Options::enable_all_keys;
+    options.fileName = KEYSTORE_FILE;
+    IKeyStore::Ptr ks = IKeyStore::create(options, PASSWORD, sizeof(PASSWORD));
+
+    std::vector<PubKey> keys(200);
+    for (auto& k : keys) {
+        ks->gen_keypair(k);
+        ks->save_keypair(k, true);
+    }
+
+    ByteBuffer buf, out;
+    size_t iKey = 0;
+
+    for (size_t iTrg : { size_t(0), size_t(137), keys.size() - 1 }) {
+        buf.clear();
+        if (!ks->encrypt(buf, DATA, sizeof(DATA), keys[iTrg])) {
+            LOG_ERROR() << "cannot encrypt, trial";
+            return 1;
+        }
+        ByteBuffer buf0 = buf;
+
+        auto t0 = std::chrono::steady_clock::now();
+        if (!ks->decrypt(out, iKey, buf, keys) || iKey != iTrg || out.size() != sizeof(DATA) || memcmp(DATA, out.data(), sizeof(DATA)) != 0) {
+            LOG_ERROR() << "cannot trial-decrypt, key=" << iTrg;
+            return 1;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (buf != buf0) {
+            LOG_ERROR() << "trial decryption modified the message";
+            return 1;
+        }
+
+        // the same, one key at a time. The message is decrypted in-place, each attempt needs a fresh copy
+        uint8_t* p = 0;
+        uint32_t size = 0;
+        size_t i = 0;
+        for (; i < keys.size(); ++i) {
+            ByteBuffer tmp = buf0;
+            if (ks->decrypt(p, size, tmp, keys[i])) break;
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        if (i != iTrg) {
+            LOG_ERROR() << "sequential decrypt mismatch";
+            return 1;
+        }
+
+        LOG_INFO() << "key " << iTrg << " of " << keys.size() << ": trial " << std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count()
+            << " us, sequential " << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << " us";
+    }
+
+    // small set, no workers involved
+    std::vector<PubKey> few(keys.begin() + 135, keys.begin() + 140);
+    buf.clear();
+    if (!ks->encrypt(buf, DATA, sizeof(DATA), keys[137]) || !ks->decrypt(out, iKey, buf, few) || iKey != 2) {
+        LOG_ERROR() << "cannot trial-decrypt, small set";
+        return 1;
+    }
+
+    // addressed to someone else
+    PubKey foreign;
+    ks->gen_keypair(foreign);
+    buf.clear();
+    if (!ks->encrypt(buf, DATA, sizeof(DATA), foreign)) {
+        LOG_ERROR() << "cannot encrypt, foreign";
+        return 1;
+    }
+    if (ks->decrypt(out, iKey, buf, keys) || ks->decrypt(out, iKey, buf, few)) {
+        LOG_ERROR() << "trial decrypt with wrong keys returned true";
+        return 1;
+    }
+
+    // empty payload, only the mac
+    buf.clear();
+    if (!ks->encrypt(buf, DATA, 0, keys[137]) || !ks->decrypt(out, iKey, buf, keys) || iKey != 137 || !out.empty()) {
+        LOG_ERROR() << "cannot trial-decrypt, empty payload";
+        return 1;
+    }
+
+    // malformed
+    buf.resize(10);
+    if (ks->decrypt(out, iKey, buf, keys)) {
+        LOG_ERROR() << "trial decrypt of garbage returned true";
+        return 1;
+    }
+
+    LOG_INFO() << __FUNCTION__ << " ok";
+    return 0;
+}
+
+int keystore_test_trial_workers() {
+    KeystoreCleanup c;
+
+    static const char DATA[] = "sdkjfhsdkjfh2394871298347jhsdfkjhsdkjfhskdjhfksjdhf";
+
+    using namespace beam;
+
+    // the pool is forced to grow regardless of the hardware, while the jobs run back to back
+    IKeyStore::Options options;
+    options.flags = IKeyStore::Options::local_file | IKeyStore::Options::enable_all_keys;
+    options.fileName = KEYSTORE_FILE;
+    options.trialDecryptThreads = 6;
+    IKeyStore::Ptr ks = IKeyStore::create(options, PASSWORD, sizeof(PASSWORD));
+
+    std::vector<PubKey> keys(64);
+    for (auto& k : keys) {
+        ks->gen_keypair(k);
+        ks->save_keypair(k, true);
+    }
+
+    ByteBuffer buf, out;
+    size_t iKey = 0;
+
+    for (int iPass = 0; iPass < 20; ++iPass) {
+        for (size_t n = 16; n <= keys.size(); n += 8) {
+            // the last key, so that all the participants are busy
+            std::vector<PubKey> subset(keys.begin(), keys.begin() + n);
+            buf.clear();
+            if (!ks->encrypt(buf, DATA, sizeof(DATA), subset.back()) || !ks->decrypt(out, iKey, buf, subset) || iKey != n - 1) {
+                LOG_ERROR() << "cannot trial-decrypt, workers, size=" << n;
+                return 1;
+            }
+        }
+    }
+
+    LOG_INFO() << __FUNCTION__ << " ok";
+    return 0;
+}
+
 int main() {
     using namespace beam;
 
@@ -148,6 +287,8 @@ int main() {
 
     try {
         ret += keystore_test_normal();
+        ret += keystore_test_trial_workers();
+        ret += keystore_test_trial();
     } catch (const std::exception& e) {
         LOG_ERROR() << e.what();
         ret = 255;
@@ -714,6 +714,202 @@ void TestSelect()
     }
 }
 
+void TestBatch()
+{
+    auto keychain = createSqliteKeychain();
+
+    struct Observer : IKeyChainObserver
+    {
+        int m_changed = 0;
+
+        void onKeychainChanged() override { ++m_changed; }
+        void onTransactionChanged() override {}
+        void onSystemStateChanged() override {}
+        void onTxPeerChanged() override {}
+        void onAddressChanged() override {}
+    } observer;
+
+    keychain->subscribe(&observer);
+
+    {
+        KeyChainBatch batch(*keychain);
+
+        for (int i = 0; i < 10; ++i)
+        {
+            Coin coin{ Amount(5 + i), Coin::Unspent, 1, 10, KeyType::Regular };
+            keychain->store(coin);
+            WALLET_CHECK(coin.m_id == uint64_t(i + 1));
+        }
+
+        {
+            // nested scope, the coins stored above are visible
+            KeyChainBatch nested(*keychain);
+
+            vector<Coin> coins;
+            keychain->visit([&coins](const Coin& coin)->bool
+            {
+                coins.push_back(coin);
+                return true;
+            });
+            WALLET_CHECK(coins.size() == 10);
+
+            for (auto& coin : coins)
+            {
+                coin.m_status = Coin::Locked;
+            }
+            keychain->update(coins);
+        }
+
+        WALLET_CHECK(observer.m_changed == 0);
+    }
+
+    WALLET_CHECK(observer.m_changed == 1);
+
+    // the same query from within its own visitor
+    int outer = 0;
+    int inner = 0;
+    keychain->visit([&](const Coin& coin)->bool
+    {
+        ++outer;
+        WALLET_CHECK(coin.m_status == Coin::Locked);
+        keychain->visit([&inner](const Coin&)->bool
+        {
+            ++inner;
+            return true;
+        });
+        return true;
+    });
+    WALLET_CHECK(outer == 10);
+    WALLET_CHECK(inner == 100);
+
+    auto countCoins = [&keychain]()
+    {
+        int n = 0;
+        keychain->visit([&n](const Coin&)->bool
+        {
+            ++n;
+            return true;
+        });
+        return n;
+    };
+
+    // leaving the scope by an exception rolls the batch back
+    try
+    {
+        KeyChainBatch batch(*keychain);
+        Coin coin{ 100, Coin::Unspent, 1, 10, KeyType::Regular };
+        keychain->store(coin);
+        throw runtime_error("abort");
+    }
+    catch (const runtime_error&)
+    {
+    }
+    WALLET_CHECK(countCoins() == 10);
+    WALLET_CHECK(observer.m_changed == 1);
+
+    // only the nested batch is rolled back
+    {
+        KeyChainBatch batch(*keychain);
+        Coin coin{ 100, Coin::Unspent, 1, 10, KeyType::Regular };
+        keychain->store(coin);
+
+        try
+        {
+            KeyChainBatch nested(*keychain);
+            Coin coin2{ 200, Coin::Unspent, 1, 10, KeyType::Regular };
+            keychain->store(coin2);
+            throw runtime_error("abort");
+        }
+        catch (const runtime_error&)
+        {
+        }
+
+        WALLET_CHECK(countCoins() == 11);
+
+        // the journal mode can't be switched within a transaction
+        bool thrown = false;
+        try
+        {
+            keychain->changePassword(string("123"));
+        }
+        catch (const runtime_error&)
+        {
+            thrown = true;
+        }
+        WALLET_CHECK(thrown);
+    }
+    WALLET_CHECK(countCoins() == 11);
+    WALLET_CHECK(observer.m_changed == 2);
+
+    keychain->unsubscribe(&observer);
+}
+
+void TestKeychainBenchmark()
+{
+    auto db = createSqliteKeychain();
+    const uint32_t count = 1000000;
+
+    auto print = [](const char* name, uint64_t n, const helpers::StopWatch& sw)
+    {
+        cout << "Keychain " << name << ": " << n << " coins, " << (n * 1000000 / std::max<uint64_t>(sw.microseconds(), 1)) << " coins/sec\n";
+    };
+
+    vector<Coin> coins;
+    coins.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        coins.emplace_back(Amount(1000 + i), Coin::Unspent, 1, 10, KeyType::Regular);
+    }
+
+    helpers::StopWatch sw;
+
+    sw.start();
+    db->store(coins);
+    sw.stop();
+    print("store", count, sw);
+    WALLET_CHECK(coins.back().m_id == count);
+
+    // coin by coin, as during the sync
+    sw.start();
+    {
+        KeyChainBatch batch(*db);
+        for (auto& coin : coins)
+        {
+            coin.m_confirmHeight = 20;
+            db->update(coin);
+        }
+    }
+    sw.stop();
+    print("update (batched)", count, sw);
+
+    const uint32_t countSingle = 10000;
+    sw.start();
+    for (uint32_t i = 0; i < countSingle; ++i)
+    {
+        db->update(coins[i]);
+    }
+    sw.stop();
+    print("update (transaction per coin)", countSingle, sw);
+
+    uint64_t n = 0;
+    sw.start();
+    db->visit([&n](const Coin&)->bool
+    {
+        ++n;
+        return true;
+    });
+    sw.stop();
+    print("visit", n, sw);
+    WALLET_CHECK(n == count);
+
+    sw.start();
+    auto selected = db->selectCoins(500, false);
+    sw.stop();
+    cout << "Keychain selectCoins: " << sw.milliseconds() << " ms\n";
+    WALLET_CHECK(selected.size() == 1);
+    WALLET_CHECK(selected[0].m_amount == 1000);
+}
+
 void TestSelect2()
 {
     auto db = createSqliteKeychain();
@@ -757,6 +953,8 @@ int main()
     TestSelect();
     //TestSelect2();
     TestAddresses();
+    TestBatch();
+    //TestKeychainBenchmark(); // takes about a minute
 
     return WALLET_CHECK_RESULT;
 }
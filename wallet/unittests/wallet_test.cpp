@@ -384,6 +384,10 @@ namespace
 
             if (main)
             {
+                proto::Config msgCfg;
+                msgCfg.m_ProofUtxoMulti = m_proofUtxoMulti;
+                walletPeer->handle_node_message(move(msgCfg));
+
                 walletPeer->handle_node_message(proto::NewTip{});
 
                 proto::Hdr msg = {};
@@ -430,6 +434,8 @@ namespace
         void set_node_address(io::Address node_address) override {}
 
         int m_peerCount;
+        bool m_proofUtxoMulti = true;
+        int m_proofRequests[2] = { 0, 0 }; // per-coin and batched
 
         vector<IWallet*> m_peers;
         IOLoop m_networkLoop;
@@ -490,10 +496,22 @@ namespace
         void send_node_message(proto::GetProofUtxo&&) override
         {
             cout << "GetProofUtxo\n";
+            ++m_proofRequests[0];
 
             enqueueNetworkTask([this] {m_peers[0]->handle_node_message(proto::ProofUtxo()); });
         }
 
+        void send_node_message(proto::GetProofUtxoMulti&& data) override
+        {
+            cout << "GetProofUtxoMulti\n";
+            ++m_proofRequests[1];
+
+            proto::ProofUtxoMulti msg;
+            msg.m_Proofs.m_vCounts.resize(data.m_Utxos.size()); // no proofs
+
+            enqueueNetworkTask([this, msg] {m_peers[0]->handle_node_message(proto::ProofUtxoMulti(msg)); });
+        }
+
         void send_node_message(proto::GetHdr&&) override
         {
             cout << "GetHdr request chain header\n";
@@ -657,6 +675,13 @@ private:
             Send(proto::ProofUtxo());
         }
 
+        void OnMsg(proto::GetProofUtxoMulti&& data) override
+        {
+            proto::ProofUtxoMulti msg;
+            msg.m_Proofs.m_vCounts.resize(data.m_Utxos.size()); // no proofs
+            Send(msg);
+        }
+
         void OnMsg(proto::Config&& /*data*/) override
         {
             proto::Hdr msg = {};
@@ -1375,9 +1400,9 @@ struct RollbackIO : public TestNetwork
     unsigned m_step;
 };
 
-void TestRollback(Height branch, Height current, unsigned step = 1)
+void TestRollback(Height branch, Height current, unsigned step = 1, bool proofUtxoMulti = true)
 {
-    cout << "\nRollback from " << current << " to " << branch << " step: " << step <<'\n';
+    cout << "\nRollback from " << current << " to " << branch << " step: " << step << (proofUtxoMulti ? "" : ", per-coin proofs") << '\n';
     auto db = createSqliteKeychain("wallet.db");
     
     MiniChainManager mcmOld, mcmNew;
@@ -1405,12 +1430,20 @@ void TestRollback(Height branch, Height current, unsigned step = 1)
 
     IOLoop mainLoop;
     auto network = make_shared<RollbackIO>(mainLoop, mcmNew, branch, step);
+    network->m_proofUtxoMulti = proofUtxoMulti;
 
     Wallet sender(db, network);
     
     network->registerPeer(&sender, true);
     
     mainLoop.run();
+
+    // the rolled back coins are re-confirmed only in the way the node supports
+    WALLET_CHECK(network->m_proofRequests[proofUtxoMulti ? 0 : 1] == 0);
+    if (!proofUtxoMulti)
+    {
+        WALLET_CHECK(network->m_proofRequests[0] > 0);
+    }
 }
 
 void TestRollback()
@@ -1435,6 +1468,7 @@ void TestRollback()
     TestRollback(93, 120);
     TestRollback(93, 120, 6);
     TestRollback(93, 120, 7);
+    TestRollback(93, 120, 7, false);
     TestRollback(99, 100);
 }
 
@@ -143,6 +143,7 @@ namespace beam
         , m_syncTotal{0}
         , m_synchronized{false}
         , m_holdNodeConnection{ holdNodeConnection }
+        , m_nodeProofUtxoMulti{ false }
     {
         assert(keyChain);
         m_keyChain->getSystemStateID(m_knownStateID);
@@ -393,31 +394,27 @@ namespace beam
         return true;
     }
 
+    bool Wallet::handle_node_message(proto::Config&& msg)
+    {
+        m_nodeProofUtxoMulti = msg.m_ProofUtxoMulti;
+        return true;
+    }
+
     bool Wallet::handle_node_message(proto::ProofUtxo&& utxoProof)
     {
         // TODO: handle the maturity of the several proofs (> 1)
-        if (m_pendingProofs.empty())
+        if (m_pendingProofs.empty() || (m_pendingProofs.front().size() != 1))
         {
             LOG_WARNING() << "Unexpected UTXO proof";
             return exit_sync();
         }
 
-        Coin& coin = m_pendingProofs.front();
+        Coin& coin = m_pendingProofs.front().front();
         Input input;
         input.m_Commitment = Commitment(m_keyChain->calcKey(coin), coin.m_amount);
         if (utxoProof.m_Proofs.empty())
         {
-            LOG_WARNING() << "Got empty proof for: " << input.m_Commitment;
-
-            if (coin.m_status == Coin::Locked)
-            {
-                coin.m_status = Coin::Spent;
-                m_keyChain->update(coin);
-            }
-            else if (coin.m_status == Coin::Unconfirmed && coin.isReward())
-            {
-                m_keyChain->remove(coin);
-            }
+            handleMissingUtxo(coin, input);
         }
         else
         {
@@ -427,28 +424,78 @@ namespace beam
                 {
                     if (m_newState.IsValidProofUtxo(input, proof))
                     {
-                        LOG_INFO() << "Got proof for: " << input.m_Commitment;
-                        coin.m_status = Coin::Unspent;
-                        coin.m_maturity = proof.m_State.m_Maturity;
-                        coin.m_confirmHeight = m_newState.m_Height;
-                        m_newState.get_Hash(coin.m_confirmHash);
-                        if (coin.isReward())
-                        {
-                            LOG_INFO() << "Block reward received: " << PrintableAmount(coin.m_amount);
-                        }
-                        if (coin.m_id == 0)
+                        handleUtxoProof(coin, input, proof.m_State);
+                    }
+                    else
+                    {
+                        LOG_ERROR() << "Invalid proof provided: " << input.m_Commitment;
+                    }
+                }
+            }
+        }
+
+        m_pendingProofs.pop_front();
+
+        return exit_sync();
+    }
+
+    bool Wallet::handle_node_message(proto::ProofUtxoMulti&& utxoProofs)
+    {
+        if (m_pendingProofs.empty())
+        {
+            LOG_WARNING() << "Unexpected UTXO proof";
+            return exit_sync();
+        }
+
+        vector<Coin>& coins = m_pendingProofs.front();
+        const Input::MultiProof& mp = utxoProofs.m_Proofs;
+
+        if (mp.m_vCounts.size() != coins.size())
+        {
+            LOG_ERROR() << "Invalid UTXO proofs: " << mp.m_vCounts.size() << " results for " << coins.size() << " coins";
+        }
+        else
+        {
+            // all the proofs are wrt the same state, verified in the order of the request
+            Input::MultiProof::Verifier verifier(mp, m_newState.m_Definition);
+            KeyChainBatch batch(*m_keyChain);
+            bool malformed = false;
+
+            for (size_t i = 0; !malformed && i < coins.size(); i++)
+            {
+                Coin& coin = coins[i];
+                Input input;
+                input.m_Commitment = Commitment(m_keyChain->calcKey(coin), coin.m_amount);
+
+                uint32_t count = mp.m_vCounts[i];
+                if (!count)
+                {
+                    handleMissingUtxo(coin, input);
+                    continue;
+                }
+
+                for (uint32_t j = 0; j < count; j++)
+                {
+                    Input::State state;
+                    bool valid = false;
+                    if (!verifier.Read(input, state, valid))
+                    {
+                        LOG_ERROR() << "Malformed proof provided: " << input.m_Commitment;
+                        malformed = true; // the rest can't be decoded either
+                        break;
+                    }
+
+                    if (coin.m_status == Coin::Unconfirmed)
+                    {
+                        if (valid)
                         {
-                            m_keyChain->store(coin);
+                            handleUtxoProof(coin, input, state);
                         }
                         else
                         {
-                            m_keyChain->update(coin);
+                            LOG_ERROR() << "Invalid proof provided: " << input.m_Commitment;
                         }
                     }
-                    else
-                    {
-                        LOG_ERROR() << "Invalid proof provided: " << input.m_Commitment;
-                    }
                 }
             }
         }
@@ -458,6 +505,42 @@ namespace beam
         return exit_sync();
     }
 
+    void Wallet::handleUtxoProof(Coin& coin, const Input& input, const Input::State& state)
+    {
+        LOG_INFO() << "Got proof for: " << input.m_Commitment;
+        coin.m_status = Coin::Unspent;
+        coin.m_maturity = state.m_Maturity;
+        coin.m_confirmHeight = m_newState.m_Height;
+        m_newState.get_Hash(coin.m_confirmHash);
+        if (coin.isReward())
+        {
+            LOG_INFO() << "Block reward received: " << PrintableAmount(coin.m_amount);
+        }
+        if (coin.m_id == 0)
+        {
+            m_keyChain->store(coin);
+        }
+        else
+        {
+            m_keyChain->update(coin);
+        }
+    }
+
+    void Wallet::handleMissingUtxo(Coin& coin, const Input& input)
+    {
+        LOG_WARNING() << "Got empty proof for: " << input.m_Commitment;
+
+        if (coin.m_status == Coin::Locked)
+        {
+            coin.m_status = Coin::Spent;
+            m_keyChain->update(coin);
+        }
+        else if (coin.m_status == Coin::Unconfirmed && coin.isReward())
+        {
+            m_keyChain->remove(coin);
+        }
+    }
+
     bool Wallet::handle_node_message(proto::NewTip&& msg)
     {
         // TODO: restore from wallet db 
@@ -631,14 +714,39 @@ namespace beam
 
     void Wallet::getUtxoProofs(const vector<Coin>& coins)
     {
-        for (auto& coin : coins)
+        if (!m_nodeProofUtxoMulti)
         {
+            for (auto& coin : coins)
+            {
+                enter_sync();
+                m_pendingProofs.emplace_back(1, coin);
+                Input input;
+                input.m_Commitment = Commitment(m_keyChain->calcKey(coin), coin.m_amount);
+                LOG_DEBUG() << "Get proof: " << input.m_Commitment;
+                m_network->send_node_message(proto::GetProofUtxo{ input, 0 });
+            }
+            return;
+        }
+
+        // one request (and one sync step) per batch of coins
+        for (size_t i0 = 0; i0 < coins.size(); i0 += proto::g_ProofUtxoMultiMaxSize)
+        {
+            size_t i1 = std::min(coins.size(), i0 + proto::g_ProofUtxoMultiMaxSize);
+
             enter_sync();
-            m_pendingProofs.push_back(coin);
-            Input input;
-            input.m_Commitment = Commitment(m_keyChain->calcKey(coin), coin.m_amount);
-            LOG_DEBUG() << "Get proof: " << input.m_Commitment;
-            m_network->send_node_message(proto::GetProofUtxo{ input, 0 });
+            m_pendingProofs.emplace_back(coins.begin() + i0, coins.begin() + i1);
+
+            proto::GetProofUtxoMulti msg;
+            msg.m_Utxos.reserve(i1 - i0);
+
+            for (size_t i = i0; i < i1; i++)
+            {
+                const Coin& coin = coins[i];
+                msg.m_Utxos.push_back(Commitment(m_keyChain->calcKey(coin), coin.m_amount));
+                LOG_DEBUG() << "Get proof: " << msg.m_Utxos.back();
+            }
+
+            m_network->send_node_message(move(msg));
         }
     }
 
@@ -38,7 +38,9 @@ namespace beam
         virtual void handle_tx_message(const WalletID&, wallet::TxFailed&&) = 0;
         // node to wallet responses
         virtual bool handle_node_message(proto::Boolean&&) = 0;
+        virtual bool handle_node_message(proto::Config&&) = 0;
         virtual bool handle_node_message(proto::ProofUtxo&&) = 0;
+        virtual bool handle_node_message(proto::ProofUtxoMulti&&) = 0;
 		virtual bool handle_node_message(proto::ProofState&& msg) = 0;
 		virtual bool handle_node_message(proto::NewTip&&) = 0;
         virtual bool handle_node_message(proto::Hdr&&) = 0;
@@ -71,6 +73,7 @@ namespace beam
         // wallet to node requests
         virtual void send_node_message(proto::NewTransaction&&) = 0;
         virtual void send_node_message(proto::GetProofUtxo&&) = 0;
+        virtual void send_node_message(proto::GetProofUtxoMulti&&) = 0; // only if the node supports it (proto::Config)
 		virtual void send_node_message(proto::GetHdr&&) = 0;
         virtual void send_node_message(proto::GetMined&&) = 0;
         virtual void send_node_message(proto::GetProofState&&) = 0;
@@ -139,7 +142,9 @@ namespace beam
         void handle_tx_message(const WalletID&, wallet::TxFailed&&) override;
 
         bool handle_node_message(proto::Boolean&& res) override;
+        bool handle_node_message(proto::Config&& msg) override;
         bool handle_node_message(proto::ProofUtxo&& proof) override;
+        bool handle_node_message(proto::ProofUtxoMulti&& proofs) override;
 		bool handle_node_message(proto::ProofState&& msg) override;
 		bool handle_node_message(proto::NewTip&& msg) override;
         bool handle_node_message(proto::Hdr&& msg) override;
@@ -161,6 +166,8 @@ namespace beam
     private:
         void remove_peer(const TxID& txId);
         void getUtxoProofs(const std::vector<Coin>& coins);
+        void handleUtxoProof(Coin& coin, const Input& input, const Input::State& state);
+        void handleMissingUtxo(Coin& coin, const Input& input);
         void do_fast_forward();
         void enter_sync();
         bool exit_sync();
@@ -215,7 +222,7 @@ namespace beam
         TxCompletedAction m_tx_completed_action;
         std::deque<std::pair<TxID, Transaction::Ptr>> m_reg_requests;
         std::vector<std::pair<TxID, Transaction::Ptr>> m_pending_reg_requests;
-        std::deque<Coin> m_pendingProofs;
+        std::deque<std::vector<Coin>> m_pendingProofs; // batches, in the order of the requests
         std::vector<Callback> m_pendingEvents;
 
 		Block::SystemState::Full m_newState;
@@ -226,6 +233,7 @@ namespace beam
         int m_syncTotal;
         bool m_synchronized;
         bool m_holdNodeConnection;
+        bool m_nodeProofUtxoMulti; // the node supports the batched UTXO proofs
 
 		std::vector<IWalletObserver*> m_subscribers;
     };
@@ -17,6 +17,7 @@
 #include "utility/logger.h"
 #include "sqlite/sqlite3.h"
 #include <sstream>
+#include <cstring>
 #include <boost/functional/hash.hpp>
 #include <boost/filesystem.hpp>
 
@@ -326,9 +327,38 @@ namespace beam
             Statement(sqlite3* db, const char* sql)
                 : _db(db)
                 , _stm(nullptr)
+                , _cached(nullptr)
             {
-                int ret = sqlite3_prepare_v2(_db, sql, -1, &_stm, NULL);
-                throwIfError(ret, _db);
+                prepare(sql);
+            }
+
+            // Reuses the statement prepared by the keychain connection.
+            // The cache is keyed by the pointer, so the SQL must be a string literal (or have a static storage otherwise),
+            // never a temporary buffer: another text at the same address would be served the wrong statement
+            Statement(const Keychain& keychain, const char* sql)
+                : _db(keychain._db)
+                , _stm(nullptr)
+                , _cached(nullptr)
+            {
+                auto& entry = keychain._statements[sql];
+                if (entry.busy)
+                {
+                    // the same query is still being stepped (i.e. from within a visitor), use a standalone one
+                    prepare(sql);
+                    return;
+                }
+
+                if (!entry.stm)
+                {
+                    prepare(sql);
+                    entry.stm = _stm;
+                }
+
+                assert(!strcmp(sqlite3_sql(entry.stm), sql));
+
+                _stm = entry.stm;
+                _cached = &entry;
+                _cached->busy = true;
             }
 
             void bind(int col, int val)
@@ -528,12 +558,28 @@ namespace beam
 
             ~Statement()
             {
-                sqlite3_finalize(_stm);
+                if (_cached)
+                {
+                    sqlite3_reset(_stm);
+                    sqlite3_clear_bindings(_stm);
+                    _cached->busy = false;
+                }
+                else
+                {
+                    sqlite3_finalize(_stm);
+                }
             }
         private:
 
+            void prepare(const char* sql)
+            {
+                int ret = sqlite3_prepare_v2(_db, sql, -1, &_stm, NULL);
+                throwIfError(ret, _db);
+            }
+
             sqlite3 * _db;
             sqlite3_stmt* _stm;
+            Keychain::CachedStatement* _cached;
         };
 
         struct Transaction
@@ -542,6 +588,7 @@ namespace beam
                 : _db(db)
                 , _commited(false)
                 , _rollbacked(false)
+                , _nested(sqlite3_get_autocommit(db) == 0)
             {
                 begin();
             }
@@ -554,13 +601,14 @@ namespace beam
 
             void begin()
             {
-                int ret = sqlite3_exec(_db, "BEGIN;", NULL, NULL, NULL);
+                // within an outer transaction (i.e. a keychain batch) it's a savepoint, committed along with the outer one
+                int ret = sqlite3_exec(_db, _nested ? "SAVEPOINT nested;" : "BEGIN;", NULL, NULL, NULL);
                 throwIfError(ret, _db);
             }
 
             bool commit()
             {
-                int ret = sqlite3_exec(_db, "COMMIT;", NULL, NULL, NULL);
+                int ret = sqlite3_exec(_db, _nested ? "RELEASE nested;" : "COMMIT;", NULL, NULL, NULL);
 
                 _commited = (ret == SQLITE_OK);
                 return _commited;
@@ -568,15 +616,16 @@ namespace beam
 
             void rollback()
             {
-                int ret = sqlite3_exec(_db, "ROLLBACK;", NULL, NULL, NULL);
-                throwIfError(ret, _db);
-
+                int ret = sqlite3_exec(_db, _nested ? "ROLLBACK TO nested; RELEASE nested;" : "ROLLBACK;", NULL, NULL, NULL);
+                // don't retry from the destructor
                 _rollbacked = true;
+                throwIfError(ret, _db);
             }
         private:
             sqlite3 * _db;
             bool _commited;
             bool _rollbacked;
+            bool _nested;
         };
     }
 
@@ -631,6 +680,10 @@ namespace beam
     {
         if (!boost::filesystem::exists(path))
         {
+            // the journal of a removed wallet with the same name would be replayed into the new one
+            boost::filesystem::remove(path + "-wal");
+            boost::filesystem::remove(path + "-shm");
+
             auto keychain = make_shared<Keychain>(secretKey);
 
             {
@@ -643,6 +696,8 @@ namespace beam
                 throwIfError(ret, keychain->_db);
             }
 
+            keychain->setJournalMode("WAL");
+
             {
                 const char* req = "CREATE TABLE " STORAGE_NAME " (" ENUM_ALL_STORAGE_FIELDS(LIST_WITH_TYPES, COMMA,) ");"
                                   "CREATE INDEX ConfirmIndex ON " STORAGE_NAME"(confirmHeight);"
@@ -758,6 +813,8 @@ namespace beam
                     }
                 }
 
+                keychain->setJournalMode("WAL");
+
                 if (keychain->getVar(WalletSeed, seed))
                 {
                     keychain->m_kdf.m_Secret = seed;
@@ -782,31 +839,30 @@ namespace beam
 
     Keychain::Keychain(const ECC::NoLeak<ECC::uintBig>& secretKey)
         : _db(nullptr)
+        , _keychainChangedPending(false)
     {
         m_kdf.m_Secret = secretKey;
     }
 
     Keychain::~Keychain()
     {
-        if (_db)
+        // innermost first
+        while (!_batch.empty())
         {
-            sqlite3_close_v2(_db);
-            _db = nullptr;
+            _batch.pop_back();
         }
-    }
-
-    uint64_t getLastID(sqlite3* db)
-    {
-        int lastId = 0;
 
+        for (auto& x : _statements)
         {
-            const char* req = "SELECT seq FROM sqlite_sequence WHERE name = '" STORAGE_NAME "';";
-            sqlite::Statement stm(db, req);
-            if (stm.step())
-                stm.get(0, lastId);
+            sqlite3_finalize(x.second.stm);
         }
+        _statements.clear();
 
-        return lastId;
+        if (_db)
+        {
+            sqlite3_close_v2(_db);
+            _db = nullptr;
+        }
     }
 
     ECC::Scalar::Native Keychain::calcKey(const beam::Coin& coin) const
@@ -829,7 +885,7 @@ namespace beam
         Block::SystemState::ID stateID = {};
         getSystemStateID(stateID);
         {
-            sqlite::Statement stm(_db, "SELECT SUM(amount)" STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 ;");
+            sqlite::Statement stm(*this, "SELECT SUM(amount)" STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 ;");
             stm.bind(1, Coin::Unspent);
             stm.bind(2, stateID.m_Height);
             Amount avalableAmount = 0;
@@ -846,7 +902,7 @@ namespace beam
         Coin coin2;
         {
             // get one coin >= amount
-            sqlite::Statement stm(_db, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 AND amount>=?3 ORDER BY amount ASC LIMIT 1;");
+            sqlite::Statement stm(*this, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 AND amount>=?3 ORDER BY amount ASC LIMIT 1;");
             stm.bind(1, Coin::Unspent);
             stm.bind(2, stateID.m_Height);
             stm.bind(3, amount);
@@ -863,7 +919,7 @@ namespace beam
         else
         {
             // select all coins less than needed amount in sorted order
-            sqlite::Statement stm(_db, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 AND amount<?3 ORDER BY amount DESC;");
+            sqlite::Statement stm(*this, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE status=?1 AND maturity<=?2 AND amount<?3 ORDER BY amount DESC;");
             stm.bind(1, Coin::Unspent);
             stm.bind(2, stateID.m_Height);
             stm.bind(3, amount);
@@ -908,7 +964,7 @@ namespace beam
             {
                 coin.m_status = Coin::Locked;
                 const char* req = "UPDATE " STORAGE_NAME " SET status=?2, lockedHeight=?3 WHERE id=?1;";
-                sqlite::Statement stm(_db, req);
+                sqlite::Statement stm(*this, req);
 
                 stm.bind(1, coin.m_id);
                 stm.bind(2, coin.m_status);
@@ -928,7 +984,7 @@ namespace beam
     std::vector<beam::Coin> Keychain::getCoinsCreatedByTx(const TxID& txId)
     {
         // select all coins for TxID
-        sqlite::Statement stm(_db, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE createTxID=?1 ORDER BY amount DESC;");
+        sqlite::Statement stm(*this, "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE createTxID=?1 ORDER BY amount DESC;");
         stm.bind(1, txId);
 
         vector<Coin> coins;
@@ -971,7 +1027,7 @@ namespace beam
             || coin.m_key_type == KeyType::Comission)
         {
             const char* req = "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME " WHERE createHeight=?1 AND key_type=?2;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, coin.m_createHeight);
             stm.bind(2, coin.m_key_type);
             if (stm.step()) //has row
@@ -981,13 +1037,13 @@ namespace beam
         }
 
         const char* req = "INSERT INTO " STORAGE_NAME " (" ENUM_STORAGE_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_STORAGE_FIELDS(BIND_LIST, COMMA, ) ");";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
 
         ENUM_STORAGE_FIELDS(STM_BIND_LIST, NOSEP, coin);
 
         stm.step();
 
-        coin.m_id = getLastID(_db);
+        coin.m_id = sqlite3_last_insert_rowid(_db); // id is the rowid alias
 
         notifyKeychainChanged();
     }
@@ -999,7 +1055,7 @@ namespace beam
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET " ENUM_STORAGE_FIELDS(SET_LIST, COMMA, ) " WHERE id=?1;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
 
             ENUM_ALL_STORAGE_FIELDS(STM_BIND_LIST, NOSEP, coin);
 
@@ -1021,7 +1077,7 @@ namespace beam
             {
                 assert(coin.m_amount > 0 && coin.m_id > 0 && coin.isValid());
                 const char* req = "UPDATE " STORAGE_NAME " SET " ENUM_STORAGE_FIELDS(SET_LIST, COMMA, ) " WHERE id=?1;";
-                sqlite::Statement stm(_db, req);
+                sqlite::Statement stm(*this, req);
 
                 ENUM_ALL_STORAGE_FIELDS(STM_BIND_LIST, NOSEP, coin);
 
@@ -1042,7 +1098,7 @@ namespace beam
             for (const auto& coin : coins)
             {
                 const char* req = "DELETE FROM " STORAGE_NAME " WHERE id=?1;";
-                sqlite::Statement stm(_db, req);
+                sqlite::Statement stm(*this, req);
 
                 stm.bind(1, coin.m_id);
 
@@ -1060,7 +1116,7 @@ namespace beam
         sqlite::Transaction trans(_db);
 
         const char* req = "DELETE FROM " STORAGE_NAME " WHERE id=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
 
         stm.bind(1, coin.m_id);
 
@@ -1073,13 +1129,13 @@ namespace beam
     void Keychain::clear()
     {
         {
-            sqlite::Statement stm(_db, "DELETE FROM " STORAGE_NAME ";");
+            sqlite::Statement stm(*this, "DELETE FROM " STORAGE_NAME ";");
             stm.step();
             notifyKeychainChanged();
         }
 
         {
-            sqlite::Statement stm(_db, "DELETE FROM " HISTORY_NAME ";");
+            sqlite::Statement stm(*this, "DELETE FROM " HISTORY_NAME ";");
             stm.step();
             notifyTransactionChanged();
         }
@@ -1088,7 +1144,7 @@ namespace beam
     void Keychain::visit(function<bool(const beam::Coin& coin)> func)
     {
         const char* req = "SELECT " STORAGE_FIELDS " FROM " STORAGE_NAME ";";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
 
         while (stm.step())
         {
@@ -1108,7 +1164,7 @@ namespace beam
         {
             const char* req = "INSERT or REPLACE INTO " VARIABLES_NAME " (" VARIABLES_FIELDS ") VALUES(?1, ?2);";
 
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
 
             stm.bind(1, name);
             stm.bind(2, data, size);
@@ -1123,7 +1179,7 @@ namespace beam
     {
         const char* req = "SELECT value FROM " VARIABLES_NAME " WHERE name=?1;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, name);
         stm.step();
 
@@ -1137,7 +1193,7 @@ namespace beam
     {
         const char* req = "SELECT value FROM " VARIABLES_NAME " WHERE name=?1;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, name);
         if (stm.step())
         {
@@ -1183,7 +1239,7 @@ namespace beam
     {
         uint64_t count = 0;
         {
-            sqlite::Statement stm(_db, "SELECT COUNT(DISTINCT confirmHash) FROM " STORAGE_NAME " ;");
+            sqlite::Statement stm(*this, "SELECT COUNT(DISTINCT confirmHash) FROM " STORAGE_NAME " ;");
             stm.step();
             stm.get(0, count);
         }
@@ -1195,7 +1251,7 @@ namespace beam
         Block::SystemState::ID id = {};
         const char* req = "SELECT DISTINCT confirmHeight, confirmHash FROM " STORAGE_NAME " WHERE confirmHeight >= ?2 LIMIT 1 OFFSET ?1;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, height);
         stm.bind(2, Rules::HeightGenesis);
         if (stm.step())
@@ -1212,7 +1268,7 @@ namespace beam
 
         {
             const char* req = "DELETE FROM " STORAGE_NAME " WHERE createHeight >?1 AND (key_type=?2 OR key_type=?3);";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, minHeight);
             stm.bind(2, KeyType::Coinbase);
             stm.bind(3, KeyType::Comission);
@@ -1221,7 +1277,7 @@ namespace beam
         
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?1, confirmHeight=?2, lockedHeight=?2, confirmHash=NULL WHERE confirmHeight > ?3 ;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, Coin::Unconfirmed);
             stm.bind(2, MaxHeight);
             stm.bind(3, minHeight);
@@ -1230,7 +1286,7 @@ namespace beam
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?1, lockedHeight=?2 WHERE lockedHeight > ?3 AND confirmHeight <= ?3 ;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, Coin::Unspent);
             stm.bind(2, MaxHeight);
             stm.bind(3, minHeight);
@@ -1246,7 +1302,7 @@ namespace beam
         vector<TxDescription> res;
         const char* req = "SELECT * FROM " HISTORY_NAME " ORDER BY createTime DESC LIMIT ?1 OFFSET ?2 ;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, count);
         stm.bind(2, start);
 
@@ -1261,7 +1317,7 @@ namespace beam
     boost::optional<TxDescription> Keychain::getTx(const TxID& txId)
     {
         const char* req = "SELECT * FROM " HISTORY_NAME " WHERE txId=?1 ;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, txId);
 
         if (stm.step())
@@ -1280,13 +1336,13 @@ namespace beam
 
         {
             const char* selectReq = "SELECT * FROM " HISTORY_NAME " WHERE txId=?1;";
-            sqlite::Statement stm2(_db, selectReq);
+            sqlite::Statement stm2(*this, selectReq);
             stm2.bind(1, p.m_txId);
 
             if (stm2.step())
             {
                 const char* updateReq = "UPDATE " HISTORY_NAME " SET modifyTime=?2, status=?3, fsmState=?4, minHeight=?5, change=?6 WHERE txId=?1;";
-                sqlite::Statement stm(_db, updateReq);
+                sqlite::Statement stm(*this, updateReq);
 
                 stm.bind(1, p.m_txId);
                 stm.bind(2, p.m_modifyTime);
@@ -1299,7 +1355,7 @@ namespace beam
             else
             {
                 const char* insertReq = "INSERT INTO " HISTORY_NAME " (" ENUM_HISTORY_FIELDS(LIST, COMMA,) ") VALUES(" ENUM_HISTORY_FIELDS(BIND_LIST, COMMA,) ");";
-                sqlite::Statement stm(_db, insertReq);
+                sqlite::Statement stm(*this, insertReq);
                 ENUM_HISTORY_FIELDS(STM_BIND_LIST, NOSEP, p);
                 stm.step();
             }
@@ -1316,7 +1372,7 @@ namespace beam
 
         {
             const char* req = "DELETE FROM " HISTORY_NAME " WHERE txId=?1;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
 
             stm.bind(1, txId);
 
@@ -1334,7 +1390,7 @@ namespace beam
 
         {
             const char* req = "UPDATE " STORAGE_NAME " SET status=?3, spentTxId=NULL WHERE spentTxId=?1 AND status=?2;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, txId);
             stm.bind(2, Coin::Locked);
             stm.bind(3, Coin::Unspent);
@@ -1342,7 +1398,7 @@ namespace beam
         }
         {
             const char* req = "DELETE FROM " STORAGE_NAME " WHERE createTxId=?1;";
-            sqlite::Statement stm(_db, req);
+            sqlite::Statement stm(*this, req);
             stm.bind(1, txId);
             stm.step();
         }
@@ -1353,7 +1409,7 @@ namespace beam
     std::vector<TxPeer> Keychain::getPeers()
     {
         std::vector<TxPeer> peers;
-        sqlite::Statement stm(_db, "SELECT * FROM " PEERS_NAME ";");
+        sqlite::Statement stm(*this, "SELECT * FROM " PEERS_NAME ";");
         while (stm.step())
         {
             auto& peer = peers.emplace_back();
@@ -1366,13 +1422,13 @@ namespace beam
     {
         sqlite::Transaction trans(_db);
         
-        sqlite::Statement stm2(_db, "SELECT * FROM " PEERS_NAME " WHERE walletID=?1;");
+        sqlite::Statement stm2(*this, "SELECT * FROM " PEERS_NAME " WHERE walletID=?1;");
         stm2.bind(1, peer.m_walletID);
 
         const char* updateReq = "UPDATE " PEERS_NAME " SET address=?2, label=?3 WHERE walletID=?1;";
         const char* insertReq = "INSERT INTO " PEERS_NAME " (" ENUM_PEER_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_PEER_FIELDS(BIND_LIST, COMMA, ) ");";
 
-        sqlite::Statement stm(_db, stm2.step() ? updateReq : insertReq);
+        sqlite::Statement stm(*this, stm2.step() ? updateReq : insertReq);
         ENUM_PEER_FIELDS(STM_BIND_LIST, NOSEP, peer);
         stm.step();
 
@@ -1381,7 +1437,7 @@ namespace beam
 
     boost::optional<TxPeer> Keychain::getPeer(const WalletID& peerID)
     {
-        sqlite::Statement stm(_db, "SELECT * FROM " PEERS_NAME " WHERE walletID=?1;");
+        sqlite::Statement stm(*this, "SELECT * FROM " PEERS_NAME " WHERE walletID=?1;");
         stm.bind(1, peerID);
         if (stm.step())
         {
@@ -1394,7 +1450,7 @@ namespace beam
 
     void Keychain::clearPeers()
     {
-        sqlite::Statement stm(_db, "DELETE FROM " PEERS_NAME ";");
+        sqlite::Statement stm(*this, "DELETE FROM " PEERS_NAME ";");
         stm.step();
     }
 
@@ -1403,7 +1459,7 @@ namespace beam
         vector<WalletAddress> res;
         const char* req = "SELECT * FROM " ADDRESSES_NAME " WHERE own=?1 ORDER BY createTime DESC;";
 
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
         stm.bind(1, own);
 
         while (stm.step())
@@ -1420,13 +1476,13 @@ namespace beam
 
         {
             const char* selectReq = "SELECT * FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-            sqlite::Statement stm2(_db, selectReq);
+            sqlite::Statement stm2(*this, selectReq);
             stm2.bind(1, address.m_walletID);
 
             if (stm2.step())
             {
                 const char* updateReq = "UPDATE " ADDRESSES_NAME " SET label=?2, category=?3 WHERE walletID=?1;";
-                sqlite::Statement stm(_db, updateReq);
+                sqlite::Statement stm(*this, updateReq);
 
                 stm.bind(1, address.m_walletID);
                 stm.bind(2, address.m_label);
@@ -1436,7 +1492,7 @@ namespace beam
             else
             {
                 const char* insertReq = "INSERT INTO " ADDRESSES_NAME " (" ENUM_ADDRESS_FIELDS(LIST, COMMA, ) ") VALUES(" ENUM_ADDRESS_FIELDS(BIND_LIST, COMMA, ) ");";
-                sqlite::Statement stm(_db, insertReq);
+                sqlite::Statement stm(*this, insertReq);
                 ENUM_ADDRESS_FIELDS(STM_BIND_LIST, NOSEP, address);
                 stm.step();
             }
@@ -1450,7 +1506,7 @@ namespace beam
     boost::optional<WalletAddress> Keychain::getAddress(const WalletID& id)
     {
         const char* req = "SELECT * FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
 
         stm.bind(1, id);
 
@@ -1466,7 +1522,7 @@ namespace beam
     void Keychain::deleteAddress(const WalletID& id)
     {
         const char* req = "DELETE FROM " ADDRESSES_NAME " WHERE walletID=?1;";
-        sqlite::Statement stm(_db, req);
+        sqlite::Statement stm(*this, req);
 
         stm.bind(1, id);
 
@@ -1493,12 +1549,89 @@ namespace beam
 
 	void Keychain::changePassword(const SecString& password)
 	{
+		// the journal mode can't be changed within a transaction
+		if (!_batch.empty())
+		{
+			throw runtime_error("can't change the keychain password within a batch");
+		}
+
+		// rekey rewrites all the pages in place, make sure none of them is left in the WAL
+		setJournalMode("DELETE");
 		int ret = sqlite3_rekey(_db, password.data(), password.size());
+		setJournalMode("WAL");
 		throwIfError(ret, _db);
 	}
 
+    void Keychain::startBatch()
+    {
+        _batch.push_back(make_unique<sqlite::Transaction>(_db));
+    }
+
+    void Keychain::commitBatch()
+    {
+        assert(!_batch.empty());
+        auto batch = move(_batch.back());
+        _batch.pop_back();
+
+        if (!batch->commit())
+        {
+            stringstream ss;
+            ss << "Failed to commit keychain batch: " << sqlite3_errmsg(_db);
+            LOG_ERROR() << ss.str();
+
+            if (_batch.empty())
+            {
+                _keychainChangedPending = false;
+            }
+            batch->rollback();
+            throw runtime_error(ss.str());
+        }
+
+        if (_batch.empty() && _keychainChangedPending)
+        {
+            _keychainChangedPending = false;
+            notifyKeychainChanged();
+        }
+    }
+
+    void Keychain::rollbackBatch()
+    {
+        assert(!_batch.empty());
+        auto batch = move(_batch.back());
+        _batch.pop_back();
+
+        if (_batch.empty())
+        {
+            // nothing has changed
+            _keychainChangedPending = false;
+        }
+
+        // called while unwinding, must not throw
+        try
+        {
+            batch->rollback();
+        }
+        catch (const exception& e)
+        {
+            LOG_ERROR() << "Failed to roll back keychain batch: " << e.what();
+        }
+    }
+
+    void Keychain::setJournalMode(const char* mode)
+    {
+        string req = string("PRAGMA journal_mode=") + mode + ";";
+        int ret = sqlite3_exec(_db, req.c_str(), NULL, NULL, NULL);
+        throwIfError(ret, _db);
+    }
+
     void Keychain::notifyKeychainChanged()
     {
+        if (!_batch.empty())
+        {
+            _keychainChangedPending = true;
+            return;
+        }
+
         for (auto sub : m_subscribers) sub->onKeychainChanged();
     }
 
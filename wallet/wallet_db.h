@@ -15,6 +15,8 @@
 #pragma once
 
 #include <boost/optional.hpp>
+#include <unordered_map>
+#include <exception>
 #include "core/common.h"
 #include "core/ecc_native.h"
 #include "wallet/common.h"
@@ -22,9 +24,16 @@
 #include "secstring.h"
 
 struct sqlite3;
+struct sqlite3_stmt;
 
 namespace beam
 {
+    namespace sqlite
+    {
+        struct Statement;
+        struct Transaction;
+    }
+
     struct Coin
     {
         enum Status
@@ -153,6 +162,41 @@ namespace beam
         virtual void unsubscribe(IKeyChainObserver* observer) = 0;
 
 		virtual void changePassword(const SecString& password) = 0;
+
+        // Groups the subsequent updates into a single DB transaction, till the matching commitBatch or rollbackBatch.
+        // May be nested, rolling back a nested batch discards only its own updates.
+        // Coin change notifications are delivered once, after the outermost batch is committed.
+        virtual void startBatch() {}
+        virtual void commitBatch() {}
+        virtual void rollbackBatch() {}
+    };
+
+    // Commits on scope exit, or rolls back if the scope is left by an exception.
+    // A failed commit is thrown from the destructor
+    struct KeyChainBatch
+    {
+        KeyChainBatch(IKeyChain& keychain)
+            : m_keychain(keychain)
+            , m_uncaughtExceptions(std::uncaught_exceptions())
+        {
+            m_keychain.startBatch();
+        }
+
+        ~KeyChainBatch() noexcept(false)
+        {
+            if (std::uncaught_exceptions() > m_uncaughtExceptions)
+            {
+                m_keychain.rollbackBatch();
+            }
+            else
+            {
+                m_keychain.commitBatch();
+            }
+        }
+
+    private:
+        IKeyChain& m_keychain;
+        int m_uncaughtExceptions;
     };
 
     struct Keychain : IKeyChain
@@ -210,15 +254,33 @@ namespace beam
         void unsubscribe(IKeyChainObserver* observer) override;
 
 		void changePassword(const SecString& password) override;
+
+        void startBatch() override;
+        void commitBatch() override;
+        void rollbackBatch() override;
     private:
+        friend struct sqlite::Statement;
+
         void storeImpl(Coin& coin);
+        void setJournalMode(const char* mode);
         void notifyKeychainChanged();
         void notifyTransactionChanged();
         void notifySystemStateChanged();
         void notifyAddressChanged();
     private:
 
+        struct CachedStatement
+        {
+            sqlite3_stmt* stm = nullptr;
+            bool busy = false; // in use by a sqlite::Statement
+        };
+
         sqlite3* _db;
+        // prepared once per connection, keyed by the address of the SQL literal (see sqlite::Statement)
+        mutable std::unordered_map<const char*, CachedStatement> _statements;
+        // one transaction per nesting level, the nested ones are savepoints
+        std::vector<std::unique_ptr<sqlite::Transaction>> _batch;
+        bool _keychainChangedPending;
         ECC::Kdf m_kdf;
 
         std::vector<IKeyChainObserver*> m_subscribers;
@@ -141,6 +141,11 @@ namespace beam {
         send_to_node(move(msg));
     }
 
+    void WalletNetworkIO::send_node_message(proto::GetProofUtxoMulti&& msg)
+    {
+        send_to_node(move(msg));
+    }
+
     void WalletNetworkIO::send_node_message(proto::GetHdr&& msg)
     {
         send_to_node(move(msg));
@@ -327,27 +332,26 @@ namespace beam {
     bool WalletNetworkIO::handle_bbs_message(proto::BbsMsg&& msg)
     {
         postpone_close_timer();
-        uint8_t* out = 0;
-        uint32_t size = 0;
 
+        std::vector<PubKey> keys;
         for (const auto& k : m_myPubKeys)
         {
-            uint32_t channel = channel_from_wallet_id(k);
+            if (channel_from_wallet_id(k) == msg.m_Channel)
+                keys.push_back(k);
+        }
 
-            if (channel != msg.m_Channel) continue;
-            if (m_keystore->decrypt(out, size, msg.m_Message, k))
-            {
-                LOG_DEBUG() << "Succeeded to decrypt BBS message from channel=" << msg.m_Channel;
-                m_lastReceiver = &k;
-                return handle_decrypted_message(msg.m_TimePosted, out, size);
-            }
-            else
-            {
-                LOG_DEBUG() << "failed to decrypt BBS message from channel=" << msg.m_Channel;
-            }
+        // all the keys of the channel are tried at once, the message is decrypted only for the matching one
+        ByteBuffer out;
+        size_t iKey = 0;
+        if (keys.empty() || !m_keystore->decrypt(out, iKey, msg.m_Message, keys))
+        {
+            LOG_DEBUG() << "failed to decrypt BBS message from channel=" << msg.m_Channel;
+            return true;
         }
 
-        return true;
+        LOG_DEBUG() << "Succeeded to decrypt BBS message from channel=" << msg.m_Channel;
+        m_lastReceiver = &*m_myPubKeys.find(keys[iKey]);
+        return handle_decrypted_message(msg.m_TimePosted, out.data(), out.size());
     }
 
     void WalletNetworkIO::set_node_address(io::Address node_address)
@@ -421,11 +425,21 @@ namespace beam {
         return m_wallet.handle_node_message(move(msg));
     }
 
+    bool WalletNetworkIO::WalletNodeConnection::OnMsg2(proto::Config&& msg)
+    {
+        return m_wallet.handle_node_message(move(msg));
+    }
+
     bool WalletNetworkIO::WalletNodeConnection::OnMsg2(proto::ProofUtxo&& msg)
     {
         return m_wallet.handle_node_message(move(msg));
     }
 
+    bool WalletNetworkIO::WalletNodeConnection::OnMsg2(proto::ProofUtxoMulti&& msg)
+    {
+        return m_wallet.handle_node_message(move(msg));
+    }
+
     bool WalletNetworkIO::WalletNodeConnection::OnMsg2(proto::NewTip&& msg)
     {
         return m_wallet.handle_node_message(move(msg));
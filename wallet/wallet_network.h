@@ -74,6 +74,7 @@ namespace beam
 
         void send_node_message(proto::NewTransaction&&) override;
         void send_node_message(proto::GetProofUtxo&&) override;
+        void send_node_message(proto::GetProofUtxoMulti&&) override;
         void send_node_message(proto::GetHdr&&) override;
         void send_node_message(proto::GetMined&&) override;
         void send_node_message(proto::GetProofState&&) override;
@@ -166,7 +167,9 @@ namespace beam
             void OnConnectedSecure() override;
 			void OnDisconnect(const DisconnectReason&) override;
 			bool OnMsg2(proto::Boolean&& msg) override;
+            bool OnMsg2(proto::Config&& msg) override;
             bool OnMsg2(proto::ProofUtxo&& msg) override;
+            bool OnMsg2(proto::ProofUtxoMulti&& msg) override;
 			bool OnMsg2(proto::ProofState&& msg) override;
 			bool OnMsg2(proto::NewTip&& msg) override;
             bool OnMsg2(proto::Hdr&& msg) override;